@@ -0,0 +1,202 @@
+// Name compression while encoding a response: the names of a response,
+// in the order DNSPackage::append writes them, encoded by DNSBuffer's
+// fixed table against the std::map of suffix strings it used before
+// (kept here as the reference), with the bytes each produces and the heap
+// allocations per response; then DNSPackage::append of the whole response
+// into a reused buffer.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "dns_answer.h"
+#include "dns_buffer.h"
+#include "dns_package.h"
+#include "dns_utils.h"
+
+static std::atomic<size_t> allocations{ 0 };
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+// The encoder DNSBuffer had: a std::map from every suffix written to its
+// offset, a substr per label and a recursive call per label.
+class MapEncoder
+{
+public:
+    void clear()
+    {
+        result.clear();
+        compress.clear();
+    }
+
+    void append_domain(const std::string& str)
+    {
+        if (str.empty())
+        {
+            result.push_back('\0');
+            return;
+        }
+        auto iter = compress.find(str);
+        if (iter != compress.end())
+        {
+            append_uint16(result, static_cast<uint16_t>(iter->second | 0xc000));
+            return;
+        }
+        auto offset = result.size();
+        auto pos = str.find('.');
+        auto before = pos != std::string::npos ? str.substr(0, pos) : str;
+        result.push_back(static_cast<uint8_t>(before.size()));
+        result.insert(result.end(), before.begin(), before.end());
+        compress.emplace(str, offset);
+        if (pos != std::string::npos)
+        {
+            append_domain(str.substr(pos + 1));
+        }
+        else
+        {
+            result.push_back('\0');
+        }
+    }
+
+    std::vector<uint8_t> result;
+
+private:
+    std::map<std::string, size_t> compress;
+};
+
+template <typename F>
+static double measure(size_t iterations, size_t& allocs, F f)
+{
+    const size_t before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        f();
+    }
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    allocs = allocations.load() - before;
+    return ns;
+}
+
+struct Response
+{
+    const char* name;
+    DNSPackage package;
+    std::vector<std::string> names;
+};
+
+static Response makeResponse(const char* name, DNSRecordType type, const std::string& host, const std::vector<std::string>& values)
+{
+    Response response{ name, DNSPackage(), { host } };
+    response.package.header.ID = 1;
+    response.package.header.flags.QR = 1;
+    response.package.header.QDCOUNT = 1;
+    response.package.requests.emplace_back(DNSRequest{ type, host });
+    for (const auto& value : values)
+    {
+        DNSAnswer answer(type, value);
+        answer.name = host;
+        response.package.answers.push_back(answer);
+        response.names.push_back(host);
+        if (type != DNSRecordType::A)
+        {
+            response.names.push_back(value);
+        }
+    }
+    response.package.header.ANCOUNT = static_cast<uint16_t>(values.size());
+    return response;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t iterations = argc >= 2 ? atoi(argv[1]) : 1000000;
+
+    std::vector<std::string> ns;
+    for (char c = 'a'; c <= 'm'; ++c)
+    {
+        ns.push_back(std::string(1, c) + ".root-servers.net");
+    }
+    std::vector<std::string> mx;
+    for (int i = 0; i < 300; ++i)
+    {
+        mx.push_back("mx" + std::to_string(i) + ".mail.example-company.com");
+    }
+    std::vector<Response> responses;
+    responses.push_back(makeResponse("A x3", DNSRecordType::A, "www.domain.com", { "1.1.1.1", "2.2.2.2", "3.3.3.3" }));
+    responses.push_back(makeResponse("MX x2", DNSRecordType::MX, "mail.department.example-company.com", { "mx1.example-company.com", "mx2.example-company.com" }));
+    responses.push_back(makeResponse("PTR x13", DNSRecordType::PTR, "4.3.2.1.in-addr.arpa", ns));
+    responses.push_back(makeResponse("MX x300 (TCP)", DNSRecordType::MX, "example-company.com", mx));
+
+    printf("%-14s %9s %8s %7s %9s %8s %7s %11s %8s\n",
+        "response", "map ns", "allocs", "bytes", "table ns", "allocs", "bytes", "append ns", "allocs");
+    for (const auto& r : responses)
+    {
+        const size_t rounds = r.names.size() > 100 ? iterations / 100 + 1 : iterations;
+        size_t sink = 0;
+        size_t map_allocs = 0, table_allocs = 0, append_allocs = 0;
+
+        MapEncoder encoder;
+        double map = measure(rounds, map_allocs, [&] {
+            encoder.clear();
+            encoder.result.resize(12);
+            for (const auto& name : r.names)
+            {
+                encoder.append_domain(name);
+            }
+            sink += encoder.result.size();
+        });
+
+        DNSBuffer buf;
+        double table = measure(rounds, table_allocs, [&] {
+            buf.clear();
+            buf.result.resize(12);
+            for (const auto& name : r.names)
+            {
+                buf.append_domain(name);
+            }
+            sink += buf.result.size();
+        });
+        const size_t map_bytes = encoder.result.size() - 12;
+        const size_t table_bytes = buf.result.size() - 12;
+
+        double append = measure(rounds, append_allocs, [&] {
+            buf.clear();
+            r.package.append(buf);
+            sink += buf.result.size();
+        });
+
+        if (sink == 0)
+        {
+            printf("nothing encoded\n");
+            return 1;
+        }
+        printf("%-14s %9.1f %8.2f %7zu %9.1f %8.2f %7zu %11.1f %8.2f\n", r.name,
+            map, static_cast<double>(map_allocs) / rounds, map_bytes,
+            table, static_cast<double>(table_allocs) / rounds, table_bytes,
+            append, static_cast<double>(append_allocs) / rounds);
+    }
+    return 0;
+}
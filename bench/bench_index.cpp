@@ -0,0 +1,73 @@
+// Record lookup cost for an increasing number of names: the std::map keyed by
+// (type, name) the server used to have against DNSNameIndex. Lookups come in
+// random order, so large tables are served from memory, not cache.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dns_index.h"
+
+int main(int argc, char* argv[])
+{
+    const size_t lookups = argc >= 2 ? atoi(argv[1]) : 1000000;
+    const size_t counts[] = { 1000, 100000, 1000000 };
+
+    printf("%10s %14s %14s\n", "names", "map ns", "index ns");
+    for (size_t count : counts)
+    {
+        std::vector<std::string> names;
+        names.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            names.push_back("host-" + std::to_string(i * 7919 % 1000003) + ".zone" + std::to_string(i % 97) + ".example.com");
+        }
+
+        std::map<std::pair<uint16_t, std::string>, uint32_t> map;
+        DNSNameIndex index;
+        bool inserted;
+        for (size_t i = 0; i < count; ++i)
+        {
+            map[{ 1, names[i] }] = static_cast<uint32_t>(i);
+            index.insert(names[i], 1, inserted);
+        }
+
+        // queries as they arrive: the name is hot in cache and hashed
+        // once, at parse time
+        std::mt19937 rng(42);
+        std::vector<std::pair<std::string, uint64_t>> queries(lookups);
+        for (auto& query : queries)
+        {
+            query.first = names[rng() % count];
+            query.second = DNSNameIndex::hash(query.first, 1);
+        }
+
+        uint64_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& query : queries)
+        {
+            found += map.find({ 1, query.first }) != map.end();
+        }
+        double map_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (const auto& query : queries)
+        {
+            found += index.find(query.first, 1, query.second) != DNSNameIndex::NOT_FOUND;
+        }
+        double index_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        if (found != lookups * 2)
+        {
+            printf("lookup mismatch\n");
+            return 1;
+        }
+        printf("%10zu %14.1f %14.1f\n", count, map_ns / lookups, index_ns / lookups);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+// Loopback UDP round-trip latency percentiles of one worker, waiting for
+// readiness (the default) against busy polling. One client sends a query,
+// waits for its answer, optionally pauses, and sends the next one.
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_package.h"
+#include "dns_socket.h"
+
+static const char* HOST = "127.0.0.1";
+static const int PORT = 10053;
+
+// Sorted round-trip times in nanoseconds, lost queries excluded.
+static std::vector<double> measure(unsigned busy_poll, int queries, int gap_us)
+{
+    DNSServer server(HOST, PORT);
+    server.settings().busy_poll = busy_poll;
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.start();
+
+    DNSPackage package;
+    package.header.ID = 1;
+    package.header.flags.RD = 1;
+    package.header.QDCOUNT = 1;
+    package.requests.emplace_back(DNSRequest{ DNSRecordType::A, "domain.com" });
+    DNSBuffer query;
+    package.append(query);
+
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    inet_pton(AF_INET, HOST, &addr.sin_addr);
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    timeval timeout = { 1, 0 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::vector<double> rtt;
+    rtt.reserve(queries);
+    uint8_t answer[UDP_SIZE];
+    for (int i = 0; i < queries; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        send(s, &query.result[0], query.result.size(), 0);
+        if (recv(s, answer, sizeof(answer), 0) > 0)
+        {
+            rtt.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+        }
+        if (gap_us > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(gap_us));
+        }
+    }
+    closesocket(s);
+
+    server.stop();
+    server.join();
+
+    std::sort(rtt.begin(), rtt.end());
+    return rtt;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p / 100 * sorted.size()));
+    return sorted[index] / 1000;
+}
+
+int main(int argc, char* argv[])
+{
+    const int queries = argc >= 2 ? atoi(argv[1]) : 100000;
+    const int gap_us = argc >= 3 ? atoi(argv[2]) : 0;
+    const unsigned busy_poll = argc >= 4 ? atoi(argv[3]) : 50;
+
+    printf("queries: %d, gap: %d us, cpus: %u\n", queries, gap_us, std::thread::hardware_concurrency());
+    printf("%-16s %10s %10s %10s %10s\n", "mode", "p50 us", "p99 us", "p99.9 us", "lost");
+    for (unsigned mode : { 0u, busy_poll })
+    {
+        auto rtt = measure(mode, queries, gap_us);
+        printf("%-16s %10.1f %10.1f %10.1f %10zu\n", mode ? "busy_poll" : "selector",
+            percentile(rtt, 50), percentile(rtt, 99), percentile(rtt, 99.9), queries - rtt.size());
+    }
+    return 0;
+}
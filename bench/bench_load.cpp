@@ -0,0 +1,74 @@
+// Startup from a large dns_server.json: the time DNSServer takes to load it
+// with the streaming loader on 1 thread and on every core, and the peak
+// RSS of the process. Run it once per size, so the peak is that size's.
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "dns.h"
+#include "dns_loader.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static long peakRssMb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t count = argc >= 2 ? atoll(argv[1]) : 1000000;
+    const std::string json = "/tmp/bench_load.json";
+    {
+        std::ofstream os(json);
+        os << "{ \"port\": 10053, \"records\": [\n";
+        for (size_t i = 0; i < count; ++i)
+        {
+            os << (i ? ",\n" : "") << "  { \"type\": \"A\", \"host\": \"host-" << i << ".zone" << i % 97
+               << ".example.com\", \"response\": [\"10." << (i >> 16) % 256 << "." << (i >> 8) % 256 << "." << i % 256 << "\"] }";
+        }
+        os << "\n] }\n";
+    }
+    const long base_mb = peakRssMb();
+
+    // the parse alone, without building the index
+    auto start = std::chrono::steady_clock::now();
+    {
+        DNSJsonLoader loader(json);
+        loader.records(1);
+    }
+    const double one_s = seconds(start);
+    start = std::chrono::steady_clock::now();
+    size_t chunks;
+    {
+        DNSJsonLoader loader(json);
+        chunks = loader.chunks();
+        loader.records();
+    }
+    const double all_s = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        DNSServer server(json);
+    }
+    const double server_s = seconds(start);
+
+    printf("%zu records, %zu chunks, %u threads\n", count, chunks, std::thread::hardware_concurrency());
+    printf("parse, 1 thread     %8.3f s\n", one_s);
+    printf("parse, all threads  %8.3f s\n", all_s);
+    printf("DNSServer(json)     %8.3f s\n", server_s);
+    printf("peak RSS            %8ld MB (%ld MB before loading)\n", peakRssMb(), base_mb);
+    std::remove(json.c_str());
+    return 0;
+}
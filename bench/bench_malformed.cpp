@@ -0,0 +1,135 @@
+// What the bounds checks cost: for well-formed queries, the time
+// DNSMessageView spends checking a query against the whole of
+// DNSServer::processQuery; for malformed ones (pointer loops, lying counts,
+// 64 KB of pointer chains over TCP), the time to answer FORMERR, which has
+// to stay bounded whatever the bytes.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_message.h"
+#include "dns_package.h"
+
+static std::vector<uint8_t> makeQuery(DNSRecordType type, const std::string& host)
+{
+    DNSPackage package;
+    package.header.ID = 1;
+    package.header.flags.RD = 1;
+    package.header.QDCOUNT = 1;
+    package.requests.emplace_back(DNSRequest{ type, host });
+    DNSBuffer buf;
+    package.append(buf);
+    return buf.result;
+}
+
+template <typename F>
+static double measure(size_t iterations, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        f();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+// A message of `size` bytes: one question, then records whose names end a
+// chain of `hops` pointers, each a step back (pointers reach the first
+// 16 KB only, so the chain is built there first).
+static std::vector<uint8_t> pointerChains(size_t size, size_t hops)
+{
+    std::vector<uint8_t> message = { 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 'a', 0, 0, 1, 0, 1 };
+    size_t target = 12;
+    size_t records = 0;
+    while (message.size() + 12 <= size)
+    {
+        const size_t name = message.size();
+        message.push_back(static_cast<uint8_t>(0xC0 | target >> 8));
+        message.push_back(static_cast<uint8_t>(target));
+        message.insert(message.end(), { 0, 1, 0, 1, 0, 0, 0, 0, 0, 0 });
+        if (++records < hops)
+        {
+            target = name; // the chain grows; later names point at its end
+        }
+    }
+    message[10] = static_cast<uint8_t>(records >> 8); // ARCOUNT
+    message[11] = static_cast<uint8_t>(records);
+    return message;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t iterations = argc >= 2 ? atoi(argv[1]) : 1000000;
+
+    DNSServer server("127.0.0.1", 10053);
+    server.addRecord(DNSRecordType::A, "www.domain.com", { "1.1.1.1", "2.2.2.2", "3.3.3.3" });
+    server.addRecord(DNSRecordType::MX, "mail.department.example-company.com", { "mx1.example-company.com", "mx2.example-company.com" });
+
+    struct Case
+    {
+        const char* name;
+        std::vector<uint8_t> query;
+    };
+    const Case valid[] = {
+        { "A x3", makeQuery(DNSRecordType::A, "www.domain.com") },
+        { "MX x2", makeQuery(DNSRecordType::MX, "mail.department.example-company.com") },
+        { "absent", makeQuery(DNSRecordType::A, "nowhere.domain.com") },
+    };
+    printf("%-14s %12s %12s %8s\n", "query", "answer ns", "checks ns", "share");
+    for (const auto& c : valid)
+    {
+        DNSBuffer buf;
+        double answer = measure(iterations, [&] {
+            buf.clear();
+            buf.max_size = UDP_SIZE;
+            server.processQuery(&c.query[0], c.query.size(), buf);
+        });
+        size_t sink = 0;
+        double checks = measure(iterations, [&] {
+            sink += DNSMessageView(&c.query[0], c.query.size()).valid();
+        });
+        if (sink != iterations)
+        {
+            printf("%s is not valid\n", c.name);
+            return 1;
+        }
+        printf("%-14s %12.1f %12.1f %7.1f%%\n", c.name, answer, checks, 100.0 * checks / answer);
+    }
+
+    const Case hostile[] = {
+        { "pointer loop", { 0x12, 0x34, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 'a', 0xC0, 12, 0, 1, 0, 1 } },
+        { "lying counts", { 0x12, 0x34, 1, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 1, 0, 1 } },
+        { "name > 255", [&] {
+            std::vector<uint8_t> query = { 0x12, 0x34, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0 };
+            for (int i = 0; i < 4; ++i)
+            {
+                query.push_back(63);
+                query.insert(query.end(), 63, 'a');
+            }
+            query.insert(query.end(), { 0, 0, 1, 0, 1 });
+            return query;
+        }() },
+        { "4K chains", pointerChains(MAX_QUERY_SIZE, MAX_POINTER_HOPS) },
+        { "4K, a hop more", pointerChains(MAX_QUERY_SIZE, MAX_POINTER_HOPS + 1) },
+        { "64K chains", pointerChains(MAX_MESSAGE_SIZE, MAX_POINTER_HOPS) },
+    };
+    printf("\n%-16s %10s %12s %8s\n", "hostile", "bytes", "answer ns", "rcode");
+    for (const auto& c : hostile)
+    {
+        DNSBuffer buf;
+        const size_t rounds = c.query.size() > 1024 ? iterations / 1000 + 1 : iterations;
+        double answer = measure(rounds, [&] {
+            buf.clear();
+            buf.max_size = 0xFFFF;
+            server.processQuery(&c.query[0], c.query.size(), buf);
+        });
+        const int rcode = buf.result.size() >= 4 ? buf.result[3] & 0x0F : -1;
+        printf("%-16s %10zu %12.1f %8d\n", c.name, c.query.size(), answer, rcode);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+// Master file throughput: a generated BIND zone (A, MX, TXT and skipped NS
+// records, relative and absolute names, comments, a parenthesized SOA) is
+// parsed from the page cache, then loaded into a server.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "dns.h"
+#include "dns_master.h"
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t count = argc >= 2 ? atoll(argv[1]) : 1000000;
+    const std::string zone = "/tmp/bench_master.zone";
+    size_t bytes;
+    {
+        std::ofstream os(zone);
+        os << "$ORIGIN example.com.\n$TTL 3600\n"
+           << "@ IN SOA ns1 hostmaster (\n    2024010101 ; serial\n    7200 3600 1209600 3600 )\n"
+           << "  IN NS ns1\n  IN NS ns2.example.net.\n";
+        for (size_t i = 0; i < count; ++i)
+        {
+            switch (i % 4)
+            {
+            case 0:
+            case 1:
+                os << "host-" << i << "\t\tIN\tA\t10." << (i >> 16) % 256 << "." << (i >> 8) % 256 << "." << i % 256 << "\n";
+                break;
+            case 2:
+                os << "mail-" << i << ".zone" << i % 97 << ".example.com. 300 IN MX 10 mx" << i % 7 << ".example.net. ; backup\n";
+                break;
+            case 3:
+                os << "txt-" << i << " IN TXT \"v=spf1 ip4:10.0.0.0/8 include:_spf.example.net -all\"\n";
+                break;
+            }
+        }
+        bytes = static_cast<size_t>(os.tellp());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t rrsets;
+    {
+        DNSMasterFile file(zone);
+        rrsets = file.size();
+    }
+    const double parse_s = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        DNSServer server("127.0.0.1", 10053);
+        server.loadMasterFile(zone);
+    }
+    const double load_s = seconds(start);
+
+    printf("%zu records, %zu RRsets, %.1f MB\n", count, rrsets, bytes / 1e6);
+    printf("parse             %8.3f s %8.1f MB/s\n", parse_s, bytes / 1e6 / parse_s);
+    printf("loadMasterFile    %8.3f s %8.1f MB/s\n", load_s, bytes / 1e6 / load_s);
+    std::remove(zone.c_str());
+    return 0;
+}
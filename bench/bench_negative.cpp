@@ -0,0 +1,89 @@
+// Cost of answering absent names (typos, random-subdomain floods) with and
+// without the negative-lookup filter: the record lookup alone, then whole
+// queries through DNSServer. Names come in random order from a large zone,
+// so the record table is served from memory, not cache.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_index.h"
+#include "dns_package.h"
+#include "dns_zone.h"
+
+static std::string hostName(const char* prefix, size_t i)
+{
+    return prefix + std::to_string(i) + ".zone" + std::to_string(i % 97) + ".example.com";
+}
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t count = argc >= 2 ? atoi(argv[1]) : 1000000;
+    const size_t lookups = 1000000;
+
+    DNSRecordBatch batch;
+    DNSZone zone;
+    const auto response = DNSZoneResponse::render(DNSRecordType::A, "host", DNSResultCode::NoError, { "10.0.0.1" });
+    for (size_t i = 0; i < count; ++i)
+    {
+        batch.add(DNSRecordType::A, hostName("host-", i), { "10.0.0.1" });
+        zone.add(DNSRecordType::A, hostName("host-", i), response);
+    }
+
+    std::mt19937 rng(42);
+    std::vector<std::string> absent(lookups);
+    std::vector<uint64_t> hashes(lookups);
+    std::vector<std::vector<uint8_t>> queries(lookups);
+    for (size_t i = 0; i < lookups; ++i)
+    {
+        absent[i] = hostName("typo-", rng() % count);
+        hashes[i] = DNSNameIndex::hash(absent[i], 1);
+        DNSPackage package;
+        package.header.QDCOUNT = 1;
+        package.requests.emplace_back(DNSRequest{ DNSRecordType::A, absent[i] });
+        DNSBuffer buf;
+        package.append(buf);
+        queries[i] = buf.result;
+    }
+
+    printf("%zu names, %zu absent lookups\n", count, lookups);
+    printf("%-10s %12s %12s %12s %10s\n", "fp_rate", "filter KB", "lookup ns", "query ns", "passed");
+    for (double fp_rate : { 0.0, 0.01, 0.001 })
+    {
+        zone.rebuildFilter(fp_rate);
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lookups; ++i)
+        {
+            found += zone.find(absent[i], 1, hashes[i]) != nullptr;
+        }
+        const double lookup_ns = seconds(start) * 1e9 / lookups;
+
+        DNSServer server("127.0.0.1", 10053);
+        server.settings().filter_fp_rate = fp_rate;
+        server.update(batch);
+        DNSBuffer buf;
+        start = std::chrono::steady_clock::now();
+        for (const auto& query : queries)
+        {
+            buf.clear();
+            server.processQuery(&query[0], query.size(), buf);
+        }
+        const double query_ns = seconds(start) * 1e9 / lookups;
+        const DNSServerStats stats = server.stats();
+        const double passed = fp_rate > 0 ? 100.0 * stats.filter_passed / (stats.filter_passed + stats.filter_rejected) : 100.0;
+
+        printf("%-10g %12zu %12.1f %12.1f %9.2f%%%s\n", fp_rate, zone.filterBytes() / 1024, lookup_ns, query_ns, passed, found ? " (found?)" : "");
+    }
+    return 0;
+}
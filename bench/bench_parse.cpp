@@ -0,0 +1,130 @@
+// CPU cost and heap allocations of reading one message: DNSPackage, which
+// copies every name into a std::string and every record into a vector,
+// against DNSMessageView, which checks the message once and reads the
+// question name into a stack buffer and the records in place.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_message.h"
+#include "dns_package.h"
+
+static std::atomic<size_t> allocations{ 0 };
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+static std::vector<uint8_t> makeQuery(DNSRecordType type, const std::string& host)
+{
+    DNSPackage package;
+    package.header.ID = 1;
+    package.header.flags.RD = 1;
+    package.header.QDCOUNT = 1;
+    package.requests.emplace_back(DNSRequest{ type, host });
+    DNSBuffer buf;
+    package.append(buf);
+    return buf.result;
+}
+
+template <typename F>
+static double measure(size_t iterations, size_t& allocs, F f)
+{
+    const size_t before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        f();
+    }
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    allocs = allocations.load() - before;
+    return ns;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t iterations = argc >= 2 ? atoi(argv[1]) : 1000000;
+
+    DNSServer server("127.0.0.1", 10053);
+    server.addRecord(DNSRecordType::A, "www.domain.com", { "1.1.1.1", "2.2.2.2", "3.3.3.3" });
+    server.addRecord(DNSRecordType::MX, "mail.department.example-company.com", { "mx1.example-company.com", "mx2.example-company.com" });
+
+    struct Case
+    {
+        const char* name;
+        std::vector<uint8_t> message;
+    };
+    std::vector<Case> cases;
+    cases.push_back({ "query short", makeQuery(DNSRecordType::A, "www.domain.com") });
+    cases.push_back({ "query long", makeQuery(DNSRecordType::MX, "mail.department.example-company.com") });
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const std::vector<uint8_t> query = cases[i].message;
+        DNSBuffer buf;
+        server.processQuery(&query[0], query.size(), buf);
+        cases.push_back({ i == 0 ? "answer A x3" : "answer MX x2", buf.result });
+    }
+
+    printf("%-14s %12s %8s %12s %8s %8s\n", "message", "package ns", "allocs", "view ns", "allocs", "speedup");
+    for (const auto& c : cases)
+    {
+        const uint8_t* data = &c.message[0];
+        size_t sink = 0;
+        size_t package_allocs = 0, view_allocs = 0;
+
+        double package = measure(iterations, package_allocs, [&] {
+            DNSPackage message(data, c.message.size());
+            sink += message.requests[0].name.size() + message.requests[0].type;
+            for (const auto& answer : message.answers)
+            {
+                sink += answer.type;
+            }
+        });
+
+        double view = measure(iterations, view_allocs, [&] {
+            DNSMessageView message(data, c.message.size());
+            char buf[DNSMessageView::MAX_NAME];
+            std::string_view name;
+            const DNSMessageView::Question question = message.question();
+            question.name.dotted(buf, name);
+            sink += name.size() + question.type;
+            for (const auto& record : message.records())
+            {
+                sink += record.type;
+            }
+        });
+
+        if (sink == 0)
+        {
+            printf("nothing read\n");
+            return 1;
+        }
+        printf("%-14s %12.1f %8.2f %12.1f %8.2f %7.1fx\n", c.name,
+            package, static_cast<double>(package_allocs) / iterations,
+            view, static_cast<double>(view_allocs) / iterations, package / view);
+    }
+    return 0;
+}
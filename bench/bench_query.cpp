@@ -0,0 +1,104 @@
+// CPU cost of answering one query, without the network: building the answer
+// from strings for every query, as processQuery used to (parse the package,
+// std::map lookup under the table lock, DNSAnswer per record, encode with
+// name compression), against DNSServer::processQuery, which copies the
+// answer section rendered when the record was added.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_package.h"
+
+struct Case
+{
+    DNSRecordType type;
+    const char* name;
+    std::vector<std::string> records;
+};
+
+static std::vector<uint8_t> makeQuery(DNSRecordType type, const std::string& host)
+{
+    DNSPackage package;
+    package.header.ID = 1;
+    package.header.flags.RD = 1;
+    package.header.QDCOUNT = 1;
+    package.requests.emplace_back(DNSRequest{ type, host });
+    DNSBuffer buf;
+    package.append(buf);
+    return buf.result;
+}
+
+template <typename F>
+static double measure(size_t iterations, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        f();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t iterations = argc >= 2 ? atoi(argv[1]) : 1000000;
+    const Case cases[] = {
+        { DNSRecordType::A, "A x3", { "1.1.1.1", "2.2.2.2", "3.3.3.3" } },
+        { DNSRecordType::MX, "MX x2", { "mx1.domain.com", "mx2.domain.com" } },
+        { DNSRecordType::TXT, "TXT x1", { "v=spf1 include:_spf.domain.com ~all" } },
+    };
+
+    DNSServer server("127.0.0.1", 10053);
+    std::map<std::pair<DNSRecordType, std::string>, std::vector<std::string>> table;
+    std::shared_mutex table_mutex;
+    for (const auto& c : cases)
+    {
+        server.addRecord(c.type, "domain.com", c.records);
+        table[{ c.type, "domain.com" }] = c.records;
+    }
+
+    printf("%-8s %14s %14s %8s\n", "records", "strings ns", "wire ns", "speedup");
+    for (const auto& c : cases)
+    {
+        const auto query = makeQuery(c.type, "domain.com");
+        DNSBuffer buf;
+
+        double strings = measure(iterations, [&] {
+            buf.clear();
+            buf.max_size = UDP_SIZE;
+            DNSPackage package(&query[0], query.size());
+            std::shared_lock<std::shared_mutex> lock(table_mutex);
+            package.header.flags.QR = 1;
+            package.header.flags.RA = 1;
+            const DNSRequest& request = package.requests[0];
+            for (const auto& item : table.find({ static_cast<DNSRecordType>(request.type), request.name })->second)
+            {
+                package.addAnswer(c.type, request.name, item);
+            }
+            package.header.ANCOUNT = static_cast<uint16_t>(package.answers.size());
+            package.append(buf);
+        });
+        size_t strings_size = buf.result.size();
+
+        double wire = measure(iterations, [&] {
+            buf.clear();
+            buf.max_size = UDP_SIZE;
+            server.processQuery(&query[0], query.size(), buf);
+        });
+        if (buf.result.size() != strings_size)
+        {
+            printf("answer size mismatch\n");
+            return 1;
+        }
+        printf("%-8s %14.1f %14.1f %7.1fx\n", c.name, strings, wire, strings / wire);
+    }
+    return 0;
+}
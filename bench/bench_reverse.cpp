@@ -0,0 +1,101 @@
+// Reverse answers derived from A records: the time to build the index over a
+// zone, to merge one changed A record into it and to skip a change of
+// another type, its size against explicit PTR records, and PTR queries
+// answered from it through DNSServer, in random order.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_package.h"
+#include "dns_zone.h"
+
+static std::string address(size_t i)
+{
+    return "10." + std::to_string((i >> 16) % 256) + "." + std::to_string((i >> 8) % 256) + "." + std::to_string(i % 256);
+}
+
+static std::string reverseName(size_t i)
+{
+    return std::to_string(i % 256) + "." + std::to_string((i >> 8) % 256) + "." + std::to_string((i >> 16) % 256) + ".10.in-addr.arpa";
+}
+
+static std::string hostName(size_t i)
+{
+    return "host-" + std::to_string(i) + ".zone" + std::to_string(i % 97) + ".example.com";
+}
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t count = argc >= 2 ? atoi(argv[1]) : 1000000;
+    const size_t lookups = 1000000;
+
+    DNSRecordBatch batch;
+    DNSZone zone;
+    size_t ptr_bytes = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        batch.add(DNSRecordType::A, hostName(i), { address(i) });
+        zone.add(DNSRecordType::A, hostName(i), DNSZoneResponse::render(DNSRecordType::A, hostName(i), DNSResultCode::NoError, { address(i) }));
+        // what a hand-written PTR record costs in blobs alone
+        ptr_bytes += DNSZoneResponse::render(DNSRecordType::PTR, reverseName(i), DNSResultCode::NoError, { hostName(i) }).size();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    zone.rebuildReverse(true);
+    const double build_s = seconds(start);
+
+    DNSZone changed(zone);
+    changed.add(DNSRecordType::A, hostName(7), DNSZoneResponse::render(DNSRecordType::A, hostName(7), DNSResultCode::NoError, { address(count + 7) }));
+    start = std::chrono::steady_clock::now();
+    changed.updateReverse(true);
+    const double merge_s = seconds(start);
+    changed.add(DNSRecordType::MX, hostName(7), DNSZoneResponse::render(DNSRecordType::MX, hostName(7), DNSResultCode::NoError, { "mx.example.com" }));
+    start = std::chrono::steady_clock::now();
+    changed.updateReverse(true);
+    const double skip_s = seconds(start);
+
+    std::mt19937 rng(42);
+    std::vector<std::vector<uint8_t>> queries(lookups);
+    for (auto& query : queries)
+    {
+        DNSPackage package;
+        package.header.QDCOUNT = 1;
+        package.requests.emplace_back(DNSRequest{ DNSRecordType::PTR, reverseName(rng() % count) });
+        DNSBuffer buf;
+        package.append(buf);
+        query = buf.result;
+    }
+    DNSServer server("127.0.0.1", 10053);
+    server.settings().reverse_ptr = true;
+    server.update(batch);
+    DNSBuffer buf;
+    size_t answered = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto& query : queries)
+    {
+        buf.clear();
+        server.processQuery(&query[0], query.size(), buf);
+        answered += (buf.result[3] & 0x0F) == 0;
+    }
+    const double query_ns = seconds(start) * 1e9 / lookups;
+
+    printf("%zu A records, %zu addresses indexed\n", count, zone.reverseSize());
+    printf("build             %8.3f s\n", build_s);
+    printf("merge one A       %8.3f s\n", merge_s);
+    printf("other type        %8.6f s\n", skip_s);
+    printf("reverse index     %8.1f bytes/address\n", double(zone.reverseBytes()) / zone.reverseSize());
+    printf("PTR records       %8.1f bytes/address (blobs, without the name index)\n", double(ptr_bytes) / count);
+    printf("query             %8.1f ns (%zu answered)\n", query_ns, answered);
+    return 0;
+}
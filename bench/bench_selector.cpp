@@ -0,0 +1,129 @@
+// Measures the cost of one DNSSelector wakeup with a single ready socket
+// while an increasing number of idle sockets stay registered for reading.
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "dns_selector.h"
+
+class CountingHandler : public ISocketHandler
+{
+public:
+    CountingHandler()
+        : reads(0)
+    {}
+    void socketReadyRead(SOCKET s) override
+    {
+        char c;
+        recv(s, &c, sizeof(c), 0);
+        ++reads;
+    }
+    void socketReadyWrite(SOCKET) override
+    {}
+
+    size_t reads;
+};
+
+static size_t raiseFdLimit()
+{
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+    {
+        return 1024;
+    }
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+    return static_cast<size_t>(rl.rlim_cur);
+}
+
+int main(int argc, char* argv[])
+{
+    const int iterations = argc >= 2 ? atoi(argv[1]) : 100000;
+    const size_t fd_limit = raiseFdLimit();
+    const size_t counts[] = { 10, 100, 1000, 10000, 50000 };
+
+#ifdef DNS_SELECTOR_EPOLL
+    printf("backend: epoll\n");
+#else
+    printf("backend: select\n");
+#endif
+    printf("%12s %16s\n", "connections", "ns/wakeup");
+
+    for (const auto count : counts)
+    {
+#ifndef DNS_SELECTOR_EPOLL
+        if (count + 8 > FD_SETSIZE)
+        {
+            printf("%12zu %16s\n", count, "over FD_SETSIZE");
+            continue;
+        }
+#endif
+        if (count + 32 > fd_limit)
+        {
+            printf("%12zu %16s\n", count, "over RLIMIT_NOFILE");
+            continue;
+        }
+
+        CountingHandler handler;
+        DNSSelector selector(&handler);
+
+        // idle connections: never become readable, but stay registered
+        std::vector<SOCKET> idle;
+        idle.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+            if (s == INVALID_SOCKET)
+            {
+                perror("socket");
+                return 1;
+            }
+            idle.push_back(s);
+            selector.addReadSocket(s);
+        }
+
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+        {
+            perror("socketpair");
+            return 1;
+        }
+        selector.addReadSocket(pair[1]);
+
+        const char c = 'x';
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            send(pair[0], &c, sizeof(c), 0);
+            selector.select();
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        printf("%12zu %16.1f\n", count, static_cast<double>(ns) / iterations);
+
+        if (handler.reads != static_cast<size_t>(iterations))
+        {
+            fprintf(stderr, "unexpected number of wakeups: %zu\n", handler.reads);
+            return 1;
+        }
+
+        selector.removeReadSocket(pair[1]);
+        closesocket(pair[0]);
+        closesocket(pair[1]);
+        for (const auto s : idle)
+        {
+            selector.removeReadSocket(s);
+            closesocket(s);
+        }
+    }
+
+    return 0;
+}
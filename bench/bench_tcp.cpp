@@ -0,0 +1,122 @@
+// Loopback TCP cost per query for the connection handler: rounds of
+// pipelined queries on one persistent connection, and one query per fresh
+// connection. Client and server share the machine, so the figures are
+// for comparing server builds, not absolute.
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_package.h"
+#include "dns_socket.h"
+
+static const char* HOST = "127.0.0.1";
+static const int PORT = 10053;
+
+static SOCKET connectServer()
+{
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    inet_pton(AF_INET, HOST, &addr.sin_addr);
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET || connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR)
+    {
+        throw std::runtime_error("Can't connect to server");
+    }
+    return s;
+}
+
+// Sends `count` length-prefixed queries at once and reads every answer.
+static void roundTrip(SOCKET s, const std::vector<uint8_t>& queries, size_t count)
+{
+    if (send(s, &queries[0], queries.size(), 0) != static_cast<ssize_t>(queries.size()))
+    {
+        throw std::runtime_error("Error sending TCP data");
+    }
+    std::vector<uint8_t> in;
+    size_t answers = 0, pos = 0;
+    uint8_t buf[65536];
+    while (answers < count)
+    {
+        ssize_t len = recv(s, buf, sizeof(buf), 0);
+        if (len <= 0)
+        {
+            throw std::runtime_error("Error receiving TCP data");
+        }
+        in.insert(in.end(), buf, buf + len);
+        while (pos + 2 <= in.size() && pos + 2 + ((in[pos] << 8) | in[pos + 1]) <= in.size())
+        {
+            pos += 2 + ((in[pos] << 8) | in[pos + 1]);
+            ++answers;
+        }
+    }
+}
+
+static std::vector<uint8_t> makeQueries(size_t count)
+{
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < count; ++i)
+    {
+        DNSPackage package;
+        package.header.ID = static_cast<uint16_t>(i);
+        package.header.flags.RD = 1;
+        package.header.QDCOUNT = 1;
+        package.requests.emplace_back(DNSRequest{ DNSRecordType::A, "domain.com" });
+        DNSBuffer buf;
+        package.append(buf);
+        out.push_back(static_cast<uint8_t>(buf.result.size() >> 8));
+        out.push_back(static_cast<uint8_t>(buf.result.size()));
+        out.insert(out.end(), buf.result.begin(), buf.result.end());
+    }
+    return out;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t total = argc >= 2 ? atoi(argv[1]) : 200000;
+
+    DNSServer server(HOST, PORT);
+    server.settings().tcp_pipeline = 64;
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.start();
+
+    printf("%-24s %12s\n", "mode", "ns/query");
+    for (size_t depth : { 1, 16, 64 })
+    {
+        const auto queries = makeQueries(depth);
+        SOCKET s = connectServer();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t done = 0; done < total; done += depth)
+        {
+            roundTrip(s, queries, depth);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        closesocket(s);
+        printf("persistent, depth %-6zu %12.0f\n", depth, ns / total);
+    }
+
+    const auto query = makeQueries(1);
+    const size_t connections = total / 10;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < connections; ++i)
+    {
+        SOCKET s = connectServer();
+        roundTrip(s, query, 1);
+        closesocket(s);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %12.0f\n", "new connection", ns / connections);
+
+    server.stop();
+    server.join();
+    return 0;
+}
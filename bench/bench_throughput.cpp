@@ -0,0 +1,80 @@
+// Loopback UDP throughput of the server for an increasing number of
+// SO_REUSEPORT workers. Every client thread keeps a window of queries in
+// flight; each window goes out from a fresh socket, hence a new source port.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dns.h"
+#include "dns_client.h"
+
+static const char* HOST = "127.0.0.1";
+static const int PORT = 10053;
+
+static double measure(unsigned workers, unsigned clients, size_t window, double seconds)
+{
+    DNSServer server(HOST, PORT);
+    server.settings().workers = workers;
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.start();
+
+    const std::vector<std::string> hosts(window, "domain.com");
+    std::atomic<uint64_t> answered(0);
+    std::atomic<bool> done(false);
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < clients; ++i)
+    {
+        threads.emplace_back([&] {
+            DNSClient client(HOST, PORT);
+            uint16_t id = 0;
+            while (!done)
+            {
+                try
+                {
+                    answered += client.requestUdpMany(id, DNSRecordType::A, hosts).size();
+                }
+                catch (const std::exception&)
+                {
+                    // a lost datagram: just carry on
+                }
+                id = static_cast<uint16_t>(id + window);
+            }
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    done = true;
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    server.stop();
+    server.join();
+
+    return answered / elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    const double seconds = argc >= 2 ? atof(argv[1]) : 2.0;
+    const unsigned cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    const unsigned clients = std::max(cpus, 4u);
+
+    printf("cpus: %u, client threads: %u\n", cpus, clients);
+    printf("%8s %14s\n", "workers", "queries/s");
+    for (unsigned workers = 1; workers <= cpus * 2; workers *= 2)
+    {
+        printf("%8u %14.0f\n", workers, measure(workers, clients, 16, seconds));
+    }
+    return 0;
+}
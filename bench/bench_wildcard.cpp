@@ -0,0 +1,87 @@
+// Lookup cost in DNSNameTree for an increasing number of names, one
+// `*.zoneN.example.com` wildcard per zone: exact hits (against the plain
+// DNSNameIndex), names synthesized from a wildcard and names that match
+// nothing. Lookups come in random order.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dns_index.h"
+#include "dns_tree.h"
+
+struct Query
+{
+    std::string name;
+    uint64_t hash;
+};
+
+template <typename Find>
+static double measure(const std::vector<Query>& queries, uint32_t expected_misses, Find find)
+{
+    uint32_t misses = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& query : queries)
+    {
+        misses += find(query) == DNSNameIndex::NOT_FOUND;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    if (misses != expected_misses)
+    {
+        printf("lookup mismatch\n");
+        exit(1);
+    }
+    return ns / queries.size();
+}
+
+static std::vector<Query> makeQueries(size_t lookups, size_t count, const std::string& prefix, const std::string& suffix)
+{
+    std::mt19937 rng(42);
+    std::vector<Query> queries(lookups);
+    for (auto& query : queries)
+    {
+        size_t i = rng() % count;
+        query.name = prefix + std::to_string(i * 7919 % 1000003) + ".zone" + std::to_string(i % 97) + suffix;
+        query.hash = DNSNameIndex::hash(query.name, 1);
+    }
+    return queries;
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t lookups = argc >= 2 ? atoi(argv[1]) : 1000000;
+    const size_t counts[] = { 1000, 100000, 1000000 };
+
+    printf("%10s %12s %12s %12s %12s\n", "names", "index ns", "exact ns", "wildcard ns", "miss ns");
+    for (size_t count : counts)
+    {
+        DNSNameIndex index;
+        DNSNameTree tree;
+        bool inserted;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const std::string name = "host-" + std::to_string(i * 7919 % 1000003) + ".zone" + std::to_string(i % 97) + ".example.com";
+            index.insert(name, 1, inserted);
+            tree.insert(name, 1, inserted);
+        }
+        for (size_t zone = 0; zone < 97; ++zone)
+        {
+            tree.insert("*.zone" + std::to_string(zone) + ".example.com", 1, inserted);
+        }
+
+        const auto exact = makeQueries(lookups, count, "host-", ".example.com");
+        const auto synthesized = makeQueries(lookups, count, "a.b.other-", ".example.com");
+        const auto missing = makeQueries(lookups, count, "host-", ".example.org");
+
+        double index_ns = measure(exact, 0, [&index](const Query& q) { return index.find(q.name, 1, q.hash); });
+        double exact_ns = measure(exact, 0, [&tree](const Query& q) { return tree.find(q.name, 1, q.hash); });
+        double wildcard_ns = measure(synthesized, 0, [&tree](const Query& q) { return tree.find(q.name, 1, q.hash); });
+        double miss_ns = measure(missing, static_cast<uint32_t>(lookups), [&tree](const Query& q) { return tree.find(q.name, 1, q.hash); });
+        printf("%10zu %12.1f %12.1f %12.1f %12.1f\n", count, index_ns, exact_ns, wildcard_ns, miss_ns);
+    }
+    return 0;
+}
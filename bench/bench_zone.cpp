@@ -0,0 +1,86 @@
+// Startup cost of a large zone: the JSON file (jsoncpp DOM, one batch)
+// against the compiled image, mapped and served in place. Then the cost of
+// answering from the mapped image against the same zone held in memory.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_package.h"
+
+static std::string hostName(size_t i)
+{
+    return "host-" + std::to_string(i) + ".zone" + std::to_string(i % 97) + ".example.com";
+}
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double answerNs(DNSServer& server, const std::vector<std::vector<uint8_t>>& queries)
+{
+    DNSBuffer buf;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& query : queries)
+    {
+        buf.clear();
+        server.processQuery(&query[0], query.size(), buf);
+    }
+    return seconds(start) * 1e9 / queries.size();
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t count = argc >= 2 ? atoi(argv[1]) : 100000;
+    const std::string json = "/tmp/bench_zone.json";
+    const std::string image = "/tmp/bench_zone.img";
+
+    {
+        std::ofstream os(json);
+        os << "{ \"records\": [\n";
+        for (size_t i = 0; i < count; ++i)
+        {
+            os << (i ? ",\n" : "") << "{ \"type\": \"A\", \"host\": \"" << hostName(i) << "\", \"response\": [\"10.0.0." << i % 250 << "\"] }";
+        }
+        os << "\n] }\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    DNSServer from_json(json);
+    const double json_s = seconds(start);
+    from_json.saveZone(image);
+
+    start = std::chrono::steady_clock::now();
+    DNSServer from_image("127.0.0.1", 10053);
+    from_image.loadZone(image);
+    const double image_s = seconds(start);
+
+    std::mt19937 rng(42);
+    std::vector<std::vector<uint8_t>> queries(1000000);
+    for (auto& query : queries)
+    {
+        DNSPackage package;
+        package.header.QDCOUNT = 1;
+        package.requests.emplace_back(DNSRequest{ DNSRecordType::A, hostName(rng() % count) });
+        DNSBuffer buf;
+        package.append(buf);
+        query = buf.result;
+    }
+    const double memory_ns = answerNs(from_json, queries);
+    const double image_ns = answerNs(from_image, queries);
+
+    printf("%zu names\n", count);
+    printf("%-8s %12s %12s\n", "", "startup s", "answer ns");
+    printf("%-8s %12.3f %12.1f\n", "json", json_s, memory_ns);
+    printf("%-8s %12.6f %12.1f\n", "image", image_s, image_ns);
+    std::remove(json.c_str());
+    std::remove(image.c_str());
+    return 0;
+}
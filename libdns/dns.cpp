@@ -12,227 +12,288 @@
 #include <fstream>
 #include <algorithm>
 #include <thread>
+#include <mutex>
+#include <atomic>
 #include <sstream>
+#include <iomanip>
 #include <json/json.h>
 
 #include "dns_utils.h"
 #include "dns_header.h"
 #include "dns_buffer.h"
 #include "dns_request.h"
+#include "dns_message.h"
 #include "dns_package.h"
-#include "dns_selector.h"
+#include "dns_processor.h"
+#include "dns_stats.h"
+#include "dns_zone.h"
+#include "dns_loader.h"
+#include "dns_master.h"
+#include "dns_epoch.h"
+#include "dns_worker.h"
+#include "dns_control.h"
+
+DNSServerSettings::DNSServerSettings()
+    : engine(DNSEngine::Selector)
+    , udp_batch(32)
+    , udp_queue(256)
+    , tcp_pipeline(16)
+    , tcp_backlog(1024)
+    , tcp_fastopen(0)
+    , tcp_defer_accept(0)
+    , tcp_idle_timeout(10000)
+    , tcp_read_timeout(5000)
+    , tcp_write_timeout(5000)
+    , max_connections(1024)
+    , busy_poll(0)
+    , busy_poll_idle(1000)
+    , workers(1)
+    , cpu_affinity(false)
+    , filter_fp_rate(0.01)
+    , reverse_ptr(false)
+{}
 
-class DNSServerImpl: private ISocketHandler
+class DNSServerImpl: private IQueryProcessor, private IControlProcessor
 {
-    friend class ISocketHandler;
-
-    struct Request
+    // IControlProcessor
+    virtual std::string processCommand(const std::string& cmd)
     {
-        DNSRecordType type;
-        std::string host;
-        Request(DNSRecordType type, const std::string& host)
-            : type(type)
-            , host(host)
-        {}
-        bool operator < (const Request& val) const
+        std::istringstream is(cmd);
+        std::string name;
+        is >> name;
+        if (name == "stop")
         {
-            return type < val.type || type == val.type && host < val.host;
+            stop();
+            return "OK\n";
         }
-    };
-
-    struct Response
-    {
-        DNSResultCode result;
-        std::vector<std::string> records;
-        Response()
-            : result(DNSResultCode::NoError)
-        {}
-        Response(DNSResultCode result, const std::vector<std::string>& records)
-            : result(result)
-            , records(records)
-        {}
-    };
-
-    struct TcpSocketContext
-    {
-        std::vector<uint8_t> request;
-        std::vector<uint8_t> response;
-        int bytes_sent;
-        TcpSocketContext()
-            : bytes_sent(0)
-        {}
-    };
-
-    struct UdpSocketContext
-    {
-        std::vector<uint8_t> request;
-        sockaddr_in client;
-        UdpSocketContext()
-            : client{ 0 }
-        {}
-    };
-
-    void closeTcpSocket(SOCKET s)
-    {
-        if (s != INVALID_SOCKET)
+        if (name == "drain")
         {
-            selector.removeReadSocket(s);
-            selector.removeWriteSocket(s);
-            tcp_socket_data.erase(s);
-            closesocket(s);
+            drain();
+            return "OK\n";
         }
+        if (name == "stats")
+        {
+            DNSServerStats result;
+            collectStats(result);
+            std::ostringstream os;
+            result.print(os);
+            return os.str();
+        }
+        if (name == "add" || name == "remove")
+        {
+            std::string type_str, host, result_str;
+            is >> type_str >> host;
+            DNSRecordType type = ::StrToRecType(type_str);
+            if (DNSRecordType::OTHER == type || host.empty())
+            {
+                return "ERROR wrong DNS record type or host\n";
+            }
+            if (name == "remove")
+            {
+                return removeRecord(type, host) ? "OK\n" : "ERROR no such record\n";
+            }
+            is >> result_str;
+            // "quoted" answers may hold spaces, e.g. TXT strings
+            std::vector<std::string> answers;
+            std::string answer;
+            while (is >> std::quoted(answer))
+            {
+                answers.push_back(answer);
+            }
+            addRecord(type, host, answers, ::StrToResultCode(result_str));
+            return "OK\n";
+        }
+        return "ERROR unknown command\n";
     }
 
-    void closeUdpSocket(SOCKET s)
+    // DNSZone::find() counting what the negative filter did; a query that
+    // falls back to the generic path is looked up twice.
+    const uint8_t* lookup(const DNSZone& zone, std::string_view name, uint16_t type, uint64_t hash, bool& wildcard)
     {
-        if (s != INVALID_SOCKET)
+        bool filtered;
+        const uint8_t* blob = zone.find(name, type, hash, wildcard, filtered);
+        if (filtered)
         {
-            selector.removeReadSocket(s);
-            selector.removeWriteSocket(s);
-            closesocket(s);
+            filter_rejected.add();
         }
+        else if (zone.filterBytes() > 0)
+        {
+            filter_passed.add();
+            if (!blob || wildcard)
+            {
+                filter_false_positives.add();
+            }
+        }
+        return blob;
     }
 
-    void readTcpSocket(SOCKET s)
+    // IQueryProcessor
+    // One plain question, the common case: the header and question are
+    // echoed, the pre-rendered answers copied after them. False when the
+    // generic path has to build the answer.
+    bool answerPrerendered(const DNSZone& zone, const DNSMessageView& message, DNSBuffer& buf)
     {
-        TcpSocketContext& ctx = tcp_socket_data[s];
-        if (ctx.request.size() < sizeof(uint16_t))
-        {
-            // receive data length
-            int bytes_to_read = static_cast<int>(sizeof(uint16_t) - ctx.request.size());
-            std::vector<uint8_t> buf(bytes_to_read, 0);
-            int msg_len = recv(s, reinterpret_cast<char*>(&buf[0]), bytes_to_read, 0);
-            if (msg_len <= 0)
-            {
-                // error or close connection
-                closeTcpSocket(s);
-                return;
-            }
-            ctx.request.insert(ctx.request.end(), buf.begin(), buf.end());
-            return; // need more data
+        if (message.qdcount() != 1 || message.ancount() != 0 || message.nscount() != 0)
+        {
+            return false;
+        }
+        const DNSMessageView::Question question = message.question();
+        const size_t question_end = question.end;
+        char name_buf[DNSMessageView::MAX_NAME];
+        std::string_view name;
+        // a name written inline takes its dotted size + 2 bytes (root: 1)
+        if (!question.name.dotted(name_buf, name)
+            || question_end != sizeof(DNSHeader) + (name.empty() ? 1 : name.size() + 2) + 2 * sizeof(uint16_t))
+        {
+            return false; // compressed, or a label with a dot in it
         }
 
-        const uint8_t* dataPtr = &ctx.request[0];
-        uint16_t expected_size = get_uint16(dataPtr);
-        if (ctx.request.size() < expected_size + sizeof(uint16_t))
+        bool wildcard;
+        const uint8_t* blob = lookup(zone, name, question.type, DNSNameIndex::hash(name, question.type), wildcard);
+        if (wildcard)
         {
-            int bytes_to_read = static_cast<int>(sizeof(uint16_t) + expected_size - ctx.request.size());
-            std::vector<uint8_t> buf(bytes_to_read, 0);
-            int msg_len = recv(s, reinterpret_cast<char*>(&buf[0]), bytes_to_read, 0);
-            if (msg_len <= 0)
+            return false; // synthesized: the answers take the question's name
+        }
+        DNSResultCode result = DNSResultCode::NameError;
+        const uint8_t* wire = nullptr;
+        size_t wire_size = 0;
+        uint16_t ancount = 0;
+        if (blob)
+        {
+            DNSZoneResponse response(blob);
+            if (response.questionEnd() != 0 && response.questionEnd() != question_end)
             {
-                // error or close connection
-                closeTcpSocket(s);
-                return;
+                return false; // rdata names point into a question of another size
             }
-            ctx.request.insert(ctx.request.end(), buf.begin(), buf.end());
+            result = response.result();
+            wire = response.wire();
+            wire_size = response.wireSize();
+            ancount = response.ancount();
         }
-
-        if (ctx.request.size() < expected_size + sizeof(uint16_t))
+        if (buf.max_size > 0 && question_end + wire_size > buf.max_size)
         {
-            return; // need more data
+            return false; // truncated answers are rare: the generic path does them
         }
 
-        // now be ready to write response
-        selector.removeReadSocket(s);
-        selector.addWriteSocket(s);
-    }
-
-    void writeTcpSocket(SOCKET s)
-    {
-        TcpSocketContext& ctx = tcp_socket_data[s];
-        if (ctx.response.empty())
+        const size_t start = buf.result.size();
+        buf.append(message.data(), question_end);
+        if (wire_size > 0)
         {
-            DNSBuffer buf;
-            buf.append(static_cast<uint16_t>(0u));  // SIZE (will be calculated later)
-            buf.data_start = buf.result.size();
-            processQuery(&ctx.request[sizeof(uint16_t)], buf);
-            buf.overwrite_uint16(0, static_cast<uint16_t>(buf.result.size() - sizeof(uint16_t)));
-            ctx.response = std::move(buf.result);
+            buf.append(wire, wire_size);
         }
-        if (ctx.bytes_sent < ctx.response.size())
+        else if (!blob && question.type == static_cast<uint16_t>(DNSRecordType::PTR) && zone.reverseSize() > 0)
         {
-            int bytes_to_write = static_cast<int>(ctx.response.size() - ctx.bytes_sent);
-            int bytes_written = send(s, reinterpret_cast<const char*>(&ctx.response[ctx.bytes_sent]), bytes_to_write, 0);
-            if (bytes_written <= 0)
+            // derived from the A records; the owner keys are wire names
+            zone.reverse(name, [&buf, &ancount](std::string_view owner) {
+                buf.append(static_cast<uint16_t>(0xC000 | sizeof(DNSHeader))); // the question's name
+                buf.append(static_cast<uint16_t>(DNSRecordType::PTR));
+                buf.append(static_cast<uint16_t>(1)); // IN
+                buf.append(static_cast<uint32_t>(ANSWER_TTL));
+                buf.append(static_cast<uint16_t>(owner.size() + 1));
+                buf.append(reinterpret_cast<const uint8_t*>(owner.data()), owner.size());
+                buf.append(static_cast<uint8_t>(0));
+                ++ancount;
+            });
+            if (ancount > 0)
             {
-                // error or close connection
-                closeTcpSocket(s);
-                return;
+                result = DNSResultCode::NoError;
             }
-            ctx.bytes_sent += bytes_written;
-            if (ctx.bytes_sent >= ctx.response.size())
+            if (buf.max_size > 0 && buf.result.size() - start > buf.max_size)
             {
-                // all data is sent, close connection
-                closeTcpSocket(s);
-                return;
+                buf.result.resize(start);
+                return false;
             }
         }
-        if (ctx.bytes_sent < ctx.response.size())
+        DNSHeaderFlags flags = message.flags();
+        flags.QR = 1; // answer
+        flags.RA = 1; // supports recursion
+        flags.RCODE = static_cast<uint16_t>(result);
+        buf.overwrite_uint16(start + 2, *reinterpret_cast<const uint16_t*>(&flags));
+        buf.overwrite_uint16(start + 6, ancount); // ANCOUNT
+        buf.overwrite_uint16(start + 10, 0); // ARCOUNT
+
+        if (logger)
         {
-            return; // need send more data
+            logger->log()
+                << "Processing query [" << message.id() << "]: 1 request(s)"
+                << std::endl;
+            logger->log()
+                << "Processing request [" << message.id()
+                << "]: type=" << RecTypeToStr(static_cast<DNSRecordType>(question.type))
+                << ", name=" << name
+                << std::endl;
+            logger->log()
+                << "Sending result: ["
+                << message.id() << "]: "
+                << ancount << " answer(s), result="
+                << ResultCodeToStr(result)
+                << std::endl;
         }
-
-        // All data is sent. Close connection
-        closeTcpSocket(s);
+        return true;
     }
 
-    void readUdpSocket(SOCKET s)
+    // A malformed query: its header echoed with FORMERR and nothing else,
+    // as far as there is a header to echo.
+    void answerFormatError(const uint8_t* query, size_t size, DNSBuffer& buf)
     {
-        char message[UDP_SIZE] = {};
-        socklen_t slen = sizeof(udp_socket_data.client);
-        int msg_len = recvfrom(s, message, UDP_SIZE, 0, (sockaddr*)&udp_socket_data.client, &slen);
-        if (msg_len <= 0)
+        if (size < sizeof(DNSHeader))
         {
-            // recvfrom error: just ignore
             return;
         }
-
-        const uint8_t* ptr = reinterpret_cast<const uint8_t*>(message);
-        udp_socket_data.request.assign(ptr, ptr + msg_len);
-
-        // now be ready to write response
-        selector.removeReadSocket(s);
-        selector.addWriteSocket(s);
+        const uint8_t* data = query;
+        DNSHeader header(data);
+        header.flags.QR = 1; // answer
+        header.flags.RA = 1; // supports recursion
+        header.flags.AA = 0;
+        header.flags.TC = 0;
+        header.flags.Z = 0;
+        header.flags.RCODE = static_cast<uint16_t>(DNSResultCode::FormatError);
+        header.QDCOUNT = 0;
+        header.ANCOUNT = 0;
+        header.NSCOUNT = 0;
+        header.ARCOUNT = 0;
+        header.append(buf);
+        if (logger)
+        {
+            logger->log()
+                << "Malformed query [" << header.ID << "]: " << size << " byte(s)"
+                << std::endl;
+        }
     }
 
-    void writeUdpSocket(SOCKET s)
+    virtual void processQuery(const uint8_t* query, size_t size, DNSBuffer& buf)
     {
-        int slen = sizeof(udp_socket_data.client);
-        if (udp_socket_data.request.size() < sizeof(DNSHeader))
+        // a query is a question and an OPT record; anything longer is refused
+        // before its names are walked, which bounds the time one can take
+        if (size > MAX_QUERY_SIZE)
         {
-            std::string cmd(udp_socket_data.request.begin(), udp_socket_data.request.end());
-            if (cmd == "quit" || cmd == "exit")
-            {
-                canExit = true;
-                cmd = "Terminating...\n";
-            }
-            else
-            {
-                cmd = "Unknown command!\n";
-            }
-            sendto(s, cmd.c_str(), static_cast<int>(cmd.size()), 0, (sockaddr*)&udp_socket_data.client, slen);
+            answerFormatError(query, size, buf);
+            return;
         }
-        else
+        const DNSMessageView message(query, size);
+        if (!message.valid())
         {
-            DNSBuffer buf;
-            buf.max_size = UDP_SIZE;
-            processQuery(&udp_socket_data.request[0], buf);
-
-            int bytes_to_write = static_cast<int>(buf.result.size());
-            sendto(s, reinterpret_cast<const char*>(&buf.result[0]), bytes_to_write, 0, (sockaddr*)&udp_socket_data.client, slen);
+            answerFormatError(query, size, buf);
+            return;
+        }
+        DNSEpoch::Guard guard(epoch);
+        const DNSZone& zone = *current.load();
+        if (answerPrerendered(zone, message, buf))
+        {
+            return;
         }
 
-        // now be ready to read requests
-        selector.removeWriteSocket(s);
-        selector.addReadSocket(s);
-
-        udp_socket_data.request.clear();
-    }
-
-    void processQuery(const uint8_t* query, DNSBuffer& buf)
-    {
-        DNSPackage package(query);
+        DNSPackage package;
+        try
+        {
+            package = DNSPackage(query, size);
+        }
+        catch (const std::runtime_error&)
+        {
+            // framed well, but an rdata the parser refuses
+            answerFormatError(query, size, buf);
+            return;
+        }
 
         if (logger)
         {
@@ -245,6 +306,7 @@ class DNSServerImpl: private ISocketHandler
         package.header.flags.QR = 1; // answer
         package.header.flags.RA = 1; // supports recursion
         package.header.flags.RCODE = static_cast<uint16_t>(DNSResultCode::NoError);
+        std::vector<std::string> owners;
         for (const auto& query : package.requests)
         {
             if (logger)
@@ -257,15 +319,24 @@ class DNSServerImpl: private ISocketHandler
             }
 
             DNSRecordType type = static_cast<DNSRecordType>(query.type);
-            Request req{ type, query.name };
-            const auto iter = table.find(req);
-            if (iter != table.end())
+            bool wildcard;
+            const uint8_t* blob = lookup(zone, query.name, query.type, query.hash, wildcard);
+            if (blob)
             {
-                for (const auto& item : iter->second.records)
+                DNSZoneResponse response(blob);
+                for (const auto& item : response.records(query.name))
                 {
                     package.addAnswer(type, query.name, item);
                 }
-                package.header.flags.RCODE = static_cast<uint16_t>(iter->second.result);
+                package.header.flags.RCODE = static_cast<uint16_t>(response.result());
+            }
+            else if (type == DNSRecordType::PTR && zone.reverse(query.name, owners) > 0)
+            {
+                for (const auto& owner : owners)
+                {
+                    package.addAnswer(type, query.name, owner);
+                }
+                owners.clear();
             }
             else
             {
@@ -309,178 +380,265 @@ class DNSServerImpl: private ISocketHandler
         }
     }
 
-    // ISocketHandler
-    virtual void socketReadyRead(SOCKET s)
+public:
+    DNSServerSettings settings;
+
+    DNSServerImpl(const std::string& host, int port, ILogger* logger)
+        : host(host)
+        , port(port)
+        , current(new DNSZone)
+        , finished(false)
+        , listen_overflows(0)
+        , logger(logger)
+#ifdef _WIN32
+        , wsa{0}
     {
-        if (s == socket_tcp)
-        {
-            struct sockaddr_storage client_addr;
-            socklen_t client_addr_len = sizeof(client_addr);
-            SOCKET client = ::accept(s, (struct sockaddr*)&client_addr, &client_addr_len);
-            if (client != INVALID_SOCKET)
-            {
-                setupsocket(client);
-                selector.addReadSocket(client);
-            }
-        }
-        else if (s == socket_udp)
-        {
-            readUdpSocket(s);
-        }
-        else
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) 
         {
-            readTcpSocket(s);
+            throw std::runtime_error("WSAStartup() failed");
         }
     }
+#else
+{}
+#endif
 
-    // ISocketHandler
-    virtual void socketReadyWrite(SOCKET s)
+    ~DNSServerImpl()
     {
-        if (s == socket_udp)
-        {
-            writeUdpSocket(s);
-        }
-        else if (s != socket_tcp)
-        {
-            writeTcpSocket(s);
-        }
+        stop();
+        join();
+        delete current.load();
     }
 
-    void process()
+    size_t update(const DNSRecordBatch& batch)
     {
-        try
+        // render outside the lock, the writers only wait for each other's copy
+        std::vector<std::vector<uint8_t>> rendered(batch.changes.size());
+        for (size_t i = 0; i < batch.changes.size(); ++i)
         {
-            if (logger)
-            {
-                logger->log() << "DNS server started!" << std::endl;
-            }
-
-            sockaddr_in server = { 0 };
-            server.sin_family = AF_INET;
-            server.sin_addr.s_addr = INADDR_ANY;
-            server.sin_port = htons(port);
-
-            // UDP socket
-            if ((socket_udp = socket(AF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET)
-            {
-                throw std::runtime_error("Create UDP socket failed");
-            }
-            setupsocket(socket_udp);
-            if (bind(socket_udp, (sockaddr*)&server, sizeof(server)) == SOCKET_ERROR)
-            {
-                throw std::runtime_error("Bind UDP socket failed");
-            }
-            selector.addReadSocket(socket_udp);
-
-            // TCP socket
-            if ((socket_tcp = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET)
-            {
-                throw std::runtime_error("Create TCP socket failed");
-            }
-            setupsocket(socket_tcp);
-            if (bind(socket_tcp, (sockaddr*)&server, sizeof(server)) == SOCKET_ERROR)
+            const auto& change = batch.changes[i];
+            if (!change.remove)
             {
-                throw std::runtime_error("Bind TCP socket failed");
+                rendered[i] = DNSZoneResponse::render(change.type, change.host, change.result, change.answer);
             }
-            listen(socket_tcp, 5);
-            selector.addReadSocket(socket_tcp);
+        }
 
-            canExit = false;
-            while (!canExit)
+        std::lock_guard<std::mutex> lock(update_mutex);
+        std::unique_ptr<DNSZone> zone(new DNSZone(*current.load()));
+        size_t applied = 0;
+        for (size_t i = 0; i < batch.changes.size(); ++i)
+        {
+            const auto& change = batch.changes[i];
+            if (change.remove)
             {
-                selector.select();
+                applied += zone->remove(change.type, change.host);
+                continue;
             }
+            zone->add(change.type, change.host, rendered[i]);
+            ++applied;
         }
-        catch(const std::exception& e)
+        zone->updateFilter(settings.filter_fp_rate);
+        zone->updateReverse(settings.reverse_ptr);
+        publish(zone.release());
+        return applied;
+    }
+
+    // Adds the records on top of the current ones, in order.
+    size_t load(std::vector<std::vector<DNSJsonLoader::Record>> chunks)
+    {
+        std::lock_guard<std::mutex> lock(update_mutex);
+        std::unique_ptr<DNSZone> zone(new DNSZone(*current.load()));
+        size_t applied = 0;
+        for (auto& chunk : chunks)
         {
-            if (logger)
+            for (auto& record : chunk)
             {
-                logger->log() << "DNS server error: " << e.what() << std::endl;
+                zone->add(record.type, record.host, record.response);
             }
+            applied += chunk.size();
+            std::vector<DNSJsonLoader::Record>().swap(chunk); // lower the peak
         }
+        zone->updateFilter(settings.filter_fp_rate);
+        zone->updateReverse(settings.reverse_ptr);
+        publish(zone.release());
+        return applied;
+    }
+
+    // Callers hold update_mutex.
+    void publish(const DNSZone* zone)
+    {
+        const DNSZone* old = current.exchange(zone);
+        epoch.retire([old] { delete old; });
+    }
 
-        // cleanup
-        closeUdpSocket(socket_udp);
-        for (auto elem: tcp_socket_data)
+    void loadZone(const std::string& path, bool huge_pages, bool verify)
+    {
+        auto image = std::make_shared<const DNSZoneImage>(path, huge_pages);
+        if (verify && !image->verify())
         {
-            closeTcpSocket(elem.first);
+            throw std::runtime_error("Zone image is corrupt");
         }
-        closeTcpSocket(socket_tcp);
+        std::unique_ptr<DNSZone> zone(new DNSZone(image));
+        if (settings.reverse_ptr && zone->reverseSize() == 0)
+        {
+            zone->rebuildReverse(true); // compiled without it
+        }
+        std::lock_guard<std::mutex> lock(update_mutex);
+        publish(zone.release());
+    }
 
-        if (logger)
+    void saveZone(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(update_mutex); // keeps the snapshot alive
+        current.load()->save(path);
+    }
+
+    void addRecord(DNSRecordType type, const std::string& host, const std::vector<std::string>& answer, DNSResultCode result)
+    {
+        DNSRecordBatch batch;
+        batch.add(type, host, answer, result);
+        update(batch);
+    }
+
+    void answer(const uint8_t* query, size_t size, DNSBuffer& buf)
+    {
+        processQuery(query, size, buf);
+    }
+
+    bool removeRecord(DNSRecordType type, const std::string& host)
+    {
+        DNSRecordBatch batch;
+        batch.remove(type, host);
+        return update(batch) == 1;
+    }
+
+    void stop()
+    {
+        for (auto& worker : workers)
         {
-            logger->log() << "DNS server finished!" << std::endl;
+            worker->stop();
         }
     }
 
-public:
-    DNSServerImpl(const std::string& host, int port, ILogger* logger)
-        : selector(this)
-        , host(host)
-        , port(port)
-        , socket_udp(INVALID_SOCKET)
-        , socket_tcp(INVALID_SOCKET)
-        , logger(logger)
-#ifdef _WIN32
-        , wsa{0}
+    void drain()
     {
-        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) 
+        for (auto& worker : workers)
         {
-            throw std::runtime_error("WSAStartup() failed");
+            worker->drain();
         }
     }
-#else
-{}
-#endif
 
-    void addRecord(DNSRecordType type, const std::string& host, const std::vector<std::string>& answer, DNSResultCode result)
+    void collectStats(DNSServerStats& result) const
     {
-        table[Request(type, host)] = Response(result, answer);
+        for (const auto& worker : workers)
+        {
+            worker->stats().collect(result);
+        }
+        result.listen_overflows = readListenOverflows() - listen_overflows;
+        result.filter_rejected = filter_rejected.get();
+        result.filter_passed = filter_passed.get();
+        result.filter_false_positives = filter_false_positives.get();
     }
 
     void start()
     {
-        thread = std::thread{ [this] { process(); } };
+        const unsigned count = std::max(settings.workers, 1u);
+        listen_overflows = readListenOverflows();
+        for (unsigned index = 0; index < count; ++index)
+        {
+            workers.emplace_back(new DNSWorker(this, settings, host, port, index, logger));
+        }
+        if (!settings.control_socket.empty())
+        {
+            control.reset(new DNSControl(this, settings.control_socket, logger));
+            control->start();
+        }
+        if (logger)
+        {
+            logger->log() << "DNS server started!" << std::endl;
+        }
+        for (auto& worker : workers)
+        {
+            worker->start();
+        }
     }
 
     void join()
     {
-        thread.join();
+        if (workers.empty() || finished)
+        {
+            return;
+        }
+        for (auto& worker : workers)
+        {
+            worker->join();
+        }
+        if (control)
+        {
+            control->stop();
+            control->join();
+        }
+        finished = true;
+
+        if (logger)
+        {
+            DNSServerStats result;
+            collectStats(result);
+            result.print(logger->log());
+            logger->log() << "DNS server finished!" << std::endl;
+        }
     }
 
 private:
-    DNSSelector selector;
     std::string host;
     int port;
-    SOCKET socket_udp, socket_tcp;
-    std::map<Request, Response> table;
-    std::map<SOCKET, TcpSocketContext> tcp_socket_data;
-    UdpSocketContext udp_socket_data;
-    fd_set readfds;
-    fd_set writefds;
-    std::thread thread;
-    bool canExit;
+    DNSEpoch epoch;                     // frees the snapshots readers are done with
+    // Immutable snapshots of the records. Readers load the current one
+    // under a DNSEpoch guard; writers copy it, change the copy and swap it
+    // in. Responses are shared between snapshots, so a copy costs the name
+    // index and one pointer per record.
+    std::atomic<const DNSZone*> current;
+    std::mutex update_mutex;            // serializes writers
+    std::vector<std::unique_ptr<DNSWorker>> workers;
+    std::unique_ptr<DNSControl> control;
+    bool finished;
+    uint64_t listen_overflows;      // host-wide counter when the server started
+    DNSSharedCounter filter_rejected;   // lookups of the workers, any thread adds
+    DNSSharedCounter filter_passed;
+    DNSSharedCounter filter_false_positives;
     ILogger* logger;
 #ifdef _WIN32
     WSADATA wsa;
 #endif
 };
 
+void DNSRecordBatch::add(DNSRecordType type, const std::string& host, const std::vector<std::string>& answer, DNSResultCode result)
+{
+    changes.push_back(Change{ false, type, host, answer, result });
+}
+
+void DNSRecordBatch::remove(DNSRecordType type, const std::string& host)
+{
+    changes.push_back(Change{ true, type, host, {}, DNSResultCode::NoError });
+}
+
+size_t DNSRecordBatch::size() const
+{
+    return changes.size();
+}
+
 DNSServer::DNSServer(const std::string& host, int port, ILogger* logger)
     : impl(new DNSServerImpl{host, port, logger})
 {}
 
 DNSServer::DNSServer(const std::string& jsonFile, ILogger* logger)
 {
+    // the records are parsed by the loader, jsoncpp only sees the settings
+    DNSJsonLoader loader(jsonFile);
     Json::Value root;
-    std::ifstream ifs(jsonFile.c_str());
-    if (!ifs.is_open())
-    {
-        throw std::runtime_error("Error opening json file");
-    }
+    std::istringstream iss(loader.settings());
     Json::CharReaderBuilder builder;
     JSONCPP_STRING errs;
-    if (!parseFromStream(builder, ifs, &root, &errs)) 
+    if (!parseFromStream(builder, iss, &root, &errs))
     {
         throw std::runtime_error("Error parsing json file");
     }
@@ -489,34 +647,111 @@ DNSServer::DNSServer(const std::string& jsonFile, ILogger* logger)
 
     impl.reset(new DNSServerImpl{ ip, port, logger });
 
-    const Json::Value records = root["records"];
-    for (auto index = 0u; index < records.size(); ++index)
+    std::string engine = root.get("engine", "selector").asString();
+    if (engine == "io_uring")
     {
-        DNSRecordType type = ::StrToRecType(records[index].get("type", "").asString());
-        if (DNSRecordType::OTHER == type)
-        {
-            throw std::runtime_error("Error parsing json file: wrong DNS record type");
-        }
-        std::string host = records[index].get("host", "").asString();
-        DNSResultCode result = ::StrToResultCode(records[index].get("result", "").asString());
-        const Json::Value response = records[index]["response"];
-        std::vector<std::string> answers;
-        for (auto i = 0u; i < response.size(); ++i)
-        {
-            answers.push_back(response[i].asString());
-        }
-        addRecord(type, host, answers, result);
+        impl->settings.engine = DNSEngine::Uring;
+    }
+    else if (engine != "selector")
+    {
+        throw std::runtime_error("Error parsing json file: wrong engine");
     }
+    impl->settings.udp_batch = root.get("udp_batch", static_cast<Json::UInt>(impl->settings.udp_batch)).asUInt();
+    impl->settings.udp_queue = root.get("udp_queue", static_cast<Json::UInt>(impl->settings.udp_queue)).asUInt();
+    impl->settings.tcp_pipeline = root.get("tcp_pipeline", static_cast<Json::UInt>(impl->settings.tcp_pipeline)).asUInt();
+    impl->settings.tcp_backlog = root.get("tcp_backlog", impl->settings.tcp_backlog).asUInt();
+    impl->settings.tcp_fastopen = root.get("tcp_fastopen", impl->settings.tcp_fastopen).asUInt();
+    impl->settings.tcp_defer_accept = root.get("tcp_defer_accept", impl->settings.tcp_defer_accept).asUInt();
+    impl->settings.tcp_idle_timeout = root.get("tcp_idle_timeout", impl->settings.tcp_idle_timeout).asUInt();
+    impl->settings.tcp_read_timeout = root.get("tcp_read_timeout", impl->settings.tcp_read_timeout).asUInt();
+    impl->settings.tcp_write_timeout = root.get("tcp_write_timeout", impl->settings.tcp_write_timeout).asUInt();
+    impl->settings.max_connections = root.get("max_connections", static_cast<Json::UInt>(impl->settings.max_connections)).asUInt();
+    impl->settings.busy_poll = root.get("busy_poll", impl->settings.busy_poll).asUInt();
+    impl->settings.busy_poll_idle = root.get("busy_poll_idle", impl->settings.busy_poll_idle).asUInt();
+    impl->settings.control_socket = root.get("control_socket", impl->settings.control_socket).asString();
+    impl->settings.workers = root.get("workers", impl->settings.workers).asUInt();
+    impl->settings.cpu_affinity = root.get("cpu_affinity", impl->settings.cpu_affinity).asBool();
+    impl->settings.filter_fp_rate = root.get("filter_fp_rate", impl->settings.filter_fp_rate).asDouble();
+    impl->settings.reverse_ptr = root.get("reverse_ptr", impl->settings.reverse_ptr).asBool();
+
+    const std::string zone_image = root.get("zone_image", "").asString();
+    if (!zone_image.empty())
+    {
+        loadZone(zone_image, root.get("zone_huge_pages", false).asBool(), root.get("zone_verify", false).asBool());
+    }
+    const std::string zone_file = root.get("zone_file", "").asString();
+    if (!zone_file.empty())
+    {
+        loadMasterFile(zone_file, root.get("zone_origin", "").asString());
+    }
+
+    impl->load(loader.records());
 }
 
 DNSServer::~DNSServer()
 {}
 
+DNSServerSettings& DNSServer::settings()
+{
+    return impl->settings;
+}
+
+DNSServerStats DNSServer::stats() const
+{
+    DNSServerStats result;
+    impl->collectStats(result);
+    return result;
+}
+
 void DNSServer::addRecord(DNSRecordType type, const std::string& host, const std::vector<std::string>& answer, DNSResultCode result)
 {
     impl->addRecord(type, host, answer, result);
 }
 
+bool DNSServer::removeRecord(DNSRecordType type, const std::string& host)
+{
+    return impl->removeRecord(type, host);
+}
+
+size_t DNSServer::update(const DNSRecordBatch& batch)
+{
+    return impl->update(batch);
+}
+
+void DNSServer::loadZone(const std::string& image, bool huge_pages, bool verify)
+{
+    impl->loadZone(image, huge_pages, verify);
+}
+
+void DNSServer::saveZone(const std::string& image)
+{
+    impl->saveZone(image);
+}
+
+size_t DNSServer::loadMasterFile(const std::string& path, const std::string& origin)
+{
+    DNSMasterFile zone(path, origin);
+    DNSRecordBatch batch;
+    zone.records(batch);
+    impl->update(batch);
+    return zone.skipped();
+}
+
+void DNSServer::processQuery(const uint8_t* query, size_t size, DNSBuffer& buf)
+{
+    impl->answer(query, size, buf);
+}
+
+void DNSServer::stop()
+{
+    impl->stop();
+}
+
+void DNSServer::drain()
+{
+    impl->drain();
+}
+
 void DNSServer::start()
 {
     impl->start();
@@ -10,6 +10,7 @@
 #include "dns_package.h"
 
 class DNSServerImpl;
+class DNSBuffer;
 
 class ILogger
 {
@@ -17,6 +18,86 @@ public:
     virtual std::ostream& log() = 0;
 };
 
+enum class DNSEngine
+{
+    Selector,   // DNSSelector (epoll/select) readiness loop
+    Uring,      // io_uring completion loop, falls back to Selector if unavailable
+};
+
+struct DNSServerSettings
+{
+public:
+    DNSServerSettings();
+
+public:
+    DNSEngine engine;
+    size_t udp_batch;       // max datagrams read (and answered) per UDP wakeup
+    size_t udp_queue;       // max replies waiting for a writable UDP socket
+    size_t tcp_pipeline;    // max answered queries waiting to be sent per TCP connection
+    unsigned tcp_backlog;       // listen() backlog of every worker's TCP socket
+    unsigned tcp_fastopen;      // TCP_FASTOPEN queue length (0: off)
+    unsigned tcp_defer_accept;  // TCP_DEFER_ACCEPT seconds (0: off)
+    unsigned tcp_idle_timeout;  // ms a TCP connection may wait for its next query (0: forever)
+    unsigned tcp_read_timeout;  // ms to finish receiving a started query (0: forever)
+    unsigned tcp_write_timeout; // ms for the client to read pending answers (0: forever)
+    size_t max_connections; // open TCP connections, split between workers (0: no limit)
+    unsigned busy_poll;     // us: spin on the UDP socket with SO_BUSY_POLL set (0: wait for readiness)
+    unsigned busy_poll_idle;    // us without a datagram before a spinning worker blocks again
+    std::string control_socket; // Unix socket path of the control channel (empty: none)
+    unsigned workers;       // event loops, each with its own SO_REUSEPORT sockets
+    bool cpu_affinity;      // pin worker N to CPU N
+    double filter_fp_rate;  // false positive rate of the negative-lookup filter (0: none)
+    bool reverse_ptr;       // answer in-addr.arpa PTR queries from the A records
+};
+
+struct DNSServerStats
+{
+public:
+    DNSServerStats();
+
+    void print(std::ostream& os) const;
+
+public:
+    std::vector<uint64_t> udp_batches;  // udp_batches[n]: UDP wakeups that drained n datagrams
+    uint64_t busy_poll_sleeps;          // times a busy-polling worker went idle and blocked
+    uint64_t udp_queued;                // replies deferred until the UDP socket was writable
+    uint64_t udp_dropped;               // replies dropped because the UDP queue was full
+    uint64_t tcp_contexts;              // TCP connection contexts allocated; stays flat under churn
+    uint64_t tcp_frames;                // TCP coroutine frames allocated; stays flat under churn
+    uint64_t tcp_timeouts;              // TCP connections closed by an idle/read/write deadline
+    uint64_t tcp_shed;                  // idle TCP connections closed to admit a new one
+    uint64_t tcp_refused;               // TCP connections refused at max_connections
+    std::vector<uint64_t> tcp_accepts;  // tcp_accepts[n]: listener wakeups that accepted n connections
+    uint64_t listen_overflows;          // SYNs dropped on full accept queues since start (Linux, host-wide)
+    uint64_t filter_rejected;           // lookups the negative filter answered without probing the records
+    uint64_t filter_passed;             // lookups it let through to the records
+    uint64_t filter_false_positives;    // of those, lookups that found no exact record
+};
+
+// Record changes that DNSServer::update() makes visible all at once: a query
+// sees either none or all of them.
+class DNSRecordBatch
+{
+public:
+    void add(DNSRecordType type, const std::string& host, const std::vector<std::string>& answer, DNSResultCode result = DNSResultCode::NoError);
+    void remove(DNSRecordType type, const std::string& host);
+
+    size_t size() const;
+
+private:
+    friend class DNSServerImpl;
+
+    struct Change
+    {
+        bool remove;
+        DNSRecordType type;
+        std::string host;
+        std::vector<std::string> answer;
+        DNSResultCode result;
+    };
+    std::vector<Change> changes;
+};
+
 class DNSServer
 {
 public:
@@ -24,8 +105,34 @@ public:
     DNSServer(const std::string& json, ILogger* logger = nullptr);
     ~DNSServer();
 
+    DNSServerSettings& settings();
+    DNSServerStats stats() const;
+
+    // All are safe to call while the server is running; queries never wait
+    // for them. Each call copies the record table, so load many records
+    // with one update().
     void addRecord(DNSRecordType type, const std::string& host, const std::vector<std::string>& answer, DNSResultCode result = DNSResultCode::NoError);
+    bool removeRecord(DNSRecordType type, const std::string& host);
+    // Changes applied; removing a missing record is not one.
+    size_t update(const DNSRecordBatch& batch);
+
+    // Replaces the records with a zone image (see saveZone), mapped
+    // read-only and served in place; only its header is checked unless
+    // `verify` is set. Later changes are kept in memory on top of it.
+    void loadZone(const std::string& image, bool huge_pages = false, bool verify = false);
+    // Writes the current records as a zone image.
+    void saveZone(const std::string& image);
+    // Adds the records of an RFC 1035 master file (see DNSMasterFile) as
+    // one update(); `origin` is its initial $ORIGIN. Records of types the
+    // server does not serve are skipped: returns how many.
+    size_t loadMasterFile(const std::string& path, const std::string& origin = "");
+
+    // Answers one query without the network (tests, benchmarks); thread-safe.
+    void processQuery(const uint8_t* query, size_t size, DNSBuffer& buf);
+
     void start();
+    void stop();    // thread-safe: close everything now
+    void drain();   // thread-safe: stop accepting, finish the pending TCP answers, then stop
     void join();
 
 private:
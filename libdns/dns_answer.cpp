@@ -15,7 +15,7 @@ public:
 class DNSAnswerExtA : public DNSAnswerExt
 {
 public:
-    DNSAnswerExtA(const uint8_t* const orig, const uint8_t*& data)
+    DNSAnswerExtA(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
     {
         auto len = get_uint16(data);
         if (len != sizeof(addr))
@@ -49,10 +49,12 @@ private:
 class DNSAnswerExtTxt : public DNSAnswerExt
 {
 public:
-    DNSAnswerExtTxt(const uint8_t* const orig, const uint8_t*& data)
+    DNSAnswerExtTxt(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
     {
         uint16_t size = get_uint16(data);
+        check_size(data, end, 1);
         uint8_t len = get_uint8(data);
+        check_size(data, end, len);
         text = get_string(data, len);
     }
     DNSAnswerExtTxt(const std::string& text)
@@ -75,12 +77,13 @@ private:
 class DNSAnswerExtMx : public DNSAnswerExt
 {
 public:
-    DNSAnswerExtMx(const uint8_t* const orig, const uint8_t*& data)
+    DNSAnswerExtMx(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
         : preference(10)
     {
         auto len = get_uint16(data);
+        check_size(data, end, sizeof(uint16_t));
         preference = get_uint16(data);
-        text = get_domain(orig, data);
+        text = get_domain(orig, end, data);
     }
     DNSAnswerExtMx(const std::string& text)
         : text(text)
@@ -108,10 +111,10 @@ private:
 class DNSAnswerExtCname : public DNSAnswerExt
 {
 public:
-    DNSAnswerExtCname(const uint8_t* const orig, const uint8_t*& data)
+    DNSAnswerExtCname(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
     {
         auto len = get_uint16(data);
-        text = get_domain(orig, data);
+        text = get_domain(orig, end, data);
     }
     DNSAnswerExtCname(const std::string& data)
         : text(data)
@@ -136,10 +139,10 @@ private:
 class DNSAnswerExtPtr : public DNSAnswerExt
 {
 public:
-    DNSAnswerExtPtr(const uint8_t* const orig, const uint8_t*& data)
+    DNSAnswerExtPtr(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
     {
         auto len = get_uint16(data);
-        host = get_domain(orig, data);
+        host = get_domain(orig, end, data);
     }
     DNSAnswerExtPtr(const std::string& data)
         : host(data)
@@ -189,32 +192,40 @@ DNSAnswer::DNSAnswer(DNSRecordType type, const std::string& data)
     }
 }
 
-DNSAnswer::DNSAnswer(const uint8_t* const orig, const uint8_t*& data)
-    : name(get_domain(orig, data))
-    , type(get_uint16(data))
-    , cls(get_uint16(data))
-    , ttl(get_uint32(data))
+DNSAnswer::DNSAnswer(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
+    : name(get_domain(orig, end, data))
 {
+    // type, class, TTL, then the rdata with its length
+    check_size(data, end, 10);
+    type = get_uint16(data);
+    cls = get_uint16(data);
+    ttl = get_uint32(data);
+    const uint8_t* rdata = data;
+    const size_t rdlength = get_uint16(rdata);
+    check_size(rdata, end, rdlength);
+    // the rdata is read within its length; types not served are skipped
+    const uint8_t* const rdata_end = rdata + rdlength;
     switch (static_cast<DNSRecordType>(type))
     {
     case DNSRecordType::A:
-        ext.reset(new DNSAnswerExtA{ orig, data });
+        ext.reset(new DNSAnswerExtA{ orig, rdata_end, data });
         break;
     case DNSRecordType::MX:
-        ext.reset(new DNSAnswerExtMx{ orig, data });
+        ext.reset(new DNSAnswerExtMx{ orig, rdata_end, data });
         break;
     case DNSRecordType::TXT:
-        ext.reset(new DNSAnswerExtTxt{ orig, data });
+        ext.reset(new DNSAnswerExtTxt{ orig, rdata_end, data });
         break;
     case DNSRecordType::CNAME:
-        ext.reset(new DNSAnswerExtCname{ orig, data });
+        ext.reset(new DNSAnswerExtCname{ orig, rdata_end, data });
         break;
     case DNSRecordType::PTR:
-        ext.reset(new DNSAnswerExtPtr{ orig, data });
+        ext.reset(new DNSAnswerExtPtr{ orig, rdata_end, data });
         break;
     default:
         break;
     }
+    data = rdata_end;
 }
 
 DNSAnswer::~DNSAnswer()
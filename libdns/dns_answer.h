@@ -12,7 +12,9 @@ struct DNSAnswer
 {
 public:
     DNSAnswer(DNSRecordType type, const std::string& data);
-    DNSAnswer(const uint8_t* const orig, const uint8_t*& data);
+    // Reads the record at `data` of the message [orig, end); throws when it
+    // is malformed.
+    DNSAnswer(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data);
     ~DNSAnswer();
 
     void append(DNSBuffer& buf) const;
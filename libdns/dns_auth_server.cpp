@@ -14,20 +14,30 @@ DNSAuthorityServer::DNSAuthorityServer()
     , ttl_min(0)
 {}
 
-DNSAuthorityServer::DNSAuthorityServer(const uint8_t* const orig, const uint8_t*& data)
-    : name(get_domain(orig, data))
-    , type(get_uint16(data))
-    , cls(get_uint16(data))
-    , ttl(get_uint32(data))
-    , len(get_uint16(data))
-    , primary(get_domain(orig, data))
-    , mbox(get_domain(orig, data))
-    , serial(get_uint32(data))
-    , refresh(get_uint32(data))
-    , retry(get_uint32(data))
-    , expire(get_uint32(data))
-    , ttl_min(get_uint32(data))
-{}
+DNSAuthorityServer::DNSAuthorityServer(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
+    : DNSAuthorityServer()
+{
+    name = get_domain(orig, end, data);
+    check_size(data, end, 10);
+    type = get_uint16(data);
+    cls = get_uint16(data);
+    ttl = get_uint32(data);
+    len = get_uint16(data);
+    check_size(data, end, len);
+    const uint8_t* const rdata_end = data + len;
+    if (type == 6) // SOA
+    {
+        primary = get_domain(orig, rdata_end, data);
+        mbox = get_domain(orig, rdata_end, data);
+        check_size(data, rdata_end, 5 * sizeof(uint32_t));
+        serial = get_uint32(data);
+        refresh = get_uint32(data);
+        retry = get_uint32(data);
+        expire = get_uint32(data);
+        ttl_min = get_uint32(data);
+    }
+    data = rdata_end;
+}
 
 void DNSAuthorityServer::append(DNSBuffer& buf) const
 {
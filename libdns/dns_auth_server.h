@@ -8,7 +8,9 @@ struct DNSAuthorityServer
 {
 public:
     DNSAuthorityServer();
-    DNSAuthorityServer(const uint8_t* const orig, const uint8_t*& data);
+    // Reads the record at `data` of the message [orig, end); throws when it
+    // is malformed. Only an SOA record's rdata is read, any other is skipped.
+    DNSAuthorityServer(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data);
 
     void append(DNSBuffer& buf) const;
 
@@ -0,0 +1,110 @@
+#include "dns_bloom.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+DNSBloomFilter::DNSBloomFilter()
+    : bit_data(nullptr)
+    , block_count(0)
+    , probes(0)
+{}
+
+DNSBloomFilter::DNSBloomFilter(size_t keys, double fp_rate)
+    : bit_data(nullptr)
+    , block_count(0)
+    , probes(0)
+{
+    if (keys == 0 || fp_rate <= 0 || fp_rate >= 1)
+    {
+        return;
+    }
+    // bits per key of a classic filter, plus a quarter for the uneven
+    // load of the blocks
+    const double ln2 = std::log(2.0);
+    const double bits_per_key = -std::log(fp_rate) / (ln2 * ln2) * 1.25;
+    probes = static_cast<unsigned>(std::clamp(std::lround(bits_per_key / 1.25 * ln2), 1l, 16l));
+    block_count = static_cast<uint64_t>(std::ceil(keys * bits_per_key / BLOCK_BITS));
+    if (block_count > 0xFFFFFFFFull)
+    {
+        throw std::runtime_error("Too many names for the negative filter");
+    }
+    bits.assign(block_count * BLOCK_WORDS, 0);
+    bit_data = bits.data();
+}
+
+DNSBloomFilter::DNSBloomFilter(const DNSBloomFilter& other)
+    : bits(other.bits)
+    , bit_data(other.bits.empty() ? other.bit_data : bits.data())
+    , block_count(other.block_count)
+    , probes(other.probes)
+{}
+
+DNSBloomFilter& DNSBloomFilter::operator=(const DNSBloomFilter& other)
+{
+    if (this != &other)
+    {
+        DNSBloomFilter copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+void DNSBloomFilter::insert(uint64_t hash)
+{
+    if (block_count == 0)
+    {
+        return;
+    }
+    if (bits.empty())
+    {
+        bits.assign(bit_data, bit_data + block_count * BLOCK_WORDS);
+        bit_data = bits.data();
+    }
+    uint64_t* block = bits.data() + (blockOf(hash) - bit_data);
+    uint64_t m = hash * 0x9E3779B97F4A7C15ull;
+    const uint32_t step = static_cast<uint32_t>(m >> 32) | 1;
+    uint32_t pos = static_cast<uint32_t>(m);
+    for (unsigned i = 0; i < probes; ++i, pos += step)
+    {
+        const unsigned bit = pos & (BLOCK_BITS - 1);
+        block[bit >> 6] |= 1ull << (bit & 63);
+    }
+}
+
+size_t DNSBloomFilter::bytes() const
+{
+    return block_count * BLOCK_WORDS * sizeof(uint64_t);
+}
+
+void DNSBloomFilter::save(std::vector<uint8_t>& out) const
+{
+    const uint64_t header[] = { block_count, probes };
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(header);
+    out.insert(out.end(), bytes, bytes + sizeof(header));
+    bytes = reinterpret_cast<const uint8_t*>(bit_data);
+    out.insert(out.end(), bytes, bytes + this->bytes());
+}
+
+const uint8_t* DNSBloomFilter::map(const uint8_t* data, const uint8_t* end)
+{
+    uint64_t header[2];
+    if (static_cast<size_t>(end - data) < sizeof(header))
+    {
+        throw std::runtime_error("Zone image is truncated");
+    }
+    memcpy(header, data, sizeof(header));
+    data += sizeof(header);
+    if (header[0] > 0xFFFFFFFFull || header[1] > 16
+        || static_cast<size_t>(end - data) / (BLOCK_WORDS * sizeof(uint64_t)) < header[0])
+    {
+        throw std::runtime_error("Zone image is truncated");
+    }
+    bits.clear();
+    block_count = header[0];
+    probes = static_cast<unsigned>(header[1]);
+    bit_data = block_count ? reinterpret_cast<const uint64_t*>(data) : nullptr;
+    return data + bytes();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A blocked Bloom filter over the 64-bit DNSNameIndex hashes: a key sets k
+// bits in one 64-byte block, so a lookup reads one cache line and no name
+// bytes. A filter without keys passes everything. Like the index it can be
+// saved into a zone image and used in place from the mapping; the first
+// insert copies the mapped bits. Not thread-safe while it is built;
+// lookups are const.
+class DNSBloomFilter
+{
+public:
+    DNSBloomFilter();
+    // Sized for `keys` keys at a false positive rate of about `fp_rate`.
+    DNSBloomFilter(size_t keys, double fp_rate);
+    DNSBloomFilter(const DNSBloomFilter& other);
+    DNSBloomFilter(DNSBloomFilter&& other) = default;
+    DNSBloomFilter& operator=(const DNSBloomFilter& other);
+    DNSBloomFilter& operator=(DNSBloomFilter&& other) = default;
+
+    void insert(uint64_t hash);
+    bool mayContain(uint64_t hash) const
+    {
+        if (block_count == 0)
+        {
+            return true;
+        }
+        const uint64_t* block = blockOf(hash);
+        uint64_t m = hash * 0x9E3779B97F4A7C15ull;
+        const uint32_t step = static_cast<uint32_t>(m >> 32) | 1;
+        uint32_t pos = static_cast<uint32_t>(m);
+        for (unsigned i = 0; i < probes; ++i, pos += step)
+        {
+            const unsigned bit = pos & (BLOCK_BITS - 1);
+            if (!(block[bit >> 6] & (1ull << (bit & 63))))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t bytes() const;
+
+    void save(std::vector<uint8_t>& out) const;
+    const uint8_t* map(const uint8_t* data, const uint8_t* end);
+
+private:
+    static constexpr unsigned BLOCK_BITS = 512;
+    static constexpr unsigned BLOCK_WORDS = BLOCK_BITS / 64;
+
+    const uint64_t* blockOf(uint64_t hash) const
+    {
+        // the high half picks the block, the rest the bits in it
+        return bit_data + ((hash >> 32) * block_count >> 32) * BLOCK_WORDS;
+    }
+
+    std::vector<uint64_t> bits;
+    const uint64_t* bit_data;       // `bits` or a mapped image
+    uint64_t block_count;
+    unsigned probes;
+};
@@ -6,47 +6,153 @@
 #include <arpa/inet.h>
 #endif
 
+#include <cstring>
+
 #include "dns_utils.h"
 
+namespace
+{
+    // Of a name's dotted text, eight bytes at a time.
+    uint32_t hash_name(const char* name, size_t size)
+    {
+        uint64_t hash = size;
+        size_t pos = 0;
+        for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t))
+        {
+            uint64_t word;
+            memcpy(&word, name + pos, sizeof(word));
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        }
+        if (pos < size)
+        {
+            uint64_t word = 0;
+            if (size >= sizeof(uint64_t))
+            {
+                memcpy(&word, name + size - sizeof(word), sizeof(word)); // overlaps the last
+            }
+            else
+            {
+                for (; pos < size; ++pos)
+                {
+                    word = word << 8 | static_cast<uint8_t>(name[pos]);
+                }
+            }
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        }
+        return static_cast<uint32_t>(hash ^ hash >> 32);
+    }
+}
+
 DNSBuffer::DNSBuffer()
     : data_start(0u)
     , max_size(0u)
+    , compress_count(0u)
 {
     result.reserve(512);
+    memset(compress_offset, 0, sizeof(compress_offset));
 }
 
 void DNSBuffer::append_domain(const std::string& str)
 {
-    if (str.empty())
+    // a label at a time, until a suffix is found already written
+    const char* name = str.data();
+    size_t size = str.size();
+    if (size > 0 && name[size - 1] == '.')
+    {
+        --size; // the root's
+    }
+    while (size > 0)
+    {
+        const uint32_t hash = hash_name(name, size);
+        const size_t target = find_suffix(hash, name, size);
+        if (target != 0)
+        {
+            append(static_cast<uint16_t>(0xC000 | target));
+            return;
+        }
+        add_suffix(hash, result.size() - data_start);
+        const char* dot = static_cast<const char*>(memchr(name, '.', size));
+        const size_t label = dot != nullptr ? static_cast<size_t>(dot - name) : size;
+        result.push_back(static_cast<uint8_t>(label));
+        result.insert(result.end(), name, name + label);
+        if (dot == nullptr)
+        {
+            break;
+        }
+        name += label + 1;
+        size -= label + 1;
+    }
+    result.push_back('\0');
+}
+
+size_t DNSBuffer::find_suffix(uint32_t hash, const char* name, size_t size) const
+{
+    for (size_t slot = hash & (COMPRESS_SLOTS - 1); compress_offset[slot] != 0; slot = (slot + 1) & (COMPRESS_SLOTS - 1))
+    {
+        if (compress_hash[slot] == hash && matches(data_start + compress_offset[slot], name, size))
+        {
+            return compress_offset[slot];
+        }
+    }
+    return 0;
+}
+
+void DNSBuffer::add_suffix(uint32_t hash, size_t offset)
+{
+    // a pointer has 14 bits for the offset
+    if (offset == 0 || offset > 0x3FFF || compress_count == COMPRESS_ENTRIES)
     {
-        result.push_back('\0');
         return;
     }
-    auto iter = compress.find(str);
-    if (iter != compress.end())
+    size_t slot = hash & (COMPRESS_SLOTS - 1);
+    while (compress_offset[slot] != 0)
     {
-        uint16_t val = static_cast<uint16_t>(iter->second);
-        val |= 0xc000;
-        append(val);
+        slot = (slot + 1) & (COMPRESS_SLOTS - 1);
     }
-    else
+    compress_hash[slot] = hash;
+    compress_offset[slot] = static_cast<uint16_t>(offset);
+    compress_used[compress_count++] = static_cast<uint8_t>(slot);
+}
+
+bool DNSBuffer::matches(size_t pos, const char* name, size_t size) const
+{
+    // walks what was written, following its pointers (backwards only),
+    // against the dotted text
+    size_t read = 0;
+    for (;;)
     {
-        auto offset = result.size() - data_start;
-        auto pos = str.find('.');
-        if (pos != std::string::npos)
+        while (pos + 1 < result.size() && (result[pos] & 0xC0) == 0xC0)
+        {
+            const size_t target = data_start + (static_cast<size_t>(result[pos] & 0x3F) << 8 | result[pos + 1]);
+            if (target >= pos)
+            {
+                return false;
+            }
+            pos = target;
+        }
+        if (pos >= result.size())
+        {
+            return false;
+        }
+        const size_t label = result[pos];
+        if (label == 0)
         {
-            auto before = str.substr(0, pos);
-            append_label(before);
-            compress.emplace(str, offset);
-            auto after = str.substr(pos + 1);
-            append_domain(after);
+            return read == size;
         }
-        else
+        if (read > 0)
         {
-            append_label(str);
-            compress.emplace(str, offset);
-            result.push_back('\0');
+            if (read == size || name[read] != '.')
+            {
+                return false;
+            }
+            ++read;
         }
+        if (label > size - read || result.size() - pos - 1 < label || memcmp(&result[pos + 1], name + read, label) != 0)
+        {
+            return false;
+        }
+        read += label;
+        pos += label + 1;
     }
 }
 
@@ -86,5 +192,9 @@ void DNSBuffer::clear()
     data_start = 0u;
     max_size = 0u;
     result.clear();
-    compress.clear();
+    for (size_t i = 0; i < compress_count; ++i)
+    {
+        compress_offset[compress_used[i]] = 0;
+    }
+    compress_count = 0;
 }
@@ -1,7 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
-#include <map>
 #include <vector>
 
 class DNSBuffer
@@ -25,5 +26,20 @@ public:
     std::vector<uint8_t> result;
 
 private:
-    std::map<std::string, size_t> compress;
+    // Name compression: where the name suffixes written so far start, in
+    // an open-addressed table keyed by a hash of the suffix's dotted text.
+    // A hit is checked against the bytes it points at, so a collision costs
+    // a compare, never a wrong pointer. Fixed size, so encoding allocates
+    // nothing; once full, further suffixes are written but not remembered.
+    static const size_t COMPRESS_SLOTS = 256;       // a power of two
+    static const size_t COMPRESS_ENTRIES = 192;     // kept at most 3/4 full
+
+    size_t find_suffix(uint32_t hash, const char* name, size_t size) const;
+    void add_suffix(uint32_t hash, size_t offset);
+    bool matches(size_t pos, const char* name, size_t size) const;
+
+    uint32_t compress_hash[COMPRESS_SLOTS];
+    uint16_t compress_offset[COMPRESS_SLOTS];       // from data_start; 0: empty (the header is there)
+    uint8_t compress_used[COMPRESS_ENTRIES];        // the slots taken, for clear()
+    size_t compress_count;
 };
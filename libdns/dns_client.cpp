@@ -15,15 +15,48 @@
 
 #include "dns_socket.h"
 #include "dns_request.h"
+#include "dns_message.h"
 #include "dns_buffer.h"
 #include "dns_utils.h"
 
+static void recvAll(SOCKET s, uint8_t* data, size_t size)
+{
+    while (size > 0)
+    {
+        int bytes_received = recv(s, reinterpret_cast<char*>(data), static_cast<int>(size), 0);
+        if (bytes_received <= 0)
+        {
+            closesocket(s);
+            throw std::runtime_error("Error receiving TCP data");
+        }
+        data += bytes_received;
+        size -= static_cast<size_t>(bytes_received);
+    }
+}
+
 DNSClient::DNSClient(const std::string& host, int port)
     : host(host)
     , port(port)
 {}
 
+static DNSMessageView checkMessage(const uint8_t* data, size_t size)
+{
+    DNSMessageView message(data, size);
+    if (!message.valid())
+    {
+        throw std::runtime_error("Malformed DNS message");
+    }
+    return message;
+}
+
 DNSPackage DNSClient::requestUdp(uint16_t id, DNSRecordType type, const std::string& host)
+{
+    std::vector<uint8_t> message;
+    requestUdp(id, type, host, message);
+    return DNSPackage(message.data(), message.size());
+}
+
+DNSMessageView DNSClient::requestUdp(uint16_t id, DNSRecordType type, const std::string& host, std::vector<uint8_t>& message)
 {
     DNSPackage package;
     package.header.ID = id;
@@ -53,8 +86,8 @@ DNSPackage DNSClient::requestUdp(uint16_t id, DNSRecordType type, const std::str
         throw std::runtime_error("Error sending UDP data");
     }
     
-    std::vector<uint8_t> in_buf(UDP_SIZE, 0);
-    int bytes_received = recvfrom(s, reinterpret_cast<char*>(&in_buf[0]), static_cast<int>(in_buf.size()), 0, nullptr, nullptr);
+    message.assign(UDP_SIZE, 0);
+    int bytes_received = recvfrom(s, reinterpret_cast<char*>(&message[0]), static_cast<int>(message.size()), 0, nullptr, nullptr);
     if (bytes_received < 0)
     {
         throw std::runtime_error("Error receiving UDP data");
@@ -62,12 +95,75 @@ DNSPackage DNSClient::requestUdp(uint16_t id, DNSRecordType type, const std::str
 
     closesocket(s);
 
-    DNSPackage response(&in_buf[0]);
+    message.resize(static_cast<size_t>(bytes_received));
+    return checkMessage(message.data(), message.size());
+}
 
-    return response;
+std::vector<DNSPackage> DNSClient::requestUdpMany(uint16_t first_id, DNSRecordType type, const std::vector<std::string>& hosts)
+{
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == INVALID_SOCKET)
+    {
+        throw std::runtime_error("Can't create UDP socket");
+    }
+    sockaddr_in server = { 0 };
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    inet_pton(AF_INET, this->host.c_str(), &server.sin_addr);
+
+    for (size_t i = 0; i < hosts.size(); ++i)
+    {
+        DNSPackage package;
+        package.header.ID = static_cast<uint16_t>(first_id + i);
+        package.header.flags.RD = 1;
+        package.header.QDCOUNT = 1;
+        package.requests.emplace_back(DNSRequest{ type, hosts[i] });
+        DNSBuffer buf;
+        package.append(buf);
+
+        int bytes_sent = sendto(s, reinterpret_cast<const char*>(&buf.result[0]), static_cast<int>(buf.result.size()), 0, reinterpret_cast<sockaddr*>(&server), static_cast<int>(sizeof(server)));
+        if (bytes_sent < buf.result.size())
+        {
+            closesocket(s);
+            throw std::runtime_error("Error sending UDP data");
+        }
+    }
+
+    std::vector<DNSPackage> result;
+    std::vector<uint8_t> in_buf(UDP_SIZE, 0);
+    while (result.size() < hosts.size())
+    {
+        int bytes_received = recvfrom(s, reinterpret_cast<char*>(&in_buf[0]), static_cast<int>(in_buf.size()), 0, nullptr, nullptr);
+        if (bytes_received < 0)
+        {
+            closesocket(s);
+            throw std::runtime_error("Error receiving UDP data");
+        }
+        try
+        {
+            checkMessage(&in_buf[0], static_cast<size_t>(bytes_received));
+            result.emplace_back(&in_buf[0], static_cast<size_t>(bytes_received));
+        }
+        catch (const std::runtime_error&)
+        {
+            closesocket(s);
+            throw;
+        }
+    }
+
+    closesocket(s);
+
+    return result;
 }
 
 DNSPackage DNSClient::requestTcp(uint16_t id, DNSRecordType type, const std::string& host)
+{
+    std::vector<uint8_t> message;
+    requestTcp(id, type, host, message);
+    return DNSPackage(message.data(), message.size());
+}
+
+DNSMessageView DNSClient::requestTcp(uint16_t id, DNSRecordType type, const std::string& host, std::vector<uint8_t>& message)
 {
     DNSPackage package;
     package.header.ID = id;
@@ -101,45 +197,87 @@ DNSPackage DNSClient::requestTcp(uint16_t id, DNSRecordType type, const std::str
         throw std::runtime_error("Error sending TCP data");
     }
 
-    std::vector<uint8_t> in_buf(sizeof(uint16_t), 0);
-    int bytes_received = recv(s, reinterpret_cast<char*>(&in_buf[0]), static_cast<int>(in_buf.size()), 0);
-    if (bytes_received < 0)
-    {
-        throw std::runtime_error("Error receiving TCP data");
-    }
-
-    const uint8_t* ptr = &in_buf[0];
-    uint16_t size = get_uint16(ptr);
-    in_buf.resize(in_buf.size() + size, 0);
-    bytes_received = recv(s, reinterpret_cast<char*>(&in_buf[sizeof(uint16_t)]), static_cast<int>(size), 0);
-    if (bytes_received < 0)
+    uint8_t length[sizeof(uint16_t)];
+    recvAll(s, length, sizeof(length));
+    const uint8_t* ptr = length;
+    message.assign(get_uint16(ptr), 0);
+    if (!message.empty())
     {
-        throw std::runtime_error("Error receiving TCP data");
+        recvAll(s, &message[0], message.size());
     }
 
     closesocket(s);
 
-    DNSPackage response(&in_buf[sizeof(uint16_t)]);
-
-    return response;
+    return checkMessage(message.data(), message.size());
 }
 
-bool DNSClient::command(const std::string& cmd)
+std::vector<DNSPackage> DNSClient::requestTcpMany(uint16_t first_id, DNSRecordType type, const std::vector<std::string>& hosts)
 {
-    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    std::vector<uint8_t> out_buf;
+    for (size_t i = 0; i < hosts.size(); ++i)
+    {
+        DNSPackage package;
+        package.header.ID = static_cast<uint16_t>(first_id + i);
+        package.header.flags.RD = 1;
+        package.header.QDCOUNT = 1;
+        package.requests.emplace_back(DNSRequest{ type, hosts[i] });
+        DNSBuffer buf;
+        buf.append(static_cast<uint16_t>(0u));  // SIZE (will be calculated later)
+        buf.data_start = buf.result.size();
+        package.append(buf);
+        buf.overwrite_uint16(0, static_cast<uint16_t>(buf.result.size() - sizeof(uint16_t)));
+        out_buf.insert(out_buf.end(), buf.result.begin(), buf.result.end());
+    }
+
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
     if (s == INVALID_SOCKET)
     {
-        throw std::runtime_error("Can't create UDP socket");
+        throw std::runtime_error("Can't create TCP socket");
     }
-    sockaddr_in server = {0};
+    sockaddr_in server = { 0 };
     server.sin_family = AF_INET;
     server.sin_port = htons(port);
-    inet_pton(AF_INET, host.c_str(), &server.sin_addr);
+    inet_pton(AF_INET, this->host.c_str(), &server.sin_addr);
+
+    if (connect(s, reinterpret_cast<sockaddr*>(&server), sizeof(server)) == SOCKET_ERROR)
+    {
+        closesocket(s);
+        throw std::runtime_error("Can't connect to server");
+    }
+
+    int bytes_sent = send(s, reinterpret_cast<const char*>(&out_buf[0]), static_cast<int>(out_buf.size()), 0);
+    if (bytes_sent < static_cast<int>(out_buf.size()))
+    {
+        closesocket(s);
+        throw std::runtime_error("Error sending TCP data");
+    }
+
+    std::vector<DNSPackage> result;
+    std::vector<uint8_t> in_buf;
+    while (result.size() < hosts.size())
+    {
+        uint8_t length[sizeof(uint16_t)];
+        recvAll(s, length, sizeof(length));
+        const uint8_t* ptr = length;
+        in_buf.resize(get_uint16(ptr));
+        if (!in_buf.empty())
+        {
+            recvAll(s, &in_buf[0], in_buf.size());
+        }
+        try
+        {
+            checkMessage(in_buf.data(), in_buf.size());
+            result.emplace_back(in_buf.data(), in_buf.size());
+        }
+        catch (const std::runtime_error&)
+        {
+            closesocket(s);
+            throw;
+        }
+    }
 
-    int length = sendto(s, cmd.c_str(), static_cast<int>(cmd.size()), 0, reinterpret_cast<sockaddr*>(&server), static_cast<int>(sizeof(server)));
- 
     closesocket(s);
 
-    return length == cmd.size();
+    return result;
 }
 
@@ -1,19 +1,34 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "dns_consts.h"
 #include "dns_package.h"
+#include "dns_message.h"
 
 class DNSClient
 {
 public:
     DNSClient(const std::string& host, int port);
 
-    bool command(const std::string& cmd);
     DNSPackage requestUdp(uint16_t id, DNSRecordType type, const std::string& host);
     DNSPackage requestTcp(uint16_t id, DNSRecordType type, const std::string& host);
 
+    // The same, reading the answer in place: it is received into `message`
+    // and viewed there, nothing is parsed into strings. Throws when the
+    // answer is malformed.
+    DNSMessageView requestUdp(uint16_t id, DNSRecordType type, const std::string& host, std::vector<uint8_t>& message);
+    DNSMessageView requestTcp(uint16_t id, DNSRecordType type, const std::string& host, std::vector<uint8_t>& message);
+
+    // Sends one query per host (ids first_id, first_id + 1, ...) before
+    // reading any answer; answers are returned in arrival order.
+    std::vector<DNSPackage> requestUdpMany(uint16_t first_id, DNSRecordType type, const std::vector<std::string>& hosts);
+
+    // Pipelines one query per host over a single TCP connection (RFC 7766):
+    // all queries are written at once, then all answers are read.
+    std::vector<DNSPackage> requestTcpMany(uint16_t first_id, DNSRecordType type, const std::vector<std::string>& hosts);
+
 private:
     std::string host;
     int port;
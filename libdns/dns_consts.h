@@ -21,3 +21,11 @@ enum class DNSResultCode
 };
 
 #define UDP_SIZE 512
+#define TCP_READ_SIZE 4096
+#define ANSWER_TTL 3600             // of every answer: the server keeps no TTLs
+
+// Limits of the message parsers
+#define MAX_MESSAGE_SIZE 0xFFFF     // the most a TCP length prefix can carry
+#define MAX_QUERY_SIZE 4096         // the most a query served is read from
+#define MAX_NAME_SIZE 255           // wire bytes, root included (RFC 1035)
+#define MAX_POINTER_HOPS 16         // compression pointers followed in one name
@@ -0,0 +1,236 @@
+#include "dns_control.h"
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+
+static const size_t MAX_COMMAND = 4096;
+
+DNSControl::DNSControl(IControlProcessor* processor, const std::string& path, ILogger* logger)
+    : processor(processor)
+    , path(path)
+    , logger(logger)
+    , selector(this)
+    , listener(INVALID_SOCKET)
+    , canExit(false)
+{}
+
+DNSControl::~DNSControl()
+{
+    stop();
+    join();
+}
+
+void DNSControl::start()
+{
+#if defined(_WIN32)
+    throw std::runtime_error("Control socket is not supported on this platform");
+#else
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::runtime_error("Control socket path is too long");
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET)
+    {
+        throw std::runtime_error("Create control socket failed");
+    }
+    setupsocket(listener);
+    unlink(path.c_str()); // a stale socket left by a previous run
+    // owner only from the start: a chmod() after bind() leaves a window
+    // in which another user can connect
+    const mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    const int bound = bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    umask(mask);
+    if (bound == SOCKET_ERROR)
+    {
+        closesocket(listener);
+        listener = INVALID_SOCKET;
+        throw std::runtime_error("Bind control socket failed");
+    }
+    if (listen(listener, 16) == SOCKET_ERROR)
+    {
+        closesocket(listener);
+        listener = INVALID_SOCKET;
+        unlink(path.c_str());
+        throw std::runtime_error("Listen control socket failed");
+    }
+    selector.addReadSocket(listener);
+
+    thread = std::thread{ [this] { process(); } };
+#endif
+}
+
+void DNSControl::stop()
+{
+    canExit = true;
+    selector.wakeup();
+}
+
+void DNSControl::join()
+{
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void DNSControl::closeClient(SOCKET s)
+{
+    selector.removeReadSocket(s);
+    selector.removeWriteSocket(s);
+    clients.erase(s);
+    closesocket(s);
+}
+
+void DNSControl::socketReadyRead(SOCKET s)
+{
+    if (s == listener)
+    {
+        SOCKET client = acceptsocket(s);
+        if (client != INVALID_SOCKET)
+        {
+            clients[client] = Client();
+            selector.addReadSocket(client);
+        }
+        return;
+    }
+
+    auto iter = clients.find(s);
+    if (iter == clients.end())
+    {
+        return;
+    }
+    Client& client = iter->second;
+    char buf[512];
+    int len = recv(s, buf, sizeof(buf), 0);
+    if (len < 0 && socketwouldblock())
+    {
+        return;
+    }
+    if (len > 0)
+    {
+        client.request.append(buf, static_cast<size_t>(len));
+    }
+    size_t eol = client.request.find('\n');
+    if (eol == std::string::npos && len > 0 && client.request.size() < MAX_COMMAND)
+    {
+        return; // need more data
+    }
+    if (eol == std::string::npos && client.request.empty())
+    {
+        closeClient(s);
+        return;
+    }
+
+    std::string cmd = client.request.substr(0, eol);
+    if (!cmd.empty() && cmd.back() == '\r')
+    {
+        cmd.pop_back();
+    }
+    if (logger)
+    {
+        logger->log() << "Control command: " << cmd << std::endl;
+    }
+    client.response = processor->processCommand(cmd);
+    selector.removeReadSocket(s);
+    selector.addWriteSocket(s);
+    socketReadyWrite(s); // the reply usually fits, and a "stop" may end the loop
+}
+
+void DNSControl::socketReadyWrite(SOCKET s)
+{
+    auto iter = clients.find(s);
+    if (iter == clients.end())
+    {
+        return;
+    }
+    Client& client = iter->second;
+    while (client.sent < client.response.size())
+    {
+        int len = ::send(s, client.response.data() + client.sent, static_cast<int>(client.response.size() - client.sent), 0);
+        if (len <= 0)
+        {
+            if (len < 0 && socketwouldblock())
+            {
+                return; // need send more data
+            }
+            break;
+        }
+        client.sent += static_cast<size_t>(len);
+    }
+    closeClient(s);
+}
+
+void DNSControl::process()
+{
+    while (!canExit)
+    {
+        selector.select();
+    }
+
+    while (!clients.empty())
+    {
+        closeClient(clients.begin()->first);
+    }
+    selector.removeReadSocket(listener);
+    closesocket(listener);
+    listener = INVALID_SOCKET;
+#if !defined(_WIN32)
+    unlink(path.c_str());
+#endif
+}
+
+std::string DNSControl::send(const std::string& path, const std::string& cmd)
+{
+#if defined(_WIN32)
+    throw std::runtime_error("Control socket is not supported on this platform");
+#else
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::runtime_error("Control socket path is too long");
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET)
+    {
+        throw std::runtime_error("Can't create control socket");
+    }
+    if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR)
+    {
+        closesocket(s);
+        throw std::runtime_error("Can't connect to control socket");
+    }
+    std::string line = cmd + "\n";
+    if (::send(s, line.data(), line.size(), 0) != static_cast<int>(line.size()))
+    {
+        closesocket(s);
+        throw std::runtime_error("Error sending control command");
+    }
+    std::string reply;
+    char buf[512];
+    int len;
+    while ((len = recv(s, buf, sizeof(buf), 0)) > 0)
+    {
+        reply.append(buf, static_cast<size_t>(len));
+    }
+    closesocket(s);
+    return reply;
+#endif
+}
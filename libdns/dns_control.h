@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "dns.h"
+#include "dns_selector.h"
+#include "dns_processor.h"
+
+// Local control plane, kept off the DNS ports: a Unix stream socket served by
+// its own thread. Every connection carries one command line and gets one
+// text reply, then the server closes it.
+class DNSControl: private ISocketHandler
+{
+public:
+    DNSControl(IControlProcessor* processor, const std::string& path, ILogger* logger);
+    ~DNSControl();
+
+    DNSControl(const DNSControl&) = delete;
+    DNSControl& operator=(const DNSControl&) = delete;
+
+    void start();   // throws if the socket can't be created
+    void stop();    // thread-safe
+    void join();
+
+    // Client side: sends one command to the socket at `path`, returns the reply.
+    static std::string send(const std::string& path, const std::string& cmd);
+
+private:
+    struct Client
+    {
+        std::string request;
+        std::string response;
+        size_t sent;
+        Client()
+            : sent(0)
+        {}
+    };
+
+    void closeClient(SOCKET s);
+
+    // ISocketHandler
+    void socketReadyRead(SOCKET s) override;
+    void socketReadyWrite(SOCKET s) override;
+
+    void process();
+
+    IControlProcessor* processor;
+    std::string path;
+    ILogger* logger;
+    DNSSelector selector;
+    SOCKET listener;
+    std::map<SOCKET, Client> clients;
+    std::atomic<bool> canExit;
+    std::thread thread;
+};
@@ -0,0 +1,105 @@
+#include "dns_epoch.h"
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+namespace
+{
+    // Every thread starts looking for a free slot at a different one, so
+    // concurrent readers do not fight over the same cache line.
+    std::atomic<size_t> next_hint(0);
+    thread_local size_t hint = next_hint.fetch_add(1, std::memory_order_relaxed);
+}
+
+DNSEpoch::DNSEpoch()
+    : current(1)
+    , slot_count(std::max<size_t>(64, 2 * std::thread::hardware_concurrency()))
+{
+    slots.reset(new Slot[slot_count]);
+    for (size_t i = 0; i < slot_count; ++i)
+    {
+        slots[i].epoch.store(IDLE, std::memory_order_relaxed);
+    }
+}
+
+DNSEpoch::~DNSEpoch()
+{
+    for (auto& item : retired)
+    {
+        item.free();
+    }
+}
+
+size_t DNSEpoch::enter()
+{
+    for (;;)
+    {
+        // the slot is published before the caller loads the pointer (both
+        // seq_cst), so a writer that still sees it idle has swapped already
+        const uint64_t epoch = current.load();
+        for (size_t n = 0, i = hint % slot_count; n < slot_count; ++n, i = (i + 1) % slot_count)
+        {
+            uint64_t expected = IDLE;
+            if (slots[i].epoch.load(std::memory_order_relaxed) == IDLE
+                && slots[i].epoch.compare_exchange_strong(expected, epoch))
+            {
+                return i;
+            }
+        }
+        std::this_thread::yield(); // more readers than slots
+    }
+}
+
+void DNSEpoch::leave(size_t slot)
+{
+    slots[slot].epoch.store(IDLE, std::memory_order_release);
+}
+
+uint64_t DNSEpoch::oldestReader() const
+{
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (size_t i = 0; i < slot_count; ++i)
+    {
+        const uint64_t epoch = slots[i].epoch.load();
+        if (epoch != IDLE)
+        {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+    return oldest;
+}
+
+void DNSEpoch::retire(std::function<void()> free)
+{
+    // readers that enter from the new epoch on load the new pointer
+    retired.push_back(Retired{ current.fetch_add(1) + 1, std::move(free) });
+    reclaim();
+}
+
+void DNSEpoch::reclaim()
+{
+    const uint64_t oldest = oldestReader();
+    auto safe = std::stable_partition(retired.begin(), retired.end(),
+        [oldest](const Retired& item) { return item.epoch > oldest; });
+    for (auto it = safe; it != retired.end(); ++it)
+    {
+        it->free();
+    }
+    retired.erase(safe, retired.end());
+}
+
+size_t DNSEpoch::pending() const
+{
+    return retired.size();
+}
+
+DNSEpoch::Guard::Guard(DNSEpoch& epoch)
+    : epoch(epoch)
+    , slot(epoch.enter())
+{}
+
+DNSEpoch::Guard::~Guard()
+{
+    epoch.leave(slot);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Epoch-based reclamation for data published through an atomic pointer.
+// A reader holds a Guard while it uses what it loaded; that costs one slot
+// CAS and one store, no lock and no shared counter. A writer swaps the
+// pointer, retire()s the old object, and the object is freed once every
+// reader that could have loaded it has left. Readers may run on any thread;
+// retire() and reclaim() must be serialized by the writer.
+class DNSEpoch
+{
+public:
+    DNSEpoch();
+    ~DNSEpoch();            // frees everything still retired
+
+    DNSEpoch(const DNSEpoch&) = delete;
+    DNSEpoch& operator=(const DNSEpoch&) = delete;
+
+    class Guard
+    {
+    public:
+        explicit Guard(DNSEpoch& epoch);
+        ~Guard();
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+        DNSEpoch& epoch;
+        size_t slot;
+    };
+
+    // Calls free() once no reader that entered before now is left; the
+    // object must already be unreachable for new readers.
+    void retire(std::function<void()> free);
+    // Frees what has become safe; retire() does it too.
+    void reclaim();
+    // Objects retired but not freed yet.
+    size_t pending() const;
+
+private:
+    static constexpr uint64_t IDLE = 0;
+
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> epoch;    // epoch the reader entered in, IDLE: free
+    };
+
+    struct Retired
+    {
+        uint64_t epoch;                 // readers from this epoch on cannot see it
+        std::function<void()> free;
+    };
+
+    size_t enter();
+    void leave(size_t slot);
+    uint64_t oldestReader() const;
+
+    std::atomic<uint64_t> current;
+    std::unique_ptr<Slot[]> slots;
+    size_t slot_count;
+    std::vector<Retired> retired;
+};
@@ -0,0 +1,389 @@
+#include "dns_index.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+// Calls out(byte) for every byte of the lowercased wire-form key of a dotted
+// name, stopping early when out() returns false. A trailing dot is the root.
+template <typename Out>
+static bool walkKey(std::string_view name, Out out)
+{
+    size_t pos = 0;
+    const size_t end = !name.empty() && name.back() == '.' ? name.size() - 1 : name.size();
+    while (pos < end)
+    {
+        size_t dot = name.find('.', pos);
+        if (dot == std::string_view::npos || dot > end)
+        {
+            dot = end;
+        }
+        if (!out(static_cast<uint8_t>(dot - pos)))
+        {
+            return false;
+        }
+        for (; pos < dot; ++pos)
+        {
+            // RFC 4343: only ASCII letters compare case-insensitively
+            uint8_t c = static_cast<uint8_t>(name[pos]);
+            if (!out(c >= 'A' && c <= 'Z' ? static_cast<uint8_t>(c + ('a' - 'A')) : c))
+            {
+                return false;
+            }
+        }
+        pos = dot + 1;
+    }
+    return true;
+}
+
+DNSNameIndex::DNSNameIndex()
+    : slots(16, Slot{ 0, NONE })
+    , mapped(false)
+    , garbage(0)
+    , next_id(0)
+    , count(0)
+{
+    sync();
+}
+
+DNSNameIndex::DNSNameIndex(const DNSNameIndex& other)
+    : slots(other.slots)
+    , records(other.records)
+    , slot_data(other.slot_data)
+    , slot_count(other.slot_count)
+    , record_data(other.record_data)
+    , record_words(other.record_words)
+    , mapped(other.mapped)
+    , garbage(other.garbage)
+    , free_ids(other.free_ids)
+    , next_id(other.next_id)
+    , count(other.count)
+{
+    if (!mapped)
+    {
+        sync();
+    }
+}
+
+DNSNameIndex& DNSNameIndex::operator=(const DNSNameIndex& other)
+{
+    if (this != &other)
+    {
+        DNSNameIndex copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+void DNSNameIndex::sync()
+{
+    slot_data = slots.data();
+    slot_count = slots.size();
+    record_data = records.data();
+    record_words = records.size();
+    mapped = false;
+}
+
+void DNSNameIndex::own()
+{
+    if (mapped)
+    {
+        slots.assign(slot_data, slot_data + slot_count);
+        records.assign(record_data, record_data + record_words);
+        sync();
+    }
+}
+
+std::string DNSNameIndex::key(std::string_view name)
+{
+    std::string result;
+    result.reserve(name.size() + 1);
+    walkKey(name, [&result](uint8_t c) { result.push_back(static_cast<char>(c)); return true; });
+    return result;
+}
+
+std::string DNSNameIndex::name(std::string_view key)
+{
+    std::string result;
+    result.reserve(key.size());
+    while (!key.empty())
+    {
+        const size_t size = std::min<size_t>(static_cast<uint8_t>(key[0]), key.size() - 1);
+        if (!result.empty())
+        {
+            result += '.';
+        }
+        result.append(key.substr(1, size));
+        key.remove_prefix(size + 1);
+    }
+    return result;
+}
+
+uint64_t DNSNameIndex::hash(std::string_view name, uint16_t type)
+{
+    // FNV-1a over the key and the type, then a murmur finalizer so the low
+    // bits (the slot) depend on every byte
+    uint64_t h = 0xCBF29CE484222325ull;
+    walkKey(name, [&h](uint8_t c) { h = (h ^ c) * 0x100000001B3ull; return true; });
+    h = (h ^ (type >> 8)) * 0x100000001B3ull;
+    h = (h ^ (type & 0xFF)) * 0x100000001B3ull;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+size_t DNSNameIndex::recordWords(size_t key_size)
+{
+    return (offsetof(Record, key) + key_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+const DNSNameIndex::Record& DNSNameIndex::record(uint32_t offset) const
+{
+    // an offset of a damaged image gets a record that matches nothing
+    static const Record DAMAGED = { 0, NOT_FOUND, 0xFFFF, 0, { 0 } };
+    if (offset >= record_words || record_words - offset < recordWords(0))
+    {
+        return DAMAGED;
+    }
+    const Record& rec = *reinterpret_cast<const Record*>(&record_data[offset]);
+    return recordWords(rec.size) <= record_words - offset ? rec : DAMAGED;
+}
+
+size_t DNSNameIndex::probe(std::string_view name, uint16_t type, uint64_t hash) const
+{
+    const size_t mask = slot_count - 1;
+    const uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    for (size_t i = static_cast<size_t>(hash) & mask; ; i = (i + 1) & mask)
+    {
+        const Slot& slot = slot_data[i];
+        if (slot.record == NONE)
+        {
+            return i;
+        }
+        if (slot.tag != tag)
+        {
+            continue;
+        }
+        const Record& rec = record(slot.record);
+        if (rec.hash != hash || rec.type != type)
+        {
+            continue;
+        }
+        size_t pos = 0;
+        bool equal = walkKey(name, [&rec, &pos](uint8_t c) { return pos < rec.size && rec.key[pos++] == c; });
+        if (equal && pos == rec.size)
+        {
+            return i;
+        }
+    }
+}
+
+uint32_t DNSNameIndex::find(std::string_view name, uint16_t type, uint64_t hash) const
+{
+    const Slot& slot = slot_data[probe(name, type, hash)];
+    return slot.record == NONE ? NOT_FOUND : record(slot.record).id;
+}
+
+uint32_t DNSNameIndex::find(std::string_view name, uint16_t type) const
+{
+    return find(name, type, hash(name, type));
+}
+
+uint32_t DNSNameIndex::insert(std::string_view name, uint16_t type, bool& inserted)
+{
+    own();
+    const uint64_t h = hash(name, type);
+    size_t i = probe(name, type, h);
+    if (slots[i].record != NONE)
+    {
+        inserted = false;
+        return record(slots[i].record).id;
+    }
+    const std::string k = key(name);
+    if (k.size() > 0xFF)
+    {
+        throw std::runtime_error("Domain name is too long");
+    }
+    if ((count + 1) * 2 > slots.size() || garbage * 2 > records.size())
+    {
+        rebuild((count + 1) * 2 > slots.size() ? slots.size() * 2 : slots.size());
+        i = probe(name, type, h);
+    }
+
+    uint32_t id = next_id;
+    if (free_ids.empty())
+    {
+        ++next_id;
+    }
+    else
+    {
+        id = free_ids.back();
+        free_ids.pop_back();
+    }
+    const uint32_t offset = static_cast<uint32_t>(records.size());
+    records.resize(records.size() + recordWords(k.size()));
+    Record& rec = *reinterpret_cast<Record*>(&records[offset]);
+    rec.hash = h;
+    rec.id = id;
+    rec.type = type;
+    rec.size = static_cast<uint8_t>(k.size());
+    memcpy(rec.key, k.data(), k.size());
+
+    slots[i] = Slot{ static_cast<uint32_t>(h >> 32), offset };
+    ++count;
+    inserted = true;
+    sync();
+    return id;
+}
+
+uint32_t DNSNameIndex::erase(std::string_view name, uint16_t type)
+{
+    own();
+    size_t i = probe(name, type, hash(name, type));
+    if (slots[i].record == NONE)
+    {
+        return NOT_FOUND;
+    }
+    const Record& rec = record(slots[i].record);
+    const uint32_t id = rec.id;
+    garbage += recordWords(rec.size);
+    free_ids.push_back(id);
+    --count;
+
+    // backward shift: pull later members of the probe run into the hole,
+    // so lookups never need tombstones
+    const size_t mask = slots.size() - 1;
+    for (size_t j = (i + 1) & mask; slots[j].record != NONE; j = (j + 1) & mask)
+    {
+        size_t home = static_cast<size_t>(record(slots[j].record).hash) & mask;
+        // the member may move to i unless its home lies cyclically in (i, j]
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays)
+        {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i] = Slot{ 0, NONE };
+    sync();
+    return id;
+}
+
+void DNSNameIndex::rebuild(size_t capacity)
+{
+    // rehash into `capacity` slots, copying the live records into a fresh arena
+    std::vector<Slot> old_slots;
+    std::vector<uint64_t> old_records;
+    old_slots.swap(slots);
+    old_records.swap(records);
+    slots.assign(capacity, Slot{ 0, NONE });
+    records.reserve(old_records.size() - garbage);
+    garbage = 0;
+
+    const size_t mask = slots.size() - 1;
+    for (const Slot& slot : old_slots)
+    {
+        if (slot.record == NONE)
+        {
+            continue;
+        }
+        const Record& rec = *reinterpret_cast<const Record*>(&old_records[slot.record]);
+        const size_t words = recordWords(rec.size);
+        const uint32_t offset = static_cast<uint32_t>(records.size());
+        records.insert(records.end(), &old_records[slot.record], &old_records[slot.record] + words);
+
+        size_t i = static_cast<size_t>(rec.hash) & mask;
+        while (slots[i].record != NONE)
+        {
+            i = (i + 1) & mask;
+        }
+        slots[i] = Slot{ slot.tag, offset };
+    }
+    sync();
+}
+
+size_t DNSNameIndex::size() const
+{
+    return count;
+}
+
+void DNSNameIndex::clear()
+{
+    slots.assign(16, Slot{ 0, NONE });
+    records.clear();
+    garbage = 0;
+    free_ids.clear();
+    next_id = 0;
+    count = 0;
+    sync();
+}
+
+// Layout: slot count, record words, count, garbage, next id, free id
+// count, then the slots, the record arena and the free ids, each padded to
+// 8 bytes.
+void DNSNameIndex::save(std::vector<uint8_t>& out) const
+{
+    const uint64_t header[] = { slot_count, record_words, count, garbage, next_id, free_ids.size() };
+    auto put = [&out](const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+        out.resize((out.size() + 7) & ~size_t(7));
+    };
+    put(header, sizeof(header));
+    put(slot_data, slot_count * sizeof(Slot));
+    put(record_data, record_words * sizeof(uint64_t));
+    put(free_ids.data(), free_ids.size() * sizeof(uint32_t));
+}
+
+const uint8_t* DNSNameIndex::map(const uint8_t* data, const uint8_t* end)
+{
+    auto take = [&data, end](size_t size) {
+        const size_t padded = (size + 7) & ~size_t(7);
+        if (padded < size || static_cast<size_t>(end - data) < padded)
+        {
+            throw std::runtime_error("Zone image is truncated");
+        }
+        const uint8_t* result = data;
+        data += padded;
+        return result;
+    };
+    uint64_t header[6];
+    memcpy(header, take(sizeof(header)), sizeof(header));
+    const uint64_t slots_size = header[0], words = header[1], free_count = header[5];
+    if (slots_size < 2 || (slots_size & (slots_size - 1)) != 0 || header[2] * 2 > slots_size
+        || slots_size > (1ull << 40) || words > (1ull << 40) || free_count > (1ull << 40))
+    {
+        throw std::runtime_error("Zone image has a malformed name index");
+    }
+    const Slot* mapped_slots = reinterpret_cast<const Slot*>(take(slots_size * sizeof(Slot)));
+    // probes end at an empty slot: at most half are used, so the scan
+    // for one stops after a few slots unless the image is damaged
+    size_t empty = 0;
+    while (empty < slots_size && mapped_slots[empty].record != NONE)
+    {
+        ++empty;
+    }
+    if (empty == slots_size)
+    {
+        throw std::runtime_error("Zone image has a malformed name index");
+    }
+    const uint64_t* mapped_records = reinterpret_cast<const uint64_t*>(take(words * sizeof(uint64_t)));
+    const uint32_t* mapped_free = reinterpret_cast<const uint32_t*>(take(free_count * sizeof(uint32_t)));
+
+    slots.clear();
+    records.clear();
+    slot_data = mapped_slots;
+    slot_count = slots_size;
+    record_data = mapped_records;
+    record_words = words;
+    mapped = true;
+    count = header[2];
+    garbage = header[3];
+    next_id = static_cast<uint32_t>(header[4]);
+    free_ids.assign(mapped_free, mapped_free + free_count);
+    return data;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Open-addressing (linear probing) hash index from (name, qtype) to a dense
+// value id. Names are keyed case-insensitively in their lowercased wire form
+// ("Mail.Example.com" -> "\4mail\7example\3com"). A hit usually costs two
+// cache lines: the 8-byte slots of the probe run and the packed record the
+// slot points to. The caller passes the hash, so a query name is hashed once,
+// when its question is parsed. The tables are flat, so an index can be saved
+// into a zone image and later used in place from a read-only mapping; the
+// first change copies the mapped tables. Not thread-safe.
+class DNSNameIndex
+{
+public:
+    static constexpr uint32_t NOT_FOUND = 0xFFFFFFFFu;
+
+    DNSNameIndex();
+    DNSNameIndex(const DNSNameIndex& other);
+    DNSNameIndex(DNSNameIndex&& other) = default;
+    DNSNameIndex& operator=(const DNSNameIndex& other);
+    DNSNameIndex& operator=(DNSNameIndex&& other) = default;
+
+    static std::string key(std::string_view name);
+    // The dotted name of a key (lowercased).
+    static std::string name(std::string_view key);
+    static uint64_t hash(std::string_view name, uint16_t type);
+
+    uint32_t find(std::string_view name, uint16_t type, uint64_t hash) const;
+    uint32_t find(std::string_view name, uint16_t type) const;
+
+    // Id of the entry for (name, type), added if missing. Ids are dense and
+    // reused after erase(), so they can index a vector of values.
+    uint32_t insert(std::string_view name, uint16_t type, bool& inserted);
+
+    // Id the erased entry had, NOT_FOUND if there was none.
+    uint32_t erase(std::string_view name, uint16_t type);
+
+    size_t size() const;
+    void clear();
+
+    // Calls f(hash) with the hash of every entry.
+    template <typename F>
+    void forEachHash(F f) const
+    {
+        for (size_t i = 0; i < slot_count; ++i)
+        {
+            if (slot_data[i].record != NONE)
+            {
+                f(record(slot_data[i].record).hash);
+            }
+        }
+    }
+
+    // Calls f(key, type, id) for every entry; `key` is the wire-form
+    // lowercased name, as key() makes it.
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (size_t i = 0; i < slot_count; ++i)
+        {
+            if (slot_data[i].record != NONE)
+            {
+                const Record& rec = record(slot_data[i].record);
+                f(std::string_view(reinterpret_cast<const char*>(rec.key), rec.size), rec.type, rec.id);
+            }
+        }
+    }
+
+    // Appends the index to `out` (8-byte aligned, host byte order).
+    void save(std::vector<uint8_t>& out) const;
+    // Uses an index save()d at `data` (8-byte aligned) in place; the
+    // memory must outlive the index and its copies. Returns the end of
+    // the saved index.
+    const uint8_t* map(const uint8_t* data, const uint8_t* end);
+
+private:
+    struct Slot
+    {
+        uint32_t tag;       // high half of the hash, filters most mismatches
+        uint32_t record;    // offset into `records`, NONE: empty
+    };
+
+    // A record packs everything a probe compares, so it usually sits in
+    // the same cache line: hash, id, type, key size, key bytes.
+    struct Record
+    {
+        uint64_t hash;
+        uint32_t id;
+        uint16_t type;
+        uint8_t size;
+        uint8_t key[1];     // `size` bytes
+    };
+
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+
+    static size_t recordWords(size_t key_size);
+    const Record& record(uint32_t offset) const;
+    size_t probe(std::string_view name, uint16_t type, uint64_t hash) const;
+    void rebuild(size_t capacity);
+    void own();                     // copy mapped tables before a change
+    void sync();                    // point the views at the own tables
+
+    std::vector<Slot> slots;        // power-of-two size, at most half full
+    std::vector<uint64_t> records;  // Record arena, 8-byte aligned; erase leaves holes
+    const Slot* slot_data;          // what lookups read: `slots` or a mapped image
+    size_t slot_count;
+    const uint64_t* record_data;
+    size_t record_words;
+    bool mapped;
+    size_t garbage;                 // bytes of erased records
+    std::vector<uint32_t> free_ids;
+    uint32_t next_id;
+    size_t count;
+};
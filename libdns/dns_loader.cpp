@@ -0,0 +1,507 @@
+#include "dns_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "dns_utils.h"
+#include "dns_zone.h"
+
+namespace
+{
+    [[noreturn]] void fail()
+    {
+        throw std::runtime_error("Error parsing json file");
+    }
+
+    // Whitespace and comments
+    void skipSpace(const char*& p, const char* end)
+    {
+        while (p < end)
+        {
+            const char c = *p;
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+            {
+                ++p;
+            }
+            else if (c == '/' && end - p >= 2 && p[1] == '/')
+            {
+                p = static_cast<const char*>(memchr(p, '\n', end - p));
+                p = p ? p + 1 : end;
+            }
+            else if (c == '/' && end - p >= 2 && p[1] == '*')
+            {
+                const char* close = nullptr;
+                for (const char* q = p + 2; q + 1 < end; ++q)
+                {
+                    if (q[0] == '*' && q[1] == '/')
+                    {
+                        close = q;
+                        break;
+                    }
+                }
+                if (!close)
+                {
+                    fail();
+                }
+                p = close + 2;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    // p at a '/' outside a string: only a comment may start there
+    void skipComment(const char*& p, const char* end)
+    {
+        const char* start = p;
+        skipSpace(p, end);
+        if (p == start)
+        {
+            fail();
+        }
+    }
+
+    void expect(const char*& p, const char* end, char c)
+    {
+        if (p == end || *p != c)
+        {
+            fail();
+        }
+        ++p;
+    }
+
+    // p at the opening quote
+    void skipString(const char*& p, const char* end)
+    {
+        ++p;
+        while (p < end)
+        {
+            const char c = *p++;
+            if (c == '"')
+            {
+                return;
+            }
+            if (c == '\\')
+            {
+                ++p;
+            }
+        }
+        fail();
+    }
+
+    void appendUtf8(std::string& out, uint32_t cp)
+    {
+        if (cp < 0x80)
+        {
+            out.push_back(static_cast<char>(cp));
+        }
+        else if (cp < 0x800)
+        {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else if (cp < 0x10000)
+        {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else
+        {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    uint32_t parseHex4(const char*& p, const char* end)
+    {
+        if (end - p < 4)
+        {
+            fail();
+        }
+        uint32_t result = 0;
+        for (int i = 0; i < 4; ++i, ++p)
+        {
+            const char c = *p;
+            result <<= 4;
+            if (c >= '0' && c <= '9')
+                result |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+                result |= 10 + c - 'a';
+            else if (c >= 'A' && c <= 'F')
+                result |= 10 + c - 'A';
+            else
+                fail();
+        }
+        return result;
+    }
+
+    // p at the opening quote; `out` is overwritten
+    void parseString(const char*& p, const char* end, std::string& out)
+    {
+        expect(p, end, '"');
+        out.clear();
+        while (true)
+        {
+            const char* run = p;
+            while (p < end && *p != '"' && *p != '\\')
+            {
+                ++p;
+            }
+            out.append(run, p);
+            if (p == end)
+            {
+                fail();
+            }
+            if (*p++ == '"')
+            {
+                return;
+            }
+            if (p == end)
+            {
+                fail();
+            }
+            switch (*p++)
+            {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u':
+            {
+                uint32_t cp = parseHex4(p, end);
+                if (cp >= 0xD800 && cp < 0xDC00)
+                {
+                    // a surrogate pair
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                    {
+                        fail();
+                    }
+                    p += 2;
+                    const uint32_t low = parseHex4(p, end);
+                    if (low < 0xDC00 || low >= 0xE000)
+                    {
+                        fail();
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(out, cp);
+                break;
+            }
+            default:
+                fail();
+            }
+        }
+    }
+
+    // Any value, not validated: the settings go through jsoncpp afterwards
+    void skipValue(const char*& p, const char* end)
+    {
+        if (p == end)
+        {
+            fail();
+        }
+        if (*p == '"')
+        {
+            skipString(p, end);
+            return;
+        }
+        if (*p != '{' && *p != '[')
+        {
+            const char* start = p;
+            while (p < end && !strchr(",]} \t\r\n/", *p))
+            {
+                ++p;
+            }
+            if (p == start)
+            {
+                fail();
+            }
+            return;
+        }
+        size_t depth = 0;
+        while (p < end)
+        {
+            switch (*p)
+            {
+            case '"':
+                skipString(p, end);
+                continue;
+            case '/':
+                skipComment(p, end);
+                continue;
+            case '{':
+            case '[':
+                ++depth;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0)
+                {
+                    ++p;
+                    return;
+                }
+                break;
+            }
+            ++p;
+        }
+        fail();
+    }
+}
+
+DNSJsonLoader::DNSJsonLoader(const std::string& path, size_t chunk_size)
+    : file(path)
+    , text(file.data())
+    , text_size(file.size())
+{
+    // the top-level members; `records` is cut into chunks on the way
+    const char* end = text + text_size;
+    const char* p = text;
+    const char* records_begin = nullptr;
+    const char* records_end = nullptr;
+    std::string key;
+    skipSpace(p, end);
+    expect(p, end, '{');
+    skipSpace(p, end);
+    while (p < end && *p != '}')
+    {
+        parseString(p, end, key);
+        skipSpace(p, end);
+        expect(p, end, ':');
+        skipSpace(p, end);
+        if (key != "records" || p == end || *p != '[')
+        {
+            skipValue(p, end);
+        }
+        else
+        {
+            records_begin = p++;
+            cuts.assign(1, static_cast<size_t>(p - text));
+            size_t depth = 1;
+            while (depth > 0)
+            {
+                if (p == end)
+                {
+                    fail();
+                }
+                switch (*p)
+                {
+                case '"':
+                    skipString(p, end);
+                    continue;
+                case '/':
+                    skipComment(p, end);
+                    continue;
+                case '{':
+                case '[':
+                    ++depth;
+                    break;
+                case '}':
+                case ']':
+                    --depth;
+                    break;
+                case ',':
+                    if (depth == 1 && static_cast<size_t>(p + 1 - text) - cuts.back() >= chunk_size)
+                    {
+                        cuts.push_back(static_cast<size_t>(p + 1 - text));
+                    }
+                    break;
+                }
+                ++p;
+            }
+            records_end = p;
+            cuts.push_back(static_cast<size_t>(p - 1 - text));
+        }
+        skipSpace(p, end);
+        if (p < end && *p == ',')
+        {
+            ++p;
+            skipSpace(p, end);
+        }
+        else if (p == end || *p != '}')
+        {
+            fail();
+        }
+    }
+    expect(p, end, '}');
+
+    if (records_begin)
+    {
+        settings_text.reserve(text_size - (records_end - records_begin) + 2);
+        settings_text.append(text, records_begin);
+        settings_text.append("[]");
+        settings_text.append(records_end, end);
+    }
+    else
+    {
+        settings_text.assign(text, end);
+    }
+}
+
+const std::string& DNSJsonLoader::settings() const
+{
+    return settings_text;
+}
+
+size_t DNSJsonLoader::chunks() const
+{
+    return cuts.empty() ? 0 : cuts.size() - 1;
+}
+
+void DNSJsonLoader::parseChunk(size_t chunk, std::vector<Record>& out) const
+{
+    const char* p = text + cuts[chunk];
+    const char* end = text + cuts[chunk + 1];
+    std::string key;
+    std::string host;
+    std::string value;
+    std::vector<std::string> answers;   // strings reused from record to record
+    skipSpace(p, end);
+    while (p < end)
+    {
+        DNSRecordType type = DNSRecordType::OTHER;
+        DNSResultCode result = DNSResultCode::NoError;
+        size_t count = 0;
+        host.clear();
+
+        expect(p, end, '{');
+        skipSpace(p, end);
+        while (p < end && *p != '}')
+        {
+            parseString(p, end, key);
+            skipSpace(p, end);
+            expect(p, end, ':');
+            skipSpace(p, end);
+            if (key == "type")
+            {
+                parseString(p, end, value);
+                type = ::StrToRecType(value);
+            }
+            else if (key == "host")
+            {
+                parseString(p, end, host);
+            }
+            else if (key == "result")
+            {
+                parseString(p, end, value);
+                result = ::StrToResultCode(value);
+            }
+            else if (key == "response")
+            {
+                count = 0;
+                expect(p, end, '[');
+                skipSpace(p, end);
+                while (p < end && *p != ']')
+                {
+                    if (count == answers.size())
+                    {
+                        answers.emplace_back();
+                    }
+                    parseString(p, end, answers[count++]);
+                    skipSpace(p, end);
+                    if (p < end && *p == ',')
+                    {
+                        ++p;
+                        skipSpace(p, end);
+                    }
+                    else if (p == end || *p != ']')
+                    {
+                        fail();
+                    }
+                }
+                expect(p, end, ']');
+            }
+            else
+            {
+                skipValue(p, end);
+            }
+            skipSpace(p, end);
+            if (p < end && *p == ',')
+            {
+                ++p;
+                skipSpace(p, end);
+            }
+            else if (p == end || *p != '}')
+            {
+                fail();
+            }
+        }
+        expect(p, end, '}');
+
+        if (DNSRecordType::OTHER == type)
+        {
+            throw std::runtime_error("Error parsing json file: wrong DNS record type");
+        }
+        answers.resize(count);
+        out.push_back(Record{ type, host, DNSZoneResponse::render(type, host, result, answers) });
+
+        skipSpace(p, end);
+        if (p == end)
+        {
+            break;
+        }
+        expect(p, end, ',');
+        skipSpace(p, end);
+    }
+}
+
+std::vector<std::vector<DNSJsonLoader::Record>> DNSJsonLoader::records(unsigned threads) const
+{
+    const size_t count = chunks();
+    std::vector<std::vector<Record>> result(count);
+    if (threads == 0)
+    {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+    std::atomic<size_t> next{ 0 };
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&] {
+        try
+        {
+            for (size_t chunk; (chunk = next++) < count; )
+            {
+                parseChunk(chunk, result[chunk]);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+            next = count; // the others stop after their chunk
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        pool.emplace_back(work);
+    }
+    work();
+    for (auto& thread : pool)
+    {
+        thread.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return result;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dns_consts.h"
+#include "dns_utils.h"
+
+// Reads a dns_server.json without building a DOM of its records. The file
+// is mapped and scanned once for the top-level members; the `records` array
+// is cut into chunks at element boundaries on the way. records() then parses
+// the chunks on several threads, straight into rendered responses. The same
+// JSON dialect as jsoncpp's defaults is accepted: comments and trailing
+// commas are allowed.
+class DNSJsonLoader
+{
+public:
+    struct Record
+    {
+        DNSRecordType type;
+        std::string host;
+        std::vector<uint8_t> response;  // DNSZoneResponse blob
+    };
+
+    explicit DNSJsonLoader(const std::string& path, size_t chunk_size = 1 << 20);
+
+    DNSJsonLoader(const DNSJsonLoader&) = delete;
+    DNSJsonLoader& operator=(const DNSJsonLoader&) = delete;
+
+    // The file with the records array emptied: the settings, small enough
+    // for a DOM.
+    const std::string& settings() const;
+    size_t chunks() const;
+    // The records in file order, one vector per chunk; `threads` 0 uses
+    // every core. Throws on the first malformed record.
+    std::vector<std::vector<Record>> records(unsigned threads = 0) const;
+
+private:
+    void parseChunk(size_t chunk, std::vector<Record>& out) const;
+
+    DNSMappedFile file;
+    const char* text;
+    size_t text_size;
+    std::string settings_text;
+    std::vector<size_t> cuts;       // chunk i spans [cuts[i], cuts[i + 1]), cut after a comma
+};
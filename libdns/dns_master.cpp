@@ -0,0 +1,553 @@
+#include "dns_master.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+#include "dns.h"
+#include "dns_utils.h"
+
+namespace
+{
+    const int MAX_INCLUDE_DEPTH = 16;
+
+    struct Token
+    {
+        std::string_view text;
+        bool quoted;
+    };
+
+    bool isDelimiter(char c)
+    {
+        switch (c)
+        {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case ';':
+        case '(':
+        case ')':
+        case '"':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // First delimiter of the token at p, skipping escaped characters.
+    const char* scanToken(const char* p, const char* end)
+    {
+        const char* skip = p;   // characters before it are escaped
+#if defined(__SSE2__)
+        // Candidates: every byte up to ')' (which covers the whitespace, '"',
+        // '(' and ')'), ';' and '\\'. Names seldom have the few other bytes
+        // in that range, so a block is usually one compare and no candidate.
+        const __m128i limit = _mm_set1_epi8(')');
+        const __m128i semicolon = _mm_set1_epi8(';');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        while (end - p >= 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            const __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, limit), v);
+            const __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, semicolon), _mm_cmpeq_epi8(v, backslash));
+            for (unsigned mask = _mm_movemask_epi8(_mm_or_si128(low, special)); mask; mask &= mask - 1)
+            {
+                const char* q = p + __builtin_ctz(mask);
+                if (q < skip)
+                {
+                    continue;
+                }
+                if (*q == '\\')
+                {
+                    skip = q + 2;
+                }
+                else if (isDelimiter(*q))
+                {
+                    return q;
+                }
+            }
+            p += 16;
+        }
+        p = std::max(p, skip);
+#endif
+        while (p < end)
+        {
+            if (*p == '\\')
+            {
+                p += 2;
+            }
+            else if (isDelimiter(*p))
+            {
+                return p;
+            }
+            else
+            {
+                ++p;
+            }
+        }
+        return end;
+    }
+
+    // The closing quote of the string whose first character is at p, or end.
+    const char* scanQuoted(const char* p, const char* end)
+    {
+        const char* skip = p;
+#if defined(__SSE2__)
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        while (end - p >= 16)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            for (unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash))); mask; mask &= mask - 1)
+            {
+                const char* q = p + __builtin_ctz(mask);
+                if (q < skip)
+                {
+                    continue;
+                }
+                if (*q == '"')
+                {
+                    return q;
+                }
+                skip = q + 2;
+            }
+            p += 16;
+        }
+        p = std::max(p, skip);
+#endif
+        while (p < end)
+        {
+            if (*p == '"')
+            {
+                return p;
+            }
+            p += *p == '\\' ? 2 : 1;
+        }
+        return end;
+    }
+
+    // Splits a master file into entries: the tokens up to the end of a line
+    // outside parentheses.
+    class Tokenizer
+    {
+    public:
+        Tokenizer(const std::string& path, const char* begin, const char* end)
+            : path(path)
+            , p(begin)
+            , end(end)
+            , current_line(1)
+            , entry_line(1)
+        {}
+
+        // False at the end of the file. `blank_owner` is set when the entry's
+        // line starts with whitespace: the previous owner is meant.
+        bool next(std::vector<Token>& tokens, bool& blank_owner)
+        {
+            tokens.clear();
+            blank_owner = false;
+            bool line_start = true;
+            int depth = 0;
+            while (p < end)
+            {
+                const char c = *p;
+                switch (c)
+                {
+                case '\n':
+                    ++current_line;
+                    ++p;
+                    if (depth == 0 && !tokens.empty())
+                    {
+                        return true;
+                    }
+                    if (tokens.empty())
+                    {
+                        blank_owner = false;
+                        line_start = true;
+                    }
+                    continue;
+                case ' ':
+                case '\t':
+                case '\r':
+                    if (line_start && tokens.empty())
+                    {
+                        blank_owner = true;
+                    }
+                    line_start = false;
+                    ++p;
+                    continue;
+                case ';':
+                {
+                    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+                    p = eol ? eol : end;
+                    continue;
+                }
+                case '(':
+                    ++depth;
+                    ++p;
+                    break;
+                case ')':
+                    if (--depth < 0)
+                    {
+                        fail("unbalanced parentheses");
+                    }
+                    ++p;
+                    break;
+                case '"':
+                {
+                    const char* start = ++p;
+                    p = scanQuoted(p, end);
+                    if (p == end)
+                    {
+                        fail("unterminated string");
+                    }
+                    push(tokens, std::string_view(start, p - start), true);
+                    current_line += std::count(start, p, '\n');
+                    ++p;
+                    break;
+                }
+                default:
+                {
+                    const char* start = p;
+                    p = std::min(scanToken(p, end), end);
+                    push(tokens, std::string_view(start, p - start), false);
+                    break;
+                }
+                }
+                line_start = false;
+            }
+            if (depth > 0)
+            {
+                fail("unbalanced parentheses");
+            }
+            return !tokens.empty();
+        }
+
+        [[noreturn]] void fail(const std::string& what) const
+        {
+            throw std::runtime_error("Error parsing zone file " + path + ":" + std::to_string(entry_line) + ": " + what);
+        }
+
+    private:
+        void push(std::vector<Token>& tokens, std::string_view text, bool quoted)
+        {
+            if (tokens.empty())
+            {
+                entry_line = current_line;
+            }
+            tokens.push_back(Token{ text, quoted });
+        }
+
+        const std::string& path;
+        const char* p;
+        const char* end;
+        size_t current_line;
+        size_t entry_line;
+    };
+
+    // \X is X, \DDD the byte of that decimal value (RFC 1035 5.1)
+    std::string unescape(std::string_view text)
+    {
+        if (text.find('\\') == std::string_view::npos)
+        {
+            return std::string(text);
+        }
+        std::string result;
+        result.reserve(text.size());
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] != '\\' || i + 1 == text.size())
+            {
+                result.push_back(text[i]);
+            }
+            else if (i + 3 < text.size() && isdigit(static_cast<unsigned char>(text[i + 1]))
+                && isdigit(static_cast<unsigned char>(text[i + 2])) && isdigit(static_cast<unsigned char>(text[i + 3])))
+            {
+                result.push_back(static_cast<char>((text[i + 1] - '0') * 100 + (text[i + 2] - '0') * 10 + (text[i + 3] - '0')));
+                i += 3;
+            }
+            else
+            {
+                result.push_back(text[++i]);
+            }
+        }
+        return result;
+    }
+
+    bool iequals(std::string_view a, const char* b)
+    {
+        const size_t size = strlen(b);
+        if (a.size() != size)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < size; ++i)
+        {
+            if (toupper(static_cast<unsigned char>(a[i])) != b[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Seconds, or BIND's 1w2d3h4m5s form
+    bool isTtl(std::string_view text)
+    {
+        if (text.empty() || !isdigit(static_cast<unsigned char>(text[0])))
+        {
+            return false;
+        }
+        uint64_t total = 0;
+        uint64_t value = 0;
+        bool digits = false;
+        for (char c : text)
+        {
+            if (isdigit(static_cast<unsigned char>(c)))
+            {
+                value = value * 10 + (c - '0');
+                digits = true;
+                if (value > 0xFFFFFFFFull)
+                {
+                    return false;
+                }
+                continue;
+            }
+            uint64_t unit;
+            switch (toupper(static_cast<unsigned char>(c)))
+            {
+            case 'S': unit = 1; break;
+            case 'M': unit = 60; break;
+            case 'H': unit = 3600; break;
+            case 'D': unit = 86400; break;
+            case 'W': unit = 604800; break;
+            default: return false;
+            }
+            if (!digits)
+            {
+                return false;
+            }
+            total += value * unit;
+            value = 0;
+            digits = false;
+        }
+        return total + value <= 0xFFFFFFFFull;
+    }
+
+    bool isClass(std::string_view text)
+    {
+        return iequals(text, "IN") || iequals(text, "CH") || iequals(text, "HS") || iequals(text, "CS")
+            || (text.size() > 5 && iequals(text.substr(0, 5), "CLASS"));
+    }
+
+    // Owner names are kept without the final dot, `origin` too.
+    std::string absolute(std::string_view name, const std::string& origin)
+    {
+        if (name == "@")
+        {
+            return origin;
+        }
+        std::string result = unescape(name);
+        if (name.size() >= 1 && name.back() == '.' && (name.size() == 1 || name[name.size() - 2] != '\\'))
+        {
+            result.pop_back();
+            return result;
+        }
+        if (!origin.empty())
+        {
+            result += '.';
+            result += origin;
+        }
+        return result;
+    }
+}
+
+DNSMasterFile::DNSMasterFile(const std::string& path, const std::string& origin)
+    : skipped_count(0)
+{
+    std::string start = origin;
+    if (!start.empty() && start.back() == '.')
+    {
+        start.pop_back();
+    }
+    parse(path, start, 0);
+}
+
+void DNSMasterFile::parse(const std::string& path, std::string origin, int depth)
+{
+    DNSMappedFile file(path);
+    Tokenizer tokenizer(path, file.data(), file.data() + file.size());
+    std::vector<Token> tokens;
+    bool blank_owner;
+    std::string owner;
+    bool has_owner = false;
+    while (tokenizer.next(tokens, blank_owner))
+    {
+        if (!blank_owner && !tokens[0].quoted && tokens[0].text[0] == '$')
+        {
+            const std::string_view directive = tokens[0].text;
+            if (iequals(directive, "$ORIGIN") && tokens.size() == 2)
+            {
+                origin = absolute(tokens[1].text, origin);
+            }
+            else if (iequals(directive, "$TTL") && tokens.size() == 2)
+            {
+                if (!isTtl(tokens[1].text))
+                {
+                    tokenizer.fail("wrong TTL");
+                }
+            }
+            else if (iequals(directive, "$INCLUDE") && (tokens.size() == 2 || tokens.size() == 3))
+            {
+                if (depth + 1 >= MAX_INCLUDE_DEPTH)
+                {
+                    tokenizer.fail("too many nested $INCLUDEs");
+                }
+                std::string include = unescape(tokens[1].text);
+                const size_t slash = path.find_last_of("/\\");
+                if (include.empty() || (include[0] != '/' && include[0] != '\\' && slash != std::string::npos))
+                {
+                    include = path.substr(0, slash + 1) + include;
+                }
+                // the included file starts at its own origin and leaves ours alone
+                parse(include, tokens.size() == 3 ? absolute(tokens[2].text, origin) : origin, depth + 1);
+            }
+            else
+            {
+                tokenizer.fail("wrong directive");
+            }
+            continue;
+        }
+
+        size_t i = 0;
+        if (!blank_owner)
+        {
+            owner = absolute(tokens[i++].text, origin);
+            has_owner = true;
+        }
+        else if (!has_owner)
+        {
+            tokenizer.fail("no owner name");
+        }
+
+        // [TTL] [class] or [class] [TTL]
+        bool in_class = true;
+        for (int k = 0; k < 2 && i < tokens.size(); ++k)
+        {
+            const std::string_view text = tokens[i].text;
+            if (isdigit(static_cast<unsigned char>(text[0])))
+            {
+                if (!isTtl(text))
+                {
+                    tokenizer.fail("wrong TTL");
+                }
+                ++i;
+            }
+            else if (isClass(text))
+            {
+                in_class = iequals(text, "IN");
+                ++i;
+            }
+            else
+            {
+                break;
+            }
+        }
+        if (i == tokens.size())
+        {
+            tokenizer.fail("no record type");
+        }
+        const std::string_view type = tokens[i++].text;
+        const size_t rdata = tokens.size() - i;
+        if (!in_class)
+        {
+            ++skipped_count;
+        }
+        else if (iequals(type, "A"))
+        {
+            uint8_t addr[4];
+            const std::string text(rdata == 1 ? tokens[i].text : std::string_view());
+            if (!str_to_ipv4(text, addr))
+            {
+                tokenizer.fail("wrong A record");
+            }
+            add(DNSRecordType::A, owner, text);
+        }
+        else if (iequals(type, "CNAME") || iequals(type, "PTR"))
+        {
+            if (rdata != 1)
+            {
+                tokenizer.fail("wrong " + std::string(type) + " record");
+            }
+            add(iequals(type, "PTR") ? DNSRecordType::PTR : DNSRecordType::CNAME, owner, absolute(tokens[i].text, origin));
+        }
+        else if (iequals(type, "MX"))
+        {
+            const std::string_view preference = rdata == 2 ? tokens[i].text : std::string_view();
+            if (preference.empty() || preference.size() > 5
+                || !std::all_of(preference.begin(), preference.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); })
+                || std::stoul(std::string(preference)) > 0xFFFF)
+            {
+                tokenizer.fail("wrong MX record");
+            }
+            add(DNSRecordType::MX, owner, absolute(tokens[i + 1].text, origin));
+        }
+        else if (iequals(type, "TXT"))
+        {
+            if (rdata == 0)
+            {
+                tokenizer.fail("wrong TXT record");
+            }
+            // the character-strings of one record make one string, as SPF has it
+            std::string text;
+            for (; i < tokens.size(); ++i)
+            {
+                text += unescape(tokens[i].text);
+            }
+            if (text.size() > 0xFF)
+            {
+                ++skipped_count;    // the server answers one character-string per record
+                continue;
+            }
+            add(DNSRecordType::TXT, owner, std::move(text));
+        }
+        else
+        {
+            ++skipped_count;
+        }
+    }
+}
+
+void DNSMasterFile::add(DNSRecordType type, std::string_view host, std::string answer)
+{
+    bool inserted;
+    const uint32_t id = positions.insert(host, static_cast<uint16_t>(type), inserted);
+    if (inserted)
+    {
+        rrsets.push_back(RRset{ type, std::string(host), {} }); // ids are dense: nothing is erased
+    }
+    rrsets[id].answer.push_back(std::move(answer));
+}
+
+void DNSMasterFile::records(DNSRecordBatch& batch) const
+{
+    for (const auto& rrset : rrsets)
+    {
+        batch.add(rrset.type, rrset.host, rrset.answer);
+    }
+}
+
+size_t DNSMasterFile::size() const
+{
+    return rrsets.size();
+}
+
+size_t DNSMasterFile::skipped() const
+{
+    return skipped_count;
+}
@@ -0,0 +1,295 @@
+#include "dns_message.h"
+
+#include <cstring>
+
+namespace
+{
+    const uint8_t ROOT = 0;
+    const size_t HEADER_SIZE = 12;
+}
+
+DNSMessageView::Name::Name()
+    : message(&ROOT)
+    , offset(0)
+{}
+
+DNSMessageView::Name::Name(const uint8_t* message, size_t offset)
+    : message(message)
+    , offset(offset)
+{}
+
+size_t DNSMessageView::Name::size() const
+{
+    size_t result = 1;
+    forEachLabel([&result](std::string_view label) { result += label.size() + 1; });
+    return result;
+}
+
+bool DNSMessageView::Name::compressed() const
+{
+    size_t pos = offset;
+    while (message[pos] != 0 && (message[pos] & 0xC0) != 0xC0)
+    {
+        pos += static_cast<size_t>(message[pos]) + 1;
+    }
+    return message[pos] != 0;
+}
+
+bool DNSMessageView::Name::dotted(char* out, std::string_view& name) const
+{
+    // at most 255 wire bytes expand to at most 253 dotted ones
+    size_t size = 0;
+    bool plain = true;
+    size_t pos = offset;
+    while (message[pos] != 0)
+    {
+        if ((message[pos] & 0xC0) == 0xC0)
+        {
+            pos = static_cast<size_t>(message[pos] & 0x3F) << 8 | message[pos + 1];
+            continue;
+        }
+        if (size > 0)
+        {
+            out[size++] = '.';
+        }
+        const size_t end = pos + 1 + message[pos];
+        for (++pos; pos < end; ++pos)
+        {
+            plain = plain && message[pos] != '.';
+            out[size++] = static_cast<char>(message[pos]);
+        }
+    }
+    name = std::string_view(out, size);
+    return plain;
+}
+
+std::string DNSMessageView::Name::str() const
+{
+    char buf[MAX_NAME];
+    std::string_view name;
+    dotted(buf, name);
+    return std::string(name);
+}
+
+DNSMessageView::RecordIterator::RecordIterator(const DNSMessageView& view, size_t pos, size_t index)
+    : view(&view)
+    , pos(pos)
+    , index(index)
+    , record()
+{
+    read();
+}
+
+void DNSMessageView::RecordIterator::read()
+{
+    const size_t answers = view->ancount();
+    const size_t authority = answers + view->nscount();
+    if (!view->valid() || index >= authority + view->arcount())
+    {
+        return;
+    }
+    record.name = Name(view->message, pos);
+    record.section = index < answers ? Section::Answer : index < authority ? Section::Authority : Section::Additional;
+    const size_t fixed = skipName(view->message, pos);
+    record.type = view->word(fixed);
+    record.cls = view->word(fixed + 2);
+    record.ttl = static_cast<uint32_t>(view->word(fixed + 4)) << 16 | view->word(fixed + 6);
+    record.rdlength = view->word(fixed + 8);
+    record.rdata = view->message + fixed + 10;
+}
+
+DNSMessageView::RecordIterator& DNSMessageView::RecordIterator::operator++()
+{
+    pos = static_cast<size_t>(record.rdata - view->message) + record.rdlength;
+    ++index;
+    read();
+    return *this;
+}
+
+DNSMessageView::DNSMessageView(const uint8_t* data, size_t size)
+    : message(data)
+    , message_size(size)
+    , questions_end(0)
+{
+    if (size < HEADER_SIZE || size > MAX_MESSAGE_SIZE)
+    {
+        return;
+    }
+    size_t pos = HEADER_SIZE;
+    const size_t questions = qdcount();
+    for (size_t i = 0; i < questions; ++i)
+    {
+        pos = checkName(pos);
+        if (pos == 0 || message_size - pos < 2 * sizeof(uint16_t))
+        {
+            return;
+        }
+        pos += 2 * sizeof(uint16_t);
+    }
+    const size_t end = pos;
+    const size_t records = static_cast<size_t>(ancount()) + nscount() + arcount();
+    for (size_t i = 0; i < records; ++i)
+    {
+        // type, class, TTL, rdlength, then the rdata
+        pos = checkName(pos);
+        if (pos == 0 || message_size - pos < 10)
+        {
+            return;
+        }
+        const size_t rdlength = word(pos + 8);
+        pos += 10;
+        if (message_size - pos < rdlength)
+        {
+            return;
+        }
+        pos += rdlength;
+    }
+    questions_end = end;
+}
+
+size_t DNSMessageView::checkName(size_t pos) const
+{
+    size_t end = 0;             // after the name's own bytes, once a pointer ends them
+    size_t limit = pos;         // a pointer has to point before the run it ends
+    size_t expanded = 1;        // the root
+    size_t hops = 0;
+    for (;;)
+    {
+        if (pos >= message_size)
+        {
+            return 0;
+        }
+        const uint8_t len = message[pos];
+        if (len == 0)
+        {
+            return end != 0 ? end : pos + 1;
+        }
+        if ((len & 0xC0) == 0xC0)
+        {
+            if (message_size - pos < 2)
+            {
+                return 0;
+            }
+            const size_t target = static_cast<size_t>(len & 0x3F) << 8 | message[pos + 1];
+            if (target >= limit || ++hops > MAX_POINTER_HOPS)
+            {
+                return 0;       // forwards, a loop or a chain too long
+            }
+            if (end == 0)
+            {
+                end = pos + 2;
+            }
+            pos = limit = target;
+            continue;
+        }
+        if ((len & 0xC0) != 0)
+        {
+            return 0;           // the extended and reserved label types
+        }
+        expanded += static_cast<size_t>(len) + 1;
+        if (expanded > MAX_NAME)
+        {
+            return 0;
+        }
+        pos += static_cast<size_t>(len) + 1;
+    }
+}
+
+size_t DNSMessageView::skipName(const uint8_t* data, size_t pos)
+{
+    while (data[pos] != 0)
+    {
+        if ((data[pos] & 0xC0) == 0xC0)
+        {
+            return pos + 2;
+        }
+        pos += static_cast<size_t>(data[pos]) + 1;
+    }
+    return pos + 1;
+}
+
+uint16_t DNSMessageView::word(size_t pos) const
+{
+    return static_cast<uint16_t>(message[pos] << 8 | message[pos + 1]);
+}
+
+bool DNSMessageView::valid() const
+{
+    return questions_end != 0;
+}
+
+const uint8_t* DNSMessageView::data() const
+{
+    return message;
+}
+
+size_t DNSMessageView::size() const
+{
+    return message_size;
+}
+
+uint16_t DNSMessageView::id() const
+{
+    return valid() ? word(0) : 0;
+}
+
+DNSHeaderFlags DNSMessageView::flags() const
+{
+    if (!valid())
+    {
+        return DNSHeaderFlags();
+    }
+    const uint8_t* data = message + 2;
+    return DNSHeaderFlags(data);
+}
+
+uint16_t DNSMessageView::qdcount() const
+{
+    return message_size >= HEADER_SIZE ? word(4) : 0;
+}
+
+uint16_t DNSMessageView::ancount() const
+{
+    return message_size >= HEADER_SIZE ? word(6) : 0;
+}
+
+uint16_t DNSMessageView::nscount() const
+{
+    return message_size >= HEADER_SIZE ? word(8) : 0;
+}
+
+uint16_t DNSMessageView::arcount() const
+{
+    return message_size >= HEADER_SIZE ? word(10) : 0;
+}
+
+DNSMessageView::Question DNSMessageView::question(size_t i) const
+{
+    if (!valid() || i >= qdcount())
+    {
+        return Question{ Name(), 0, 0, 0 };
+    }
+    if (i == 0 && qdcount() == 1)
+    {
+        // the usual query: the question ends where the records start
+        const size_t fixed = questions_end - 2 * sizeof(uint16_t);
+        return Question{ Name(message, HEADER_SIZE), word(fixed), word(fixed + 2), questions_end };
+    }
+    size_t pos = HEADER_SIZE;
+    for (; i > 0; --i)
+    {
+        pos = skipName(message, pos) + 2 * sizeof(uint16_t);
+    }
+    const size_t fixed = skipName(message, pos);
+    return Question{ Name(message, pos), word(fixed), word(fixed + 2), fixed + 2 * sizeof(uint16_t) };
+}
+
+DNSMessageView::Records DNSMessageView::records() const
+{
+    if (!valid())
+    {
+        return Records{ RecordIterator(*this, 0, 0), RecordIterator(*this, 0, 0) };
+    }
+    const size_t total = static_cast<size_t>(ancount()) + nscount() + arcount();
+    return Records{ RecordIterator(*this, questions_end, 0), RecordIterator(*this, 0, total) };
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "dns_consts.h"
+#include "dns_header.h"
+
+// A received DNS message read in place. The constructor walks the message
+// once and checks that the header, every question and every record lie in
+// the buffer and that every name is well formed: labels of at most 63
+// bytes, at most 255 bytes expanded, at most MAX_POINTER_HOPS compression
+// pointers, each pointing backwards; nor may the message be longer than
+// MAX_MESSAGE_SIZE. Nothing is copied or allocated; the fields are read
+// from the buffer when asked for, so the buffer must outlive the view and
+// anything taken from it. A view that is not valid() hands out nothing.
+class DNSMessageView
+{
+public:
+    static const size_t MAX_NAME = MAX_NAME_SIZE;
+
+    // A name as it lies in the message, compression pointers and all.
+    class Name
+    {
+    public:
+        Name();
+
+        // Calls f(label) with the raw bytes of every label, the root left out.
+        template <typename F>
+        void forEachLabel(F f) const
+        {
+            // validated: every pointer points backwards, so this ends
+            size_t pos = offset;
+            while (message[pos] != 0)
+            {
+                if ((message[pos] & 0xC0) == 0xC0)
+                {
+                    pos = static_cast<size_t>(message[pos] & 0x3F) << 8 | message[pos + 1];
+                    continue;
+                }
+                f(std::string_view(reinterpret_cast<const char*>(message) + pos + 1, message[pos]));
+                pos += static_cast<size_t>(message[pos]) + 1;
+            }
+        }
+
+        size_t size() const;        // expanded wire bytes, the root's included
+        bool compressed() const;
+
+        // The dotted form ("www.example.com", the root empty) written into
+        // `out`, which holds MAX_NAME bytes. False for a label with a dot
+        // in it, which has no dotted form.
+        bool dotted(char* out, std::string_view& name) const;
+        std::string str() const;
+
+    private:
+        friend class DNSMessageView;
+        Name(const uint8_t* message, size_t offset);
+
+        const uint8_t* message;
+        size_t offset;
+    };
+
+    struct Question
+    {
+        Name name;
+        uint16_t type;
+        uint16_t cls;
+        size_t end;                 // the offset after the question
+    };
+
+    enum class Section
+    {
+        Answer,
+        Authority,
+        Additional,
+    };
+
+    struct Record
+    {
+        Name name;
+        Section section;
+        uint16_t type;
+        uint16_t cls;
+        uint32_t ttl;
+        const uint8_t* rdata;
+        uint16_t rdlength;
+    };
+
+    // Reads the records of the three sections in order, one at a time.
+    class RecordIterator
+    {
+    public:
+        const Record& operator*() const { return record; }
+        const Record* operator->() const { return &record; }
+        RecordIterator& operator++();
+        bool operator==(const RecordIterator& other) const { return index == other.index; }
+        bool operator!=(const RecordIterator& other) const { return index != other.index; }
+
+    private:
+        friend class DNSMessageView;
+        RecordIterator(const DNSMessageView& view, size_t pos, size_t index);
+        void read();
+
+        const DNSMessageView* view;
+        size_t pos;
+        size_t index;
+        Record record;
+    };
+
+    struct Records
+    {
+        RecordIterator first;
+        RecordIterator last;
+        RecordIterator begin() const { return first; }
+        RecordIterator end() const { return last; }
+    };
+
+    DNSMessageView(const uint8_t* data, size_t size);
+
+    bool valid() const;
+    const uint8_t* data() const;
+    size_t size() const;
+
+    uint16_t id() const;
+    DNSHeaderFlags flags() const;
+    uint16_t qdcount() const;
+    uint16_t ancount() const;
+    uint16_t nscount() const;
+    uint16_t arcount() const;
+
+    // The i-th question, found by skipping the ones before it.
+    Question question(size_t i = 0) const;
+    Records records() const;
+
+private:
+    uint16_t word(size_t pos) const;
+    // The offset after the name at `pos`, 0 when it is malformed.
+    size_t checkName(size_t pos) const;
+    static size_t skipName(const uint8_t* data, size_t pos);
+
+    const uint8_t* message;
+    size_t message_size;
+    size_t questions_end;           // 0: not valid
+};
@@ -4,21 +4,34 @@
 
 #include "dns_consts.h"
 
-DNSPackage::DNSPackage(const uint8_t* data)
+DNSPackage::DNSPackage(const uint8_t* data, size_t size)
 {
-    const uint8_t* orig = data;
+    if (size < sizeof(DNSHeader) || size > MAX_MESSAGE_SIZE)
+    {
+        throw std::runtime_error("Malformed DNS message size");
+    }
+    const uint8_t* const orig = data;
+    const uint8_t* const end = data + size;
     header = DNSHeader(data);
+    // each entry takes 5 bytes at least: a count the size cannot hold is a lie
+    const size_t entries = static_cast<size_t>(header.QDCOUNT) + header.ANCOUNT + header.NSCOUNT;
+    if (entries * 5 > static_cast<size_t>(end - data))
+    {
+        throw std::runtime_error("DNS message is truncated");
+    }
+    requests.reserve(header.QDCOUNT);
     for (auto i = 0; i < header.QDCOUNT; ++i)
     {
-        requests.emplace_back(DNSRequest{ orig, data });
+        requests.emplace_back(DNSRequest{ orig, end, data });
     }
+    answers.reserve(header.ANCOUNT);
     for (auto i = 0; i < header.ANCOUNT; ++i)
     {
-        answers.emplace_back(DNSAnswer{ orig, data });
+        answers.emplace_back(DNSAnswer{ orig, end, data });
     }
     for (auto i = 0; i < header.NSCOUNT; ++i)
     {
-        authorities.emplace_back(DNSAuthorityServer{ orig, data });
+        authorities.emplace_back(DNSAuthorityServer{ orig, end, data });
     }
 }
 
@@ -46,7 +59,7 @@ void DNSPackage::addAnswer(DNSRecordType type, const std::string& name, const st
     {
         answer.name = name;
         answer.cls = 1;
-        answer.ttl = 3600;
+        answer.ttl = ANSWER_TTL;
         answers.push_back(answer);
     }
 }
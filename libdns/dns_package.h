@@ -11,7 +11,10 @@ class DNSPackage
 {
 public:
     DNSPackage() {}
-    DNSPackage(const uint8_t* data);
+    // Parses the message of `size` bytes at `data`; throws when it is
+    // malformed or longer than MAX_MESSAGE_SIZE. The counts of the header
+    // are only believed as far as the message bears them out.
+    DNSPackage(const uint8_t* data, size_t size);
 
     void append(DNSBuffer& buf) const;
 
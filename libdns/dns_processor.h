@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class DNSBuffer;
+
+class IQueryProcessor
+{
+public:
+    virtual void processQuery(const uint8_t* query, size_t size, DNSBuffer& buf) = 0;
+};
+
+class IControlProcessor
+{
+public:
+    // Executes one control command line, returns the reply text.
+    virtual std::string processCommand(const std::string& cmd) = 0;
+};
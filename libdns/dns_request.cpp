@@ -1,24 +1,30 @@
 #include "dns_request.h"
 #include "dns_buffer.h"
 #include "dns_utils.h"
+#include "dns_index.h"
 
 DNSRequest::DNSRequest()
     : type(0)
     , cls(0)
+    , hash(DNSNameIndex::hash(name, type))
 {}
 
 DNSRequest::DNSRequest(DNSRecordType type, const std::string& name)
     : name(name)
     , type(static_cast<uint16_t>(type))
     , cls(0)
+    , hash(DNSNameIndex::hash(name, this->type))
 {}
 
 
-DNSRequest::DNSRequest(const uint8_t* const orig, const uint8_t*& data)
-    : name(get_domain(orig, data))
-    , type(get_uint16(data))
-    , cls(get_uint16(data))
-{}
+DNSRequest::DNSRequest(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
+    : name(get_domain(orig, end, data))
+{
+    check_size(data, end, 2 * sizeof(uint16_t));
+    type = get_uint16(data);
+    cls = get_uint16(data);
+    hash = DNSNameIndex::hash(name, type);
+}
 
 void DNSRequest::append(DNSBuffer& buf) const
 {
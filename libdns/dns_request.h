@@ -11,7 +11,9 @@ class DNSRequest
 public:
     DNSRequest();
     DNSRequest(DNSRecordType type, const std::string& name);
-    DNSRequest(const uint8_t* const orig, const uint8_t*& data);
+    // Reads the question at `data` of the message [orig, end); throws when
+    // it is malformed.
+    DNSRequest(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data);
 
     void append(DNSBuffer& buf) const;
 
@@ -19,4 +21,5 @@ public:
     std::string name;
     uint16_t type;
     uint16_t cls;
+    uint64_t hash;  // DNSNameIndex::hash(name, type), computed once here
 };
@@ -0,0 +1,232 @@
+#include "dns_reverse.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "dns_index.h"
+#include "dns_utils.h"
+
+namespace
+{
+    const std::string_view SUFFIX = ".in-addr.arpa";
+}
+
+DNSReverseIndex::DNSReverseIndex()
+    : entry_data(nullptr)
+    , entry_count(0)
+    , name_data(nullptr)
+    , name_size(0)
+    , stale_size(0)
+{}
+
+void DNSReverseIndex::add(std::string_view owner, const std::vector<std::string>& addresses)
+{
+    const size_t offset = names.size();
+    bool added = false;
+    for (const auto& item : addresses)
+    {
+        uint8_t addr[4];
+        if (!str_to_ipv4(item, addr))
+        {
+            continue;
+        }
+        if (offset > 0xFFFFFFFFu)
+        {
+            throw std::runtime_error("Too many names for the reverse index");
+        }
+        entries.push_back(Entry{
+            static_cast<uint32_t>(addr[0]) << 24 | static_cast<uint32_t>(addr[1]) << 16 | static_cast<uint32_t>(addr[2]) << 8 | addr[3],
+            static_cast<uint32_t>(offset) });
+        added = true;
+    }
+    if (added)
+    {
+        names.push_back(static_cast<uint8_t>(owner.size()));
+        names.insert(names.end(), owner.begin(), owner.end());
+    }
+}
+
+void DNSReverseIndex::finish()
+{
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.addr != b.addr ? a.addr < b.addr : a.owner < b.owner;
+    });
+    // an owner listing one address twice answers once
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.addr == b.addr && a.owner == b.owner;
+    }), entries.end());
+    entry_data = entries.data();
+    entry_count = entries.size();
+    name_data = names.data();
+    name_size = names.size();
+}
+
+void DNSReverseIndex::merge(const DNSReverseIndex& base, const DNSReverseIndex& removed, const DNSReverseIndex& added)
+{
+    if (base.name_size + added.name_size > 0xFFFFFFFFu)
+    {
+        throw std::runtime_error("Too many names for the reverse index");
+    }
+    // pairs of equal addresses stay ordered by owner offset: the added
+    // names go after the base's
+    const uint32_t shift = static_cast<uint32_t>(base.name_size);
+    names.assign(base.name_data, base.name_data + base.name_size);
+    names.insert(names.end(), added.name_data, added.name_data + added.name_size);
+    entries.clear();
+    entries.reserve(base.entry_count + added.entry_count);
+    const Entry* gone = removed.entry_data;
+    const Entry* gone_end = removed.entry_data + removed.entry_count;
+    const Entry* put = added.entry_data;
+    const Entry* put_end = added.entry_data + added.entry_count;
+    for (const Entry* it = base.entry_data; it != base.entry_data + base.entry_count; ++it)
+    {
+        for (; put != put_end && put->addr < it->addr; ++put)
+        {
+            entries.push_back(Entry{ put->addr, put->owner + shift });
+        }
+        while (gone != gone_end && gone->addr < it->addr)
+        {
+            ++gone;
+        }
+        bool keep = true;
+        for (const Entry* match = gone; keep && match != gone_end && match->addr == it->addr; ++match)
+        {
+            keep = base.owner(it->owner) != removed.owner(match->owner);
+        }
+        if (keep)
+        {
+            entries.push_back(*it);
+        }
+    }
+    for (; put != put_end; ++put)
+    {
+        entries.push_back(Entry{ put->addr, put->owner + shift });
+    }
+    entry_data = entries.data();
+    entry_count = entries.size();
+    name_data = names.data();
+    name_size = names.size();
+    stale_size = base.stale_size + removed.name_size;
+}
+
+std::string_view DNSReverseIndex::owner(uint32_t offset) const
+{
+    if (offset >= name_size || name_data[offset] >= name_size - offset)
+    {
+        return {}; // a damaged image
+    }
+    return std::string_view(reinterpret_cast<const char*>(name_data) + offset + 1, name_data[offset]);
+}
+
+bool DNSReverseIndex::parseName(std::string_view name, uint32_t& addr)
+{
+    if (!name.empty() && name.back() == '.')
+    {
+        name.remove_suffix(1);
+    }
+    if (name.size() <= SUFFIX.size())
+    {
+        return false;
+    }
+    const std::string_view suffix = name.substr(name.size() - SUFFIX.size());
+    for (size_t i = 0; i < SUFFIX.size(); ++i)
+    {
+        if ((suffix[i] | 0x20) != SUFFIX[i])
+        {
+            return false;
+        }
+    }
+    name.remove_suffix(SUFFIX.size());
+
+    // the labels name the octets last to first
+    addr = 0;
+    for (int octet = 0; octet < 4; ++octet)
+    {
+        if (octet > 0)
+        {
+            if (name.empty() || name[0] != '.')
+            {
+                return false;
+            }
+            name.remove_prefix(1);
+        }
+        size_t digits = 0;
+        unsigned value = 0;
+        while (digits < name.size() && name[digits] >= '0' && name[digits] <= '9')
+        {
+            value = value * 10 + (name[digits] - '0');
+            ++digits;
+        }
+        if (digits == 0 || digits > 3 || value > 255 || (digits > 1 && name[0] == '0'))
+        {
+            return false;
+        }
+        addr |= value << (8 * octet);
+        name.remove_prefix(digits);
+    }
+    return name.empty();
+}
+
+const DNSReverseIndex::Entry* DNSReverseIndex::lowerBound(uint32_t addr) const
+{
+    return std::lower_bound(entry_data, entry_data + entry_count, addr, [](const Entry& entry, uint32_t addr) {
+        return entry.addr < addr;
+    });
+}
+
+size_t DNSReverseIndex::find(std::string_view name, std::vector<std::string>& owners) const
+{
+    return forEachOwner(name, [&owners](std::string_view key) {
+        owners.push_back(DNSNameIndex::name(key));
+    });
+}
+
+size_t DNSReverseIndex::size() const
+{
+    return entry_count;
+}
+
+size_t DNSReverseIndex::bytes() const
+{
+    return entry_count * sizeof(Entry) + name_size;
+}
+
+size_t DNSReverseIndex::staleBytes() const
+{
+    return stale_size;
+}
+
+void DNSReverseIndex::save(std::vector<uint8_t>& out) const
+{
+    const uint64_t header[] = { entry_count, name_size };
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(header);
+    out.insert(out.end(), bytes, bytes + sizeof(header));
+    bytes = reinterpret_cast<const uint8_t*>(entry_data);
+    out.insert(out.end(), bytes, bytes + entry_count * sizeof(Entry));
+    out.insert(out.end(), name_data, name_data + name_size);
+}
+
+const uint8_t* DNSReverseIndex::map(const uint8_t* data, const uint8_t* end)
+{
+    uint64_t header[2];
+    if (static_cast<size_t>(end - data) < sizeof(header))
+    {
+        throw std::runtime_error("Zone image is truncated");
+    }
+    memcpy(header, data, sizeof(header));
+    data += sizeof(header);
+    if (header[0] > static_cast<size_t>(end - data) / sizeof(Entry)
+        || header[1] > static_cast<size_t>(end - data) - header[0] * sizeof(Entry))
+    {
+        throw std::runtime_error("Zone image is truncated");
+    }
+    entries.clear();
+    names.clear();
+    stale_size = 0;
+    entry_count = header[0];
+    name_size = header[1];
+    entry_data = reinterpret_cast<const Entry*>(data);
+    name_data = data + entry_count * sizeof(Entry);
+    return name_data + name_size;
+}
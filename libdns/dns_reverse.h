@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// PTR answers derived from the A records: a sorted array of (IPv4 address,
+// owner) pairs, 8 bytes per address, with each owner name stored once in
+// wire form. An in-addr.arpa name is parsed into its address and looked up
+// by binary search, so no per-address names are kept. Like the filter it
+// can be saved into a zone image and used in place from the mapping. Not
+// thread-safe while it is built; lookups are const.
+class DNSReverseIndex
+{
+public:
+    DNSReverseIndex();
+
+    // `owner` is a DNSNameIndex key, `addresses` the record's answers;
+    // strings that are not IPv4 addresses are left out. finish() makes
+    // the added pairs searchable.
+    void add(std::string_view owner, const std::vector<std::string>& addresses);
+    void finish();
+    // Makes this `base` without the pairs of `removed` and with those of
+    // `added`, both finished: the small sorted delta is merged into the
+    // base's sorted pairs in one pass. The names of the owners taken out
+    // stay behind, see staleBytes().
+    void merge(const DNSReverseIndex& base, const DNSReverseIndex& removed, const DNSReverseIndex& added);
+
+    // "4.3.2.1.in-addr.arpa" (any case, trailing dot optional) -> 0x01020304
+    static bool parseName(std::string_view name, uint32_t& addr);
+
+    // Calls f(owner) with the DNSNameIndex key of every owner of the
+    // address `name` stands for; the number of calls.
+    template <typename F>
+    size_t forEachOwner(std::string_view name, F f) const
+    {
+        uint32_t addr;
+        if (entry_count == 0 || !parseName(name, addr))
+        {
+            return 0;
+        }
+        size_t count = 0;
+        for (const Entry* it = lowerBound(addr); it != entry_data + entry_count && it->addr == addr; ++it)
+        {
+            if (it->owner < name_size && name_data[it->owner] < name_size - it->owner) // else a damaged image
+            {
+                f(std::string_view(reinterpret_cast<const char*>(name_data) + it->owner + 1, name_data[it->owner]));
+                ++count;
+            }
+        }
+        return count;
+    }
+    // Appends the owners, dotted; the number appended.
+    size_t find(std::string_view name, std::vector<std::string>& owners) const;
+
+    size_t size() const;            // addresses
+    size_t bytes() const;
+    size_t staleBytes() const;      // names left behind by merge()
+
+    void save(std::vector<uint8_t>& out) const;
+    const uint8_t* map(const uint8_t* data, const uint8_t* end);
+
+private:
+    struct Entry
+    {
+        uint32_t addr;
+        uint32_t owner;             // offset into the names: size byte, key
+    };
+
+    const Entry* lowerBound(uint32_t addr) const;
+    std::string_view owner(uint32_t offset) const;
+
+    std::vector<Entry> entries;
+    std::vector<uint8_t> names;
+    const Entry* entry_data;        // `entries` or a mapped image
+    size_t entry_count;
+    const uint8_t* name_data;
+    size_t name_size;
+    size_t stale_size;
+};
@@ -0,0 +1,105 @@
+#include "dns_ring.h"
+
+#include <algorithm>
+#include <cstring>
+
+DNSRingBuffer::DNSRingBuffer(size_t capacity)
+    : cap(capacity)
+    , head(0)
+    , count(0)
+    , data(new uint8_t[capacity])
+{}
+
+size_t DNSRingBuffer::capacity() const
+{
+    return cap;
+}
+
+size_t DNSRingBuffer::size() const
+{
+    return count;
+}
+
+size_t DNSRingBuffer::space() const
+{
+    return cap - count;
+}
+
+bool DNSRingBuffer::empty() const
+{
+    return count == 0;
+}
+
+void DNSRingBuffer::clear()
+{
+    head = 0;
+    count = 0;
+}
+
+uint8_t* DNSRingBuffer::tail(size_t& len)
+{
+    size_t pos = (head + count) % cap;
+    if (count == cap)
+    {
+        len = 0;
+    }
+    else
+    {
+        len = pos >= head ? cap - pos : head - pos;
+    }
+    return &data[pos];
+}
+
+void DNSRingBuffer::commit(size_t len)
+{
+    count += len;
+}
+
+void DNSRingBuffer::append(const uint8_t* ptr, size_t len)
+{
+    size_t pos = (head + count) % cap;
+    size_t first = std::min(len, cap - pos);
+    memcpy(&data[pos], ptr, first);
+    memcpy(&data[0], ptr + first, len - first);
+    count += len;
+}
+
+void DNSRingBuffer::copy(size_t offset, uint8_t* out, size_t len) const
+{
+    size_t pos = (head + offset) % cap;
+    size_t first = std::min(len, cap - pos);
+    memcpy(out, &data[pos], first);
+    memcpy(out + first, &data[0], len - first);
+}
+
+const uint8_t* DNSRingBuffer::contiguous(size_t offset, size_t len) const
+{
+    size_t pos = (head + offset) % cap;
+    return pos + len <= cap ? &data[pos] : nullptr;
+}
+
+size_t DNSRingBuffer::slices(SocketSlice out[2]) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    size_t first = std::min(count, cap - head);
+    out[0] = { &data[head], first };
+    if (first == count)
+    {
+        return 1;
+    }
+    out[1] = { &data[0], count - first };
+    return 2;
+}
+
+void DNSRingBuffer::consume(size_t len)
+{
+    head = (head + len) % cap;
+    count -= len;
+    if (count == 0)
+    {
+        head = 0; // keeps the next recv contiguous
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "dns_socket.h"
+
+// Fixed-capacity byte FIFO. The storage is allocated once, in the constructor,
+// and reused for the lifetime of the object.
+class DNSRingBuffer
+{
+public:
+    DNSRingBuffer(size_t capacity);
+
+    DNSRingBuffer(const DNSRingBuffer&) = delete;
+    DNSRingBuffer& operator=(const DNSRingBuffer&) = delete;
+
+    size_t capacity() const;
+    size_t size() const;
+    size_t space() const;
+    bool empty() const;
+    void clear();
+
+    // Contiguous free space after the last byte (for recv); call commit()
+    // with the number of bytes actually written there.
+    uint8_t* tail(size_t& len);
+    void commit(size_t len);
+
+    // Appends len bytes, which must fit into space().
+    void append(const uint8_t* data, size_t len);
+
+    // Copies len bytes starting at offset from the first byte.
+    void copy(size_t offset, uint8_t* out, size_t len) const;
+
+    // Pointer to [offset, offset + len) if that range does not wrap, else nullptr.
+    const uint8_t* contiguous(size_t offset, size_t len) const;
+
+    // The content as one or two slices (for a gathered write), returns their number.
+    size_t slices(SocketSlice out[2]) const;
+
+    // Drops len bytes from the front.
+    void consume(size_t len);
+
+private:
+    size_t cap;
+    size_t head;
+    size_t count;
+    std::unique_ptr<uint8_t[]> data;
+};
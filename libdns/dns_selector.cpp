@@ -1,5 +1,55 @@
 #include "dns_selector.h"
 
+#if defined(_WIN32)
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include <stdexcept>
+
+DNSSelector::DNSSelector(ISocketHandler* handler)
+    : handler(handler)
+    , wake_socket(socket(AF_INET, SOCK_DGRAM, 0))
+{
+    // select() can only wait for sockets, so wakeup() sends a datagram to
+    // a loopback socket that is always in the read set
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (wake_socket == INVALID_SOCKET
+        || bind(wake_socket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR
+        || getsockname(wake_socket, (sockaddr*)&addr, &len) == SOCKET_ERROR
+        || connect(wake_socket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+    {
+        throw std::runtime_error("DNSSelector error: wakeup socket");
+    }
+    setupsocket(wake_socket);
+}
+
+DNSSelector::~DNSSelector()
+{
+    closesocket(wake_socket);
+}
+
+void DNSSelector::wakeup()
+{
+    const char c = 0;
+    send(wake_socket, &c, sizeof(c), 0);
+}
+
+void DNSSelector::drainWakeup()
+{
+    char buf[64];
+    while (recv(wake_socket, buf, sizeof(buf), 0) > 0)
+    {}
+}
+
 void DNSSelector::addReadSocket(SOCKET s)
 {
     rsockets.insert(s);
@@ -1,6 +1,12 @@
 #pragma once
 
+#ifdef DNS_SELECTOR_EPOLL
+#include <cstdint>
+#include <vector>
+#include <sys/epoll.h>
+#else
 #include <set>
+#endif
 
 #include "dns_socket.h"
 
@@ -14,18 +20,37 @@ public:
 class DNSSelector
 {
 public:
-    DNSSelector(ISocketHandler* handler)
-        : handler(handler)
-    {}
+    DNSSelector(ISocketHandler* handler);
+    ~DNSSelector();
+
+    DNSSelector(const DNSSelector&) = delete;
+    DNSSelector& operator=(const DNSSelector&) = delete;
 
     void addReadSocket(SOCKET s);
     void removeReadSocket(SOCKET s);
     void addWriteSocket(SOCKET s);
     void removeWriteSocket(SOCKET s);
-    int select();
+    // Waits for readiness (at most timeout_ms, forever if negative) and
+    // dispatches it to the handler. Returns the number of ready sockets.
+    int select(int timeout_ms = -1);
+
+    // Makes a select() running in another thread return. Thread-safe.
+    void wakeup();
 
 private:
     ISocketHandler* handler;
+#ifdef DNS_SELECTOR_EPOLL
+    void update(SOCKET s, uint32_t mask);
+
+    int epfd;
+    int wakefd;                         // eventfd
+    std::vector<uint32_t> interest;     // registered EPOLLIN/EPOLLOUT mask, indexed by fd
+    std::vector<epoll_event> events;
+#else
+    void drainWakeup();
+
+    SOCKET wake_socket;                 // UDP socket connected to itself
     std::set<SOCKET> rsockets;
     std::set<SOCKET> wsockets;
+#endif
 };
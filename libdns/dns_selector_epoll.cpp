@@ -0,0 +1,146 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <stdexcept>
+
+#include "dns_selector.h"
+
+// Level-triggered epoll backend: interest registrations persist in the kernel
+// between select() calls, so a wakeup costs O(ready fds), not O(open fds).
+
+static const int MAX_EVENTS = 256;
+
+DNSSelector::DNSSelector(ISocketHandler* handler)
+    : handler(handler)
+    , epfd(epoll_create1(EPOLL_CLOEXEC))
+    , wakefd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    , events(MAX_EVENTS)
+{
+    if (epfd < 0 || wakefd < 0)
+    {
+        throw std::runtime_error("DNSSelector error: epoll_create1()/eventfd()");
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakefd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0)
+    {
+        throw std::runtime_error("DNSSelector error: epoll_ctl()");
+    }
+}
+
+DNSSelector::~DNSSelector()
+{
+    close(wakefd);
+    close(epfd);
+}
+
+void DNSSelector::wakeup()
+{
+    uint64_t value = 1;
+    ssize_t res = write(wakefd, &value, sizeof(value));
+    (void)res; // the counter is already non-zero if this fails
+}
+
+void DNSSelector::update(SOCKET s, uint32_t mask)
+{
+    if (s < 0)
+    {
+        return;
+    }
+    if (static_cast<size_t>(s) >= interest.size())
+    {
+        interest.resize(static_cast<size_t>(s) + 1, 0u);
+    }
+    uint32_t& curr = interest[s];
+    if (curr == mask)
+    {
+        return;
+    }
+
+    epoll_event ev{};
+    ev.events = mask;
+    ev.data.fd = s;
+    if (mask == 0u)
+    {
+        // the fd may already be gone from the set if it was closed elsewhere
+        epoll_ctl(epfd, EPOLL_CTL_DEL, s, &ev);
+    }
+    else if (curr == 0u)
+    {
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) < 0 && errno == EEXIST)
+        {
+            epoll_ctl(epfd, EPOLL_CTL_MOD, s, &ev);
+        }
+    }
+    else
+    {
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, s, &ev) < 0 && errno == ENOENT)
+        {
+            epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev);
+        }
+    }
+    curr = mask;
+}
+
+void DNSSelector::addReadSocket(SOCKET s)
+{
+    uint32_t mask = static_cast<size_t>(s) < interest.size() ? interest[s] : 0u;
+    update(s, mask | EPOLLIN);
+}
+
+void DNSSelector::removeReadSocket(SOCKET s)
+{
+    uint32_t mask = static_cast<size_t>(s) < interest.size() ? interest[s] : 0u;
+    update(s, mask & ~static_cast<uint32_t>(EPOLLIN));
+}
+
+void DNSSelector::addWriteSocket(SOCKET s)
+{
+    uint32_t mask = static_cast<size_t>(s) < interest.size() ? interest[s] : 0u;
+    update(s, mask | EPOLLOUT);
+}
+
+void DNSSelector::removeWriteSocket(SOCKET s)
+{
+    uint32_t mask = static_cast<size_t>(s) < interest.size() ? interest[s] : 0u;
+    update(s, mask & ~static_cast<uint32_t>(EPOLLOUT));
+}
+
+int DNSSelector::select(int timeout_ms)
+{
+    int result = epoll_wait(epfd, &events[0], static_cast<int>(events.size()), timeout_ms);
+    if (result < 0)
+    {
+        return SOCKET_ERROR;
+    }
+
+    for (auto i = 0; i < result; i++)
+    {
+        const SOCKET s = events[i].data.fd;
+        const uint32_t ready = events[i].events;
+
+        if (s == wakefd)
+        {
+            uint64_t value;
+            ssize_t res = read(wakefd, &value, sizeof(value));
+            (void)res;
+            continue;
+        }
+
+        // handlers may drop interest (or close the fd) while we are dispatching,
+        // so always check against the current registration
+        if ((ready & (EPOLLIN | EPOLLERR | EPOLLHUP)) && (interest[s] & EPOLLIN))
+        {
+            handler->socketReadyRead(s);
+        }
+        if ((ready & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && (interest[s] & EPOLLOUT))
+        {
+            handler->socketReadyWrite(s);
+        }
+    }
+
+    return result;
+}
@@ -2,10 +2,16 @@
 
 #include "dns_selector.h"
 
-int DNSSelector::select()
+int DNSSelector::select(int timeout_ms)
 {
+    timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    timeval* timeout = timeout_ms < 0 ? nullptr : &tv;
+
     fd_set rset;
     FD_ZERO(&rset);
+    FD_SET(wake_socket, &rset);
     for (const auto s : rsockets)
     {
         FD_SET(s, &rset);
@@ -18,7 +24,7 @@ int DNSSelector::select()
         FD_SET(s, &wset);
     }
 
-    int size = 0;
+    int size = wake_socket + 1;
     if (!rsockets.empty())
     {
         size = std::max(size, *rsockets.rbegin() + 1);
@@ -28,12 +34,18 @@ int DNSSelector::select()
         size = std::max(size, *wsockets.rbegin() + 1);
     }
 
-    int result = ::select(size, &rset, &wset, nullptr, nullptr);
+    int result = ::select(size, &rset, &wset, nullptr, timeout);
     if (result == SOCKET_ERROR)
     {
         return result;
     }
 
+    if (FD_ISSET(wake_socket, &rset))
+    {
+        drainWakeup();
+        FD_CLR(wake_socket, &rset);
+    }
+
     for (auto i = 0; i < size; i++)
     {
         if (FD_ISSET(i, &rset))
@@ -2,10 +2,16 @@
 
 #include "dns_selector.h"
 
-int DNSSelector::select()
+int DNSSelector::select(int timeout_ms)
 {
+    timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    timeval* timeout = timeout_ms < 0 ? nullptr : &tv;
+
     fd_set rset;
     FD_ZERO(&rset);
+    FD_SET(wake_socket, &rset);
     for (const auto s : rsockets)
     {
         FD_SET(s, &rset);
@@ -18,7 +24,7 @@ int DNSSelector::select()
         FD_SET(s, &wset);
     }
 
-    int result = ::select(0, &rset, &wset, nullptr, nullptr);
+    int result = ::select(0, &rset, &wset, nullptr, timeout);
     if (result == SOCKET_ERROR)
     {
         return result;
@@ -26,6 +32,11 @@ int DNSSelector::select()
 
     for (auto i = 0u; i < rset.fd_count; i++)
     {
+        if (rset.fd_array[i] == wake_socket)
+        {
+            drainWakeup();
+            continue;
+        }
         handler->socketReadyRead(rset.fd_array[i]);
     }
 
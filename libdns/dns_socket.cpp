@@ -1,12 +1,17 @@
 #include "dns_socket.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <utility>
 
 #ifndef _WIN32
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #endif
 
 #ifndef _WIN32
@@ -48,4 +53,128 @@ void setupsocket(SOCKET s)
 #endif
 }
 
+bool socketwouldblock()
+{
+#ifdef _WIN32
+   return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+   return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+void setupreuseport(SOCKET s)
+{
+#ifdef SO_REUSEPORT
+   int option = 1;
+   if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char*>(&option), sizeof(option)) < 0)
+   {
+       throw std::runtime_error("setupreuseport error: setsockopt()");
+   }
+#else
+   (void)s;
+   throw std::runtime_error("setupreuseport error: SO_REUSEPORT is not supported");
+#endif
+}
+
+void setupfastopen(SOCKET s, int queue)
+{
+#ifdef TCP_FASTOPEN
+   if (setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN, reinterpret_cast<const char*>(&queue), sizeof(queue)) < 0)
+   {
+       throw std::runtime_error("setupfastopen error: setsockopt()");
+   }
+#else
+   (void)s;
+   (void)queue;
+   throw std::runtime_error("setupfastopen error: TCP_FASTOPEN is not supported");
+#endif
+}
+
+void setupdeferaccept(SOCKET s, int seconds)
+{
+#ifdef TCP_DEFER_ACCEPT
+   if (setsockopt(s, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) < 0)
+   {
+       throw std::runtime_error("setupdeferaccept error: setsockopt()");
+   }
+#else
+   (void)s;
+   (void)seconds;
+   throw std::runtime_error("setupdeferaccept error: TCP_DEFER_ACCEPT is not supported");
+#endif
+}
 
+bool setupbusypoll(SOCKET s, int usecs)
+{
+#ifdef SO_BUSY_POLL
+   if (setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0)
+   {
+       return false;
+   }
+#ifdef SO_PREFER_BUSY_POLL
+   int prefer = 1;
+   setsockopt(s, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)); // Linux 5.11+, optional
+#endif
+   return true;
+#else
+   (void)s;
+   (void)usecs;
+   return false;
+#endif
+}
+
+SOCKET acceptsocket(SOCKET listener)
+{
+#ifdef __linux__
+   return accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+   SOCKET s = accept(listener, nullptr, nullptr);
+   if (s != INVALID_SOCKET)
+   {
+      try
+      {
+         setupsocket(s);
+      }
+      catch (const std::exception&)
+      {
+         closesocket(s);
+         return INVALID_SOCKET;
+      }
+   }
+   return s;
+#endif
+}
+
+int sendslices(SOCKET s, const SocketSlice* slices, size_t count)
+{
+   count = std::min<size_t>(count, SOCKET_MAX_SLICES);
+#ifdef _WIN32
+   WSABUF bufs[SOCKET_MAX_SLICES];
+   for (size_t i = 0; i < count; ++i)
+   {
+      bufs[i].buf = reinterpret_cast<char*>(const_cast<uint8_t*>(slices[i].data));
+      bufs[i].len = static_cast<ULONG>(slices[i].size);
+   }
+   DWORD sent = 0;
+   if (WSASend(s, bufs, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) != 0)
+   {
+      return SOCKET_ERROR;
+   }
+   return static_cast<int>(sent);
+#else
+   iovec iov[SOCKET_MAX_SLICES];
+   for (size_t i = 0; i < count; ++i)
+   {
+      iov[i].iov_base = const_cast<uint8_t*>(slices[i].data);
+      iov[i].iov_len = slices[i].size;
+   }
+   msghdr msg = {};
+   msg.msg_iov = iov;
+   msg.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+   return static_cast<int>(sendmsg(s, &msg, MSG_NOSIGNAL));
+#else
+   return static_cast<int>(sendmsg(s, &msg, 0));
+#endif
+#endif
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #ifdef _WIN32
 #include <WinSock2.h>
 typedef int socklen_t;
@@ -11,3 +14,34 @@ void closesocket(SOCKET s);
 #endif
 
 void setupsocket(SOCKET s);
+
+// True when the last failed socket call would have blocked (EAGAIN/EWOULDBLOCK).
+bool socketwouldblock();
+
+// Lets several sockets bind the same address/port; the kernel load-balances
+// incoming datagrams and connections between them.
+void setupreuseport(SOCKET s);
+
+// TCP listener options; both throw where the platform lacks them.
+void setupfastopen(SOCKET s, int queue);        // TCP_FASTOPEN: SYN data for up to `queue` pending connections
+void setupdeferaccept(SOCKET s, int seconds);   // TCP_DEFER_ACCEPT: wake up only once the first data arrived
+
+// SO_BUSY_POLL (plus SO_PREFER_BUSY_POLL where the kernel has it): a blocking
+// or empty receive polls the device queue for up to `usecs` instead of waiting
+// for the interrupt. Returns false where the platform or privileges lack it.
+bool setupbusypoll(SOCKET s, int usecs);
+
+// Accepts a pending connection as a non-blocking socket (accept4 where
+// available), returns INVALID_SOCKET when the queue is empty or on error.
+SOCKET acceptsocket(SOCKET listener);
+
+struct SocketSlice
+{
+    const uint8_t* data;
+    size_t size;
+};
+
+// Sends up to SOCKET_MAX_SLICES slices with one gathered write (sendmsg/WSASend).
+// Returns the number of bytes sent or SOCKET_ERROR.
+#define SOCKET_MAX_SLICES 64
+int sendslices(SOCKET s, const SocketSlice* slices, size_t count);
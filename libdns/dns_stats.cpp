@@ -0,0 +1,150 @@
+#include "dns_stats.h"
+
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "dns.h"
+
+namespace
+{
+    std::atomic<size_t> next_stripe(0);
+    thread_local size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed);
+}
+
+DNSSharedCounter::DNSSharedCounter()
+{
+    for (auto& item : stripes)
+    {
+        item.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+void DNSSharedCounter::add(uint64_t n)
+{
+    stripes[stripe % STRIPES].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t DNSSharedCounter::get() const
+{
+    uint64_t result = 0;
+    for (const auto& item : stripes)
+    {
+        result += item.value.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+DNSHistogram::DNSHistogram(size_t size)
+    : size(size)
+    , buckets(new DNSCounter[size])
+{}
+
+void DNSHistogram::add(size_t value)
+{
+    buckets[value < size ? value : size - 1].add();
+}
+
+void DNSHistogram::collect(std::vector<uint64_t>& out) const
+{
+    if (out.size() < size)
+    {
+        out.resize(size, 0u);
+    }
+    for (size_t i = 0; i < size; ++i)
+    {
+        out[i] += buckets[i].get();
+    }
+}
+
+uint64_t readListenOverflows()
+{
+#ifdef __linux__
+    // two lines per group: field names, then values
+    std::ifstream netstat("/proc/net/netstat");
+    std::string names, values;
+    while (std::getline(netstat, names) && std::getline(netstat, values))
+    {
+        if (names.compare(0, 7, "TcpExt:") != 0)
+        {
+            continue;
+        }
+        std::istringstream n(names), v(values);
+        std::string name, value;
+        while (n >> name && v >> value)
+        {
+            if (name == "ListenOverflows")
+            {
+                return std::stoull(value);
+            }
+        }
+    }
+#endif
+    return 0;
+}
+
+DNSLoopStats::DNSLoopStats(size_t udp_batch)
+    : udp_batches(udp_batch + 1)
+    , tcp_accepts(MAX_ACCEPTS + 1)
+{}
+
+void DNSLoopStats::collect(DNSServerStats& out) const
+{
+    udp_batches.collect(out.udp_batches);
+    out.busy_poll_sleeps += busy_poll_sleeps.get();
+    out.udp_queued += udp_queued.get();
+    out.udp_dropped += udp_dropped.get();
+    out.tcp_contexts += tcp_contexts.get();
+    out.tcp_frames += tcp_frames.get();
+    out.tcp_timeouts += tcp_timeouts.get();
+    out.tcp_shed += tcp_shed.get();
+    out.tcp_refused += tcp_refused.get();
+    tcp_accepts.collect(out.tcp_accepts);
+}
+
+DNSServerStats::DNSServerStats()
+    : busy_poll_sleeps(0)
+    , udp_queued(0)
+    , udp_dropped(0)
+    , tcp_contexts(0)
+    , tcp_frames(0)
+    , tcp_timeouts(0)
+    , tcp_shed(0)
+    , tcp_refused(0)
+    , listen_overflows(0)
+    , filter_rejected(0)
+    , filter_passed(0)
+    , filter_false_positives(0)
+{}
+
+static void printHistogram(std::ostream& os, const char* name, const std::vector<uint64_t>& values)
+{
+    os << name << ":";
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if (values[i] != 0)
+        {
+            os << " " << i << "=" << values[i];
+        }
+    }
+    os << "\n";
+}
+
+void DNSServerStats::print(std::ostream& os) const
+{
+    printHistogram(os, "udp_batches", udp_batches);
+    os << "busy_poll_sleeps: " << busy_poll_sleeps << "\n";
+    os << "udp_queued: " << udp_queued << "\n";
+    os << "udp_dropped: " << udp_dropped << "\n";
+    os << "tcp_contexts: " << tcp_contexts << "\n";
+    os << "tcp_frames: " << tcp_frames << "\n";
+    os << "tcp_timeouts: " << tcp_timeouts << "\n";
+    os << "tcp_shed: " << tcp_shed << "\n";
+    os << "tcp_refused: " << tcp_refused << "\n";
+    printHistogram(os, "tcp_accepts", tcp_accepts);
+    os << "listen_overflows: " << listen_overflows << "\n";
+    os << "filter_rejected: " << filter_rejected << "\n";
+    os << "filter_passed: " << filter_passed << "\n";
+    os << "filter_false_positives: " << filter_false_positives << "\n";
+}
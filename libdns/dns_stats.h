@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct DNSServerStats;
+
+// Event loop counters. Each one has a single writer (the loop thread that
+// owns it) and may be read concurrently by DNSServer::stats().
+class DNSCounter
+{
+public:
+    DNSCounter()
+        : value(0)
+    {}
+
+    void add(uint64_t n = 1)
+    {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    uint64_t get() const
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value;
+};
+
+// A counter any thread may add to. Each thread adds to one of several
+// cache lines, so concurrent writers seldom share one.
+class DNSSharedCounter
+{
+public:
+    DNSSharedCounter();
+
+    void add(uint64_t n = 1);
+    uint64_t get() const;
+
+private:
+    static const size_t STRIPES = 16;
+
+    struct alignas(64) Stripe
+    {
+        std::atomic<uint64_t> value;
+    };
+
+    Stripe stripes[STRIPES];
+};
+
+// Counts occurrences of small values; values past the end land in the last bucket.
+class DNSHistogram
+{
+public:
+    DNSHistogram(size_t size);
+
+    void add(size_t value);
+    void collect(std::vector<uint64_t>& out) const;
+
+private:
+    size_t size;
+    std::unique_ptr<DNSCounter[]> buckets;
+};
+
+// Host-wide count of connections dropped because an accept queue was full
+// (TcpExt ListenOverflows); always 0 where the kernel does not report it.
+uint64_t readListenOverflows();
+
+struct DNSLoopStats
+{
+public:
+    static const size_t MAX_ACCEPTS = 64;   // tcp_accepts buckets past this one are merged
+
+    DNSLoopStats(size_t udp_batch);
+
+    void collect(DNSServerStats& out) const;
+
+public:
+    DNSHistogram udp_batches;   // datagrams drained per UDP wakeup
+    DNSCounter busy_poll_sleeps;    // busy polling stopped for lack of traffic
+    DNSCounter udp_queued;      // replies deferred because the socket would block
+    DNSCounter udp_dropped;     // replies dropped because the queue was full
+    DNSCounter tcp_contexts;    // TCP connection contexts allocated (the slab only grows)
+    DNSCounter tcp_frames;      // connection coroutine frames allocated (the pool only grows)
+    DNSCounter tcp_timeouts;    // connections closed by a deadline
+    DNSCounter tcp_shed;        // idle connections closed to admit a new one
+    DNSCounter tcp_refused;     // connections refused because none was idle
+    DNSHistogram tcp_accepts;   // connections accepted per listener wakeup
+};
@@ -0,0 +1,86 @@
+#include "dns_task.h"
+
+#include <new>
+
+namespace
+{
+    struct FreeFrame
+    {
+        FreeFrame* next;
+    };
+
+    // Few coroutine types exist, so a handful of size classes is plenty;
+    // frames of any other size go straight to the heap.
+    struct FramePool
+    {
+        static const size_t CLASSES = 8;
+
+        size_t sizes[CLASSES] = {};
+        FreeFrame* free[CLASSES] = {};
+        size_t allocated = 0;
+
+        ~FramePool()
+        {
+            for (size_t i = 0; i < CLASSES; ++i)
+            {
+                while (free[i])
+                {
+                    FreeFrame* frame = free[i];
+                    free[i] = frame->next;
+                    ::operator delete(frame);
+                }
+            }
+        }
+
+        // Size class of `size`, claiming an unused one; CLASSES if all are taken.
+        size_t find(size_t size)
+        {
+            for (size_t i = 0; i < CLASSES; ++i)
+            {
+                if (sizes[i] == size)
+                {
+                    return i;
+                }
+                if (sizes[i] == 0)
+                {
+                    sizes[i] = size;
+                    return i;
+                }
+            }
+            return CLASSES;
+        }
+    };
+
+    thread_local FramePool pool;
+}
+
+void* DNSFramePool::allocate(size_t size)
+{
+    size_t i = pool.find(size);
+    if (i < FramePool::CLASSES && pool.free[i])
+    {
+        FreeFrame* frame = pool.free[i];
+        pool.free[i] = frame->next;
+        return frame;
+    }
+    ++pool.allocated;
+    return ::operator new(size < sizeof(FreeFrame) ? sizeof(FreeFrame) : size);
+}
+
+void DNSFramePool::release(void* frame, size_t size)
+{
+    size_t i = pool.find(size);
+    if (i == FramePool::CLASSES)
+    {
+        ::operator delete(frame);
+        return;
+    }
+    FreeFrame* free = static_cast<FreeFrame*>(frame);
+    free->next = pool.free[i];
+    pool.free[i] = free;
+}
+
+size_t DNSFramePool::allocated()
+{
+    return pool.allocated;
+}
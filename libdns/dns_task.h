@@ -0,0 +1,90 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+
+// Recycles coroutine frames through per-thread free lists, one per frame
+// size. A given coroutine always has the same frame size, so once a loop has
+// seen its peak number of concurrent tasks, starting one touches no heap.
+class DNSFramePool
+{
+public:
+    static void* allocate(size_t size);
+    static void release(void* frame, size_t size);
+
+    // Frames this thread has taken from the heap (the pool only grows).
+    static size_t allocated();
+};
+
+// A coroutine owned by the object that started it. It is created suspended,
+// runs when resume() is called and stays suspended at its end until the
+// owner destroys it; destroying a suspended task unwinds its locals.
+// Exceptions escape from the resume() that raised them.
+class DNSTask
+{
+public:
+    struct promise_type
+    {
+        DNSTask get_return_object()
+        {
+            return DNSTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { throw; }
+
+        static void* operator new(size_t size) { return DNSFramePool::allocate(size); }
+        static void operator delete(void* frame, size_t size) { DNSFramePool::release(frame, size); }
+    };
+
+    DNSTask()
+        : handle(nullptr)
+    {}
+    DNSTask(DNSTask&& other) noexcept
+        : handle(other.handle)
+    {
+        other.handle = nullptr;
+    }
+    DNSTask& operator=(DNSTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+    ~DNSTask()
+    {
+        reset();
+    }
+
+    DNSTask(const DNSTask&) = delete;
+    DNSTask& operator=(const DNSTask&) = delete;
+
+    void resume()
+    {
+        handle.resume();
+    }
+    bool done() const
+    {
+        return !handle || handle.done();
+    }
+    void reset()
+    {
+        if (handle)
+        {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+private:
+    explicit DNSTask(std::coroutine_handle<promise_type> handle)
+        : handle(handle)
+    {}
+
+    std::coroutine_handle<promise_type> handle;
+};
@@ -0,0 +1,189 @@
+#include "dns_timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+DNSTimer::DNSTimer()
+    : data(0)
+    , wheel(nullptr)
+    , slot(nullptr)
+    , prev(nullptr)
+    , next(nullptr)
+    , expires(0)
+{}
+
+DNSTimer::~DNSTimer()
+{
+    if (wheel)
+    {
+        wheel->cancel(*this);
+    }
+}
+
+bool DNSTimer::armed() const
+{
+    return wheel != nullptr;
+}
+
+DNSTimerWheel::DNSTimerWheel(ITimerHandler* handler, unsigned tick_ms)
+    : handler(handler)
+    , tick_ms(std::max(tick_ms, 1u))
+    , current(now() / this->tick_ms)
+    , count(0)
+    , slots{}
+{}
+
+DNSTimerWheel::~DNSTimerWheel()
+{
+    for (auto& level : slots)
+    {
+        for (auto& head : level)
+        {
+            while (head)
+            {
+                unlink(*head);
+            }
+        }
+    }
+}
+
+uint64_t DNSTimerWheel::now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void DNSTimerWheel::schedule(DNSTimer& timer, uint64_t delay_ms, uint64_t now_ms)
+{
+    if (timer.wheel)
+    {
+        timer.wheel->unlink(timer);
+    }
+    // round up: a timer never fires early
+    timer.expires = std::max((now_ms + delay_ms + tick_ms - 1) / tick_ms, current + 1);
+    timer.wheel = this;
+    ++count;
+    place(timer);
+}
+
+void DNSTimerWheel::cancel(DNSTimer& timer)
+{
+    if (timer.wheel == this)
+    {
+        unlink(timer);
+    }
+}
+
+void DNSTimerWheel::place(DNSTimer& timer)
+{
+    const uint64_t range = uint64_t(1) << (SLOT_BITS * LEVELS);
+    if (timer.expires - current >= range)
+    {
+        timer.expires = current + range - 1;
+    }
+    const uint64_t diff = timer.expires - current;
+    unsigned level = 0;
+    while (level + 1 < LEVELS && diff >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+    {
+        ++level;
+    }
+    DNSTimer** head = &slots[level][(timer.expires >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    timer.slot = head;
+    timer.prev = nullptr;
+    timer.next = *head;
+    if (*head)
+    {
+        (*head)->prev = &timer;
+    }
+    *head = &timer;
+}
+
+void DNSTimerWheel::unlink(DNSTimer& timer)
+{
+    if (timer.prev)
+    {
+        timer.prev->next = timer.next;
+    }
+    else
+    {
+        *timer.slot = timer.next;
+    }
+    if (timer.next)
+    {
+        timer.next->prev = timer.prev;
+    }
+    timer.wheel = nullptr;
+    timer.slot = nullptr;
+    timer.prev = nullptr;
+    timer.next = nullptr;
+    --count;
+}
+
+void DNSTimerWheel::cascade(unsigned level)
+{
+    // the slot now covers the next SLOTS^level ticks: spread it over lower levels
+    DNSTimer** head = &slots[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    DNSTimer* timer = *head;
+    *head = nullptr;
+    while (timer)
+    {
+        DNSTimer* next = timer->next;
+        place(*timer);
+        timer = next;
+    }
+}
+
+void DNSTimerWheel::advance(uint64_t now_ms)
+{
+    const uint64_t target = now_ms / tick_ms;
+    while (current < target)
+    {
+        if (count == 0)
+        {
+            current = target;
+            break;
+        }
+        ++current;
+        for (unsigned level = 1; level < LEVELS; ++level)
+        {
+            if ((current & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0)
+            {
+                break;
+            }
+            cascade(level);
+        }
+        DNSTimer** head = &slots[0][current & (SLOTS - 1)];
+        while (*head)
+        {
+            DNSTimer& timer = **head;
+            unlink(timer);
+            handler->timerExpired(timer);
+        }
+    }
+}
+
+int DNSTimerWheel::timeout(uint64_t now_ms) const
+{
+    if (count == 0)
+    {
+        return -1;
+    }
+    uint64_t tick = current + 1;
+    // the first non-empty level 0 slot, or the next cascade
+    while (!slots[0][tick & (SLOTS - 1)] && (tick & (SLOTS - 1)) != 0)
+    {
+        ++tick;
+    }
+    const uint64_t due = tick * tick_ms;
+    if (due <= now_ms)
+    {
+        return 0;
+    }
+    return static_cast<int>(std::min<uint64_t>(due - now_ms, INT_MAX));
+}
+
+size_t DNSTimerWheel::size() const
+{
+    return count;
+}
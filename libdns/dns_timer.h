@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class DNSTimer;
+
+class ITimerHandler
+{
+public:
+    virtual void timerExpired(DNSTimer& timer) = 0;
+};
+
+// A timer slot owned by the caller (usually embedded into the object it
+// times); the wheel only links it into its lists, so arming allocates nothing.
+class DNSTimer
+{
+public:
+    DNSTimer();
+    ~DNSTimer();
+
+    DNSTimer(const DNSTimer&) = delete;
+    DNSTimer& operator=(const DNSTimer&) = delete;
+
+    bool armed() const;
+
+public:
+    uint64_t data;              // free for the owner, e.g. the socket it times
+
+private:
+    friend class DNSTimerWheel;
+
+    class DNSTimerWheel* wheel;
+    DNSTimer** slot;            // list head the timer is linked into
+    DNSTimer* prev;
+    DNSTimer* next;
+    uint64_t expires;           // in ticks
+};
+
+// Hierarchical timing wheel (4 levels of 64 slots): O(1) schedule and cancel,
+// expiry is amortized O(1) per timer. Resolution is one tick; a timer never
+// fires early but may fire up to one tick late. Single-threaded.
+class DNSTimerWheel
+{
+public:
+    DNSTimerWheel(ITimerHandler* handler, unsigned tick_ms = 10);
+    ~DNSTimerWheel();
+
+    DNSTimerWheel(const DNSTimerWheel&) = delete;
+    DNSTimerWheel& operator=(const DNSTimerWheel&) = delete;
+
+    // Monotonic milliseconds.
+    static uint64_t now();
+
+    // (Re)arms the timer to fire delay_ms after now_ms.
+    void schedule(DNSTimer& timer, uint64_t delay_ms, uint64_t now_ms);
+    void cancel(DNSTimer& timer);
+
+    // Fires every timer due at now_ms. The handler may schedule or cancel
+    // any timer, including the one being fired.
+    void advance(uint64_t now_ms);
+
+    // Milliseconds until advance() may have work to do, -1 with no timers.
+    int timeout(uint64_t now_ms) const;
+
+    size_t size() const;
+
+private:
+    static const unsigned LEVELS = 4;
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS = 1u << SLOT_BITS;
+
+    void place(DNSTimer& timer);
+    void unlink(DNSTimer& timer);
+    void cascade(unsigned level);
+
+    ITimerHandler* handler;
+    unsigned tick_ms;
+    uint64_t current;           // last processed tick
+    size_t count;
+    DNSTimer* slots[LEVELS][SLOTS];
+};
@@ -0,0 +1,253 @@
+#include "dns_tree.h"
+
+#include <cstring>
+#include <stdexcept>
+
+// A name of at most 255 wire bytes has at most 127 labels.
+static const size_t MAX_LABELS = 128;
+
+DNSNameTree::DNSNameTree()
+    : mapped_refs(nullptr)
+    , mapped_ref_count(0)
+    , wildcard_count(0)
+{}
+
+void DNSNameTree::ownRefs()
+{
+    if (mapped_refs)
+    {
+        node_refs.assign(mapped_refs, mapped_refs + mapped_ref_count);
+        mapped_refs = nullptr;
+        mapped_ref_count = 0;
+    }
+}
+
+size_t DNSNameTree::labelStarts(std::string_view name, size_t* starts, size_t max)
+{
+    const size_t end = !name.empty() && name.back() == '.' ? name.size() - 1 : name.size();
+    size_t labels = 0;
+    for (size_t pos = 0; pos < end; ++pos)
+    {
+        if (pos == 0 || name[pos - 1] == '.')
+        {
+            if (labels == max)
+            {
+                throw std::runtime_error("Domain name is too long");
+            }
+            starts[labels++] = pos;
+        }
+    }
+    return labels;
+}
+
+bool DNSNameTree::isWildcard(std::string_view name)
+{
+    return !name.empty() && name[0] == '*' && (name.size() == 1 || name[1] == '.');
+}
+
+bool DNSNameTree::exists(std::string_view name, const size_t* starts, size_t labels, size_t suffix) const
+{
+    if (suffix == 0)
+    {
+        return true; // the root
+    }
+    const size_t start = starts[labels - suffix];
+    return nodes.find(name.substr(start), 0) != NOT_FOUND;
+}
+
+uint32_t DNSNameTree::findWildcard(std::string_view name, uint16_t type) const
+{
+    if (wildcard_count == 0)
+    {
+        return NOT_FOUND;
+    }
+    size_t starts[MAX_LABELS];
+    size_t labels;
+    try
+    {
+        labels = labelStarts(name, starts, MAX_LABELS);
+    }
+    catch (const std::runtime_error&)
+    {
+        return NOT_FOUND;
+    }
+    if (labels == 0 || exists(name, starts, labels, labels))
+    {
+        return NOT_FOUND; // the name exists: no synthesis, even without the type
+    }
+
+    // the closest encloser: the longest suffix that exists
+    size_t lo = 0, hi = labels - 1;
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi + 1) / 2;
+        if (exists(name, starts, labels, mid))
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    // "*." + the closest encloser, without touching the heap
+    char source[2 + 256];
+    const std::string_view encloser = lo == 0 ? std::string_view() : name.substr(starts[labels - lo]);
+    if (encloser.size() > 256)
+    {
+        return NOT_FOUND;
+    }
+    source[0] = '*';
+    source[1] = '.';
+    memcpy(source + 2, encloser.data(), encloser.size());
+    return records.find(std::string_view(source, lo == 0 ? 1 : 2 + encloser.size()), type);
+}
+
+uint32_t DNSNameTree::find(std::string_view name, uint16_t type, uint64_t hash, bool& wildcard) const
+{
+    wildcard = false;
+    const uint32_t id = records.find(name, type, hash);
+    if (id != NOT_FOUND || wildcard_count == 0)
+    {
+        return id;
+    }
+    const uint32_t source = findWildcard(name, type);
+    wildcard = source != NOT_FOUND;
+    return source;
+}
+
+uint32_t DNSNameTree::find(std::string_view name, uint16_t type, uint64_t hash) const
+{
+    bool wildcard;
+    return find(name, type, hash, wildcard);
+}
+
+uint32_t DNSNameTree::find(std::string_view name, uint16_t type) const
+{
+    return find(name, type, DNSNameIndex::hash(name, type));
+}
+
+void DNSNameTree::addNodes(std::string_view name)
+{
+    size_t starts[MAX_LABELS];
+    const size_t labels = labelStarts(name, starts, MAX_LABELS);
+    for (size_t i = 0; i < labels; ++i)
+    {
+        bool added;
+        const uint32_t node = nodes.insert(name.substr(starts[i]), 0, added);
+        if (node >= node_refs.size())
+        {
+            node_refs.resize(node + 1);
+        }
+        node_refs[node] = added ? 1 : node_refs[node] + 1;
+    }
+}
+
+uint32_t DNSNameTree::insert(std::string_view name, uint16_t type, bool& inserted)
+{
+    size_t starts[MAX_LABELS];
+    labelStarts(name, starts, MAX_LABELS); // throws before anything changes
+    const uint32_t id = records.insert(name, type, inserted);
+    if (!inserted)
+    {
+        return id;
+    }
+    ownRefs();
+    if (isWildcard(name) && wildcard_count++ == 0)
+    {
+        // the first wildcard: the nodes of every name, this one's included
+        records.forEach([this](std::string_view key, uint16_t, uint32_t) {
+            addNodes(DNSNameIndex::name(key));
+        });
+    }
+    else if (wildcard_count > 0)
+    {
+        addNodes(name);
+    }
+    return id;
+}
+
+uint32_t DNSNameTree::erase(std::string_view name, uint16_t type)
+{
+    const uint32_t id = records.erase(name, type);
+    if (id == NOT_FOUND || wildcard_count == 0)
+    {
+        return id;
+    }
+    ownRefs();
+    if (isWildcard(name) && --wildcard_count == 0)
+    {
+        // the last wildcard: nothing searches the nodes any more
+        nodes = DNSNameIndex();
+        std::vector<uint32_t>().swap(node_refs);
+        return id;
+    }
+    size_t starts[MAX_LABELS];
+    const size_t labels = labelStarts(name, starts, MAX_LABELS);
+    for (size_t i = 0; i < labels; ++i)
+    {
+        const std::string_view suffix = name.substr(starts[i]);
+        const uint32_t node = nodes.find(suffix, 0);
+        if (node < node_refs.size() && --node_refs[node] == 0) // else a damaged image
+        {
+            nodes.erase(suffix, 0);
+        }
+    }
+    return id;
+}
+
+size_t DNSNameTree::size() const
+{
+    return records.size();
+}
+
+size_t DNSNameTree::wildcards() const
+{
+    return wildcard_count;
+}
+
+void DNSNameTree::clear()
+{
+    records.clear();
+    nodes.clear();
+    node_refs.clear();
+    mapped_refs = nullptr;
+    mapped_ref_count = 0;
+    wildcard_count = 0;
+}
+
+void DNSNameTree::save(std::vector<uint8_t>& out) const
+{
+    records.save(out);
+    nodes.save(out);
+    const uint32_t* refs = mapped_refs ? mapped_refs : node_refs.data();
+    const uint64_t header[] = { wildcard_count, mapped_refs ? mapped_ref_count : node_refs.size() };
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(header);
+    out.insert(out.end(), bytes, bytes + sizeof(header));
+    bytes = reinterpret_cast<const uint8_t*>(refs);
+    out.insert(out.end(), bytes, bytes + header[1] * sizeof(uint32_t));
+    out.resize((out.size() + 7) & ~size_t(7));
+}
+
+const uint8_t* DNSNameTree::map(const uint8_t* data, const uint8_t* end)
+{
+    data = records.map(data, end);
+    data = nodes.map(data, end);
+    uint64_t header[2];
+    if (static_cast<size_t>(end - data) < sizeof(header))
+    {
+        throw std::runtime_error("Zone image is truncated");
+    }
+    memcpy(header, data, sizeof(header));
+    data += sizeof(header);
+    const size_t refs_size = (header[1] * sizeof(uint32_t) + 7) & ~size_t(7);
+    if (header[1] > (1ull << 40) || static_cast<size_t>(end - data) < refs_size)
+    {
+        throw std::runtime_error("Zone image is truncated");
+    }
+    node_refs.clear();
+    mapped_refs = reinterpret_cast<const uint32_t*>(data);
+    mapped_ref_count = header[1];
+    wildcard_count = header[0];
+    return data + refs_size;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dns_index.h"
+
+// The zone's names as a label-reversed tree: (name, qtype) records plus,
+// while the zone has wildcards, every owner name and its ancestors (empty
+// non-terminals included) as nodes, both kept in flat DNSNameIndex tables
+// keyed by the whole suffix. Without wildcards each owner name is stored
+// once; the first wildcard builds the nodes from the records.
+// Exact matches cost one probe. A miss in a zone with wildcards finds the
+// closest encloser by binary search over the suffix length (a suffix
+// exists only if all shorter ones do), then looks for the `*` record
+// below it, as RFC 4592 has it. Like DNSNameIndex, a tree can be saved into
+// a zone image and used in place from a mapping. Not thread-safe.
+class DNSNameTree
+{
+public:
+    static constexpr uint32_t NOT_FOUND = DNSNameIndex::NOT_FOUND;
+
+    DNSNameTree();
+
+    // Id of the record answering (name, type): the exact one, else the
+    // wildcard of the closest encloser (`wildcard` is set then).
+    uint32_t find(std::string_view name, uint16_t type, uint64_t hash, bool& wildcard) const;
+    uint32_t find(std::string_view name, uint16_t type, uint64_t hash) const;
+    uint32_t find(std::string_view name, uint16_t type) const;
+    // Only the wildcard part of find(), for callers that know there is no
+    // exact record.
+    uint32_t findWildcard(std::string_view name, uint16_t type) const;
+
+    // Same contract as DNSNameIndex: dense ids, reused after erase().
+    uint32_t insert(std::string_view name, uint16_t type, bool& inserted);
+    uint32_t erase(std::string_view name, uint16_t type);
+
+    size_t size() const;
+    size_t wildcards() const;
+    void clear();
+
+    // Calls f(hash) with the DNSNameIndex hash of every (name, type).
+    template <typename F>
+    void forEachHash(F f) const
+    {
+        records.forEachHash(f);
+    }
+    // Calls f(key, type, id) for every record, see DNSNameIndex::forEach().
+    template <typename F>
+    void forEach(F f) const
+    {
+        records.forEach(f);
+    }
+
+    void save(std::vector<uint8_t>& out) const;
+    const uint8_t* map(const uint8_t* data, const uint8_t* end);
+
+private:
+    static bool isWildcard(std::string_view name);
+    static size_t labelStarts(std::string_view name, size_t* starts, size_t max);
+    bool exists(std::string_view name, const size_t* starts, size_t labels, size_t suffix) const;
+    void addNodes(std::string_view name);
+    void ownRefs();
+
+    DNSNameIndex records;           // (owner, qtype) -> record id
+    DNSNameIndex nodes;             // (name, 0) -> node id, for every name that exists; empty without wildcards
+    std::vector<uint32_t> node_refs;    // records at or below each node
+    const uint32_t* mapped_refs;    // node_refs of a mapped image, copied on the first change
+    size_t mapped_ref_count;
+    size_t wildcard_count;          // records owned by a `*` label
+};
@@ -0,0 +1,197 @@
+#include "dns_udp.h"
+
+#include <cstring>
+
+#include "dns_consts.h"
+
+DNSUdpBatch::DNSUdpBatch(size_t capacity)
+    : received(0)
+    , requests(capacity * UDP_SIZE, 0)
+    , sizes(capacity, 0)
+    , clients(capacity)
+    , responses(capacity)
+#ifdef __linux__
+    , in_iov(capacity)
+    , in_msgs(capacity)
+    , out_iov(capacity)
+    , out_msgs(capacity)
+    , out_index(capacity)
+#endif
+{
+#ifdef __linux__
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        in_iov[i].iov_base = &requests[i * UDP_SIZE];
+        in_iov[i].iov_len = UDP_SIZE;
+    }
+#endif
+}
+
+size_t DNSUdpBatch::capacity() const
+{
+    return sizes.size();
+}
+
+size_t DNSUdpBatch::count() const
+{
+    return received;
+}
+
+const uint8_t* DNSUdpBatch::request(size_t i) const
+{
+    return &requests[i * UDP_SIZE];
+}
+
+size_t DNSUdpBatch::requestSize(size_t i) const
+{
+    return sizes[i];
+}
+
+const sockaddr_in& DNSUdpBatch::client(size_t i) const
+{
+    return clients[i];
+}
+
+DNSBuffer& DNSUdpBatch::response(size_t i)
+{
+    return responses[i];
+}
+
+size_t DNSUdpBatch::receive(SOCKET s)
+{
+    received = 0;
+#ifdef __linux__
+    for (size_t i = 0; i < in_msgs.size(); ++i)
+    {
+        memset(&in_msgs[i], 0, sizeof(in_msgs[i]));
+        in_msgs[i].msg_hdr.msg_name = &clients[i];
+        in_msgs[i].msg_hdr.msg_namelen = sizeof(clients[i]);
+        in_msgs[i].msg_hdr.msg_iov = &in_iov[i];
+        in_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int result = recvmmsg(s, &in_msgs[0], static_cast<unsigned>(in_msgs.size()), MSG_DONTWAIT, nullptr);
+    if (result <= 0)
+    {
+        // recvmmsg error: just ignore
+        return 0;
+    }
+    received = static_cast<size_t>(result);
+    for (size_t i = 0; i < received; ++i)
+    {
+        sizes[i] = in_msgs[i].msg_len;
+    }
+#else
+    while (received < sizes.size())
+    {
+        socklen_t slen = sizeof(clients[received]);
+        char* message = reinterpret_cast<char*>(&requests[received * UDP_SIZE]);
+        int msg_len = recvfrom(s, message, UDP_SIZE, 0, (sockaddr*)&clients[received], &slen);
+        if (msg_len <= 0)
+        {
+            // recvfrom error or nothing left: just stop
+            break;
+        }
+        sizes[received++] = static_cast<size_t>(msg_len);
+    }
+#endif
+    for (size_t i = 0; i < received; ++i)
+    {
+        responses[i].clear();
+    }
+    return received;
+}
+
+size_t DNSUdpBatch::send(SOCKET s)
+{
+#ifdef __linux__
+    size_t pending = 0;
+    for (size_t i = 0; i < received; ++i)
+    {
+        if (responses[i].result.empty())
+        {
+            continue;
+        }
+        out_iov[pending].iov_base = &responses[i].result[0];
+        out_iov[pending].iov_len = responses[i].result.size();
+        memset(&out_msgs[pending], 0, sizeof(out_msgs[pending]));
+        out_msgs[pending].msg_hdr.msg_name = &clients[i];
+        out_msgs[pending].msg_hdr.msg_namelen = sizeof(clients[i]);
+        out_msgs[pending].msg_hdr.msg_iov = &out_iov[pending];
+        out_msgs[pending].msg_hdr.msg_iovlen = 1;
+        out_index[pending] = i;
+        ++pending;
+    }
+    size_t sent = 0;
+    while (sent < pending)
+    {
+        int result = sendmmsg(s, &out_msgs[sent], static_cast<unsigned>(pending - sent), MSG_DONTWAIT);
+        if (result <= 0)
+        {
+            if (socketwouldblock())
+            {
+                return out_index[sent];
+            }
+            ++sent; // this reply failed for good: drop it
+            continue;
+        }
+        sent += static_cast<size_t>(result);
+    }
+    return received;
+#else
+    for (size_t i = 0; i < received; ++i)
+    {
+        const auto& result = responses[i].result;
+        if (result.empty())
+        {
+            continue;
+        }
+        int slen = sizeof(clients[i]);
+        if (sendto(s, reinterpret_cast<const char*>(&result[0]), static_cast<int>(result.size()), 0, (const sockaddr*)&clients[i], slen) < 0
+            && socketwouldblock())
+        {
+            return i;
+        }
+    }
+    return received;
+#endif
+}
+
+DNSUdpQueue::DNSUdpQueue(size_t capacity)
+    : capacity(capacity)
+{}
+
+bool DNSUdpQueue::push(const sockaddr_in& client, const std::vector<uint8_t>& data)
+{
+    if (datagrams.size() >= capacity)
+    {
+        return false;
+    }
+    datagrams.push_back(Datagram{ client, data });
+    return true;
+}
+
+bool DNSUdpQueue::flush(SOCKET s)
+{
+    while (!datagrams.empty())
+    {
+        const Datagram& front = datagrams.front();
+        int slen = sizeof(front.client);
+        if (sendto(s, reinterpret_cast<const char*>(&front.data[0]), static_cast<int>(front.data.size()), 0, (const sockaddr*)&front.client, slen) < 0
+            && socketwouldblock())
+        {
+            return false;
+        }
+        datagrams.pop_front();
+    }
+    return true;
+}
+
+bool DNSUdpQueue::empty() const
+{
+    return datagrams.empty();
+}
+
+size_t DNSUdpQueue::size() const
+{
+    return datagrams.size();
+}
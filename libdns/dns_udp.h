@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#if defined(_WIN32)
+#include <WinSock2.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#include "dns_socket.h"
+#include "dns_buffer.h"
+
+// Receives up to `capacity` datagrams per call and sends the replies back
+// in one go: recvmmsg/sendmmsg on Linux, a recvfrom/sendto loop elsewhere.
+class DNSUdpBatch
+{
+public:
+    DNSUdpBatch(size_t capacity);
+
+    DNSUdpBatch(const DNSUdpBatch&) = delete;
+    DNSUdpBatch& operator=(const DNSUdpBatch&) = delete;
+
+    size_t capacity() const;
+
+    // Reads the datagrams already queued on the socket, returns their number.
+    // Responses of the previous batch are dropped.
+    size_t receive(SOCKET s);
+
+    const uint8_t* request(size_t i) const;
+    size_t requestSize(size_t i) const;
+    const sockaddr_in& client(size_t i) const;
+
+    // Reply for datagram i; a reply left empty is not sent.
+    DNSBuffer& response(size_t i);
+
+    // Sends all non-empty replies, returns the index of the first reply that
+    // could not be sent because the socket would block (count() when
+    // everything went out). Replies failing with any other error are dropped.
+    size_t send(SOCKET s);
+
+    size_t count() const;
+
+private:
+    size_t received;
+    std::vector<uint8_t> requests;
+    std::vector<size_t> sizes;
+    std::vector<sockaddr_in> clients;
+    std::vector<DNSBuffer> responses;
+#ifdef __linux__
+    std::vector<iovec> in_iov;
+    std::vector<mmsghdr> in_msgs;
+    std::vector<iovec> out_iov;
+    std::vector<mmsghdr> out_msgs;
+    std::vector<size_t> out_index;
+#endif
+};
+
+// Replies that did not fit into the socket send buffer, waiting for the
+// socket to become writable. Holds at most `capacity` datagrams.
+class DNSUdpQueue
+{
+public:
+    DNSUdpQueue(size_t capacity);
+
+    // Returns false (and keeps nothing) when the queue is full.
+    bool push(const sockaddr_in& client, const std::vector<uint8_t>& data);
+
+    // Sends queued replies until the socket would block, returns true when
+    // the queue is empty afterwards.
+    bool flush(SOCKET s);
+
+    bool empty() const;
+    size_t size() const;
+
+private:
+    struct Datagram
+    {
+        sockaddr_in client;
+        std::vector<uint8_t> data;
+    };
+
+    size_t capacity;
+    std::deque<Datagram> datagrams;
+};
@@ -0,0 +1,858 @@
+#include "dns_uring.h"
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "dns_consts.h"
+#include "dns_header.h"
+#include "dns_buffer.h"
+#include "dns_utils.h"
+
+static const unsigned RING_ENTRIES = 256;
+static const unsigned BUF_COUNT = 256;      // must be a power of 2
+static const size_t BUF_SIZE = 2048;        // recvmsg_out + sockaddr + datagram
+static const uint16_t BUF_GROUP = 0;
+
+// as in the selector loop: every answer fits into an empty output ring, a
+// query must fit into the input ring
+static const size_t TCP_INPUT_SIZE = 16384;
+static const size_t TCP_OUTPUT_SIZE = sizeof(uint16_t) + 0xFFFF;
+
+enum UringOp : uint64_t
+{
+    OP_UDP_RECV = 1,
+    OP_UDP_SEND,
+    OP_ACCEPT,
+    OP_TCP_RECV,
+    OP_TCP_SEND,
+    OP_TCP_CLOSE,
+    OP_CANCEL,
+    OP_WAKE,
+};
+
+static uint64_t makeUserData(UringOp op, uint32_t index)
+{
+    return (static_cast<uint64_t>(op) << 32) | index;
+}
+
+DNSUring::TcpConnection::TcpConnection()
+    : input(TCP_INPUT_SIZE)
+    , output(TCP_OUTPUT_SIZE)
+    , iov{}
+    , msg{}
+    , receiving(false)
+    , shut(false)
+    , closing(false)
+    , deadline(TcpDeadline::None)
+    , idle_prev(nullptr)
+    , idle_next(nullptr)
+{}
+
+void DNSUring::TcpConnection::reset()
+{
+    input.clear();
+    output.clear();
+    receiving = false;
+    shut = false;
+    closing = false;
+    deadline = TcpDeadline::None;
+    idle_prev = nullptr;
+    idle_next = nullptr;
+}
+
+DNSUring::DNSUring(IQueryProcessor* processor, const DNSServerSettings& settings, size_t tcp_limit, DNSLoopStats& stats)
+    : processor(processor)
+    , settings(settings)
+    , tcp_pipeline(std::max<size_t>(settings.tcp_pipeline, 1u))
+    , tcp_limit(tcp_limit)
+    , stats(stats)
+    , udp(INVALID_SOCKET)
+    , tcp(INVALID_SOCKET)
+    , wakefd(eventfd(0, EFD_CLOEXEC))
+    , wake_value(0)
+    , ring_fd(-1)
+    , ring_ptr(MAP_FAILED)
+    , ring_size(0)
+    , sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+    , sqes_size(0)
+    , sq_entries(0)
+    , sq_head(nullptr)
+    , sq_tail(nullptr)
+    , sq_mask(nullptr)
+    , sq_array(nullptr)
+    , sq_local_tail(0)
+    , cq_head(nullptr)
+    , cq_tail(nullptr)
+    , cq_mask(nullptr)
+    , cqes(nullptr)
+    , buf_ring(static_cast<io_uring_buf_ring*>(MAP_FAILED))
+    , buf_ring_size(0)
+    , buf_ring_tail(0)
+    , recv_msg{}
+    , unsupported(false)
+    , draining(false)
+    , stopping(false)
+    , inflight(0)
+    , udp_received(0)
+    , tcp_accepted(0)
+    , timers(this)
+    , tcp_live(0)
+    , tcp_open(0)
+    , idle_head(nullptr)
+    , idle_tail(nullptr)
+    , tcp_query(0xFFFF)
+{}
+
+DNSUring::~DNSUring()
+{
+    teardown();
+    if (wakefd >= 0)
+    {
+        close(wakefd);
+    }
+}
+
+void DNSUring::wakeup()
+{
+    uint64_t value = 1;
+    ssize_t res = write(wakefd, &value, sizeof(value));
+    (void)res; // the counter is already non-zero if this fails
+}
+
+bool DNSUring::setup()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = RING_ENTRIES * 4;
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+    if (ring_fd < 0)
+    {
+        return false;
+    }
+    // EXT_ARG: waits time out when the next deadline is due
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_EXT_ARG))
+    {
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring_size = std::max(sq_size, cq_size);
+    ring_ptr = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (ring_ptr == MAP_FAILED)
+    {
+        return false;
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    uint8_t* ptr = static_cast<uint8_t*>(ring_ptr);
+    sq_entries = params.sq_entries;
+    sq_head = reinterpret_cast<unsigned*>(ptr + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(ptr + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(ptr + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(ptr + params.sq_off.array);
+    sq_local_tail = *sq_tail;
+    cq_head = reinterpret_cast<unsigned*>(ptr + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(ptr + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(ptr + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(ptr + params.cq_off.cqes);
+
+    return setupBufferRing();
+}
+
+bool DNSUring::setupBufferRing()
+{
+    buf_ring_size = BUF_COUNT * sizeof(io_uring_buf);
+    buf_ring = static_cast<io_uring_buf_ring*>(mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (buf_ring == MAP_FAILED)
+    {
+        return false;
+    }
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        return false;
+    }
+
+    buffers.assign(BUF_COUNT * BUF_SIZE, 0);
+    buf_ring_tail = 0;
+    for (uint16_t bid = 0; bid < BUF_COUNT; ++bid)
+    {
+        returnBuffer(bid);
+    }
+    return true;
+}
+
+void DNSUring::teardown()
+{
+    for (size_t fd = 0; fd < connections.size(); ++fd)
+    {
+        TcpConnection* conn = connections[fd];
+        if (conn)
+        {
+            if (!conn->closing)
+            {
+                releaseTcp(*conn);
+                closesocket(static_cast<SOCKET>(fd));
+            }
+            connections[fd] = nullptr;
+            tcp_free.push_back(conn);
+        }
+    }
+    tcp_live = 0;
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqes_size);
+        sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    }
+    if (ring_ptr != MAP_FAILED)
+    {
+        munmap(ring_ptr, ring_size);
+        ring_ptr = MAP_FAILED;
+    }
+    if (ring_fd >= 0)
+    {
+        // closing the ring cancels all outstanding requests
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (buf_ring != MAP_FAILED)
+    {
+        munmap(buf_ring, buf_ring_size);
+        buf_ring = static_cast<io_uring_buf_ring*>(MAP_FAILED);
+    }
+}
+
+void DNSUring::reserveSqes(unsigned count)
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sq_local_tail + count - head > sq_entries)
+    {
+        // the kernel consumes all published entries during io_uring_enter
+        submit(0, -1);
+    }
+}
+
+io_uring_sqe* DNSUring::getSqe()
+{
+    reserveSqes(1);
+    unsigned index = sq_local_tail & *sq_mask;
+    sq_array[index] = index;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ++sq_local_tail;
+    ++inflight;
+    return sqe;
+}
+
+int DNSUring::submit(unsigned wait, int timeout_ms)
+{
+    unsigned to_submit = sq_local_tail - *sq_tail;
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0u;
+    if (wait == 0 || timeout_ms < 0)
+    {
+        long ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait, flags, nullptr, 0);
+        return ret < 0 ? -errno : static_cast<int>(ret);
+    }
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    long ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    return ret < 0 ? -errno : static_cast<int>(ret);
+}
+
+void DNSUring::returnBuffer(uint16_t bid)
+{
+    // not buf_ring->bufs: in C++ its flex-array wrapper shifts the entries by 8 bytes
+    io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(buf_ring) + (buf_ring_tail & (BUF_COUNT - 1));
+    buf->addr = reinterpret_cast<uint64_t>(&buffers[bid * BUF_SIZE]);
+    buf->len = static_cast<uint32_t>(BUF_SIZE);
+    buf->bid = bid;
+    ++buf_ring_tail;
+    __atomic_store_n(&buf_ring->tail, buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+void DNSUring::postWakeRead()
+{
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakefd;
+    sqe->addr = reinterpret_cast<uint64_t>(&wake_value);
+    sqe->len = sizeof(wake_value);
+    sqe->user_data = makeUserData(OP_WAKE, 0);
+}
+
+void DNSUring::postRecvmsg()
+{
+    memset(&recv_msg, 0, sizeof(recv_msg));
+    recv_msg.msg_namelen = sizeof(sockaddr_in);
+
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = udp;
+    sqe->addr = reinterpret_cast<uint64_t>(&recv_msg);
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = makeUserData(OP_UDP_RECV, 0);
+}
+
+void DNSUring::postAccept()
+{
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = tcp;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = makeUserData(OP_ACCEPT, 0);
+}
+
+void DNSUring::postTcpRecv(SOCKET s, TcpConnection& conn)
+{
+    // the input ring always has room here: a query that can never fit
+    // closes the connection and a complete one is answered first
+    size_t len = 0;
+    uint8_t* tail = conn.input.tail(len);
+    conn.receiving = true;
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = s;
+    sqe->addr = reinterpret_cast<uint64_t>(tail);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->user_data = makeUserData(OP_TCP_RECV, static_cast<uint32_t>(s));
+}
+
+void DNSUring::postTcpClose(SOCKET s, TcpConnection& conn)
+{
+    releaseTcp(conn);
+    conn.closing = true;
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = s;
+    sqe->user_data = makeUserData(OP_TCP_CLOSE, static_cast<uint32_t>(s));
+}
+
+void DNSUring::postCancel(uint64_t user_data)
+{
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = user_data;
+    sqe->user_data = makeUserData(OP_CANCEL, 0);
+}
+
+void DNSUring::startDrain()
+{
+    // no new queries: connections waiting for one are closed as their recv
+    // is cancelled, the others once their answers are sent
+    draining = true;
+    postCancel(makeUserData(OP_UDP_RECV, 0));
+    postCancel(makeUserData(OP_ACCEPT, 0));
+    for (size_t fd = 0; fd < connections.size(); ++fd)
+    {
+        if (connections[fd] && connections[fd]->receiving)
+        {
+            postCancel(makeUserData(OP_TCP_RECV, static_cast<uint32_t>(fd)));
+        }
+    }
+}
+
+DNSUring::TcpConnection* DNSUring::openTcp(SOCKET s)
+{
+    TcpConnection* conn;
+    if (tcp_free.empty())
+    {
+        tcp_slab.emplace_back(new TcpConnection);
+        tcp_free.reserve(tcp_slab.size()); // closing never allocates
+        stats.tcp_contexts.add();
+        conn = tcp_slab.back().get();
+    }
+    else
+    {
+        conn = tcp_free.back();
+        tcp_free.pop_back();
+        conn->reset();
+    }
+    if (static_cast<size_t>(s) >= connections.size())
+    {
+        connections.resize(static_cast<size_t>(s) + 1, nullptr);
+    }
+    connections[s] = conn;
+    conn->timer.data = static_cast<uint64_t>(s);
+    ++tcp_live;
+    ++tcp_open;
+    return conn;
+}
+
+DNSUring::TcpConnection* DNSUring::tcpConnection(SOCKET s) const
+{
+    return static_cast<size_t>(s) < connections.size() ? connections[s] : nullptr;
+}
+
+void DNSUring::releaseTcp(TcpConnection& conn)
+{
+    // no longer counts against tcp_limit and has no deadline; the entry
+    // stays in connections until the close completes
+    if (conn.shut || conn.closing)
+    {
+        return;
+    }
+    timers.cancel(conn.timer);
+    unlinkIdle(conn);
+    conn.deadline = TcpDeadline::None;
+    --tcp_open;
+}
+
+void DNSUring::shutTcp(SOCKET s, TcpConnection& conn)
+{
+    // the recv or send pending on the connection completes (with 0 or an
+    // error) and its handler posts the close
+    releaseTcp(conn);
+    conn.shut = true;
+    shutdown(s, SHUT_RDWR);
+}
+
+void DNSUring::unlinkIdle(TcpConnection& conn)
+{
+    if (conn.deadline != TcpDeadline::Idle)
+    {
+        return;
+    }
+    (conn.idle_prev ? conn.idle_prev->idle_next : idle_head) = conn.idle_next;
+    (conn.idle_next ? conn.idle_next->idle_prev : idle_tail) = conn.idle_prev;
+    conn.idle_prev = nullptr;
+    conn.idle_next = nullptr;
+}
+
+void DNSUring::updateTcpDeadline(TcpConnection& conn, bool progress)
+{
+    // the selector loop's rules: a deadline starts when the connection enters
+    // a state and is only pushed back by progress
+    TcpDeadline deadline = TcpDeadline::Idle;
+    uint64_t timeout = settings.tcp_idle_timeout;
+    if (!conn.output.empty())
+    {
+        deadline = TcpDeadline::Write;
+        timeout = settings.tcp_write_timeout;
+    }
+    else if (!conn.input.empty())
+    {
+        deadline = TcpDeadline::Read;
+        timeout = settings.tcp_read_timeout;
+    }
+    if (deadline == conn.deadline && !progress)
+    {
+        return;
+    }
+
+    if (deadline != conn.deadline)
+    {
+        unlinkIdle(conn);
+        conn.deadline = deadline;
+        if (deadline == TcpDeadline::Idle)
+        {
+            conn.idle_prev = idle_tail;
+            conn.idle_next = nullptr;
+            (idle_tail ? idle_tail->idle_next : idle_head) = &conn;
+            idle_tail = &conn;
+        }
+    }
+    if (timeout > 0)
+    {
+        timers.schedule(conn.timer, timeout, DNSTimerWheel::now());
+    }
+    else
+    {
+        timers.cancel(conn.timer);
+    }
+}
+
+void DNSUring::timerExpired(DNSTimer& timer)
+{
+    const SOCKET s = static_cast<SOCKET>(timer.data);
+    stats.tcp_timeouts.add();
+    shutTcp(s, *connections[s]);
+}
+
+void DNSUring::answerTcp(SOCKET s, TcpConnection& conn)
+{
+    // answer every complete query already received (up to tcp_pipeline)
+    // and send the answers together
+    size_t answered = 0;
+    while (answered < tcp_pipeline && conn.input.size() >= sizeof(uint16_t))
+    {
+        uint8_t length[sizeof(uint16_t)];
+        conn.input.copy(0, length, sizeof(length));
+        const uint8_t* dataPtr = length;
+        uint16_t expected_size = get_uint16(dataPtr);
+        if (expected_size < sizeof(DNSHeader) || sizeof(uint16_t) + expected_size > TCP_INPUT_SIZE)
+        {
+            // not a query, or one that can never fit: the stream cannot be resynchronized
+            postTcpClose(s, conn);
+            return;
+        }
+        if (conn.input.size() - sizeof(uint16_t) < expected_size)
+        {
+            break; // need more data
+        }
+        const uint8_t* query = conn.input.contiguous(sizeof(uint16_t), expected_size);
+        if (!query)
+        {
+            conn.input.copy(sizeof(uint16_t), &tcp_query[0], expected_size);
+            query = &tcp_query[0];
+        }
+        tcp_answer.clear();
+        tcp_answer.max_size = 0xFFFF; // the most a length prefix can carry
+        processor->processQuery(query, expected_size, tcp_answer);
+        const size_t size = tcp_answer.result.size();
+        if (sizeof(uint16_t) + size > conn.output.space())
+        {
+            break; // the query stays buffered and is answered again once output is sent
+        }
+        length[0] = static_cast<uint8_t>(size >> 8);
+        length[1] = static_cast<uint8_t>(size);
+        conn.output.append(length, sizeof(length));
+        conn.output.append(&tcp_answer.result[0], size);
+        conn.input.consume(sizeof(uint16_t) + expected_size);
+        ++answered;
+    }
+
+    if (conn.output.empty())
+    {
+        if (draining)
+        {
+            postTcpClose(s, conn); // every complete query is answered
+            return;
+        }
+        postTcpRecv(s, conn); // need more data
+        updateTcpDeadline(conn, false);
+        return;
+    }
+    SocketSlice slices[2];
+    size_t count = conn.output.slices(slices);
+    for (size_t i = 0; i < count; ++i)
+    {
+        conn.iov[i].iov_base = const_cast<uint8_t*>(slices[i].data);
+        conn.iov[i].iov_len = slices[i].size;
+    }
+    memset(&conn.msg, 0, sizeof(conn.msg));
+    conn.msg.msg_iov = conn.iov;
+    conn.msg.msg_iovlen = count;
+
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = s;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = makeUserData(OP_TCP_SEND, static_cast<uint32_t>(s));
+    updateTcpDeadline(conn, answered > 0);
+}
+
+void DNSUring::onUdpRecv(int res, uint32_t flags)
+{
+    if (res == -EINVAL || res == -EOPNOTSUPP)
+    {
+        unsupported = true;
+        return;
+    }
+    if (res >= 0 && (flags & IORING_CQE_F_BUFFER))
+    {
+        uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        const uint8_t* buf = &buffers[bid * BUF_SIZE];
+        const io_uring_recvmsg_out* out = reinterpret_cast<const io_uring_recvmsg_out*>(buf);
+        size_t offset = sizeof(io_uring_recvmsg_out) + recv_msg.msg_namelen + recv_msg.msg_controllen;
+        size_t len = offset <= static_cast<size_t>(res) ? std::min(static_cast<size_t>(out->payloadlen), static_cast<size_t>(res) - offset) : 0;
+        // datagrams too short to be a query are dropped
+        if (len >= sizeof(DNSHeader) && out->namelen >= sizeof(sockaddr_in))
+        {
+            const uint8_t* payload = buf + offset;
+
+            if (free_replies.empty())
+            {
+                free_replies.push_back(static_cast<uint32_t>(replies.size()));
+                replies.emplace_back(new UdpReply);
+            }
+            uint32_t index = free_replies.back();
+            free_replies.pop_back();
+            UdpReply& reply = *replies[index];
+            memcpy(&reply.client, buf + sizeof(io_uring_recvmsg_out), sizeof(reply.client));
+
+            reply.buf.clear();
+            reply.buf.max_size = UDP_SIZE;
+            processor->processQuery(payload, len, reply.buf);
+            ++udp_received;
+
+            reply.iov.iov_base = &reply.buf.result[0];
+            reply.iov.iov_len = reply.buf.result.size();
+            memset(&reply.msg, 0, sizeof(reply.msg));
+            reply.msg.msg_name = &reply.client;
+            reply.msg.msg_namelen = sizeof(reply.client);
+            reply.msg.msg_iov = &reply.iov;
+            reply.msg.msg_iovlen = 1;
+
+            io_uring_sqe* sqe = getSqe();
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = udp;
+            sqe->addr = reinterpret_cast<uint64_t>(&reply.msg);
+            sqe->len = 1;
+            sqe->user_data = makeUserData(OP_UDP_SEND, index);
+        }
+        returnBuffer(bid);
+    }
+    if (!(flags & IORING_CQE_F_MORE) && !stopping && !draining)
+    {
+        postRecvmsg();
+    }
+}
+
+void DNSUring::onUdpSend(uint32_t index)
+{
+    free_replies.push_back(index);
+}
+
+void DNSUring::onAccept(int res, uint32_t flags)
+{
+    if (res == -EINVAL || res == -EOPNOTSUPP)
+    {
+        unsupported = true;
+        return;
+    }
+    if (res >= 0 && (stopping || draining))
+    {
+        closesocket(static_cast<SOCKET>(res));
+    }
+    else if (res >= 0)
+    {
+        SOCKET s = static_cast<SOCKET>(res);
+        ++tcp_accepted;
+        if (tcp_limit > 0 && tcp_open >= tcp_limit)
+        {
+            if (!idle_head)
+            {
+                // every connection is busy: refuse the new one
+                stats.tcp_refused.add();
+                closesocket(s);
+                s = INVALID_SOCKET;
+            }
+            else
+            {
+                // make room by shedding the connection idle for the longest time
+                stats.tcp_shed.add();
+                const SOCKET idle = static_cast<SOCKET>(idle_head->timer.data);
+                shutTcp(idle, *idle_head);
+            }
+        }
+        if (s != INVALID_SOCKET)
+        {
+            TcpConnection& conn = *openTcp(s);
+            postTcpRecv(s, conn);
+            updateTcpDeadline(conn, false);
+        }
+    }
+    if (!(flags & IORING_CQE_F_MORE) && !stopping && !draining)
+    {
+        postAccept();
+    }
+}
+
+void DNSUring::onTcpRecv(SOCKET s, int res)
+{
+    TcpConnection* conn = tcpConnection(s);
+    if (!conn || stopping)
+    {
+        return; // teardown() closes the connection
+    }
+    conn->receiving = false;
+    if (res <= 0 || conn->shut)
+    {
+        // error, close connection, shut down or cancelled by a drain: every
+        // complete query is answered already
+        postTcpClose(s, *conn);
+        return;
+    }
+    conn->input.commit(static_cast<size_t>(res));
+    answerTcp(s, *conn);
+}
+
+void DNSUring::onTcpSend(SOCKET s, int res)
+{
+    TcpConnection* conn = tcpConnection(s);
+    if (!conn || stopping)
+    {
+        return; // teardown() closes the connection
+    }
+    if (res < static_cast<int>(conn->output.size()) || conn->shut)
+    {
+        postTcpClose(s, *conn);
+        return;
+    }
+    conn->output.clear();
+    answerTcp(s, *conn);
+}
+
+void DNSUring::onTcpClose(SOCKET s, int res)
+{
+    if (res == -ECANCELED)
+    {
+        // cancelled on shutdown before it ran
+        closesocket(s);
+    }
+    TcpConnection* conn = tcpConnection(s);
+    if (conn)
+    {
+        connections[s] = nullptr;
+        tcp_free.push_back(conn);
+        --tcp_live;
+    }
+}
+
+bool DNSUring::processCompletions()
+{
+    unsigned head = *cq_head;
+    bool processed = false;
+    udp_received = 0;
+    tcp_accepted = 0;
+    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        io_uring_cqe cqe = cqes[head & *cq_mask];
+        ++head;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        processed = true;
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            --inflight;
+        }
+
+        uint32_t index = static_cast<uint32_t>(cqe.user_data);
+        switch (static_cast<UringOp>(cqe.user_data >> 32))
+        {
+        case OP_UDP_RECV:
+            onUdpRecv(cqe.res, cqe.flags);
+            break;
+        case OP_UDP_SEND:
+            onUdpSend(index);
+            break;
+        case OP_ACCEPT:
+            onAccept(cqe.res, cqe.flags);
+            break;
+        case OP_TCP_RECV:
+            onTcpRecv(static_cast<SOCKET>(index), cqe.res);
+            break;
+        case OP_TCP_SEND:
+            onTcpSend(static_cast<SOCKET>(index), cqe.res);
+            break;
+        case OP_TCP_CLOSE:
+            onTcpClose(static_cast<SOCKET>(index), cqe.res);
+            break;
+        case OP_CANCEL:
+            break;
+        case OP_WAKE:
+            if (!stopping)
+            {
+                postWakeRead();
+            }
+            break;
+        }
+    }
+    if (udp_received > 0)
+    {
+        stats.udp_batches.add(udp_received);
+    }
+    if (tcp_accepted > 0)
+    {
+        stats.tcp_accepts.add(tcp_accepted);
+    }
+    return processed;
+}
+
+bool DNSUring::run(SOCKET udp, SOCKET tcp, const std::atomic<bool>& canExit, const std::atomic<bool>& drain)
+{
+    this->udp = udp;
+    this->tcp = tcp;
+    unsupported = false;
+    draining = false;
+
+    if (wakefd < 0 || !setup())
+    {
+        teardown();
+        return false;
+    }
+
+    postWakeRead();
+    postRecvmsg();
+    postAccept();
+    if (submit(0, -1) < 0)
+    {
+        teardown();
+        return false;
+    }
+    // kernels without multishot recvmsg/accept reject them right at submission
+    processCompletions();
+    if (unsupported)
+    {
+        teardown();
+        return false;
+    }
+
+    while (!canExit && !(draining && tcp_live == 0))
+    {
+        if (drain && !draining)
+        {
+            startDrain();
+        }
+        int ret = submit(1, timers.timeout(DNSTimerWheel::now()));
+        if (ret < 0 && ret != -EINTR && ret != -EBUSY && ret != -ETIME)
+        {
+            teardown();
+            throw std::runtime_error("io_uring_enter failed");
+        }
+        processCompletions();
+        timers.advance(DNSTimerWheel::now());
+    }
+
+    // Cancel everything left and wait for it: a pending request keeps its socket
+    // alive after closesocket(), so a server restarted on the same port could
+    // lose datagrams to the old one. The cancellation catches UDP replies and
+    // TCP answers still being sent too: stop() drops them, only drain() waits
+    // for the answers.
+    stopping = true;
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = makeUserData(OP_CANCEL, 0);
+    while (inflight > 0)
+    {
+        int ret = submit(1, -1);
+        if (ret < 0 && ret != -EINTR && ret != -EBUSY)
+        {
+            break;
+        }
+        processCompletions();
+    }
+    teardown();
+    return true;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "dns.h"
+#include "dns_socket.h"
+#include "dns_buffer.h"
+#include "dns_processor.h"
+#include "dns_ring.h"
+#include "dns_stats.h"
+#include "dns_timer.h"
+
+// io_uring serving engine: multishot recvmsg on the UDP socket (into a
+// provided buffer ring), multishot accept on the TCP listener and persistent
+// TCP connections whose pipelined queries are answered with one send.
+// Connections get the same deadlines, cap (tcp_limit, this worker's share of
+// max_connections) and counters as the selector loop.
+class DNSUring: private ITimerHandler
+{
+public:
+    DNSUring(IQueryProcessor* processor, const DNSServerSettings& settings, size_t tcp_limit, DNSLoopStats& stats);
+    ~DNSUring();
+
+    DNSUring(const DNSUring&) = delete;
+    DNSUring& operator=(const DNSUring&) = delete;
+
+    // Serves both sockets until canExit becomes true, which cancels whatever
+    // is pending, or until drain becomes true and then every connection has
+    // sent its answers and closed: the UDP receive and the accept are
+    // cancelled and no connection reads again, but pending sends complete.
+    // Returns false before serving if the kernel can't run the engine (no
+    // io_uring, no provided buffer rings or no multishot support); the
+    // caller should then fall back to DNSSelector.
+    bool run(SOCKET udp, SOCKET tcp, const std::atomic<bool>& canExit, const std::atomic<bool>& drain);
+
+    // Makes run() re-check canExit and drain. Thread-safe.
+    void wakeup();
+
+private:
+    struct UdpReply
+    {
+        DNSBuffer buf;              // cleared and reused for each datagram
+        sockaddr_in client;
+        iovec iov;
+        msghdr msg;
+    };
+
+    enum class TcpDeadline
+    {
+        None,
+        Idle,       // waiting for the next query
+        Read,       // a query is partially received
+        Write,      // answers wait for the client to read them
+    };
+
+    // Connections live in a slab and are reused, buffers included, by
+    // later connections.
+    struct TcpConnection
+    {
+        DNSRingBuffer input;            // received bytes not parsed yet
+        DNSRingBuffer output;           // length-prefixed answers being sent
+        iovec iov[2];                   // output slices of the pending send
+        msghdr msg;
+        bool receiving;                 // a recv is pending
+        bool shut;                      // shut down by a deadline or to make room
+        bool closing;                   // the close is posted
+        TcpDeadline deadline;           // what `timer` is counting down
+        DNSTimer timer;
+        TcpConnection* idle_prev;       // idle connections, oldest first
+        TcpConnection* idle_next;
+        TcpConnection();
+        void reset();
+    };
+
+    bool setup();
+    bool setupBufferRing();
+    void teardown();
+
+    void reserveSqes(unsigned count);
+    struct io_uring_sqe* getSqe();
+    int submit(unsigned wait, int timeout_ms);  // timeout_ms < 0: no timeout
+    bool processCompletions();
+
+    void postWakeRead();
+    void postRecvmsg();
+    void postAccept();
+    void postTcpRecv(SOCKET s, TcpConnection& conn);
+    void postTcpClose(SOCKET s, TcpConnection& conn);
+    void postCancel(uint64_t user_data);
+    void startDrain();
+    void answerTcp(SOCKET s, TcpConnection& conn);
+    void returnBuffer(uint16_t bid);
+
+    TcpConnection* openTcp(SOCKET s);
+    TcpConnection* tcpConnection(SOCKET s) const;
+    void releaseTcp(TcpConnection& conn);
+    void shutTcp(SOCKET s, TcpConnection& conn);
+    void updateTcpDeadline(TcpConnection& conn, bool progress);
+    void unlinkIdle(TcpConnection& conn);
+
+    // ITimerHandler
+    void timerExpired(DNSTimer& timer) override;
+
+    void onUdpRecv(int res, uint32_t flags);
+    void onUdpSend(uint32_t index);
+    void onAccept(int res, uint32_t flags);
+    void onTcpRecv(SOCKET s, int res);
+    void onTcpSend(SOCKET s, int res);
+    void onTcpClose(SOCKET s, int res);
+
+    IQueryProcessor* processor;
+    const DNSServerSettings& settings;
+    size_t tcp_pipeline;        // max queries answered with one send
+    size_t tcp_limit;           // open connections at most, 0: no limit
+    DNSLoopStats& stats;
+    SOCKET udp;
+    SOCKET tcp;
+    int wakefd;                 // eventfd
+    uint64_t wake_value;
+
+    int ring_fd;
+    void* ring_ptr;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned sq_entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_local_tail;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    std::vector<uint8_t> buffers;
+    uint16_t buf_ring_tail;
+    msghdr recv_msg;
+    bool unsupported;
+    bool draining;              // no new queries; exits once tcp_live is 0
+    bool stopping;
+    size_t inflight;            // requests that will still post a CQE
+    size_t udp_received;        // datagrams answered by the current batch of completions
+    size_t tcp_accepted;        // connections accepted by the current batch of completions
+
+    std::vector<std::unique_ptr<UdpReply>> replies;
+    std::vector<uint32_t> free_replies;
+    DNSTimerWheel timers;
+    std::vector<std::unique_ptr<TcpConnection>> tcp_slab;  // every connection ever allocated
+    std::vector<TcpConnection*> tcp_free;
+    std::vector<TcpConnection*> connections;              // indexed by fd, until the close completes
+    size_t tcp_live;            // entries in connections
+    size_t tcp_open;            // connections neither shut nor closing
+    TcpConnection* idle_head;
+    TcpConnection* idle_tail;
+    DNSBuffer tcp_answer;       // reused for every TCP answer
+    std::vector<uint8_t> tcp_query; // a query wrapped around the input ring
+};
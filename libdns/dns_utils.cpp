@@ -1,14 +1,22 @@
 #include "dns_utils.h"
 
 #include <cctype>
+#include <cstring>
 #include <unordered_map>
 #include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
 
 #if defined(_WIN32)
 #include <WinSock2.h>
 #include <WS2tcpip.h>
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 uint8_t get_uint8(const uint8_t*& data)
@@ -20,14 +28,18 @@ uint8_t get_uint8(const uint8_t*& data)
 
 uint16_t get_uint16(const uint8_t*& data)
 {
-    uint16_t val = ntohs(*reinterpret_cast<const uint16_t*>(data));
+    uint16_t val;
+    memcpy(&val, data, sizeof(val)); // packet fields are not aligned
+    val = ntohs(val);
     data += sizeof(uint16_t);
     return val;
 }
 
 uint32_t get_uint32(const uint8_t*& data)
 {
-    uint32_t val = ntohl(*reinterpret_cast<const uint32_t*>(data));
+    uint32_t val;
+    memcpy(&val, data, sizeof(val));
+    val = ntohl(val);
     data += sizeof(uint32_t);
     return val;
 }
@@ -53,42 +65,64 @@ void append_uint32(std::vector<uint8_t>& buf, uint32_t val)
     buf.insert(buf.end(), ptr, ptr + sizeof(val));
 }
 
-std::string get_domain(const uint8_t* const orig, const uint8_t*& data)
+std::string get_domain(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data)
 {
     std::string result;
     const uint8_t* curr = data;
-    bool compressed = false;
-    while (*curr)
+    const uint8_t* next = nullptr;  // after the name's own bytes, once a pointer ends them
+    const uint8_t* limit = data;    // a pointer has to point before the run it ends
+    size_t hops = 0;
+    size_t wire_size = 1;           // the root
+    for (;;)
     {
-        auto type = curr[0] >> 6;
-        if (0 == type)
+        check_size(curr, end, 1);
+        const uint8_t len = curr[0];
+        if (len == 0)
         {
-            auto len = curr[0];
-            std::string label(reinterpret_cast<const char*>(curr + 1), len);
-            result = result.empty() ?
-                label :
-                result.append(".").append(label);
-            curr += static_cast<size_t>(len) + 1u;
-            if (!compressed)
-            {
-                data += static_cast<size_t>(len) + 1u;
-            }
+            break;
         }
-        else if (3 == type)
+        if ((len & 0xC0) == 0xC0)
         {
-            curr = orig + (static_cast<size_t>(curr[0] & 0x3F) << 8) + curr[1];
-            if (!compressed)
+            check_size(curr, end, 2);
+            const size_t target = static_cast<size_t>(len & 0x3F) << 8 | curr[1];
+            if (++hops > MAX_POINTER_HOPS || target >= static_cast<size_t>(limit - orig))
+            {
+                throw std::runtime_error("Malformed compression pointer");
+            }
+            if (!next)
             {
-                data += 2u;
+                next = curr + 2;
             }
-            compressed = true;
+            curr = limit = orig + target;
+            continue;
+        }
+        if ((len & 0xC0) != 0)
+        {
+            throw std::runtime_error("Unsupported label type");
         }
+        wire_size += static_cast<size_t>(len) + 1;
+        if (wire_size > MAX_NAME_SIZE)
+        {
+            throw std::runtime_error("Domain name is too long");
+        }
+        check_size(curr + 1, end, len);
+        if (!result.empty())
+        {
+            result.push_back('.');
+        }
+        result.append(reinterpret_cast<const char*>(curr + 1), len);
+        curr += static_cast<size_t>(len) + 1u;
     }
-    if (!compressed)
+    data = next ? next : curr + 1;
+    return result;
+}
+
+void check_size(const uint8_t* data, const uint8_t* end, size_t size)
+{
+    if (data > end || static_cast<size_t>(end - data) < size)
     {
-        data += 1;
+        throw std::runtime_error("DNS message is truncated");
     }
-    return result;
 }
 
 DNSRecordType StrToRecType(const std::string& str)
@@ -181,3 +215,64 @@ std::string ipv6_to_str(uint8_t const addr[16])
     inet_ntop(AF_INET6, addr, buf, INET_ADDRSTRLEN);
     return std::string(buf);
 }
+
+DNSMappedFile::DNSMappedFile(const std::string& path)
+    : text(nullptr)
+    , text_size(0)
+{
+#ifdef _WIN32
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+    {
+        throw std::runtime_error("Error opening " + path);
+    }
+    buffer.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    text = buffer.data();
+    text_size = buffer.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Error opening " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Error opening " + path);
+    }
+    text_size = static_cast<size_t>(st.st_size);
+    if (text_size > 0)
+    {
+        void* mapping = mmap(nullptr, text_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("mmap() failed for " + path);
+        }
+        madvise(mapping, text_size, MADV_SEQUENTIAL);
+        text = static_cast<const char*>(mapping);
+    }
+    close(fd);
+#endif
+}
+
+DNSMappedFile::~DNSMappedFile()
+{
+#ifndef _WIN32
+    if (text)
+    {
+        munmap(const_cast<char*>(text), text_size);
+    }
+#endif
+}
+
+const char* DNSMappedFile::data() const
+{
+    return text;
+}
+
+size_t DNSMappedFile::size() const
+{
+    return text_size;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -9,7 +10,14 @@ uint8_t get_uint8(const uint8_t*& data);
 uint16_t get_uint16(const uint8_t*& data);
 uint32_t get_uint32(const uint8_t*& data);
 std::string get_string(const uint8_t*& data, size_t len);
-std::string get_domain(const uint8_t* const orig, const uint8_t*& data);
+// Reads the name at `data` in the message starting at `orig` and ending at
+// `end`, following compression pointers. Throws when it is malformed: out
+// of the message, longer than MAX_NAME_SIZE, more than MAX_POINTER_HOPS
+// pointers, a pointer that does not point backwards or an unknown label
+// type.
+std::string get_domain(const uint8_t* const orig, const uint8_t* const end, const uint8_t*& data);
+// Throws unless `size` more bytes follow `data` before `end`.
+void check_size(const uint8_t* data, const uint8_t* end, size_t size);
 
 void append_uint16(std::vector<uint8_t>& buf, uint16_t val);
 void append_uint32(std::vector<uint8_t>& buf, uint32_t val);
@@ -25,3 +33,25 @@ bool str_to_ipv6(const std::string& val, uint8_t out[16]);
 
 std::string ipv4_to_str(uint8_t const addr[4]);
 std::string ipv6_to_str(uint8_t const addr[16]);
+
+// A file mapped read-only for one front-to-back pass (read into memory
+// where there is no mmap). Throws if it cannot be opened.
+class DNSMappedFile
+{
+public:
+    explicit DNSMappedFile(const std::string& path);
+    ~DNSMappedFile();
+
+    DNSMappedFile(const DNSMappedFile&) = delete;
+    DNSMappedFile& operator=(const DNSMappedFile&) = delete;
+
+    const char* data() const;
+    size_t size() const;
+
+private:
+    const char* text;
+    size_t text_size;
+#ifdef _WIN32
+    std::string buffer;
+#endif
+};
@@ -0,0 +1,752 @@
+#include "dns_worker.h"
+
+#if defined(_WIN32)
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include "dns_utils.h"
+#include "dns_header.h"
+#include "dns_buffer.h"
+#include "dns_udp.h"
+#ifdef DNS_ENGINE_URING
+#include "dns_uring.h"
+#endif
+
+// Every answer fits into an empty output ring; a query must fit into the input ring.
+static const size_t TCP_INPUT_SIZE = 16384;
+static const size_t TCP_OUTPUT_SIZE = sizeof(uint16_t) + 0xFFFF;
+
+// Empty receives between two looks at the TCP sockets and timers while busy polling.
+static const unsigned BUSY_POLL_ROUNDS = 32;
+
+static uint64_t microseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+DNSWorker::TcpSocketContext::TcpSocketContext(size_t pipeline)
+    : input(TCP_INPUT_SIZE)
+    , output(TCP_OUTPUT_SIZE)
+    , answers(new size_t[pipeline])
+    , answers_head(0)
+    , answers_count(0)
+    , front_sent(0)
+    , closing(false)
+    , ready(0)
+    , deadline(TcpDeadline::None)
+    , idle_prev(nullptr)
+    , idle_next(nullptr)
+{}
+
+void DNSWorker::TcpSocketContext::reset()
+{
+    input.clear();
+    output.clear();
+    answers_head = 0;
+    answers_count = 0;
+    front_sent = 0;
+    closing = false;
+    ready = 0;
+    deadline = TcpDeadline::None;
+    idle_prev = nullptr;
+    idle_next = nullptr;
+}
+
+DNSWorker::DNSWorker(IQueryProcessor* processor, const DNSServerSettings& settings, const std::string& host, int port, unsigned index, ILogger* logger)
+    : processor(processor)
+    , settings(settings)
+    , address{}
+    , port(port)
+    , index(index)
+    , logger(logger)
+    , selector(this)
+    , socket_udp(INVALID_SOCKET)
+    , socket_tcp(INVALID_SOCKET)
+    , tcp_open(0)
+    , tcp_limit(settings.max_connections ? (settings.max_connections + std::max(settings.workers, 1u) - 1) / std::max(settings.workers, 1u) : 0)
+    , idle_head(nullptr)
+    , idle_tail(nullptr)
+    , timers(this)
+    , tcp_query(0xFFFF)
+    , udp_active(0)
+    , loop_stats(std::max<size_t>(settings.udp_batch, 1u))
+    , canExit(false)
+    , draining(false)
+{
+    if (!host.empty() && !str_to_ipv4(host, address))
+    {
+        throw std::runtime_error("Wrong listen address: " + host);
+    }
+#ifdef DNS_ENGINE_URING
+    if (settings.engine == DNSEngine::Uring)
+    {
+        uring.reset(new DNSUring(processor, settings, tcp_limit, loop_stats));
+    }
+#endif
+}
+
+DNSWorker::~DNSWorker()
+{}
+
+const DNSLoopStats& DNSWorker::stats() const
+{
+    return loop_stats;
+}
+
+void DNSWorker::start()
+{
+    thread = std::thread{ [this] { process(); } };
+}
+
+void DNSWorker::stop()
+{
+    canExit = true;
+    selector.wakeup();
+#ifdef DNS_ENGINE_URING
+    if (uring)
+    {
+        uring->wakeup();
+    }
+#endif
+}
+
+void DNSWorker::drain()
+{
+    draining = true;
+    selector.wakeup();
+#ifdef DNS_ENGINE_URING
+    if (uring)
+    {
+        uring->wakeup();
+    }
+#endif
+}
+
+void DNSWorker::join()
+{
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void DNSWorker::closeTcpSocket(SOCKET s)
+{
+    if (s != INVALID_SOCKET)
+    {
+        selector.removeReadSocket(s);
+        selector.removeWriteSocket(s);
+        TcpSocketContext* ctx = tcpContext(s);
+        if (ctx)
+        {
+            ctx->task.reset();
+            timers.cancel(ctx->timer);
+            unlinkIdle(*ctx);
+            tcp_sockets[s] = nullptr;
+            tcp_free.push_back(ctx);
+            --tcp_open;
+        }
+        closesocket(s);
+    }
+}
+
+void DNSWorker::closeUdpSocket(SOCKET s)
+{
+    if (s != INVALID_SOCKET)
+    {
+        selector.removeReadSocket(s);
+        selector.removeWriteSocket(s);
+        closesocket(s);
+    }
+}
+
+DNSWorker::TcpSocketContext* DNSWorker::openTcpContext(SOCKET s)
+{
+    TcpSocketContext* ctx;
+    if (tcp_free.empty())
+    {
+        tcp_slab.emplace_back(new TcpSocketContext(std::max<size_t>(settings.tcp_pipeline, 1u)));
+        tcp_free.reserve(tcp_slab.size()); // closing never allocates
+        loop_stats.tcp_contexts.add();
+        ctx = tcp_slab.back().get();
+    }
+    else
+    {
+        ctx = tcp_free.back();
+        tcp_free.pop_back();
+        ctx->reset();
+    }
+    if (static_cast<size_t>(s) >= tcp_sockets.size())
+    {
+        tcp_sockets.resize(static_cast<size_t>(s) + 1, nullptr);
+    }
+    tcp_sockets[s] = ctx;
+    ctx->timer.data = static_cast<uint64_t>(s);
+    ++tcp_open;
+    return ctx;
+}
+
+DNSWorker::TcpSocketContext* DNSWorker::tcpContext(SOCKET s) const
+{
+    return static_cast<size_t>(s) < tcp_sockets.size() ? tcp_sockets[s] : nullptr;
+}
+
+void DNSWorker::acceptTcpSocket(SOCKET s)
+{
+    // drain the whole accept queue: a burst costs one wakeup, not one per client
+    size_t accepted = 0;
+    SOCKET client;
+    while ((client = acceptsocket(s)) != INVALID_SOCKET)
+    {
+        ++accepted;
+        if (tcp_limit > 0 && tcp_open >= tcp_limit)
+        {
+            if (!idle_head)
+            {
+                // every connection is busy: refuse the new one
+                loop_stats.tcp_refused.add();
+                closesocket(client);
+                continue;
+            }
+            // make room by shedding the connection idle for the longest time
+            loop_stats.tcp_shed.add();
+            closeTcpSocket(static_cast<SOCKET>(idle_head->timer.data));
+        }
+        TcpSocketContext* ctx = openTcpContext(client);
+        size_t frames = DNSFramePool::allocated();
+        ctx->task = serveTcp(client, *ctx);
+        if (DNSFramePool::allocated() != frames)
+        {
+            loop_stats.tcp_frames.add();
+        }
+        resumeTcp(client, *ctx, 0);
+    }
+    loop_stats.tcp_accepts.add(accepted);
+}
+
+void DNSWorker::unlinkIdle(TcpSocketContext& ctx)
+{
+    if (ctx.deadline != TcpDeadline::Idle)
+    {
+        return;
+    }
+    (ctx.idle_prev ? ctx.idle_prev->idle_next : idle_head) = ctx.idle_next;
+    (ctx.idle_next ? ctx.idle_next->idle_prev : idle_tail) = ctx.idle_prev;
+    ctx.idle_prev = nullptr;
+    ctx.idle_next = nullptr;
+}
+
+void DNSWorker::updateTcpDeadline(TcpSocketContext& ctx, bool progress)
+{
+    // a deadline starts when the connection enters a state and is only pushed
+    // back by progress (a query parsed, an answer sent), so trickling bytes
+    // does not keep a connection alive
+    TcpDeadline deadline = TcpDeadline::Idle;
+    uint64_t timeout = settings.tcp_idle_timeout;
+    if (!ctx.output.empty())
+    {
+        deadline = TcpDeadline::Write;
+        timeout = settings.tcp_write_timeout;
+    }
+    else if (!ctx.input.empty())
+    {
+        deadline = TcpDeadline::Read;
+        timeout = settings.tcp_read_timeout;
+    }
+    if (deadline == ctx.deadline && !progress)
+    {
+        return;
+    }
+
+    if (deadline != ctx.deadline)
+    {
+        unlinkIdle(ctx);
+        ctx.deadline = deadline;
+        if (deadline == TcpDeadline::Idle)
+        {
+            ctx.idle_prev = idle_tail;
+            ctx.idle_next = nullptr;
+            (idle_tail ? idle_tail->idle_next : idle_head) = &ctx;
+            idle_tail = &ctx;
+        }
+    }
+    if (timeout > 0)
+    {
+        timers.schedule(ctx.timer, timeout, DNSTimerWheel::now());
+    }
+    else
+    {
+        timers.cancel(ctx.timer);
+    }
+}
+
+void DNSWorker::timerExpired(DNSTimer& timer)
+{
+    loop_stats.tcp_timeouts.add();
+    closeTcpSocket(static_cast<SOCKET>(timer.data));
+}
+
+void DNSWorker::TcpReady::await_suspend(std::coroutine_handle<>) const
+{
+    ctx.ready = 0;
+    if (events & TCP_READ)
+    {
+        worker.selector.addReadSocket(s);
+    }
+    else
+    {
+        worker.selector.removeReadSocket(s);
+    }
+    if (events & TCP_WRITE)
+    {
+        worker.selector.addWriteSocket(s);
+    }
+    else
+    {
+        worker.selector.removeWriteSocket(s);
+    }
+}
+
+unsigned DNSWorker::TcpReady::await_resume() const
+{
+    return ctx.ready;
+}
+
+DNSWorker::TcpReady DNSWorker::tcpReady(SOCKET s, TcpSocketContext& ctx, unsigned events)
+{
+    return TcpReady{ *this, s, ctx, events };
+}
+
+DNSTask DNSWorker::serveTcp(SOCKET s, TcpSocketContext& ctx)
+{
+    unsigned ready = 0;
+    for (;;)
+    {
+        bool progress = false;
+        if (ready & TCP_READ)
+        {
+            size_t len;
+            uint8_t* ptr = ctx.input.tail(len);
+            if (len == 0)
+            {
+                co_return; // the input ring is full of a query that can never fit
+            }
+            int msg_len = recv(s, reinterpret_cast<char*>(ptr), static_cast<int>(len), 0);
+            if (msg_len > 0)
+            {
+                ctx.input.commit(static_cast<size_t>(msg_len));
+            }
+            else if (msg_len == 0)
+            {
+                // the client has sent everything: answer what is complete, then close
+                ctx.closing = true;
+            }
+            else if (!socketwouldblock())
+            {
+                co_return; // error
+            }
+        }
+
+        // answer the complete queries and send; once the output drains,
+        // go on with the queries held back by the pipeline limit
+        bool full;
+        for (;;)
+        {
+            progress |= answerTcpQueries(ctx, full);
+            if (ctx.output.empty())
+            {
+                break;
+            }
+            if (sendTcpOutput(s, ctx, progress) <= 0 && !socketwouldblock())
+            {
+                co_return; // error or close connection
+            }
+            if (!ctx.output.empty())
+            {
+                break; // need send more data
+            }
+        }
+        if (ctx.closing && ctx.output.empty())
+        {
+            co_return;
+        }
+        updateTcpDeadline(ctx, progress);
+
+        // stop reading while too many answers wait for the client
+        unsigned events = ctx.closing || full ? 0 : TCP_READ;
+        if (!ctx.output.empty())
+        {
+            events |= TCP_WRITE;
+        }
+        ready = co_await tcpReady(s, ctx, events);
+    }
+}
+
+void DNSWorker::resumeTcp(SOCKET s, TcpSocketContext& ctx, unsigned events)
+{
+    ctx.ready |= events;
+    ctx.task.resume();
+    if (ctx.task.done())
+    {
+        closeTcpSocket(s);
+    }
+}
+
+bool DNSWorker::answerTcpQueries(TcpSocketContext& ctx, bool& full)
+{
+    const size_t limit = std::max<size_t>(settings.tcp_pipeline, 1u);
+    full = false;
+    bool parsed = false;
+    while (ctx.input.size() >= sizeof(uint16_t))
+    {
+        if (ctx.answers_count >= limit)
+        {
+            full = true;
+            break;
+        }
+        uint8_t length[sizeof(uint16_t)];
+        ctx.input.copy(0, length, sizeof(length));
+        const uint8_t* dataPtr = length;
+        uint16_t expected_size = get_uint16(dataPtr);
+        if (expected_size < sizeof(DNSHeader) || sizeof(uint16_t) + expected_size > TCP_INPUT_SIZE)
+        {
+            // not a query, or one that can never fit: the stream cannot be
+            // resynchronized, so the answers so far go out and the connection closes
+            ctx.input.consume(ctx.input.size());
+            ctx.closing = true;
+            break;
+        }
+        if (ctx.input.size() - sizeof(uint16_t) < expected_size)
+        {
+            break; // need more data
+        }
+        const uint8_t* query = ctx.input.contiguous(sizeof(uint16_t), expected_size);
+        if (!query)
+        {
+            ctx.input.copy(sizeof(uint16_t), &tcp_query[0], expected_size);
+            query = &tcp_query[0];
+        }
+        tcp_answer.clear();
+        tcp_answer.max_size = 0xFFFF; // the most a length prefix can carry
+        processor->processQuery(query, expected_size, tcp_answer);
+        const size_t size = tcp_answer.result.size();
+        if (sizeof(uint16_t) + size > ctx.output.space())
+        {
+            // the query stays buffered and is answered again once output drains
+            full = true;
+            break;
+        }
+        length[0] = static_cast<uint8_t>(size >> 8);
+        length[1] = static_cast<uint8_t>(size);
+        ctx.output.append(length, sizeof(length));
+        ctx.output.append(&tcp_answer.result[0], size);
+        ctx.answers[(ctx.answers_head + ctx.answers_count) % limit] = sizeof(uint16_t) + size;
+        ++ctx.answers_count;
+        ctx.input.consume(sizeof(uint16_t) + expected_size);
+        parsed = true;
+    }
+    return parsed;
+}
+
+int DNSWorker::sendTcpOutput(SOCKET s, TcpSocketContext& ctx, bool& progress)
+{
+    // length prefixes and bodies go out in the same write
+    SocketSlice slices[2];
+    size_t count = ctx.output.slices(slices);
+    int bytes_written = sendslices(s, slices, count);
+    if (bytes_written <= 0)
+    {
+        return bytes_written;
+    }
+    ctx.output.consume(static_cast<size_t>(bytes_written));
+
+    const size_t limit = std::max<size_t>(settings.tcp_pipeline, 1u);
+    size_t sent = ctx.front_sent + static_cast<size_t>(bytes_written);
+    while (ctx.answers_count > 0 && sent >= ctx.answers[ctx.answers_head])
+    {
+        sent -= ctx.answers[ctx.answers_head];
+        ctx.answers_head = (ctx.answers_head + 1) % limit;
+        --ctx.answers_count;
+        progress = true;
+    }
+    ctx.front_sent = sent;
+    return bytes_written;
+}
+
+void DNSWorker::beginDrain()
+{
+    // no new queries: the UDP socket and the listener go first, then every
+    // connection stops reading and is closed once its answers are sent
+    closeUdpSocket(socket_udp);
+    socket_udp = INVALID_SOCKET;
+    closeTcpSocket(socket_tcp);
+    socket_tcp = INVALID_SOCKET;
+    for (size_t fd = 0; fd < tcp_sockets.size(); ++fd)
+    {
+        TcpSocketContext* ctx = tcp_sockets[fd];
+        if (ctx)
+        {
+            ctx->closing = true;
+            resumeTcp(static_cast<SOCKET>(fd), *ctx, 0);
+        }
+    }
+}
+
+size_t DNSWorker::readUdpSocket(SOCKET s)
+{
+    size_t count = udp_batch->receive(s);
+    if (count == 0)
+    {
+        return 0;
+    }
+    loop_stats.udp_batches.add(count);
+    if (settings.busy_poll > 0)
+    {
+        udp_active = microseconds();
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        DNSBuffer& buf = udp_batch->response(i);
+        // datagrams too short to be a query get no answer
+        if (udp_batch->requestSize(i) >= sizeof(DNSHeader))
+        {
+            buf.max_size = UDP_SIZE;
+            processor->processQuery(udp_batch->request(i), udp_batch->requestSize(i), buf);
+        }
+    }
+
+    // answer right away; only what the socket refuses is queued
+    size_t sent = udp_queue->empty() ? udp_batch->send(s) : 0;
+    for (size_t i = sent; i < count; ++i)
+    {
+        const auto& result = udp_batch->response(i).result;
+        if (result.empty())
+        {
+            continue;
+        }
+        if (udp_queue->push(udp_batch->client(i), result))
+        {
+            loop_stats.udp_queued.add();
+        }
+        else
+        {
+            loop_stats.udp_dropped.add();
+        }
+    }
+    if (!udp_queue->empty())
+    {
+        selector.addWriteSocket(s);
+    }
+    return count;
+}
+
+void DNSWorker::writeUdpSocket(SOCKET s)
+{
+    if (udp_queue->flush(s))
+    {
+        selector.removeWriteSocket(s);
+    }
+}
+
+void DNSWorker::socketReadyRead(SOCKET s)
+{
+    if (s == socket_tcp)
+    {
+        acceptTcpSocket(s);
+    }
+    else if (s == socket_udp)
+    {
+        readUdpSocket(s);
+    }
+    else if (TcpSocketContext* ctx = tcpContext(s))
+    {
+        resumeTcp(s, *ctx, TCP_READ);
+    }
+}
+
+void DNSWorker::socketReadyWrite(SOCKET s)
+{
+    if (s == socket_udp)
+    {
+        writeUdpSocket(s);
+    }
+    else if (TcpSocketContext* ctx = tcpContext(s))
+    {
+        resumeTcp(s, *ctx, TCP_WRITE);
+    }
+}
+
+SOCKET DNSWorker::openSocket(int type)
+{
+    const char* name = type == SOCK_DGRAM ? "UDP" : "TCP";
+
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    memcpy(&server.sin_addr, address, sizeof(address));
+    server.sin_port = htons(port);
+
+    SOCKET s = socket(AF_INET, type, 0);
+    if (s == INVALID_SOCKET)
+    {
+        throw std::runtime_error(std::string("Create ") + name + " socket failed");
+    }
+    setupsocket(s);
+    if (settings.workers > 1)
+    {
+        // every worker binds its own socket, the kernel spreads the load
+        setupreuseport(s);
+    }
+    if (bind(s, (sockaddr*)&server, sizeof(server)) == SOCKET_ERROR)
+    {
+        closesocket(s);
+        throw std::runtime_error(std::string("Bind ") + name + " socket failed");
+    }
+    return s;
+}
+
+void DNSWorker::pinThread()
+{
+    unsigned cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    unsigned cpu = index % cpus;
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+bool DNSWorker::serveUring()
+{
+#ifdef DNS_ENGINE_URING
+    if (uring->run(socket_udp, socket_tcp, canExit, draining))
+    {
+        return true;
+    }
+#endif
+    if (logger)
+    {
+        logger->log() << "io_uring engine is not available, using selector" << std::endl;
+    }
+    return false;
+}
+
+bool DNSWorker::busyPolling() const
+{
+    return settings.busy_poll > 0 && socket_udp != INVALID_SOCKET
+        && microseconds() - udp_active < settings.busy_poll_idle;
+}
+
+void DNSWorker::busyPoll()
+{
+    // spin on the non-blocking UDP socket; the selector only gets a
+    // zero-timeout look now and then for TCP, timers and wakeups
+    for (unsigned i = 0; i < BUSY_POLL_ROUNDS && !canExit && !draining; ++i)
+    {
+        readUdpSocket(socket_udp);
+    }
+    selector.select(0);
+    timers.advance(DNSTimerWheel::now());
+    if (!busyPolling())
+    {
+        // back to blocking: the next datagram wakes the selector up, and
+        // readUdpSocket() resumes spinning
+        loop_stats.busy_poll_sleeps.add();
+    }
+}
+
+void DNSWorker::process()
+{
+    try
+    {
+        if (settings.cpu_affinity)
+        {
+            pinThread();
+        }
+
+        // UDP socket
+        socket_udp = openSocket(SOCK_DGRAM);
+        selector.addReadSocket(socket_udp);
+
+        // TCP socket
+        socket_tcp = openSocket(SOCK_STREAM);
+        if (settings.tcp_fastopen > 0)
+        {
+            setupfastopen(socket_tcp, static_cast<int>(settings.tcp_fastopen));
+        }
+        if (settings.tcp_defer_accept > 0)
+        {
+            setupdeferaccept(socket_tcp, static_cast<int>(settings.tcp_defer_accept));
+        }
+        if (listen(socket_tcp, static_cast<int>(settings.tcp_backlog)) == SOCKET_ERROR)
+        {
+            throw std::runtime_error("Listen TCP socket failed");
+        }
+        selector.addReadSocket(socket_tcp);
+
+        if (settings.busy_poll > 0 && !setupbusypoll(socket_udp, static_cast<int>(settings.busy_poll)) && logger)
+        {
+            logger->log() << "SO_BUSY_POLL is not available, busy polling in user space only" << std::endl;
+        }
+
+        udp_batch.reset(new DNSUdpBatch(std::max<size_t>(settings.udp_batch, 1u)));
+        udp_queue.reset(new DNSUdpQueue(settings.udp_queue));
+
+        // the ring returns once stopped or drained
+        const bool served = settings.engine == DNSEngine::Uring && serveUring();
+        bool drained = false;
+        while (!served && !canExit)
+        {
+            if (draining && !drained)
+            {
+                beginDrain();
+                drained = true;
+            }
+            if (drained && tcp_open == 0)
+            {
+                break;
+            }
+            if (busyPolling())
+            {
+                busyPoll();
+                continue;
+            }
+            selector.select(timers.timeout(DNSTimerWheel::now()));
+            timers.advance(DNSTimerWheel::now());
+        }
+    }
+    catch(const std::exception& e)
+    {
+        if (logger)
+        {
+            logger->log() << "DNS server error: " << e.what() << std::endl;
+        }
+    }
+
+    // cleanup
+    closeUdpSocket(socket_udp);
+    for (size_t fd = 0; fd < tcp_sockets.size(); ++fd)
+    {
+        if (tcp_sockets[fd])
+        {
+            closeTcpSocket(static_cast<SOCKET>(fd));
+        }
+    }
+    closeTcpSocket(socket_tcp);
+}
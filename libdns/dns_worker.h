@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dns.h"
+#include "dns_buffer.h"
+#include "dns_ring.h"
+#include "dns_selector.h"
+#include "dns_processor.h"
+#include "dns_stats.h"
+#include "dns_task.h"
+#include "dns_timer.h"
+
+class DNSUdpBatch;
+class DNSUdpQueue;
+class DNSUring;
+
+// One event loop: its own UDP and TCP sockets (bound with SO_REUSEPORT when
+// the server runs several workers), its own DNSSelector and its own thread.
+// Queries are answered by the shared IQueryProcessor.
+class DNSWorker: private ISocketHandler, private ITimerHandler
+{
+public:
+    DNSWorker(IQueryProcessor* processor, const DNSServerSettings& settings, const std::string& host, int port, unsigned index, ILogger* logger);
+    ~DNSWorker();
+
+    DNSWorker(const DNSWorker&) = delete;
+    DNSWorker& operator=(const DNSWorker&) = delete;
+
+    void start();
+    void stop();    // thread-safe
+    void drain();   // thread-safe: stop accepting, exit once every TCP answer is sent
+    void join();
+
+    const DNSLoopStats& stats() const;
+
+private:
+    // A persistent connection (RFC 7766), served by a serveTcp() coroutine:
+    // queries are parsed as soon as they are complete and answered in the
+    // read path; `output` holds the answers the socket did not accept yet.
+    // Contexts live in a slab and are reused, buffers included, by later
+    // connections; coroutine frames come from DNSFramePool.
+    enum class TcpDeadline
+    {
+        None,
+        Idle,       // waiting for the next query
+        Read,       // a query is partially received
+        Write,      // answers wait for the client to read them
+    };
+
+    static const unsigned TCP_READ = 1;
+    static const unsigned TCP_WRITE = 2;
+
+    struct TcpSocketContext
+    {
+        DNSRingBuffer input;                // received bytes not parsed yet
+        DNSRingBuffer output;               // length-prefixed answers not sent yet
+        std::unique_ptr<size_t[]> answers;  // sizes of the answers in output (a ring)
+        size_t answers_head;
+        size_t answers_count;
+        size_t front_sent;                  // bytes of the first answer already sent
+        bool closing;                       // peer shut down its side, or the server drains
+        unsigned ready;                     // TCP_READ/TCP_WRITE seen since the task suspended
+        DNSTask task;
+        TcpDeadline deadline;               // what `timer` is counting down
+        DNSTimer timer;
+        TcpSocketContext* idle_prev;        // idle connections, oldest first
+        TcpSocketContext* idle_next;
+        TcpSocketContext(size_t pipeline);
+        void reset();
+    };
+
+    // co_await tcpReady(s, ctx, TCP_READ | TCP_WRITE): registers exactly that
+    // interest with the selector and yields the events that resumed the task.
+    struct TcpReady
+    {
+        DNSWorker& worker;
+        SOCKET s;
+        TcpSocketContext& ctx;
+        unsigned events;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<>) const;
+        unsigned await_resume() const;
+    };
+
+    void closeTcpSocket(SOCKET s);
+    void closeUdpSocket(SOCKET s);
+    DNSTask serveTcp(SOCKET s, TcpSocketContext& ctx);
+    TcpReady tcpReady(SOCKET s, TcpSocketContext& ctx, unsigned events);
+    void resumeTcp(SOCKET s, TcpSocketContext& ctx, unsigned events);
+    bool answerTcpQueries(TcpSocketContext& ctx, bool& full);
+    int sendTcpOutput(SOCKET s, TcpSocketContext& ctx, bool& progress);
+    TcpSocketContext* openTcpContext(SOCKET s);
+    TcpSocketContext* tcpContext(SOCKET s) const;
+    void acceptTcpSocket(SOCKET s);
+    void updateTcpDeadline(TcpSocketContext& ctx, bool progress);
+    void unlinkIdle(TcpSocketContext& ctx);
+    void beginDrain();
+    size_t readUdpSocket(SOCKET s);
+    void writeUdpSocket(SOCKET s);
+
+    // ISocketHandler
+    void socketReadyRead(SOCKET s) override;
+    void socketReadyWrite(SOCKET s) override;
+
+    // ITimerHandler
+    void timerExpired(DNSTimer& timer) override;
+
+    SOCKET openSocket(int type);
+    void pinThread();
+    bool serveUring();
+    bool busyPolling() const;
+    void busyPoll();
+    void process();
+
+    IQueryProcessor* processor;
+    const DNSServerSettings& settings;
+    uint8_t address[4];             // IPv4 address to bind, zero: any
+    int port;
+    unsigned index;
+    ILogger* logger;
+
+    DNSSelector selector;
+    SOCKET socket_udp, socket_tcp;
+    std::vector<std::unique_ptr<TcpSocketContext>> tcp_slab;  // every context ever allocated
+    std::vector<TcpSocketContext*> tcp_free;
+    std::vector<TcpSocketContext*> tcp_sockets;             // open connections, indexed by fd
+    size_t tcp_open;                                        // open connections
+    size_t tcp_limit;                                       // this worker's share of max_connections
+    TcpSocketContext* idle_head;
+    TcpSocketContext* idle_tail;
+    DNSTimerWheel timers;
+    DNSBuffer tcp_answer;                                   // reused for every TCP answer
+    std::vector<uint8_t> tcp_query;                         // a query wrapped around the input ring
+    std::unique_ptr<DNSUdpBatch> udp_batch;
+    std::unique_ptr<DNSUdpQueue> udp_queue;
+    uint64_t udp_active;                                    // us, when busy polling last got a datagram
+#ifdef DNS_ENGINE_URING
+    std::unique_ptr<DNSUring> uring;
+#endif
+    DNSLoopStats loop_stats;
+    std::atomic<bool> canExit;
+    std::atomic<bool> draining;
+    std::thread thread;
+};
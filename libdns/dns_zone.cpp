@@ -0,0 +1,732 @@
+#include "dns_zone.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "dns_answer.h"
+#include "dns_buffer.h"
+#include "dns_header.h"
+#include "dns_package.h"
+
+namespace
+{
+    // Sections are 8-byte aligned, offsets count from the start of the file.
+    struct ImageHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;        // ENDIAN_MARK as written: images are host-endian
+        uint64_t size;              // the whole file
+        uint64_t checksum;          // of everything after the header
+        uint64_t tree;              // DNSNameTree::save()
+        uint64_t responses;         // blob offset per record id
+        uint64_t response_count;
+        uint64_t blobs;
+        uint64_t reverse;           // DNSReverseIndex::save()
+        uint64_t filter;            // DNSBloomFilter::save()
+        uint64_t header_checksum;   // of the fields above
+    };
+
+    const char MAGIC[8] = { 'D', 'N', 'S', 'Z', 'O', 'N', 'E', 0 };
+    const uint32_t ENDIAN_MARK = 0x01020304;
+    const uint64_t NONE = ~0ull;
+    const uint8_t REMOVED[1] = {};  // hides an image's blob until the id is reused
+
+    uint64_t checksum(const uint8_t* data, size_t size)
+    {
+        // FNV-1a, a word at a time
+        uint64_t h = 0xCBF29CE484222325ull;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            h = (h ^ word) * 0x100000001B3ull;
+        }
+        for (; i < size; ++i)
+        {
+            h = (h ^ data[i]) * 0x100000001B3ull;
+        }
+        return h;
+    }
+
+    uint64_t headerChecksum(const ImageHeader& header)
+    {
+        return checksum(reinterpret_cast<const uint8_t*>(&header), offsetof(ImageHeader, header_checksum));
+    }
+
+    void pad(std::vector<uint8_t>& out)
+    {
+        out.resize((out.size() + 7) & ~size_t(7));
+    }
+}
+
+std::vector<uint8_t> DNSZoneResponse::render(DNSRecordType type, const std::string& host, DNSResultCode result, const std::vector<std::string>& records)
+{
+    DNSPackage package;
+    package.header.QDCOUNT = 1;
+    package.requests.emplace_back(DNSRequest{ type, host });
+    if (result == DNSResultCode::NoError)
+    {
+        for (const auto& item : records)
+        {
+            package.addAnswer(type, host, item);
+        }
+    }
+    DNSBuffer buf;
+    package.header.append(buf);
+    package.requests[0].append(buf);
+    const size_t question_end = buf.result.size();
+    for (const auto& answer : package.answers)
+    {
+        answer.append(buf);
+    }
+    const size_t wire_size = buf.result.size() - question_end;
+    if (package.answers.size() > 0xFFFF || question_end > 0xFFFF || wire_size > 0xFFFF)
+    {
+        throw std::runtime_error("Too many DNS answers");
+    }
+    // only names in the rdata can point past the question's first byte
+    const bool any_owner = package.answers.empty() || type == DNSRecordType::A || type == DNSRecordType::TXT;
+
+    Header header{
+        static_cast<uint16_t>(result),
+        static_cast<uint16_t>(package.answers.size()),
+        static_cast<uint16_t>(any_owner ? 0 : question_end),
+        static_cast<uint16_t>(wire_size),
+    };
+    std::vector<uint8_t> blob(sizeof(header) + wire_size);
+    memcpy(blob.data(), &header, sizeof(header));
+    if (wire_size > 0)
+    {
+        memcpy(&blob[sizeof(header)], &buf.result[question_end], wire_size);
+    }
+    return blob;
+}
+
+DNSZoneResponse::DNSZoneResponse(const uint8_t* blob)
+    : blob(blob)
+{
+    memcpy(&header, blob, sizeof(header));
+}
+
+bool DNSZoneResponse::fits(const uint8_t* blob, size_t space)
+{
+    Header header;
+    if (space < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, blob, sizeof(header));
+    return header.wire_size <= space - sizeof(header);
+}
+
+DNSResultCode DNSZoneResponse::result() const
+{
+    return static_cast<DNSResultCode>(header.result);
+}
+
+uint16_t DNSZoneResponse::ancount() const
+{
+    return header.ancount;
+}
+
+size_t DNSZoneResponse::questionEnd() const
+{
+    return header.question_end;
+}
+
+const uint8_t* DNSZoneResponse::wire() const
+{
+    return blob + sizeof(Header);
+}
+
+size_t DNSZoneResponse::wireSize() const
+{
+    return header.wire_size;
+}
+
+size_t DNSZoneResponse::size() const
+{
+    return sizeof(Header) + header.wire_size;
+}
+
+std::vector<std::string> DNSZoneResponse::records(std::string_view name) const
+{
+    std::vector<std::string> result;
+    if (header.ancount == 0)
+    {
+        return result;
+    }
+    // the question the answers were rendered after, then the answers
+    std::string owner(name);
+    const size_t owner_size = owner.empty() ? 1 : owner.size() + 2;
+    if (header.question_end != 0 && sizeof(DNSHeader) + owner_size + 2 * sizeof(uint16_t) != header.question_end)
+    {
+        // a wildcard's answers: "*." and as much of the name as it owns
+        const size_t size = header.question_end - sizeof(DNSHeader) - 2 * sizeof(uint16_t);
+        owner = size <= 3 || size - 4 > name.size() ? "*" : "*." + std::string(name.substr(name.size() - (size - 4)));
+    }
+    DNSBuffer buf;
+    DNSHeader().append(buf);
+    buf.append_domain(owner);
+    buf.append(static_cast<uint16_t>(0)); // type and class: not read
+    buf.append(static_cast<uint16_t>(0));
+    const size_t question_end = buf.result.size();
+    buf.append(wire(), wireSize());
+
+    result.reserve(header.ancount);
+    const uint8_t* data = &buf.result[question_end];
+    for (uint16_t i = 0; i < header.ancount; ++i)
+    {
+        result.push_back(DNSAnswer(buf.result.data(), buf.result.data() + buf.result.size(), data).decode());
+    }
+    return result;
+}
+
+DNSResponseArena::DNSResponseArena()
+    : chunk_bytes(0)
+    , chunk_size(0)
+    , chunk_used(0)
+    , table(16, nullptr)
+    , count(0)
+{}
+
+uint64_t DNSResponseArena::hash(const uint8_t* blob, size_t size)
+{
+    // the checksum's low bits only see the low bytes of each word: mix the
+    // rest in, the slot is taken from the low bits
+    uint64_t h = checksum(blob, size);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+const uint8_t* DNSResponseArena::intern(const uint8_t* blob)
+{
+    const size_t size = DNSZoneResponse(blob).size();
+    if ((count + 1) * 4 > table.size() * 3)
+    {
+        grow();
+    }
+    const size_t mask = table.size() - 1;
+    size_t i = hash(blob, size) & mask;
+    for (; table[i]; i = (i + 1) & mask)
+    {
+        if (DNSZoneResponse(table[i]).size() == size && memcmp(table[i], blob, size) == 0)
+        {
+            return table[i];
+        }
+    }
+    if (size > chunk_size - chunk_used)
+    {
+        chunk_size = std::max(size, CHUNK_SIZE);
+        chunks.emplace_back(new uint8_t[chunk_size]);
+        chunk_bytes += chunk_size;
+        chunk_used = 0;
+    }
+    uint8_t* stored = chunks.back().get() + chunk_used;
+    memcpy(stored, blob, size);
+    chunk_used += size;
+    table[i] = stored;
+    ++count;
+    return stored;
+}
+
+void DNSResponseArena::grow()
+{
+    std::vector<const uint8_t*> old(table.size() * 2, nullptr);
+    old.swap(table);
+    const size_t mask = table.size() - 1;
+    for (const uint8_t* blob : old)
+    {
+        if (blob)
+        {
+            size_t i = hash(blob, DNSZoneResponse(blob).size()) & mask;
+            while (table[i])
+            {
+                i = (i + 1) & mask;
+            }
+            table[i] = blob;
+        }
+    }
+}
+
+size_t DNSResponseArena::size() const
+{
+    return count;
+}
+
+size_t DNSResponseArena::bytes() const
+{
+    return chunk_bytes + table.size() * sizeof(const uint8_t*);
+}
+
+DNSZoneImage::DNSZoneImage(const std::string& path, bool huge_pages)
+    : image(nullptr)
+    , image_size(0)
+{
+#ifdef _WIN32
+    std::ifstream is(path, std::ios::binary | std::ios::ate);
+    if (!is)
+    {
+        throw std::runtime_error("Error opening zone image");
+    }
+    image_size = static_cast<size_t>(is.tellg());
+    if (image_size < sizeof(ImageHeader))
+    {
+        throw std::runtime_error("Zone image is truncated");
+    }
+    buffer.resize((image_size + 7) / 8);
+    is.seekg(0);
+    is.read(reinterpret_cast<char*>(buffer.data()), image_size);
+    image = reinterpret_cast<const uint8_t*>(buffer.data());
+    (void)huge_pages;
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Error opening zone image");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ImageHeader)))
+    {
+        close(fd);
+        throw std::runtime_error("Zone image is truncated");
+    }
+    image_size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, image_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("mmap() failed for zone image");
+    }
+    image = static_cast<const uint8_t*>(mapping);
+#ifdef MADV_HUGEPAGE
+    if (huge_pages)
+    {
+        // best effort: file-backed huge pages need kernel support
+        madvise(mapping, image_size, MADV_HUGEPAGE);
+    }
+#endif
+    // lookups jump around the tables
+    madvise(mapping, image_size, MADV_RANDOM);
+#endif
+
+    ImageHeader header;
+    memcpy(&header, image, sizeof(header));
+    const char* error = nullptr;
+    if (image_size < sizeof(header) || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        error = "Not a zone image";
+    }
+    else if (header.version != VERSION || header.byte_order != ENDIAN_MARK)
+    {
+        error = "Zone image was compiled by another version or for another platform";
+    }
+    else if (header.header_checksum != headerChecksum(header) || header.size != image_size)
+    {
+        error = "Zone image is corrupt";
+    }
+    else if (header.tree < sizeof(header) || header.tree > header.responses || header.responses > header.blobs
+        || header.blobs > header.reverse || header.reverse > header.filter || header.filter > image_size
+        || header.response_count > (header.blobs - header.responses) / sizeof(uint64_t)
+        || (header.tree | header.responses | header.blobs | header.filter | header.reverse) % sizeof(uint64_t) != 0)
+    {
+        error = "Zone image is corrupt";
+    }
+    if (error)
+    {
+#ifndef _WIN32
+        munmap(const_cast<uint8_t*>(image), image_size);
+#endif
+        throw std::runtime_error(error);
+    }
+}
+
+DNSZoneImage::~DNSZoneImage()
+{
+#ifndef _WIN32
+    munmap(const_cast<uint8_t*>(image), image_size);
+#endif
+}
+
+const uint8_t* DNSZoneImage::data() const
+{
+    return image;
+}
+
+size_t DNSZoneImage::size() const
+{
+    return image_size;
+}
+
+bool DNSZoneImage::verify() const
+{
+    ImageHeader header;
+    memcpy(&header, image, sizeof(header));
+    return header.checksum == checksum(image + sizeof(header), image_size - sizeof(header));
+}
+
+DNSZone::DNSZone()
+    : filter(std::make_shared<DNSBloomFilter>())
+    , filter_rate(0)
+    , filter_keys(0)
+    , filter_inserted(0)
+    , reverse_index(std::make_shared<const DNSReverseIndex>())
+    , reverse_enabled(false)
+    , reverse_stale(false)
+    , arena(std::make_shared<DNSResponseArena>())
+    , image_responses(nullptr)
+    , image_response_count(0)
+    , image_blobs(nullptr)
+    , image_blob_size(0)
+{}
+
+DNSZone::DNSZone(std::shared_ptr<const DNSZoneImage> mapped)
+    : filter_rate(-1)
+    , reverse_stale(false)
+    , arena(std::make_shared<DNSResponseArena>())
+    , image(mapped)
+{
+    ImageHeader header;
+    memcpy(&header, image->data(), sizeof(header));
+    const uint8_t* begin = image->data();
+    index.map(begin + header.tree, begin + header.responses);
+    auto mapped_filter = std::make_shared<DNSBloomFilter>();
+    mapped_filter->map(begin + header.filter, begin + image->size());
+    filter = std::move(mapped_filter);
+    filter_keys = filter_inserted = index.size();
+    auto mapped_reverse = std::make_shared<DNSReverseIndex>();
+    mapped_reverse->map(begin + header.reverse, begin + header.filter);
+    reverse_index = std::move(mapped_reverse);
+    reverse_enabled = reverse_index->size() > 0;
+    image_responses = reinterpret_cast<const uint64_t*>(begin + header.responses);
+    image_response_count = header.response_count;
+    image_blobs = begin + header.blobs;
+    image_blob_size = header.reverse - header.blobs;
+}
+
+const uint8_t* DNSZone::response(uint32_t id) const
+{
+    if (id < responses.size() && responses[id])
+    {
+        return responses[id] == REMOVED ? nullptr : responses[id];
+    }
+    if (id < image_response_count)
+    {
+        // NONE and damaged offsets fall outside the blobs
+        const uint64_t offset = image_responses[id];
+        if (offset < image_blob_size && DNSZoneResponse::fits(image_blobs + offset, image_blob_size - offset))
+        {
+            return image_blobs + offset;
+        }
+    }
+    return nullptr;
+}
+
+const uint8_t* DNSZone::find(std::string_view name, uint16_t type, uint64_t hash, bool& wildcard, bool& filtered) const
+{
+    uint32_t id;
+    filtered = !filter->mayContain(hash);
+    if (filtered)
+    {
+        id = index.findWildcard(name, type);
+        wildcard = id != DNSNameTree::NOT_FOUND;
+    }
+    else
+    {
+        id = index.find(name, type, hash, wildcard);
+    }
+    return id == DNSNameTree::NOT_FOUND ? nullptr : response(id);
+}
+
+const uint8_t* DNSZone::find(std::string_view name, uint16_t type, uint64_t hash, bool& wildcard) const
+{
+    bool filtered;
+    return find(name, type, hash, wildcard, filtered);
+}
+
+const uint8_t* DNSZone::find(std::string_view name, uint16_t type, uint64_t hash) const
+{
+    bool wildcard;
+    return find(name, type, hash, wildcard);
+}
+
+void DNSZone::add(DNSRecordType type, const std::string& host, const std::vector<uint8_t>& response)
+{
+    bool inserted;
+    const uint32_t id = index.insert(host, static_cast<uint16_t>(type), inserted);
+    if (inserted)
+    {
+        if (filter->bytes() > 0)
+        {
+            if (filter.use_count() > 1)
+            {
+                // only the writer copies zones, so the count cannot rise meanwhile
+                filter = std::make_shared<DNSBloomFilter>(*filter);
+            }
+            filter->insert(DNSNameIndex::hash(host, static_cast<uint16_t>(type)));
+        }
+        ++filter_inserted;
+    }
+    noteReverse(type, host, inserted ? nullptr : this->response(id));
+    if (id >= responses.size())
+    {
+        responses.resize(id + 1);
+    }
+    responses[id] = arena->intern(response.data());
+    if (arena->size() > 2 * index.size() + 4096)
+    {
+        compact(); // mostly blobs of replaced or removed records
+    }
+}
+
+bool DNSZone::remove(DNSRecordType type, const std::string& host)
+{
+    const uint32_t id = index.erase(host, static_cast<uint16_t>(type));
+    if (id == DNSNameTree::NOT_FOUND)
+    {
+        return false;
+    }
+    noteReverse(type, host, response(id));
+    if (id < image_response_count)
+    {
+        if (id >= responses.size())
+        {
+            responses.resize(id + 1);
+        }
+        responses[id] = REMOVED;
+    }
+    else
+    {
+        responses[id] = nullptr;
+    }
+    return true;
+}
+
+void DNSZone::noteReverse(DNSRecordType type, const std::string& host, const uint8_t* old)
+{
+    if (!reverse_enabled || reverse_stale || type != DNSRecordType::A)
+    {
+        return;
+    }
+    std::string key = DNSNameIndex::key(host);
+    if (key.size() >= 2 && key[0] == 1 && key[1] == '*')
+    {
+        return; // a wildcard owns no address
+    }
+    if (reverse_changes.size() > reverse_index->size() / 4 + 1024)
+    {
+        reverse_changes.clear(); // cheaper to rebuild than to merge
+        reverse_stale = true;
+        return;
+    }
+    // the first change of an owner finds the addresses the index has
+    auto [it, first] = reverse_changes.try_emplace(std::move(key));
+    if (first && old && DNSZoneResponse(old).result() == DNSResultCode::NoError)
+    {
+        it->second = DNSZoneResponse(old).records({});
+    }
+}
+
+void DNSZone::compact()
+{
+    // older snapshots keep the old arena alive
+    auto compacted = std::make_shared<DNSResponseArena>();
+    for (auto& blob : responses)
+    {
+        if (blob && blob != REMOVED)
+        {
+            blob = compacted->intern(blob);
+        }
+    }
+    arena = std::move(compacted);
+}
+
+size_t DNSZone::size() const
+{
+    return index.size();
+}
+
+size_t DNSZone::responseBytes() const
+{
+    return arena->bytes();
+}
+
+void DNSZone::rebuildFilter(double fp_rate)
+{
+    auto rebuilt = std::make_shared<DNSBloomFilter>(index.size(), fp_rate);
+    if (rebuilt->bytes() > 0)
+    {
+        index.forEachHash([&rebuilt](uint64_t hash) { rebuilt->insert(hash); });
+    }
+    filter = std::move(rebuilt);
+    filter_rate = fp_rate;
+    filter_keys = filter_inserted = index.size();
+}
+
+void DNSZone::updateFilter(double fp_rate)
+{
+    // a quarter over before rebuilding keeps the rate near `fp_rate` and
+    // the rebuilds amortized over the inserts
+    if ((filter_rate >= 0 && fp_rate != filter_rate) || filter_inserted > filter_keys + filter_keys / 4)
+    {
+        rebuildFilter(fp_rate);
+    }
+}
+
+size_t DNSZone::filterBytes() const
+{
+    return filter->bytes();
+}
+
+void DNSZone::rebuildReverse(bool enabled)
+{
+    auto rebuilt = std::make_shared<DNSReverseIndex>();
+    if (enabled)
+    {
+        index.forEach([this, &rebuilt](std::string_view key, uint16_t type, uint32_t id) {
+            if (type != static_cast<uint16_t>(DNSRecordType::A) || (key.size() >= 2 && key[0] == 1 && key[1] == '*'))
+            {
+                return; // a wildcard owns no address
+            }
+            const uint8_t* blob = response(id);
+            if (blob && DNSZoneResponse(blob).result() == DNSResultCode::NoError)
+            {
+                rebuilt->add(key, DNSZoneResponse(blob).records({})); // A blobs fit any owner
+            }
+        });
+    }
+    rebuilt->finish();
+    reverse_index = std::move(rebuilt);
+    reverse_enabled = enabled;
+    reverse_stale = false;
+    reverse_changes.clear();
+}
+
+void DNSZone::updateReverse(bool enabled)
+{
+    if (enabled != reverse_enabled || reverse_stale || reverse_index->staleBytes() > reverse_index->bytes() / 2)
+    {
+        rebuildReverse(enabled);
+        return;
+    }
+    if (reverse_changes.empty())
+    {
+        return;
+    }
+    DNSReverseIndex removed;
+    DNSReverseIndex added;
+    for (const auto& [key, addresses] : reverse_changes)
+    {
+        removed.add(key, addresses);
+        const std::string name = DNSNameIndex::name(key);
+        bool wildcard;
+        const uint32_t id = index.find(name, static_cast<uint16_t>(DNSRecordType::A), DNSNameIndex::hash(name, static_cast<uint16_t>(DNSRecordType::A)), wildcard);
+        const uint8_t* blob = id == DNSNameTree::NOT_FOUND || wildcard ? nullptr : response(id);
+        if (blob && DNSZoneResponse(blob).result() == DNSResultCode::NoError)
+        {
+            added.add(key, DNSZoneResponse(blob).records({}));
+        }
+    }
+    removed.finish();
+    added.finish();
+    auto merged = std::make_shared<DNSReverseIndex>();
+    merged->merge(*reverse_index, removed, added);
+    reverse_index = std::move(merged);
+    reverse_changes.clear();
+}
+
+size_t DNSZone::reverse(std::string_view name, std::vector<std::string>& owners) const
+{
+    return reverse_index->find(name, owners);
+}
+
+size_t DNSZone::reverseSize() const
+{
+    return reverse_index->size();
+}
+
+size_t DNSZone::reverseBytes() const
+{
+    return reverse_index->bytes();
+}
+
+void DNSZone::save(const std::string& path) const
+{
+    std::vector<uint8_t> out(sizeof(ImageHeader));
+    ImageHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = DNSZoneImage::VERSION;
+    header.byte_order = ENDIAN_MARK;
+
+    header.tree = out.size();
+    index.save(out);
+
+    header.responses = out.size();
+    header.response_count = std::max(responses.size(), image_response_count);
+    out.resize(out.size() + header.response_count * sizeof(uint64_t));
+    header.blobs = out.size();
+    std::unordered_map<const uint8_t*, uint64_t> written;   // interned blobs are written once
+    for (uint64_t id = 0; id < header.response_count; ++id)
+    {
+        const uint8_t* blob = response(static_cast<uint32_t>(id));
+        uint64_t offset = NONE;
+        if (blob)
+        {
+            auto it = written.emplace(blob, out.size() - header.blobs);
+            offset = it.first->second;
+            if (it.second)
+            {
+                out.insert(out.end(), blob, blob + DNSZoneResponse(blob).size());
+            }
+        }
+        memcpy(&out[header.responses + id * sizeof(uint64_t)], &offset, sizeof(offset));
+    }
+    pad(out);
+    header.reverse = out.size();
+    reverse_index->save(out);
+    pad(out);
+    header.filter = out.size();
+    filter->save(out);
+    pad(out);
+
+    header.size = out.size();
+    header.checksum = checksum(out.data() + sizeof(header), out.size() - sizeof(header));
+    header.header_checksum = headerChecksum(header);
+    memcpy(out.data(), &header, sizeof(header));
+
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+        os.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+        if (!os.flush())
+        {
+            throw std::runtime_error("Error writing zone image");
+        }
+    }
+#ifdef _WIN32
+    std::remove(path.c_str()); // rename() does not replace there
+#endif
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Error writing zone image");
+    }
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "dns_consts.h"
+#include "dns_tree.h"
+#include "dns_bloom.h"
+#include "dns_reverse.h"
+
+// A record's answers as the server keeps them, one contiguous blob: the
+// answer section rendered for a question at offset 12. The rdata is kept
+// in its typed wire form only (packed IPv4, length-prefixed TXT, names
+// compressed against the owner); the answer strings are decoded from it
+// when the generic path needs them. A and TXT answers point to nothing but
+// the start of the question, so their blobs fit any owner and equal ones
+// are shared.
+class DNSZoneResponse
+{
+public:
+    static std::vector<uint8_t> render(DNSRecordType type, const std::string& host, DNSResultCode result, const std::vector<std::string>& records);
+
+    // Whether the blob at `blob` ends within `space` bytes.
+    static bool fits(const uint8_t* blob, size_t space);
+
+    explicit DNSZoneResponse(const uint8_t* blob);
+
+    DNSResultCode result() const;
+    uint16_t ancount() const;
+    // Header + question size the offsets assume; 0: any.
+    size_t questionEnd() const;
+    const uint8_t* wire() const;
+    size_t wireSize() const;
+    // The answer strings; `name` is the name asked for: the owner, or a
+    // name below the wildcard owning the record.
+    std::vector<std::string> records(std::string_view name) const;
+    size_t size() const;            // of the whole blob
+
+private:
+    struct Header
+    {
+        uint16_t result;
+        uint16_t ancount;
+        uint16_t question_end;
+        uint16_t wire_size;
+    };
+
+    const uint8_t* blob;
+    Header header;
+};
+
+// The response blobs of the records added in memory, packed into 1 MB
+// chunks that never move, equal blobs stored once. Zone snapshots share
+// an arena and keep plain pointers into it: only the writer appends, and
+// the chunks live as long as any snapshot using them. Not thread-safe.
+class DNSResponseArena
+{
+public:
+    DNSResponseArena();
+
+    // The stored blob equal to `blob`, added if missing.
+    const uint8_t* intern(const uint8_t* blob);
+
+    size_t size() const;            // distinct blobs
+    size_t bytes() const;           // chunks and lookup table
+
+private:
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    static uint64_t hash(const uint8_t* blob, size_t size);
+    void grow();
+
+    std::vector<std::unique_ptr<uint8_t[]>> chunks;
+    size_t chunk_bytes;             // allocated in all chunks
+    size_t chunk_size;              // of the last one
+    size_t chunk_used;
+    std::vector<const uint8_t*> table;  // open addressing by content, null: empty
+    size_t count;
+};
+
+// A zone image file (`dns_server --compile`) mapped read-only. Opening it
+// checks the header and that the sections lie in order inside the file,
+// so it takes the same time for any zone size; the zone checks the sizes
+// of each table as it maps it and every offset it reads from the image
+// before following it, so a damaged image answers wrongly, never reads
+// outside the mapping. verify() checksums the whole file. The pages come
+// from the page cache, so every process serving the same image shares
+// them.
+class DNSZoneImage
+{
+public:
+    static constexpr uint32_t VERSION = 4;
+
+    DNSZoneImage(const std::string& path, bool huge_pages = false);
+    ~DNSZoneImage();
+
+    DNSZoneImage(const DNSZoneImage&) = delete;
+    DNSZoneImage& operator=(const DNSZoneImage&) = delete;
+
+    const uint8_t* data() const;
+    size_t size() const;
+    bool verify() const;
+
+private:
+    const uint8_t* image;
+    size_t image_size;
+#ifdef _WIN32
+    std::vector<uint64_t> buffer;   // no mmap: the file is read
+#endif
+};
+
+// The records a server answers from: the name tree, one interned response
+// blob per record id, a Bloom filter of the (name, type) pairs, which turns most
+// lookups of absent names away before they reach the tree, and optionally
+// the PTR answers of the A records. A zone made from an image uses the
+// image's tables and blobs in place; changes made on top of it are kept in memory, and the
+// first one copies the name tables. Not thread-safe, and copies share
+// the response arena; the server shares zones as immutable snapshots and
+// changes them under one lock.
+class DNSZone
+{
+public:
+    DNSZone();
+    explicit DNSZone(std::shared_ptr<const DNSZoneImage> mapped);
+
+    // Response blob for (name, type), nullptr if none; `wildcard` is set
+    // when it comes from the wildcard of the closest encloser, `filtered`
+    // when the filter ruled an exact record out without a probe.
+    const uint8_t* find(std::string_view name, uint16_t type, uint64_t hash, bool& wildcard, bool& filtered) const;
+    const uint8_t* find(std::string_view name, uint16_t type, uint64_t hash, bool& wildcard) const;
+    const uint8_t* find(std::string_view name, uint16_t type, uint64_t hash) const;
+
+    void add(DNSRecordType type, const std::string& host, const std::vector<uint8_t>& response);
+    bool remove(DNSRecordType type, const std::string& host);
+    size_t size() const;
+    size_t responseBytes() const;   // the arena's, shared with other snapshots
+
+    // Rebuilds the filter over the current records, for about `fp_rate`
+    // false positives; 0 drops it.
+    void rebuildFilter(double fp_rate);
+    // add() inserts new names into the filter, copying it first if other
+    // snapshots share it, and remove() leaves their bits set; this
+    // rebuilds it once the names inserted since the last build outgrow
+    // its size or `fp_rate` differs from the rate it was built for. A
+    // snapshot calls it once it is complete.
+    void updateFilter(double fp_rate);
+    size_t filterBytes() const;
+
+    // Rebuilds the reverse index over the current A records, or drops it.
+    void rebuildReverse(bool enabled);
+    // add() and remove() leave the index as it is and note the A owners
+    // they change; this merges their old and new addresses into a copy,
+    // or rebuilds it when `enabled` changed, the changes are too many or
+    // the merges left too many stale names. A snapshot calls it once it
+    // is complete.
+    void updateReverse(bool enabled);
+    // Appends the owners of the A records with the address of an
+    // in-addr.arpa `name`; the number appended.
+    size_t reverse(std::string_view name, std::vector<std::string>& owners) const;
+    // The same as wire names without the root label, see
+    // DNSReverseIndex::forEachOwner().
+    template <typename F>
+    size_t reverse(std::string_view name, F f) const
+    {
+        return reverse_index->forEachOwner(name, f);
+    }
+    size_t reverseSize() const;     // addresses
+    size_t reverseBytes() const;
+
+    // Writes the zone as an image file (replaced atomically).
+    void save(const std::string& path) const;
+
+private:
+    const uint8_t* response(uint32_t id) const;
+    void compact();
+    void noteReverse(DNSRecordType type, const std::string& host, const uint8_t* old);
+
+    DNSNameTree index;              // (name, type) -> id
+    std::shared_ptr<DNSBloomFilter> filter;  // shared by the snapshots until changed
+    double filter_rate;             // built for; < 0: as compiled into the image
+    size_t filter_keys;             // names it was sized for
+    size_t filter_inserted;         // names inserted since, these included
+    std::shared_ptr<const DNSReverseIndex> reverse_index;
+    bool reverse_enabled;
+    bool reverse_stale;             // too many changes to note: rebuilt
+    std::unordered_map<std::string, std::vector<std::string>> reverse_changes; // A owner key -> addresses in the index
+    std::shared_ptr<DNSResponseArena> arena;
+    std::vector<const uint8_t*> responses;  // by id, into the arena; null: the image's
+    std::shared_ptr<const DNSZoneImage> image;
+    const uint64_t* image_responses;    // blob offset per id, NONE: free
+    size_t image_response_count;
+    const uint8_t* image_blobs;
+    size_t image_blob_size;
+};
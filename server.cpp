@@ -1,7 +1,10 @@
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 #include "dns.h"
+#include "dns_control.h"
 
 class LoggerImpl: public ILogger
 {
@@ -14,6 +17,52 @@ public:
 
 int main(int argc, char* argv[]) 
 {
+    if (argc >= 4 && std::string(argv[1]) == "--control")
+    {
+        // dns_server --control <socket> <command> [args...]
+        std::ostringstream cmd;
+        cmd << argv[3];
+        for (int i = 4; i < argc; ++i)
+        {
+            // an argument with spaces or quotes stays one answer
+            const std::string arg = argv[i];
+            if (arg.find_first_of(" \t\"\\") != std::string::npos)
+            {
+                cmd << ' ' << std::quoted(arg);
+            }
+            else
+            {
+                cmd << ' ' << arg;
+            }
+        }
+        try
+        {
+            std::cout << DNSControl::send(argv[2], cmd.str());
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Critical error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc == 5 && std::string(argv[1]) == "--compile" && std::string(argv[3]) == "-o")
+    {
+        // dns_server --compile <zone.json> -o <zone.img>
+        try
+        {
+            DNSServer server(argv[2]);
+            server.saveZone(argv[4]);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Critical error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
     const char* cfg = argc >= 2 ? argv[1] : "dns_server.json";
     try
     {
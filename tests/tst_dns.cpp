@@ -2,11 +2,37 @@
 #include <gtest/gtest.h>
 #include <json/json.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+
 #include "dns.h"
 #include "dns_buffer.h"
 #include "dns_header.h"
 #include "dns_package.h"
+#include "dns_message.h"
 #include "dns_client.h"
+#include "dns_selector.h"
+#include "dns_udp.h"
+#include "dns_ring.h"
+#include "dns_timer.h"
+#include "dns_control.h"
+#include "dns_index.h"
+#include "dns_epoch.h"
+#include "dns_tree.h"
+#include "dns_bloom.h"
+#include "dns_reverse.h"
+#include "dns_zone.h"
+#include "dns_loader.h"
+#include "dns_master.h"
+#include "dns_utils.h"
 
 static const std::string HOST = "127.0.0.1";
 static const int PORT = 10000;
@@ -70,7 +96,7 @@ TEST(Dns, ParseQuery)
 {
     std::string pkg{ "1cb901000001000000000000033132310a766c61736f76736f6674036e65740000010001" };
     auto vec = fromHex(pkg);
-    DNSPackage package(&vec[0]);
+    DNSPackage package(&vec[0], vec.size());
     ASSERT_EQ(0x1cb9, package.header.ID);
     ASSERT_EQ(1, package.header.QDCOUNT);
     ASSERT_EQ(0, package.header.ANCOUNT);
@@ -85,7 +111,7 @@ TEST(Dns, ParseResponse_TypeA_Success)
 {
     std::string pkg{ "4f16818000010001000000000a766c61736f76736f6674036e65740000010001c00c0001000100000e100004b9fddb5c" };
     auto vec = fromHex(pkg);
-    DNSPackage package(&vec[0]);
+    DNSPackage package(&vec[0], vec.size());
     ASSERT_EQ(0x4f16, package.header.ID);
     ASSERT_EQ(1, package.header.QDCOUNT);
     ASSERT_EQ(1, package.header.ANCOUNT);
@@ -100,7 +126,7 @@ TEST(Dns, ParseResponse_TypeA_HostNotFound)
 {
     std::string pkg{ "db2481830001000000010000086e78646f6d61696e0a766c61736f76736f6674036e65740000010001c01500060001000006fd002e056e7331303107636c6f75646e73c02007737570706f7274c03b78a4450e00001c20000007080012750000000e10" };
     auto vec = fromHex(pkg);
-    DNSPackage package(&vec[0]);
+    DNSPackage package(&vec[0], vec.size());
     ASSERT_EQ(0xdb24, package.header.ID);
     ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(package.header.flags.RCODE));
     ASSERT_EQ(1, package.header.QDCOUNT);
@@ -116,7 +142,7 @@ TEST(Dns, ParseResponse_TypeMX_Success)
 {
     std::string pkg{ "3f2c8180000100010000000006676f6f676c6503636f6d00000f0001c00c000f0001000001060009000a04736d7470c00c" };
     auto vec = fromHex(pkg);
-    DNSPackage package(&vec[0]);
+    DNSPackage package(&vec[0], vec.size());
     ASSERT_EQ(0x3f2c, package.header.ID);
     ASSERT_EQ(1, package.header.QDCOUNT);
     ASSERT_EQ(1, package.header.ANCOUNT);
@@ -131,7 +157,7 @@ TEST(Dns, ParseResponse_TypeMX_HostNotFound)
 {
     std::string pkg{ "b5e7818300010000000100000a6e6f745f657869737473036e657400000f0001c0170006000100000384003d01610c67746c642d73657276657273c017056e73746c640c766572697369676e2d67727303636f6d0065f84efb000007080000038400093a8000015180" };
     auto vec = fromHex(pkg);
-    DNSPackage package(&vec[0]);
+    DNSPackage package(&vec[0], vec.size());
     ASSERT_EQ(0xb5e7, package.header.ID);
     ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(package.header.flags.RCODE));
     ASSERT_EQ(1, package.header.QDCOUNT);
@@ -147,7 +173,7 @@ TEST(Dns, ParseResponse_TypeTXT_Success)
 {
     std::string pkg{ "248c818000010001000000000a766c61736f76736f6674036e65740000100001c00c0010000100000e10000e0d763d737066312061202d616c6c" };
     auto vec = fromHex(pkg);
-    DNSPackage package(&vec[0]);
+    DNSPackage package(&vec[0], vec.size());
     ASSERT_EQ(0x248c, package.header.ID);
     ASSERT_EQ(1, package.header.QDCOUNT);
     ASSERT_EQ(1, package.header.ANCOUNT);
@@ -162,7 +188,7 @@ TEST(Dns, ParseResponse_TypeTXT_HostNotFound)
 {
     std::string pkg{ "b5e7818300010000000100000a6e6f745f657869737473036e657400000f0001c0170006000100000384003d01610c67746c642d73657276657273c017056e73746c640c766572697369676e2d67727303636f6d0065f84efb000007080000038400093a8000015180" };
     auto vec = fromHex(pkg);
-    DNSPackage package(&vec[0]);
+    DNSPackage package(&vec[0], vec.size());
     ASSERT_EQ(0xb5e7, package.header.ID);
     ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(package.header.flags.RCODE));
     ASSERT_EQ(1, package.header.QDCOUNT);
@@ -178,7 +204,7 @@ TEST(Dns, ParseResponse_TypeCNAME_Success)
 {
     std::string pkg{ "09178180000100010000000005636d61696c0a766c61736f76736f6674036e65740000050001c00c0005000100000e100007046d61696cc012" };
     auto vec = fromHex(pkg);
-    DNSPackage package(&vec[0]);
+    DNSPackage package(&vec[0], vec.size());
     ASSERT_EQ(0x0917, package.header.ID);
     ASSERT_EQ(1, package.header.QDCOUNT);
     ASSERT_EQ(1, package.header.ANCOUNT);
@@ -189,29 +215,173 @@ TEST(Dns, ParseResponse_TypeCNAME_Success)
     ASSERT_EQ(pkg, toHex(buf.result));
 }
 
-#if (0)
-TEST(Dns, DNSServer_quit_command_works)
+// rcvbuf: SO_RCVBUF to set before connecting, 0 for the default
+static SOCKET connectTcp(int rcvbuf = 0)
+{
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(PORT);
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s != INVALID_SOCKET && rcvbuf > 0)
+    {
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&rcvbuf), sizeof(rcvbuf));
+    }
+    if (s == INVALID_SOCKET || connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+    {
+        throw std::runtime_error("Can't connect to server");
+    }
+    return s;
+}
+
+// true when the server closed the connection
+static bool waitClosed(SOCKET s)
+{
+    char buf[16];
+    return recv(s, buf, sizeof(buf), 0) == 0;
+}
+
+static const std::string CONTROL = "/tmp/tst_dns_control.sock";
+
+TEST(Dns, DNSServer_control_socket_updates_records_and_stops)
 {
     DNSServer server(HOST, PORT);
+    server.settings().control_socket = CONTROL;
     server.start();
-    sleep(20);
+
     DNSClient client(HOST, PORT);
-    ASSERT_TRUE(client.command("quit"));
+    ASSERT_EQ(0, client.requestUdp(1, DNSRecordType::A, "domain.com").answers.size());
+    ASSERT_EQ("OK\n", DNSControl::send(CONTROL, "add A domain.com NoError 1.1.1.1 2.2.2.2"));
+    DNSPackage added = client.requestUdp(2, DNSRecordType::A, "domain.com");
+    ASSERT_EQ(2, added.answers.size());
+    ASSERT_EQ(std::string{ "2.2.2.2" }, added.answers[1].decode());
+    ASSERT_EQ("OK\n", DNSControl::send(CONTROL, "remove A domain.com"));
+    ASSERT_EQ(0, client.requestUdp(3, DNSRecordType::A, "domain.com").answers.size());
+    ASSERT_EQ("OK\n", DNSControl::send(CONTROL, "add TXT domain.com NoError \"v=spf1 -all\" plain \"say \\\"hi\\\"\""));
+    DNSPackage text = client.requestUdp(4, DNSRecordType::TXT, "domain.com");
+    ASSERT_EQ(3, text.answers.size());
+    ASSERT_EQ(std::string{ "v=spf1 -all" }, text.answers[0].decode());
+    ASSERT_EQ(std::string{ "plain" }, text.answers[1].decode());
+    ASSERT_EQ(std::string{ "say \"hi\"" }, text.answers[2].decode());
+    struct stat st;
+    ASSERT_EQ(0, stat(CONTROL.c_str(), &st));
+    ASSERT_EQ(0600u, st.st_mode & 0777u); // owner only
+
+    ASSERT_EQ(0, DNSControl::send(CONTROL, "bogus").find("ERROR"));
+    ASSERT_NE(std::string::npos, DNSControl::send(CONTROL, "stats").find("udp_queued"));
+    ASSERT_EQ("OK\n", DNSControl::send(CONTROL, "stop"));
     server.join();
 }
-#endif
 
-#if (0)
-TEST(Dns, DNSServer_exit_command_works)
+TEST(Dns, DNSServer_ignores_commands_on_dns_port)
 {
     DNSServer server(HOST, PORT);
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
     server.start();
-    sleep(20);
+
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(PORT);
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_EQ(4, sendto(s, "exit", 4, 0, (sockaddr*)&addr, sizeof(addr)));
+    closesocket(s);
+
     DNSClient client(HOST, PORT);
-    ASSERT_TRUE(client.command("exit"));
+    ASSERT_EQ(1, client.requestUdp(1, DNSRecordType::A, "domain.com").answers.size());
+
+    server.stop();
     server.join();
 }
-#endif
+
+TEST(Dns, DNSServer_binds_the_configured_address)
+{
+    DNSServer server("127.0.0.2", PORT);
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.start();
+
+    DNSClient client("127.0.0.2", PORT);
+    ASSERT_EQ(1, client.requestTcp(1, DNSRecordType::A, "domain.com").answers.size());
+
+    // nothing listens on the other loopback addresses
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(PORT);
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(0, connect(s, (sockaddr*)&addr, sizeof(addr)));
+    closesocket(s);
+
+    server.stop();
+    server.join();
+
+    DNSServer wrong("localhost", PORT);
+    ASSERT_THROW(wrong.start(), std::runtime_error);
+}
+
+TEST(Dns, DNSServer_drain_finishes_pending_tcp_answers)
+{
+    // answers of 64 KB each, more than the socket buffers hold, to a client
+    // that reads nothing until the drain began: some of them are still
+    // waiting to be sent
+    std::vector<std::string> addresses;
+    for (int i = 0; i < 4000; ++i)
+    {
+        addresses.push_back("10.0." + std::to_string(i / 250) + "." + std::to_string(i % 250));
+    }
+    for (DNSEngine engine : { DNSEngine::Selector, DNSEngine::Uring })
+    {
+        DNSServer server(HOST, PORT);
+        server.settings().engine = engine;
+        server.settings().tcp_pipeline = 2;
+        server.addRecord(DNSRecordType::A, "domain.com", addresses);
+        server.start();
+
+        // pipelined queries in one write, then a drain before reading any answer
+        const uint16_t total = 96;
+        std::vector<uint8_t> queries;
+        for (uint16_t id = 1; id <= total; ++id)
+        {
+            DNSPackage package;
+            package.header.ID = id;
+            package.header.QDCOUNT = 1;
+            package.requests.emplace_back(DNSRequest{ DNSRecordType::A, "domain.com" });
+            DNSBuffer buf;
+            package.append(buf);
+            queries.push_back(static_cast<uint8_t>(buf.result.size() >> 8));
+            queries.push_back(static_cast<uint8_t>(buf.result.size()));
+            queries.insert(queries.end(), buf.result.begin(), buf.result.end());
+        }
+        SOCKET s = connectTcp(4096);
+        ASSERT_EQ(static_cast<int>(queries.size()), send(s, reinterpret_cast<const char*>(&queries[0]), static_cast<int>(queries.size()), 0));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        server.drain();
+
+        std::vector<uint8_t> answers;
+        char buf[4096];
+        int len;
+        while ((len = recv(s, buf, sizeof(buf), 0)) > 0)
+        {
+            answers.insert(answers.end(), buf, buf + len);
+        }
+        ASSERT_EQ(0, len); // closed by the server after the last answer
+        closesocket(s);
+
+        size_t count = 0;
+        for (size_t pos = 0; pos + 2 <= answers.size(); ++count)
+        {
+            size_t size = (static_cast<size_t>(answers[pos]) << 8) | answers[pos + 1];
+            ASSERT_LE(pos + 2 + size, answers.size());
+            DNSPackage answer(&answers[pos + 2], size);
+            ASSERT_EQ(count + 1, answer.header.ID);
+            ASSERT_EQ(addresses.size(), answer.answers.size());
+            pos += 2 + size;
+        }
+        ASSERT_EQ(total, count);
+
+        server.join(); // the workers exit by themselves once drained
+    }
+}
 
 class DnsServerFixture : public testing::Test 
 {
@@ -224,7 +394,7 @@ public:
     }
     ~DnsServerFixture()
     {
-        client.command("exit");
+        server.stop();
         server.join();
     }
 
@@ -315,6 +485,1554 @@ TEST_F(DnsServerFixture, CanHandleRequestTypeTxt)
     ASSERT_EQ(std::string{ "text message 3" }, result.answers[2].decode());
 }
 
+TEST_F(DnsServerFixture, AnswersEveryDatagramOfUdpBatch)
+{
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.addRecord(DNSRecordType::A, "domain1.com", { "2.2.2.2" });
+
+    std::vector<std::string> hosts;
+    for (int i = 0; i < 20; ++i)
+    {
+        hosts.push_back(i % 2 ? "domain.com" : "domain1.com");
+    }
+    std::vector<DNSPackage> result = client.requestUdpMany(1000, DNSRecordType::A, hosts);
+    ASSERT_EQ(hosts.size(), result.size());
+    for (const auto& package : result)
+    {
+        uint16_t index = package.header.ID - 1000;
+        ASSERT_LT(index, hosts.size());
+        ASSERT_EQ(1, package.answers.size());
+        ASSERT_EQ(std::string{ index % 2 ? "1.1.1.1" : "2.2.2.2" }, package.answers[0].decode());
+    }
+
+    DNSServerStats stats = server.stats();
+    uint64_t datagrams = 0;
+    for (size_t i = 0; i < stats.udp_batches.size(); ++i)
+    {
+        datagrams += i * stats.udp_batches[i];
+    }
+    ASSERT_EQ(hosts.size(), datagrams);
+}
+
+TEST_F(DnsServerFixture, ClientReadsAnswersInPlace)
+{
+    server.addRecord(DNSRecordType::MX, "domain.com", { "mx1.domain.com", "mx2.domain.com" });
+    std::vector<uint8_t> message;
+    for (bool tcp : { false, true })
+    {
+        DNSMessageView answer = tcp
+            ? client.requestTcp(9, DNSRecordType::MX, "domain.com", message)
+            : client.requestUdp(9, DNSRecordType::MX, "domain.com", message);
+        ASSERT_EQ(9, answer.id());
+        ASSERT_EQ(DNSResultCode::NoError, static_cast<DNSResultCode>(answer.flags().RCODE));
+        ASSERT_EQ(std::string{ "domain.com" }, answer.question().name.str());
+        size_t records = 0;
+        for (const auto& record : answer.records())
+        {
+            ASSERT_EQ(std::string{ "domain.com" }, record.name.str());
+            ASSERT_EQ(static_cast<uint16_t>(DNSRecordType::MX), record.type);
+            ++records;
+        }
+        ASSERT_EQ(2u, records);
+    }
+}
+
+TEST(Dns, DNSServer_uring_engine_serves_udp_and_tcp)
+{
+    DNSServer server(HOST, PORT);
+    server.settings().engine = DNSEngine::Uring;
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1", "2.2.2.2" });
+    server.start();
+
+    DNSClient client(HOST, PORT);
+    for (uint16_t id = 1; id <= 3; ++id)
+    {
+        DNSPackage result_udp = client.requestUdp(id, DNSRecordType::A, "domain.com");
+        ASSERT_EQ(id, result_udp.header.ID);
+        ASSERT_EQ(2, result_udp.answers.size());
+        ASSERT_EQ(std::string{ "2.2.2.2" }, result_udp.answers[1].decode());
+
+        DNSPackage result_tcp = client.requestTcp(100 + id, DNSRecordType::A, "domain.com");
+        ASSERT_EQ(100 + id, result_tcp.header.ID);
+        ASSERT_EQ(2, result_tcp.answers.size());
+        ASSERT_EQ(std::string{ "1.1.1.1" }, result_tcp.answers[0].decode());
+    }
+
+    auto pipelined = client.requestTcpMany(200, DNSRecordType::A, std::vector<std::string>(20, "domain.com"));
+    ASSERT_EQ(20, pipelined.size());
+    ASSERT_EQ(219, pipelined[19].header.ID);
+
+    // more than a length prefix can carry comes back truncated: 4095
+    // answers of 16 bytes fit a blob, not a message with the question
+    std::vector<std::string> addresses;
+    for (int i = 0; i < 4095; ++i)
+    {
+        addresses.push_back("10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256));
+    }
+    server.addRecord(DNSRecordType::A, "big.domain.com", addresses);
+    auto big = client.requestTcpMany(300, DNSRecordType::A, { "big.domain.com", "domain.com" });
+    ASSERT_EQ(2, big.size());
+    ASSERT_EQ(1, big[0].header.flags.TC);
+    ASSERT_EQ(0, big[0].answers.size());
+    ASSERT_EQ(301, big[1].header.ID);
+    ASSERT_EQ(2, big[1].answers.size());
+
+    // counted like the selector loop counts them; sequential connections reuse one context
+    DNSServerStats stats = server.stats();
+    uint64_t datagrams = 0;
+    for (size_t n = 0; n < stats.udp_batches.size(); ++n)
+    {
+        datagrams += n * stats.udp_batches[n];
+    }
+    ASSERT_EQ(3u, datagrams);
+    uint64_t accepted = 0;
+    for (size_t n = 0; n < stats.tcp_accepts.size(); ++n)
+    {
+        accepted += n * stats.tcp_accepts[n];
+    }
+    ASSERT_EQ(5u, accepted);
+    ASSERT_GE(stats.tcp_contexts, 1u);
+    ASSERT_LE(stats.tcp_contexts, 2u);
+
+    server.stop();
+    server.join();
+}
+
+TEST(Dns, DNSServer_reuseport_workers_serve_and_stop_together)
+{
+    DNSServer server(HOST, PORT);
+    server.settings().workers = 4;
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.start();
+
+    // every client has its own source port, so the kernel spreads them between workers
+    for (uint16_t id = 1; id <= 8; ++id)
+    {
+        DNSClient client(HOST, PORT);
+        DNSPackage result_udp = client.requestUdp(id, DNSRecordType::A, "domain.com");
+        ASSERT_EQ(id, result_udp.header.ID);
+        ASSERT_EQ(1, result_udp.answers.size());
+
+        DNSPackage result_tcp = client.requestTcp(100 + id, DNSRecordType::A, "domain.com");
+        ASSERT_EQ(100 + id, result_tcp.header.ID);
+        ASSERT_EQ(1, result_tcp.answers.size());
+    }
+
+    DNSServerStats stats = server.stats();
+    uint64_t datagrams = 0;
+    for (size_t n = 0; n < stats.udp_batches.size(); ++n)
+    {
+        datagrams += n * stats.udp_batches[n];
+    }
+    ASSERT_EQ(8u, datagrams);
+
+    server.stop();
+    server.join();
+}
+
+TEST(Dns, DNSServer_answers_pipelined_tcp_queries_on_one_connection)
+{
+    DNSServer server(HOST, PORT);
+    // more queries than the per-connection limit: reading pauses and resumes
+    server.settings().tcp_pipeline = 4;
+    server.addRecord(DNSRecordType::A, "a.com", { "1.1.1.1" });
+    server.addRecord(DNSRecordType::A, "b.com", { "2.2.2.2" });
+    server.start();
+
+    DNSClient client(HOST, PORT);
+    std::vector<std::string> hosts;
+    for (int i = 0; i < 50; ++i)
+    {
+        hosts.push_back(i % 2 ? "b.com" : "a.com");
+    }
+
+    auto result = client.requestTcpMany(1, DNSRecordType::A, hosts);
+    ASSERT_EQ(hosts.size(), result.size());
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        ASSERT_EQ(1 + i, result[i].header.ID);
+        ASSERT_EQ(1, result[i].answers.size());
+        ASSERT_EQ(std::string{ i % 2 ? "2.2.2.2" : "1.1.1.1" }, result[i].answers[0].decode());
+    }
+
+    server.stop();
+    server.join();
+}
+
+TEST(Dns, DNSSelector_dispatches_interest_wakeups_and_reused_fds)
+{
+    struct Handler : ISocketHandler
+    {
+        std::vector<SOCKET> reads, writes;
+        void socketReadyRead(SOCKET s) override { reads.push_back(s); }
+        void socketReadyWrite(SOCKET s) override { writes.push_back(s); }
+    } handler;
+    DNSSelector selector(&handler);
+    auto bound = [](int port) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+        if (s == INVALID_SOCKET || bind(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+        {
+            throw std::runtime_error("Can't bind UDP socket");
+        }
+        setupsocket(s);
+        return std::make_pair(s, addr);
+    };
+    SOCKET sender = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(INVALID_SOCKET, sender);
+    auto [receiver, addr] = bound(PORT + 2);
+    const char datagram[] = "x";
+    ASSERT_EQ(1, sendto(sender, datagram, 1, 0, (sockaddr*)&addr, sizeof(addr)));
+
+    // added interest is dispatched, removed interest is not
+    selector.addReadSocket(receiver);
+    ASSERT_EQ(1, selector.select(1000));
+    ASSERT_EQ(std::vector<SOCKET>{ receiver }, handler.reads);
+    selector.removeReadSocket(receiver);
+    handler.reads.clear();
+    selector.select(50);
+    ASSERT_TRUE(handler.reads.empty()); // the datagram is still queued
+    selector.addWriteSocket(receiver);
+    ASSERT_EQ(1, selector.select(1000));
+    ASSERT_EQ(std::vector<SOCKET>{ receiver }, handler.writes);
+    ASSERT_TRUE(handler.reads.empty());
+    selector.removeWriteSocket(receiver);
+
+    // a wakeup from another thread ends a select() waiting forever
+    std::thread waker([&selector] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        selector.wakeup();
+    });
+    selector.select(-1);
+    waker.join();
+    ASSERT_TRUE(handler.reads.empty() && handler.writes.size() == 1);
+
+    // a closed fd dropped from the interest and reopened is watched again
+    selector.addReadSocket(receiver);
+    closesocket(receiver);
+    selector.removeReadSocket(receiver);
+    auto [reopened, reopened_addr] = bound(PORT + 3);
+#ifndef _WIN32
+    ASSERT_EQ(receiver, reopened); // the lowest free fd
+#endif
+    selector.addReadSocket(reopened);
+    ASSERT_EQ(1, sendto(sender, datagram, 1, 0, (sockaddr*)&reopened_addr, sizeof(reopened_addr)));
+    ASSERT_EQ(1, selector.select(1000));
+    ASSERT_EQ(std::vector<SOCKET>{ reopened }, handler.reads);
+
+    closesocket(reopened);
+    closesocket(sender);
+}
+
+TEST(Dns, DNSRingBuffer_wraps_around)
+{
+    DNSRingBuffer ring(8);
+    const uint8_t data[] = { 1, 2, 3, 4, 5, 6 };
+    ring.append(data, 6);
+    ring.consume(4);
+    ASSERT_EQ(2, ring.size());
+    ASSERT_EQ(6, ring.space());
+
+    ring.append(data, 5);   // 5 6 | 1 2 3 4 5, wraps
+    ASSERT_EQ(7, ring.size());
+    ASSERT_EQ(nullptr, ring.contiguous(0, 7));
+    uint8_t out[7];
+    ring.copy(0, out, 7);
+    ASSERT_EQ(5, out[0]);
+    ASSERT_EQ(5, out[6]);
+
+    SocketSlice slices[2];
+    ASSERT_EQ(2, ring.slices(slices));
+    ASSERT_EQ(7, slices[0].size + slices[1].size);
+
+    size_t len;
+    ring.tail(len);
+    ASSERT_EQ(1, len);
+    ring.consume(7);
+    ASSERT_TRUE(ring.empty());
+    ring.tail(len);
+    ASSERT_EQ(8, len);
+}
+
+TEST(Dns, DNSServer_reuses_tcp_contexts_and_frames_across_connections)
+{
+    DNSServer server(HOST, PORT);
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.start();
+
+    DNSClient client(HOST, PORT);
+    for (uint16_t id = 1; id <= 200; ++id)
+    {
+        ASSERT_EQ(id, client.requestTcp(id, DNSRecordType::A, "domain.com").header.ID);
+    }
+
+    // connections are sequential: the slab only grows by the few that overlap
+    DNSServerStats stats = server.stats();
+    ASSERT_GE(stats.tcp_contexts, 1u);
+    ASSERT_LE(stats.tcp_contexts, 4u);
+    ASSERT_GE(stats.tcp_frames, 1u);
+    ASSERT_LE(stats.tcp_frames, stats.tcp_contexts); // frames are pooled like the contexts
+
+    server.stop();
+    server.join();
+}
+
+class RecordingTimerHandler : public ITimerHandler
+{
+public:
+    void timerExpired(DNSTimer& timer) override
+    {
+        fired.push_back(timer.data);
+    }
+    std::vector<uint64_t> fired;
+};
+
+TEST(Dns, DNSTimerWheel_fires_in_order_never_early)
+{
+    RecordingTimerHandler handler;
+    DNSTimerWheel wheel(&handler, 10);
+    const uint64_t start = DNSTimerWheel::now();
+
+    // level 0, level 1 (> 64 ticks), level 2 (> 4096 ticks)
+    const uint64_t delays[] = { 50, 900, 70000, 30 };
+    DNSTimer timers[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        timers[i].data = i;
+        wheel.schedule(timers[i], delays[i], start);
+    }
+    DNSTimer cancelled;
+    wheel.schedule(cancelled, 40, start);
+    wheel.cancel(cancelled);
+    ASSERT_FALSE(cancelled.armed());
+    ASSERT_EQ(4, wheel.size());
+
+    for (uint64_t t = start; handler.fired.size() < 4; t += 5)
+    {
+        ASSERT_LE(0, wheel.timeout(t));
+        wheel.advance(t);
+        for (auto i : handler.fired)
+        {
+            ASSERT_GE(t, start + delays[i]);
+        }
+    }
+    ASSERT_EQ((std::vector<uint64_t>{ 3, 0, 1, 2 }), handler.fired);
+    ASSERT_EQ(0, wheel.size());
+    ASSERT_EQ(-1, wheel.timeout(start));
+}
+
+TEST(Dns, DNSServer_closes_idle_and_slow_tcp_clients)
+{
+    for (DNSEngine engine : { DNSEngine::Selector, DNSEngine::Uring })
+    {
+        DNSServer server(HOST, PORT);
+        server.settings().engine = engine;
+        server.settings().tcp_idle_timeout = 100;
+        server.settings().tcp_read_timeout = 100;
+        server.start();
+
+        SOCKET idle = connectTcp();
+        SOCKET slow = connectTcp();
+        const char partial[] = { 0, 30, 1 }; // a query that never completes
+        ASSERT_EQ(3, send(slow, partial, sizeof(partial), 0));
+
+        ASSERT_TRUE(waitClosed(idle));
+        ASSERT_TRUE(waitClosed(slow));
+        ASSERT_EQ(2u, server.stats().tcp_timeouts);
+        closesocket(idle);
+        closesocket(slow);
+
+        server.stop();
+        server.join();
+    }
+}
+
+TEST(Dns, DNSServer_sheds_oldest_idle_tcp_connection_at_cap)
+{
+    for (DNSEngine engine : { DNSEngine::Selector, DNSEngine::Uring })
+    {
+        DNSServer server(HOST, PORT);
+        server.settings().engine = engine;
+        server.settings().max_connections = 2;
+        server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+        server.start();
+
+        DNSClient client(HOST, PORT);
+        SOCKET oldest = connectTcp();
+        ASSERT_EQ(1, client.requestTcpMany(1, DNSRecordType::A, { "domain.com" }).size()); // `oldest` is accepted by now
+        SOCKET newer = connectTcp();
+        ASSERT_EQ(1, client.requestTcpMany(2, DNSRecordType::A, { "domain.com" }).size());
+
+        ASSERT_TRUE(waitClosed(oldest));
+        DNSServerStats stats = server.stats();
+        ASSERT_GE(stats.tcp_shed, 1u);
+        ASSERT_EQ(0u, stats.tcp_refused);
+        ASSERT_GE(stats.tcp_contexts, 1u);
+        closesocket(oldest);
+        closesocket(newer);
+
+        server.stop();
+        server.join();
+    }
+}
+
+TEST(Dns, DNSServer_drains_tcp_accept_bursts)
+{
+    DNSServer server(HOST, PORT);
+    server.settings().tcp_backlog = 128;
+#ifdef __linux__
+    server.settings().tcp_fastopen = 16;
+    server.settings().tcp_defer_accept = 1;
+#endif
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.start();
+
+    DNSPackage query;
+    query.header.ID = 7;
+    query.header.QDCOUNT = 1;
+    query.requests.emplace_back(DNSRequest{ DNSRecordType::A, "domain.com" });
+    DNSBuffer buf;
+    buf.append(static_cast<uint16_t>(0u));
+    buf.data_start = buf.result.size();
+    query.append(buf);
+    buf.overwrite_uint16(0, static_cast<uint16_t>(buf.result.size() - sizeof(uint16_t)));
+
+    // connect everything first, so the listener sees a burst
+    std::vector<SOCKET> sockets;
+    for (int i = 0; i < 50; ++i)
+    {
+        sockets.push_back(connectTcp());
+    }
+    for (auto s : sockets)
+    {
+        ASSERT_EQ(buf.result.size(), send(s, reinterpret_cast<const char*>(&buf.result[0]), static_cast<int>(buf.result.size()), 0));
+    }
+    for (auto s : sockets)
+    {
+        char answer[512];
+        ASSERT_LT(static_cast<int>(sizeof(uint16_t) + sizeof(DNSHeader)), recv(s, answer, sizeof(answer), 0));
+        closesocket(s);
+    }
+
+    DNSServerStats stats = server.stats();
+    uint64_t accepted = 0;
+    for (size_t n = 0; n < stats.tcp_accepts.size(); ++n)
+    {
+        accepted += n * stats.tcp_accepts[n];
+    }
+    ASSERT_EQ(50u, accepted);
+
+    server.stop();
+    server.join();
+}
+
+TEST(Dns, DNSServer_busy_poll_serves_and_backs_off_when_idle)
+{
+    DNSServer server(HOST, PORT);
+    server.settings().busy_poll = 50;
+    server.settings().busy_poll_idle = 1000;
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.start();
+
+    DNSClient client(HOST, PORT);
+    ASSERT_EQ(1, client.requestUdp(1, DNSRecordType::A, "domain.com").answers.size());
+    ASSERT_EQ(1, client.requestTcp(2, DNSRecordType::A, "domain.com").answers.size()); // served while spinning
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_GE(server.stats().busy_poll_sleeps, 1u);
+    ASSERT_EQ(1, client.requestUdp(3, DNSRecordType::A, "domain.com").answers.size()); // wakes the worker up
+
+    server.stop();
+    server.join();
+}
+
+TEST(Dns, DNSNameIndex_is_case_insensitive_and_survives_erase)
+{
+    ASSERT_EQ(std::string("\4mail\7example\3com"), DNSNameIndex::key("Mail.EXAMPLE.com."));
+    ASSERT_EQ(DNSNameIndex::hash("Mail.Example.COM", 1), DNSNameIndex::hash("mail.example.com", 1));
+
+    DNSNameIndex index;
+    bool inserted;
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        ASSERT_EQ(i, index.insert("host" + std::to_string(i) + ".example.com", 1, inserted));
+        ASSERT_TRUE(inserted);
+    }
+    ASSERT_EQ(7u, index.insert("HOST7.example.com", 1, inserted));
+    ASSERT_FALSE(inserted);
+    ASSERT_EQ(DNSNameIndex::NOT_FOUND, index.find("host7.example.com", 16));
+    ASSERT_EQ(DNSNameIndex::NOT_FOUND, index.find("host7.example", 1));
+
+    // every other name goes: the rest must stay reachable across the shifted runs
+    for (uint32_t i = 0; i < 1000; i += 2)
+    {
+        ASSERT_EQ(i, index.erase("host" + std::to_string(i) + ".example.com", 1));
+    }
+    ASSERT_EQ(500u, index.size());
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        ASSERT_EQ(i % 2 ? i : DNSNameIndex::NOT_FOUND, index.find("host" + std::to_string(i) + ".EXAMPLE.com", 1));
+    }
+    ASSERT_LT(index.insert("new.example.com", 1, inserted), 1000u); // a freed id is reused
+
+    // enough churn to compact the record arena
+    for (uint32_t i = 1; i < 1000; i += 2)
+    {
+        index.erase("host" + std::to_string(i) + ".example.com", 1);
+        index.insert("other" + std::to_string(i) + ".example.com", 1, inserted);
+    }
+    ASSERT_EQ(501u, index.size());
+    ASSERT_NE(DNSNameIndex::NOT_FOUND, index.find("new.example.com", 1));
+    ASSERT_NE(DNSNameIndex::NOT_FOUND, index.find("Other999.example.com", 1));
+    ASSERT_EQ(DNSNameIndex::NOT_FOUND, index.find("host999.example.com", 1));
+}
+
+TEST(Dns, DNSNameTree_matches_wildcards_below_the_closest_encloser)
+{
+    DNSNameTree tree;
+    bool inserted, wildcard;
+    const uint32_t any = tree.insert("*.tenant.example.com", 1, inserted);
+    const uint32_t host = tree.insert("host.tenant.example.com", 16, inserted);
+    tree.insert("deep.sub.tenant.example.com", 1, inserted); // sub.tenant.example.com: empty non-terminal
+    ASSERT_EQ(1u, tree.wildcards());
+
+    ASSERT_EQ(any, tree.find("a.tenant.example.com", 1, DNSNameIndex::hash("a.tenant.example.com", 1), wildcard));
+    ASSERT_TRUE(wildcard);
+    ASSERT_EQ(any, tree.find("X.Y.Tenant.Example.com", 1)); // several labels, any case
+    ASSERT_EQ(host, tree.find("host.tenant.example.com", 16, DNSNameIndex::hash("host.tenant.example.com", 16), wildcard));
+    ASSERT_FALSE(wildcard);
+
+    // RFC 4592: names that exist are never synthesized, nor is anything
+    // below them without a wildcard of their own
+    ASSERT_EQ(DNSNameTree::NOT_FOUND, tree.find("host.tenant.example.com", 1));
+    ASSERT_EQ(DNSNameTree::NOT_FOUND, tree.find("sub.tenant.example.com", 1));
+    ASSERT_EQ(DNSNameTree::NOT_FOUND, tree.find("x.sub.tenant.example.com", 1));
+    ASSERT_EQ(DNSNameTree::NOT_FOUND, tree.find("tenant.example.com", 1));
+    ASSERT_EQ(DNSNameTree::NOT_FOUND, tree.find("a.tenant.example.com", 16));
+    ASSERT_EQ(DNSNameTree::NOT_FOUND, tree.find("a.other.example.com", 1));
+
+    // the empty non-terminal goes with its last name
+    ASSERT_NE(DNSNameTree::NOT_FOUND, tree.erase("deep.sub.tenant.example.com", 1));
+    ASSERT_EQ(any, tree.find("x.sub.tenant.example.com", 1));
+    ASSERT_EQ(any, tree.erase("*.tenant.example.com", 1));
+    ASSERT_EQ(0u, tree.wildcards());
+    ASSERT_EQ(DNSNameTree::NOT_FOUND, tree.find("a.tenant.example.com", 1));
+    ASSERT_EQ(1u, tree.size());
+}
+
+TEST(Dns, DNSBloomFilter_has_no_false_negatives_and_bounded_false_positives)
+{
+    ASSERT_TRUE(DNSBloomFilter().mayContain(42)); // no keys: everything passes
+
+    DNSBloomFilter filter(100000, 0.01);
+    for (uint32_t i = 0; i < 100000; ++i)
+    {
+        filter.insert(DNSNameIndex::hash("host-" + std::to_string(i) + ".domain.com", 1));
+    }
+    for (uint32_t i = 0; i < 100000; ++i)
+    {
+        ASSERT_TRUE(filter.mayContain(DNSNameIndex::hash("host-" + std::to_string(i) + ".domain.com", 1)));
+    }
+    size_t positives = 0;
+    for (uint32_t i = 0; i < 100000; ++i)
+    {
+        positives += filter.mayContain(DNSNameIndex::hash("absent-" + std::to_string(i) + ".domain.com", 1));
+    }
+    ASSERT_LT(positives, 2000u); // 1% asked for
+}
+
+TEST(Dns, DNSZone_updates_filter_in_place_until_it_outgrows_it)
+{
+    auto add = [](DNSZone& zone, const std::string& host) {
+        zone.add(DNSRecordType::A, host, DNSZoneResponse::render(DNSRecordType::A, host, DNSResultCode::NoError, { "10.0.0.1" }));
+    };
+    auto found = [](const DNSZone& zone, const std::string& host) {
+        return zone.find(host, 1, DNSNameIndex::hash(host, 1)) != nullptr;
+    };
+    DNSZone zone;
+    for (int i = 0; i < 1000; ++i)
+    {
+        add(zone, "host-" + std::to_string(i) + ".domain.com");
+    }
+    zone.updateFilter(0.01);
+    const size_t bytes = zone.filterBytes();
+    ASSERT_GT(bytes, 0u);
+
+    // a snapshot gets its own copy with the new name, the same size
+    DNSZone copy(zone);
+    add(copy, "new.domain.com");
+    copy.updateFilter(0.01);
+    ASSERT_EQ(bytes, copy.filterBytes());
+    ASSERT_TRUE(found(copy, "new.domain.com"));
+    ASSERT_FALSE(found(zone, "new.domain.com"));
+    // a removed name leaves its bits, never a wrong answer
+    ASSERT_TRUE(copy.remove(DNSRecordType::A, "host-1.domain.com"));
+    ASSERT_FALSE(found(copy, "host-1.domain.com"));
+    add(copy, "host-1.domain.com");
+    ASSERT_TRUE(found(copy, "host-1.domain.com"));
+
+    // rebuilt once a quarter more names went in, or for another rate
+    for (int i = 0; i < 250; ++i)
+    {
+        add(copy, "more-" + std::to_string(i) + ".domain.com");
+    }
+    copy.updateFilter(0.01);
+    ASSERT_GT(copy.filterBytes(), bytes);
+    for (int i = 0; i < 250; ++i)
+    {
+        ASSERT_TRUE(found(copy, "more-" + std::to_string(i) + ".domain.com"));
+    }
+    zone.updateFilter(0.001);
+    ASSERT_GT(zone.filterBytes(), bytes);
+    zone.updateFilter(0);
+    ASSERT_EQ(0u, zone.filterBytes());
+
+    // the mapped bits are copied before the first insert
+    const std::string image = "/tmp/tst_dns_filter_update.img";
+    copy.save(image);
+    DNSZone mapped(std::make_shared<const DNSZoneImage>(image));
+    add(mapped, "mapped.domain.com");
+    mapped.updateFilter(0.01);
+    ASSERT_TRUE(found(mapped, "mapped.domain.com"));
+    ASSERT_TRUE(found(mapped, "more-7.domain.com"));
+    std::remove(image.c_str());
+}
+
+TEST(Dns, DNSZone_merges_a_changes_into_the_reverse_index)
+{
+    auto add = [](DNSZone& zone, const std::string& host, const std::vector<std::string>& addresses, DNSResultCode result = DNSResultCode::NoError) {
+        zone.add(DNSRecordType::A, host, DNSZoneResponse::render(DNSRecordType::A, host, result, addresses));
+    };
+    auto owners = [](const DNSZone& zone, int last) {
+        std::vector<std::string> result;
+        zone.reverse(std::to_string(last) + ".0.0.10.in-addr.arpa", result);
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+    DNSZone zone;
+    for (int i = 0; i < 200; ++i)
+    {
+        add(zone, "host-" + std::to_string(i) + ".domain.com", { "10.0.0." + std::to_string(i % 50), "10.0.0." + std::to_string(100 + i % 7) });
+    }
+    zone.updateReverse(true);
+    ASSERT_EQ(400u, zone.reverseSize());
+
+    DNSZone merged(zone);
+    add(merged, "host-1.domain.com", { "10.0.0.60" });                  // replaced
+    ASSERT_TRUE(merged.remove(DNSRecordType::A, "host-2.domain.com"));  // removed
+    add(merged, "HOST-3.domain.com", { "10.0.0.61" });                  // replaced twice, any case
+    add(merged, "host-3.domain.com", { "10.0.0.62", "10.0.0.103" });
+    add(merged, "host-4.domain.com", {}, DNSResultCode::NameError);     // no address
+    add(merged, "new.domain.com", { "10.0.0.1" });                      // added, then removed
+    ASSERT_TRUE(merged.remove(DNSRecordType::A, "new.domain.com"));
+    add(merged, "other.domain.com", { "10.0.0.63" });
+    add(merged, "*.domain.com", { "10.0.0.64" });
+    merged.add(DNSRecordType::TXT, "host-5.domain.com", DNSZoneResponse::render(DNSRecordType::TXT, "host-5.domain.com", DNSResultCode::NoError, { "text" }));
+    merged.updateReverse(true);
+    ASSERT_GT(merged.reverseSize(), 0u);
+
+    DNSZone rebuilt(merged);
+    rebuilt.rebuildReverse(true);
+    ASSERT_EQ(rebuilt.reverseSize(), merged.reverseSize());
+    for (int last = 0; last < 110; ++last)
+    {
+        ASSERT_EQ(owners(rebuilt, last), owners(merged, last)) << last;
+    }
+    ASSERT_GT(merged.reverseBytes(), rebuilt.reverseBytes()); // the replaced names stay behind
+    ASSERT_EQ(std::vector<std::string>{ "other.domain.com" }, owners(merged, 63));
+    ASSERT_TRUE(owners(merged, 64).empty());
+    // the snapshot merged from keeps its own
+    ASSERT_EQ(400u, zone.reverseSize());
+    ASSERT_EQ(std::vector<std::string>{}, owners(zone, 60));
+
+    // disabling drops it, and enabling rebuilds it
+    merged.updateReverse(false);
+    ASSERT_EQ(0u, merged.reverseSize());
+    merged.updateReverse(true);
+    ASSERT_EQ(rebuilt.reverseSize(), merged.reverseSize());
+}
+
+TEST(Dns, DNSEpoch_frees_retired_objects_after_readers_leave)
+{
+    DNSEpoch epoch;
+    int freed = 0;
+    {
+        DNSEpoch::Guard reader(epoch);
+        epoch.retire([&freed] { ++freed; });
+        ASSERT_EQ(0, freed); // the reader may still use it
+        ASSERT_EQ(1u, epoch.pending());
+    }
+    {
+        DNSEpoch::Guard late(epoch); // entered after the retire: does not hold it back
+        epoch.reclaim();
+        ASSERT_EQ(1, freed);
+        ASSERT_EQ(0u, epoch.pending());
+    }
+    epoch.retire([&freed] { ++freed; });
+    ASSERT_EQ(2, freed);
+}
+
+TEST_F(DnsServerFixture, LooksUpNamesCaseInsensitively)
+{
+    server.addRecord(DNSRecordType::A, "Domain.COM", { "1.1.1.1" });
+
+    DNSPackage result = client.requestUdp(1, DNSRecordType::A, "dOmAiN.com");
+    ASSERT_EQ(DNSResultCode::NoError, static_cast<DNSResultCode>(result.header.flags.RCODE));
+    ASSERT_EQ(1, result.answers.size());
+    ASSERT_EQ(std::string{ "dOmAiN.com" }, result.answers[0].name); // the question's spelling is kept
+}
+
+TEST_F(DnsServerFixture, SynthesizesWildcardAnswers)
+{
+    server.addRecord(DNSRecordType::A, "*.tenant.domain.com", { "1.1.1.1" });
+    server.addRecord(DNSRecordType::A, "www.tenant.domain.com", { "2.2.2.2" });
+
+    DNSPackage result = client.requestUdp(1, DNSRecordType::A, "a.tenant.domain.com");
+    ASSERT_EQ(DNSResultCode::NoError, static_cast<DNSResultCode>(result.header.flags.RCODE));
+    ASSERT_EQ(1, result.answers.size());
+    ASSERT_EQ(std::string{ "a.tenant.domain.com" }, result.answers[0].name); // owned by the question
+    ASSERT_EQ(std::string{ "1.1.1.1" }, result.answers[0].decode());
+
+    result = client.requestUdp(2, DNSRecordType::A, "www.tenant.domain.com");
+    ASSERT_EQ(std::string{ "2.2.2.2" }, result.answers[0].decode());
+
+    result = client.requestUdp(3, DNSRecordType::A, "tenant.domain.com");
+    ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(result.header.flags.RCODE));
+}
+
+static std::vector<uint8_t> makeQuery(uint16_t id, DNSRecordType type, const std::string& host)
+{
+    DNSPackage package;
+    package.header.ID = id;
+    package.header.flags.RD = 1;
+    package.header.QDCOUNT = 1;
+    package.requests.emplace_back(DNSRequest{ type, host });
+    DNSBuffer buf;
+    package.append(buf);
+    return buf.result;
+}
+
+TEST(Dns, DNSServer_prerendered_answers_match_generic_encoding)
+{
+    DNSServer server(HOST, PORT);
+    server.addRecord(DNSRecordType::MX, "domain.com", { "mx1.domain.com", "mx2.domain.com" });
+    server.addRecord(DNSRecordType::TXT, "domain.com", { "some text" });
+
+    for (DNSRecordType type : { DNSRecordType::MX, DNSRecordType::TXT })
+    {
+        // what the generic path renders, name compression included
+        const auto query = makeQuery(0x1234, type, "domain.com");
+        DNSPackage expected(&query[0], query.size());
+        expected.header.flags.QR = 1;
+        expected.header.flags.RA = 1;
+        for (const auto& item : type == DNSRecordType::MX ? std::vector<std::string>{ "mx1.domain.com", "mx2.domain.com" } : std::vector<std::string>{ "some text" })
+        {
+            expected.addAnswer(type, "domain.com", item);
+        }
+        expected.header.ANCOUNT = static_cast<uint16_t>(expected.answers.size());
+        DNSBuffer expected_buf;
+        expected.append(expected_buf);
+
+        DNSBuffer buf;
+        server.processQuery(&query[0], query.size(), buf);
+        ASSERT_EQ(toHex(expected_buf.result), toHex(buf.result));
+    }
+
+    // another spelling of the name: same answers, the question as asked
+    const auto query = makeQuery(7, DNSRecordType::MX, "DOMAIN.com");
+    DNSBuffer buf;
+    server.processQuery(&query[0], query.size(), buf);
+    DNSPackage answer(&buf.result[0], buf.result.size());
+    ASSERT_EQ(7, answer.header.ID);
+    ASSERT_EQ(std::string{ "DOMAIN.com" }, answer.requests[0].name);
+    ASSERT_EQ(2, answer.answers.size());
+    ASSERT_EQ(std::string{ "mx2.DOMAIN.com" }, answer.answers[1].decode()); // the suffix is compressed into the question
+
+    const auto missing = makeQuery(8, DNSRecordType::A, "domain.com");
+    buf.clear();
+    server.processQuery(&missing[0], missing.size(), buf);
+    DNSPackage not_found(&buf.result[0], buf.result.size());
+    ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(not_found.header.flags.RCODE));
+    ASSERT_EQ(0, not_found.header.ANCOUNT);
+}
+
+TEST(Dns, DNSServer_truncates_prerendered_answers_too_big_for_udp)
+{
+    DNSServer server(HOST, PORT);
+    std::vector<std::string> addresses;
+    for (int i = 0; i < 40; ++i)
+    {
+        addresses.push_back("10.0.0." + std::to_string(i));
+    }
+    server.addRecord(DNSRecordType::A, "big.com", addresses);
+
+    const auto query = makeQuery(1, DNSRecordType::A, "big.com");
+    DNSBuffer buf;
+    buf.max_size = UDP_SIZE;
+    server.processQuery(&query[0], query.size(), buf);
+    DNSPackage answer(&buf.result[0], buf.result.size());
+    ASSERT_EQ(1, answer.header.flags.TC);
+    ASSERT_EQ(0, answer.header.ANCOUNT);
+
+    buf.clear();
+    server.processQuery(&query[0], query.size(), buf); // no limit: everything fits
+    ASSERT_EQ(40, DNSPackage(&buf.result[0], buf.result.size()).answers.size());
+}
+
+TEST(Dns, DNSBuffer_compresses_names_against_what_it_wrote)
+{
+    DNSBuffer buf;
+    buf.append(static_cast<uint16_t>(0u)); // a TCP length prefix: offsets count from after it
+    buf.data_start = buf.result.size();
+    DNSHeader().append(buf);
+    buf.append_domain("www.domain.com");
+    buf.append_domain("mx.domain.com");     // the suffix at 0x10
+    buf.append_domain("DOMAIN.com");        // case is kept: only "com" is shared
+    buf.append_domain("www.domain.com.");   // the whole name, trailing dot or not
+    buf.append_domain("");
+    const std::vector<uint8_t> header(buf.result.begin(), buf.result.begin() + 14);
+    ASSERT_EQ(toHex(header)
+        + "03777777" "06646f6d61696e" "03636f6d" "00"
+        + "026d78" "c010"
+        + "06444f4d41494e" "c017"
+        + "c00c"
+        + "00",
+        toHex(buf.result));
+
+    // cleared, nothing is left to point at
+    buf.clear();
+    DNSHeader().append(buf);
+    buf.append_domain("mx.domain.com");
+    ASSERT_EQ(toHex(std::vector<uint8_t>(12, 0)) + "026d78" "06646f6d61696e" "03636f6d" "00", toHex(buf.result));
+
+    // more names than the table holds, and names past the reach of a
+    // pointer: every one still reads back as it was written
+    buf.clear();
+    DNSHeader().append(buf);
+    std::vector<std::pair<size_t, std::string>> names;
+    for (size_t i = 0; buf.result.size() < 0x5000; ++i)
+    {
+        names.emplace_back(buf.result.size(), "host" + std::to_string(i % 1000) + ".zone" + std::to_string(i % 7) + ".example.com");
+        buf.append_domain(names.back().second);
+    }
+    const uint8_t* end = buf.result.data() + buf.result.size();
+    for (const auto& name : names)
+    {
+        const uint8_t* data = buf.result.data() + name.first;
+        ASSERT_EQ(name.second, get_domain(buf.result.data(), end, data));
+    }
+    ASSERT_LT(buf.result.size(), names.size() * names.back().second.size()); // and most are compressed
+}
+
+TEST(Dns, DNSServer_batch_updates_are_atomic_for_running_queries)
+{
+    DNSServer server(HOST, PORT);
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+
+    // each batch replaces the record by removing and re-adding it, so a
+    // query that saw half a batch would get NameError
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+    std::thread reader([&] {
+        const auto query = makeQuery(1, DNSRecordType::A, "domain.com");
+        DNSBuffer buf;
+        while (!done)
+        {
+            buf.clear();
+            server.processQuery(&query[0], query.size(), buf);
+            DNSPackage answer(&buf.result[0], buf.result.size());
+            if (answer.header.flags.RCODE != static_cast<uint16_t>(DNSResultCode::NoError) || answer.answers.size() != 1)
+            {
+                ++errors;
+            }
+        }
+    });
+    for (int i = 0; i < 500; ++i)
+    {
+        DNSRecordBatch batch;
+        batch.remove(DNSRecordType::A, "domain.com");
+        batch.add(DNSRecordType::A, "domain.com", { "10.0.0." + std::to_string(i % 250) });
+        batch.add(DNSRecordType::TXT, "domain.com", { "update " + std::to_string(i) });
+        ASSERT_EQ(3u, server.update(batch));
+    }
+    done = true;
+    reader.join();
+    ASSERT_EQ(0, errors);
+
+    DNSRecordBatch batch;
+    batch.remove(DNSRecordType::MX, "domain.com");
+    ASSERT_EQ(0u, server.update(batch));
+    ASSERT_TRUE(server.removeRecord(DNSRecordType::TXT, "domain.com"));
+    ASSERT_FALSE(server.removeRecord(DNSRecordType::TXT, "domain.com"));
+}
+
+TEST(Dns, DNSServer_serves_zone_image_and_updates_on_top)
+{
+    const std::string image = "/tmp/tst_dns_zone.img";
+    {
+        DNSServer server(HOST, PORT);
+        DNSRecordBatch batch;
+        batch.add(DNSRecordType::MX, "domain.com", { "mx1.domain.com", "mx2.domain.com" });
+        batch.add(DNSRecordType::A, "*.tenant.domain.com", { "1.1.1.1" });
+        batch.add(DNSRecordType::A, "gone.domain.com", { "2.2.2.2" });
+        batch.add(DNSRecordType::A, "missing.domain.com", {}, DNSResultCode::NameError);
+        server.update(batch);
+        server.removeRecord(DNSRecordType::A, "gone.domain.com");
+        server.saveZone(image);
+    }
+
+    DNSServer server(HOST, PORT);
+    server.loadZone(image, false, true);
+    auto ask = [&server](DNSRecordType type, const std::string& host) {
+        const auto query = makeQuery(1, type, host);
+        DNSBuffer buf;
+        server.processQuery(&query[0], query.size(), buf);
+        return DNSPackage(&buf.result[0], buf.result.size());
+    };
+    DNSPackage answer = ask(DNSRecordType::MX, "domain.com");
+    ASSERT_EQ(2, answer.answers.size());
+    ASSERT_EQ(std::string{ "mx2.domain.com" }, answer.answers[1].decode());
+    answer = ask(DNSRecordType::A, "x.tenant.domain.com"); // generic path, from the image's strings
+    ASSERT_EQ(std::string{ "1.1.1.1" }, answer.answers[0].decode());
+    ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(ask(DNSRecordType::A, "gone.domain.com").header.flags.RCODE));
+    ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(ask(DNSRecordType::A, "missing.domain.com").header.flags.RCODE));
+
+    // changes on top of the mapped image
+    server.addRecord(DNSRecordType::MX, "domain.com", { "mx3.domain.com" });
+    ASSERT_TRUE(server.removeRecord(DNSRecordType::A, "*.tenant.domain.com"));
+    server.addRecord(DNSRecordType::A, "new.domain.com", { "3.3.3.3" });
+    answer = ask(DNSRecordType::MX, "domain.com");
+    ASSERT_EQ(1, answer.answers.size());
+    ASSERT_EQ(std::string{ "mx3.domain.com" }, answer.answers[0].decode());
+    ASSERT_EQ(0, ask(DNSRecordType::A, "x.tenant.domain.com").answers.size());
+    ASSERT_EQ(std::string{ "3.3.3.3" }, ask(DNSRecordType::A, "new.domain.com").answers[0].decode());
+
+    // a damaged image is refused
+    {
+        std::fstream file(image, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-1, std::ios::end);
+        file.put('\x7f');
+    }
+    ASSERT_NO_THROW(DNSServer(HOST, PORT).loadZone(image)); // the header is fine
+    ASSERT_THROW(DNSServer(HOST, PORT).loadZone(image, false, true), std::runtime_error);
+    {
+        std::ofstream file(image, std::ios::binary | std::ios::trunc);
+        file << "not a zone image, just some text long enough for a header......................";
+    }
+    ASSERT_THROW(DNSServer(HOST, PORT).loadZone(image), std::runtime_error);
+    std::remove(image.c_str());
+}
+
+TEST(Dns, DNSServer_checks_offsets_read_from_a_damaged_image)
+{
+    const std::string image = "/tmp/tst_dns_damaged.img";
+    {
+        DNSServer server(HOST, PORT);
+        DNSRecordBatch batch;
+        for (int i = 0; i < 100; ++i)
+        {
+            batch.add(DNSRecordType::A, "host-" + std::to_string(i) + ".domain.com", { "1.1.1.1" });
+        }
+        server.update(batch);
+        server.saveZone(image);
+    }
+    auto field = [&image](size_t offset) {
+        std::ifstream file(image, std::ios::binary);
+        uint64_t value = 0;
+        file.seekg(offset);
+        file.read(reinterpret_cast<char*>(&value), sizeof(value));
+        return value;
+    };
+    auto ask = [](DNSServer& server, const std::string& host) {
+        const auto query = makeQuery(1, DNSRecordType::A, host);
+        DNSBuffer buf;
+        server.processQuery(&query[0], query.size(), buf);
+        return DNSPackage(&buf.result[0], buf.result.size());
+    };
+    // the header's offsets of the tree, the blob offsets and their count
+    const uint64_t tree = field(32), responses = field(40), response_count = field(48);
+    {
+        // every blob offset past the end of the blobs
+        std::fstream file(image, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(responses);
+        const uint64_t damaged = 1ull << 40;
+        for (uint64_t i = 0; i < response_count; ++i)
+        {
+            file.write(reinterpret_cast<const char*>(&damaged), sizeof(damaged));
+        }
+    }
+    {
+        DNSServer server(HOST, PORT);
+        server.loadZone(image); // the header is fine
+        ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(ask(server, "host-7.domain.com").header.flags.RCODE));
+        ASSERT_THROW(DNSServer(HOST, PORT).loadZone(image, false, true), std::runtime_error);
+    }
+    {
+        // every record offset of the name index past its records: the
+        // slots (tag, offset) follow its 6-word header
+        const uint64_t slots = field(tree);
+        std::fstream file(image, std::ios::in | std::ios::out | std::ios::binary);
+        const uint32_t damaged = 0x7FFFFFF0u;
+        for (uint64_t i = 0; i < slots; ++i)
+        {
+            const uint64_t offset = tree + 6 * sizeof(uint64_t) + i * 2 * sizeof(uint32_t) + sizeof(uint32_t);
+            uint32_t record;
+            file.seekg(offset);
+            file.read(reinterpret_cast<char*>(&record), sizeof(record));
+            if (record != 0xFFFFFFFFu) // empty slots end the probes
+            {
+                file.seekp(offset);
+                file.write(reinterpret_cast<const char*>(&damaged), sizeof(damaged));
+            }
+        }
+    }
+    {
+        DNSServer server(HOST, PORT);
+        server.loadZone(image);
+        ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(ask(server, "host-7.domain.com").header.flags.RCODE));
+        server.addRecord(DNSRecordType::A, "new.domain.com", { "2.2.2.2" });
+        ASSERT_EQ(std::string{ "2.2.2.2" }, ask(server, "new.domain.com").answers.at(0).decode());
+    }
+    {
+        // no empty slot would end a probe: refused, not served
+        const uint64_t slots = field(tree);
+        std::fstream file(image, std::ios::in | std::ios::out | std::ios::binary);
+        const uint32_t damaged = 0x7FFFFFF0u;
+        for (uint64_t i = 0; i < slots; ++i)
+        {
+            file.seekp(tree + 6 * sizeof(uint64_t) + i * 2 * sizeof(uint32_t) + sizeof(uint32_t));
+            file.write(reinterpret_cast<const char*>(&damaged), sizeof(damaged));
+        }
+    }
+    ASSERT_THROW(DNSServer(HOST, PORT).loadZone(image), std::runtime_error);
+    std::remove(image.c_str());
+}
+
+TEST(Dns, DNSJsonLoader_parses_record_chunks_in_parallel)
+{
+    const std::string json = "/tmp/tst_dns_loader.json";
+    {
+        std::ofstream os(json);
+        os << "{\n  // settings around the records\n  \"port\": 10053,\n  \"records\": [\n";
+        for (int i = 0; i < 1000; ++i)
+        {
+            os << "    { \"type\": \"" << (i % 2 ? "A" : "txt") << "\", \"host\": \"h" << i << ".domain.com\", "
+               << "\"comment\": { \"nested\": [1, \"]}\"] }, \"response\": [\"10.0." << i / 256 << "." << i % 256 << "\",] },\n";
+        }
+        os << "    /* escapes */ { \"type\": \"TXT\", \"host\": \"esc.domain.com\", \"response\": [\"a\\\"b\\\\c\\u00e9\\ud83d\\ude00\"], \"result\": \"NoError\" },\n";
+        os << "  ],\n  \"workers\": 2,\n}\n";
+    }
+
+    DNSJsonLoader loader(json, 64);
+    ASSERT_LT(100, loader.chunks());
+    Json::Value root;
+    std::istringstream iss(loader.settings());
+    ASSERT_TRUE(Json::parseFromStream(Json::CharReaderBuilder(), iss, &root, nullptr));
+    ASSERT_EQ(10053, root["port"].asInt());
+    ASSERT_EQ(2, root["workers"].asInt());
+    ASSERT_EQ(0, root["records"].size());
+
+    const auto chunks = loader.records(4);
+    std::vector<const DNSJsonLoader::Record*> records;
+    for (const auto& chunk : chunks)
+    {
+        for (const auto& record : chunk)
+        {
+            records.push_back(&record);
+        }
+    }
+    ASSERT_EQ(1001, records.size());
+    ASSERT_EQ(DNSRecordType::TXT, records[998]->type);
+    ASSERT_EQ(std::string{ "h999.domain.com" }, records[999]->host);
+    ASSERT_EQ(std::vector<std::string>{ "10.0.3.231" }, DNSZoneResponse(records[999]->response.data()).records(records[999]->host));
+    ASSERT_EQ(std::vector<std::string>{ "a\"b\\c\xC3\xA9\xF0\x9F\x98\x80" }, DNSZoneResponse(records[1000]->response.data()).records(records[1000]->host));
+
+    DNSServer server(json);
+    const auto query = makeQuery(1, DNSRecordType::A, "h501.domain.com");
+    DNSBuffer buf;
+    server.processQuery(&query[0], query.size(), buf);
+    DNSPackage answer(&buf.result[0], buf.result.size());
+    ASSERT_EQ(1, answer.answers.size());
+    ASSERT_EQ(std::string{ "10.0.1.245" }, answer.answers[0].decode());
+
+    for (const char* bad : {
+        "{ \"records\": [ { \"type\": \"SOA\", \"host\": \"domain.com\" } ] }",
+        "{ \"records\": [ { \"type\": \"A\", \"host\": \"domain.com\" }, , ] }",
+        "{ \"records\": [ { \"type\": \"A\", \"host\": \"domain.com\", \"response\": [\"1.1.1.1\" } ] }",
+        "{ \"records\": [ { \"type\": \"A\", \"host\": \"domain.com\" } / ] }",
+        "{ \"records\": [ { \"type\": \"A\", \"host\": \"domain.com\" }",
+        })
+    {
+        std::ofstream(json, std::ios::trunc) << bad;
+        ASSERT_THROW(DNSServer{ json }, std::runtime_error) << bad;
+    }
+    std::remove(json.c_str());
+}
+
+TEST(Dns, DNSServer_loads_master_file)
+{
+    const std::string zone = "/tmp/tst_dns_master.zone";
+    const std::string sub = "/tmp/tst_dns_master_sub.zone";
+    std::ofstream(zone, std::ios::trunc)
+        << "$ORIGIN example.com.\n"
+        << "$TTL 1h30m\n"
+        << "@   IN  SOA ns1 hostmaster ( 2024010101 ; serial\n"
+        << "            7200 3600 1209600 3600 )\n"
+        << "    IN  NS  ns1\n"
+        << "    IN  MX  10 mail\n"
+        << "    IN  MX  20 mail.backup.net.\n"
+        << "@ 300 IN A 192.0.2.1\n"
+        << "www     CNAME @\n"
+        << "mail    IN 600 A 192.0.2.2\n"
+        << "\tA 192.0.2.3          ; blank owner\n"
+        << "\n"
+        << "Mail    A 192.0.2.4\n"
+        << "txt     TXT \"v=spf1 \\\"quoted\\\" -all\" ( \" part2\"\n"
+        << "             )\n"
+        << "text    TXT plain\\032text\r\n"
+        << "$INCLUDE tst_dns_master_sub.zone sub\n"
+        << "after   A 192.0.2.9\n"
+        << "1.2.0.192.in-addr.arpa. PTR mail\n"
+        << "ch CH TXT \"chaos\"\n"
+        << "v6 AAAA ::1\n";
+    std::ofstream(sub, std::ios::trunc)
+        << "host A 10.0.0.1\n"
+        << "@ TXT \"sub\"";
+
+    DNSServer server(HOST, PORT);
+    ASSERT_EQ(4, server.loadMasterFile(zone));
+    auto ask = [&server](DNSRecordType type, const std::string& host) {
+        const auto query = makeQuery(1, type, host);
+        DNSBuffer buf;
+        server.processQuery(&query[0], query.size(), buf);
+        std::vector<std::string> result;
+        for (const auto& answer : DNSPackage(&buf.result[0], buf.result.size()).answers)
+        {
+            result.push_back(answer.decode());
+        }
+        return result;
+    };
+    using Answers = std::vector<std::string>;
+    ASSERT_EQ((Answers{ "mail.example.com", "mail.backup.net" }), ask(DNSRecordType::MX, "example.com"));
+    ASSERT_EQ((Answers{ "192.0.2.1" }), ask(DNSRecordType::A, "example.com"));
+    ASSERT_EQ((Answers{ "example.com" }), ask(DNSRecordType::CNAME, "www.example.com"));
+    ASSERT_EQ((Answers{ "192.0.2.2", "192.0.2.3", "192.0.2.4" }), ask(DNSRecordType::A, "mail.example.com"));
+    ASSERT_EQ((Answers{ "v=spf1 \"quoted\" -all part2" }), ask(DNSRecordType::TXT, "txt.example.com"));
+    ASSERT_EQ((Answers{ "plain text" }), ask(DNSRecordType::TXT, "text.example.com"));
+    ASSERT_EQ((Answers{ "10.0.0.1" }), ask(DNSRecordType::A, "host.sub.example.com"));
+    ASSERT_EQ((Answers{ "sub" }), ask(DNSRecordType::TXT, "sub.example.com"));
+    ASSERT_EQ((Answers{ "192.0.2.9" }), ask(DNSRecordType::A, "after.example.com"));
+    ASSERT_EQ((Answers{ "mail.example.com" }), ask(DNSRecordType::PTR, "1.2.0.192.in-addr.arpa"));
+
+    // a long token crosses the 16-byte blocks of the tokenizer
+    const std::string name(30, 'x');
+    std::ofstream(zone, std::ios::trunc) << name << "\\;" << name << " A 10.0.0.2 ; " << name << "\n";
+    ASSERT_EQ(0, server.loadMasterFile(zone, "example.com."));
+    ASSERT_EQ((Answers{ "10.0.0.2" }), ask(DNSRecordType::A, name + ";" + name + ".example.com"));
+
+    for (const char* bad : {
+        "a A 10.0.0.1\nb A 10.0.0.256\n",
+        "a A 10.0.0.1\nb MX mail\n",
+        "a A 10.0.0.1\nb TXT ( \"x\"\n",
+        "a A 10.0.0.1\nb TXT \"x\n",
+        "a A 10.0.0.1\n$GENERATE 1-2 h$ A 10.0.0.$\n",
+        })
+    {
+        std::ofstream(zone, std::ios::trunc) << bad;
+        try
+        {
+            DNSMasterFile file(zone, "example.com");
+            FAIL() << bad;
+        }
+        catch (const std::runtime_error& e)
+        {
+            ASSERT_NE(std::string::npos, std::string(e.what()).find(zone + ":2:")) << e.what();
+        }
+    }
+    std::remove(zone.c_str());
+    std::remove(sub.c_str());
+}
+
+TEST(Dns, DNSServer_negative_filter_rejects_absent_names)
+{
+    DNSServer server(HOST, PORT);
+    DNSRecordBatch batch;
+    batch.add(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    batch.add(DNSRecordType::A, "*.tenant.domain.com", { "2.2.2.2" });
+    for (int i = 0; i < 1000; ++i)
+    {
+        batch.add(DNSRecordType::A, "host-" + std::to_string(i) + ".domain.com", { "3.3.3.3" });
+    }
+    server.update(batch);
+    auto ask = [&server](DNSRecordType type, const std::string& host) {
+        const auto query = makeQuery(1, type, host);
+        DNSBuffer buf;
+        server.processQuery(&query[0], query.size(), buf);
+        return DNSPackage(&buf.result[0], buf.result.size());
+    };
+
+    ASSERT_EQ(1, ask(DNSRecordType::A, "domain.com").answers.size());
+    for (int i = 0; i < 1000; ++i)
+    {
+        ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(ask(DNSRecordType::A, "typo-" + std::to_string(i) + ".domain.com").header.flags.RCODE));
+    }
+    // a name the filter turns away can still match a wildcard
+    ASSERT_EQ(std::string{ "2.2.2.2" }, ask(DNSRecordType::A, "x.tenant.domain.com").answers[0].decode());
+    DNSServerStats stats = server.stats();
+    ASSERT_GT(stats.filter_rejected, 950u);
+    ASSERT_GE(stats.filter_passed, 1u);
+    // the wildcard query is looked up twice: it falls back to the generic path
+    ASSERT_EQ(1003u, stats.filter_rejected + stats.filter_passed);
+    ASSERT_EQ(stats.filter_passed - 1, stats.filter_false_positives);
+
+    // records added later are not turned away
+    server.addRecord(DNSRecordType::A, "typo-1.domain.com", { "4.4.4.4" });
+    ASSERT_EQ(std::string{ "4.4.4.4" }, ask(DNSRecordType::A, "typo-1.domain.com").answers[0].decode());
+
+    // the filter travels in a zone image
+    const std::string image = "/tmp/tst_dns_filter.img";
+    server.saveZone(image);
+    DNSServer mapped(HOST, PORT);
+    mapped.loadZone(image);
+    const auto query = makeQuery(1, DNSRecordType::A, "typo-2.domain.com");
+    DNSBuffer buf;
+    mapped.processQuery(&query[0], query.size(), buf);
+    ASSERT_EQ(1u, mapped.stats().filter_rejected);
+    std::remove(image.c_str());
+
+    DNSServer unfiltered(HOST, PORT);
+    unfiltered.settings().filter_fp_rate = 0;
+    unfiltered.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    buf.clear();
+    unfiltered.processQuery(&query[0], query.size(), buf);
+    ASSERT_EQ(0u, unfiltered.stats().filter_rejected);
+}
+
+TEST(Dns, DNSServer_answers_ptr_from_a_records)
+{
+    uint32_t addr;
+    ASSERT_TRUE(DNSReverseIndex::parseName("4.3.2.1.IN-ADDR.arpa.", addr));
+    ASSERT_EQ(0x01020304u, addr);
+    ASSERT_FALSE(DNSReverseIndex::parseName("3.2.1.in-addr.arpa", addr));
+    ASSERT_FALSE(DNSReverseIndex::parseName("256.3.2.1.in-addr.arpa", addr));
+    ASSERT_FALSE(DNSReverseIndex::parseName("04.3.2.1.in-addr.arpa", addr));
+
+    DNSServer server(HOST, PORT);
+    server.settings().reverse_ptr = true;
+    DNSRecordBatch batch;
+    batch.add(DNSRecordType::A, "www.Domain.com", { "10.1.2.3", "10.1.2.4" });
+    batch.add(DNSRecordType::A, "web.domain.com", { "10.1.2.3" });
+    batch.add(DNSRecordType::A, "*.domain.com", { "10.9.9.9" });
+    batch.add(DNSRecordType::A, "gone.domain.com", {}, DNSResultCode::NameError);
+    batch.add(DNSRecordType::PTR, "4.2.1.10.in-addr.arpa", { "explicit.domain.com" });
+    server.update(batch);
+    auto ask = [&server](const std::string& host) {
+        const auto query = makeQuery(1, DNSRecordType::PTR, host);
+        DNSBuffer buf;
+        server.processQuery(&query[0], query.size(), buf);
+        return DNSPackage(&buf.result[0], buf.result.size());
+    };
+
+    DNSPackage answer = ask("3.2.1.10.in-addr.arpa");
+    ASSERT_EQ(DNSResultCode::NoError, static_cast<DNSResultCode>(answer.header.flags.RCODE));
+    std::vector<std::string> owners;
+    for (const auto& item : answer.answers)
+    {
+        ASSERT_EQ(std::string{ "3.2.1.10.in-addr.arpa" }, item.name);
+        ASSERT_EQ(static_cast<uint32_t>(ANSWER_TTL), item.ttl); // as the generic path and the blobs
+        owners.push_back(item.decode());
+    }
+    std::sort(owners.begin(), owners.end());
+    ASSERT_EQ((std::vector<std::string>{ "web.domain.com", "www.domain.com" }), owners);
+    // explicit records take precedence, wildcards own no address
+    ASSERT_EQ(std::string{ "explicit.domain.com" }, ask("4.2.1.10.in-addr.arpa").answers[0].decode());
+    ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(ask("9.9.9.10.in-addr.arpa").header.flags.RCODE));
+
+    // follows the records, and travels in a zone image
+    server.removeRecord(DNSRecordType::A, "web.domain.com");
+    ASSERT_EQ(1u, ask("3.2.1.10.in-addr.arpa").answers.size());
+    const std::string image = "/tmp/tst_dns_reverse.img";
+    server.saveZone(image);
+    DNSServer mapped(HOST, PORT);
+    mapped.loadZone(image);
+    const auto query = makeQuery(1, DNSRecordType::PTR, "3.2.1.10.in-addr.arpa");
+    DNSBuffer buf;
+    mapped.processQuery(&query[0], query.size(), buf);
+    ASSERT_EQ(std::string{ "www.domain.com" }, DNSPackage(&buf.result[0], buf.result.size()).answers.at(0).decode());
+    std::remove(image.c_str());
+
+    DNSServer plain(HOST, PORT);
+    plain.addRecord(DNSRecordType::A, "www.domain.com", { "10.1.2.3" });
+    buf.clear();
+    plain.processQuery(&query[0], query.size(), buf);
+    ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(DNSPackage(&buf.result[0], buf.result.size()).header.flags.RCODE));
+}
+
+TEST(Dns, DNSZone_interns_responses_and_decodes_typed_rdata)
+{
+    // A and TXT blobs fit any owner: one copy for all of them
+    DNSZone zone;
+    for (int i = 0; i < 1000; ++i)
+    {
+        const std::string host = "host-" + std::to_string(i) + ".domain.com";
+        zone.add(DNSRecordType::A, host, DNSZoneResponse::render(DNSRecordType::A, host, DNSResultCode::NoError, { "10.0.0.1" }));
+    }
+    const size_t bytes = zone.responseBytes();
+    DNSZone copy(zone);
+    copy.add(DNSRecordType::A, "other.domain.com", DNSZoneResponse::render(DNSRecordType::A, "other.domain.com", DNSResultCode::NoError, { "10.0.0.1" }));
+    ASSERT_EQ(bytes, copy.responseBytes());
+    const uint8_t* blob = copy.find("host-7.domain.com", 1, DNSNameIndex::hash("host-7.domain.com", 1));
+    ASSERT_EQ(blob, copy.find("other.domain.com", 1, DNSNameIndex::hash("other.domain.com", 1)));
+    ASSERT_EQ(0u, DNSZoneResponse(blob).questionEnd());
+    ASSERT_EQ(std::vector<std::string>{ "10.0.0.1" }, DNSZoneResponse(blob).records("anything.example"));
+
+    // names in the rdata point into the question: decoded for the owner,
+    // or for a name below the wildcard owning the record
+    DNSServer server(HOST, PORT);
+    for (int i = 0; i < 10; ++i)
+    {
+        server.addRecord(DNSRecordType::A, "h" + std::to_string(i) + ".tenant.domain.com", { "1.1.1.1" });
+    }
+    server.addRecord(DNSRecordType::MX, "*.tenant.domain.com", { "mx1.tenant.domain.com", "mx2.domain.com" });
+    server.addRecord(DNSRecordType::CNAME, "*", { "www.domain.com" });
+    auto ask = [&server](DNSRecordType type, const std::string& host) {
+        const auto query = makeQuery(1, type, host);
+        DNSBuffer buf;
+        server.processQuery(&query[0], query.size(), buf);
+        return DNSPackage(&buf.result[0], buf.result.size());
+    };
+    DNSPackage answer = ask(DNSRecordType::MX, "a.b.tenant.domain.com");
+    ASSERT_EQ(2, answer.answers.size());
+    ASSERT_EQ(std::string{ "a.b.tenant.domain.com" }, answer.answers[0].name);
+    ASSERT_EQ(std::string{ "mx1.tenant.domain.com" }, answer.answers[0].decode());
+    ASSERT_EQ(std::string{ "mx2.domain.com" }, answer.answers[1].decode());
+    ASSERT_EQ(std::string{ "www.domain.com" }, ask(DNSRecordType::CNAME, "x.org").answers.at(0).decode());
+    // the nodes were built from the records added before the first wildcard
+    ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(ask(DNSRecordType::MX, "h3.tenant.domain.com").header.flags.RCODE));
+
+    // without wildcards the lookups go on as before
+    ASSERT_TRUE(server.removeRecord(DNSRecordType::MX, "*.tenant.domain.com"));
+    ASSERT_TRUE(server.removeRecord(DNSRecordType::CNAME, "*"));
+    ASSERT_EQ(DNSResultCode::NameError, static_cast<DNSResultCode>(ask(DNSRecordType::MX, "a.b.tenant.domain.com").header.flags.RCODE));
+    ASSERT_EQ(std::string{ "1.1.1.1" }, ask(DNSRecordType::A, "h3.tenant.domain.com").answers.at(0).decode());
+}
+
+TEST(Dns, DNSMessageView_reads_in_place_and_rejects_malformed_messages)
+{
+    auto vec = fromHex("3f2c8180000100010000000006676f6f676c6503636f6d00000f0001c00c000f0001000001060009000a04736d7470c00c");
+    DNSMessageView view(&vec[0], vec.size());
+    ASSERT_TRUE(view.valid());
+    ASSERT_EQ(0x3f2c, view.id());
+    ASSERT_EQ(1, view.flags().QR);
+    ASSERT_EQ(1, view.qdcount());
+    ASSERT_EQ(1, view.ancount());
+    const DNSMessageView::Question question = view.question();
+    ASSERT_EQ(std::string{ "google.com" }, question.name.str());
+    ASSERT_FALSE(question.name.compressed());
+    ASSERT_EQ(12u, question.name.size());
+    ASSERT_EQ(static_cast<uint16_t>(DNSRecordType::MX), question.type);
+    ASSERT_EQ(1, question.cls);
+    ASSERT_EQ(28u, question.end);
+    size_t records = 0;
+    for (const auto& record : view.records())
+    {
+        ASSERT_EQ(DNSMessageView::Section::Answer, record.section);
+        ASSERT_TRUE(record.name.compressed());
+        ASSERT_EQ(std::string{ "google.com" }, record.name.str());
+        ASSERT_EQ(static_cast<uint16_t>(DNSRecordType::MX), record.type);
+        ASSERT_EQ(0x106u, record.ttl);
+        ASSERT_EQ(9, record.rdlength);
+        ASSERT_EQ(&vec[vec.size() - 9], record.rdata);
+        ++records;
+    }
+    ASSERT_EQ(1u, records);
+
+    for (size_t size = 0; size < vec.size(); ++size)
+    {
+        ASSERT_FALSE(DNSMessageView(&vec[0], size).valid()) << size;
+    }
+    auto damaged = [&vec](size_t pos, uint8_t value) {
+        std::vector<uint8_t> copy = vec;
+        copy[pos] = value;
+        return DNSMessageView(&copy[0], copy.size()).valid();
+    };
+    ASSERT_FALSE(damaged(29, 0x28));   // a pointer forwards
+    ASSERT_FALSE(damaged(29, 0x1C));   // a pointer to itself
+    ASSERT_FALSE(damaged(12, 0x46));   // a reserved label type
+    ASSERT_FALSE(damaged(5, 2));       // a question more than there is
+
+    // at most 255 bytes a name, root included
+    auto query = [](size_t last) {
+        std::string hex = "000100000001000000000000";
+        for (size_t i = 0; i < 4; ++i)
+        {
+            const size_t len = i < 3 ? 63 : last;
+            hex += toHex(std::vector<uint8_t>{ static_cast<uint8_t>(len) }) + std::string(2 * len, '6');
+        }
+        return fromHex(hex + "0000010001");
+    };
+    auto longest = query(61);
+    ASSERT_TRUE(DNSMessageView(&longest[0], longest.size()).valid());
+    char buf[DNSMessageView::MAX_NAME];
+    std::string_view name;
+    ASSERT_TRUE(DNSMessageView(&longest[0], longest.size()).question().name.dotted(buf, name));
+    ASSERT_EQ(253u, name.size());
+    auto too_long = query(62);
+    ASSERT_FALSE(DNSMessageView(&too_long[0], too_long.size()).valid());
+
+    // a label with a dot in it has no dotted form
+    auto dotted = fromHex("0001000000010000000000000361" "2e" "6203636f6d0000010001");
+    ASSERT_FALSE(DNSMessageView(&dotted[0], dotted.size()).question().name.dotted(buf, name));
+}
+
+TEST(Dns, DNSServer_answers_malformed_queries_with_formerr)
+{
+    DNSServer server(HOST, PORT);
+    server.addRecord(DNSRecordType::A, "domain.com", { "1.1.1.1" });
+    server.addRecord(DNSRecordType::MX, "domain.com", { "mx1.domain.com" });
+    auto ask = [&server](const std::vector<uint8_t>& query) {
+        DNSBuffer buf;
+        buf.max_size = UDP_SIZE;
+        server.processQuery(query.data(), query.size(), buf);
+        return buf.result;
+    };
+    auto rcode = [](const std::vector<uint8_t>& answer) {
+        return static_cast<DNSResultCode>(answer.at(3) & 0x0F);
+    };
+
+    // a pointer to itself, a pointer loop, a forward pointer, a reserved
+    // label type, a name of 257 bytes, counts the message cannot hold
+    const std::vector<std::string> malformed = {
+        "123401000001000000000000c00c00010001",
+        "1234010000010000000000000161c00c00010001",
+        "123401000001000000000000c01400010001000000000000",
+        "123401000001000000000000466100010001",
+        "123401000001000000000000" + [] {
+            std::string hex;
+            for (int i = 0; i < 4; ++i)
+            {
+                hex += "3f" + std::string(126, '6');
+            }
+            return hex;
+        }() + "0000010001",
+        "1234010000ff00ff00ff00ff",
+        "123401000001ffff0000000006646f6d61696e03636f6d0000010001",
+    };
+    for (const auto& hex : malformed)
+    {
+        const auto answer = ask(fromHex(hex));
+        ASSERT_EQ(sizeof(DNSHeader), answer.size()) << hex;
+        ASSERT_EQ(0x12, answer[0]);
+        ASSERT_EQ(0x34, answer[1]);
+        ASSERT_EQ(DNSResultCode::FormatError, rcode(answer)) << hex;
+        ASSERT_THROW(DNSPackage(fromHex(hex).data(), fromHex(hex).size()), std::runtime_error) << hex;
+    }
+    ASSERT_TRUE(ask(fromHex("1234")).empty()); // no header to echo
+    std::vector<uint8_t> oversized = makeQuery(0x1234, DNSRecordType::A, "domain.com");
+    oversized.resize(MAX_QUERY_SIZE + 1);
+    ASSERT_EQ(DNSResultCode::FormatError, rcode(ask(oversized)));
+
+    // the corpus: well-formed queries and answers, mutated at random; every
+    // one is answered, and whatever DNSMessageView refuses gets FORMERR
+    const std::vector<std::vector<uint8_t>> corpus = {
+        makeQuery(1, DNSRecordType::A, "domain.com"),
+        makeQuery(2, DNSRecordType::MX, "DOMAIN.com"),
+        makeQuery(3, DNSRecordType::PTR, "1.1.1.1.in-addr.arpa"),
+        fromHex("4f16818000010001000000000a766c61736f76736f6674036e65740000010001c00c0001000100000e100004b9fddb5c"),
+        fromHex("3f2c8180000100010000000006676f6f676c6503636f6d00000f0001c00c000f0001000001060009000a04736d7470c00c"),
+        fromHex("1cb901000001000000000001033132310a766c61736f76736f6674036e65740000010001" "0000291000000000000000"),
+    };
+    std::mt19937 random(20261016);
+    for (int round = 0; round < 20000; ++round)
+    {
+        std::vector<uint8_t> query = corpus[random() % corpus.size()];
+        for (unsigned edits = 1 + random() % 4; edits > 0; --edits)
+        {
+            const size_t pos = random() % query.size();
+            switch (random() % 5)
+            {
+            case 0: query[pos] = static_cast<uint8_t>(random()); break;
+            case 1: query[pos] ^= static_cast<uint8_t>(1u << (random() % 8)); break;
+            case 2: query.resize(pos + 1); break;
+            case 3: query.insert(query.begin() + pos, { 0xC0, static_cast<uint8_t>(random() % query.size()) }); break;
+            case 4: query[pos] = static_cast<uint8_t>(random() % 4 == 0 ? 0xFF : random() % 64); break;
+            }
+        }
+        const bool valid = DNSMessageView(query.data(), query.size()).valid();
+        try
+        {
+            DNSPackage package(query.data(), query.size());
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+        const auto answer = ask(query);
+        if (query.size() < sizeof(DNSHeader))
+        {
+            ASSERT_TRUE(answer.empty());
+            continue;
+        }
+        ASSERT_GE(answer.size(), sizeof(DNSHeader));
+        ASSERT_LE(answer.size(), static_cast<size_t>(UDP_SIZE));
+        ASSERT_EQ(query[0], answer[0]);
+        ASSERT_EQ(query[1], answer[1]);
+        ASSERT_TRUE(answer[2] & 0x80); // QR
+        if (!valid)
+        {
+            ASSERT_EQ(DNSResultCode::FormatError, rcode(answer));
+        }
+    }
+
+    // TCP: a length prefix too short for a header ends the connection
+    for (DNSEngine engine : { DNSEngine::Selector, DNSEngine::Uring })
+    {
+        DNSServer tcp_server(HOST, PORT);
+        tcp_server.settings().engine = engine;
+        tcp_server.start();
+        SOCKET s = connectTcp();
+        const uint8_t frame[] = { 0x00, 0x03, 0x01, 0x02, 0x03 };
+        ASSERT_EQ(5, send(s, reinterpret_cast<const char*>(frame), sizeof(frame), 0));
+        ASSERT_TRUE(waitClosed(s));
+        closesocket(s);
+        tcp_server.stop();
+        tcp_server.join();
+    }
+}
+
+TEST(Dns, DNSUdpQueue_is_bounded_and_flushes_in_order)
+{
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(PORT + 1);
+
+    SOCKET receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(INVALID_SOCKET, receiver);
+    ASSERT_EQ(0, bind(receiver, (sockaddr*)&addr, sizeof(addr)));
+    SOCKET sender = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(INVALID_SOCKET, sender);
+    setupsocket(sender);
+
+    DNSUdpQueue queue(2);
+    ASSERT_TRUE(queue.empty());
+    ASSERT_TRUE(queue.push(addr, { 1 }));
+    ASSERT_TRUE(queue.push(addr, { 2, 2 }));
+    ASSERT_FALSE(queue.push(addr, { 3, 3, 3 }));
+    ASSERT_EQ(2, queue.size());
+
+    ASSERT_TRUE(queue.flush(sender));
+    ASSERT_TRUE(queue.empty());
+
+    char buf[16];
+    ASSERT_EQ(1, recv(receiver, buf, sizeof(buf), 0));
+    ASSERT_EQ(2, recv(receiver, buf, sizeof(buf), 0));
+
+    closesocket(sender);
+    closesocket(receiver);
+}
+
 int main(int argc, char** argv)
 {
     ::testing::InitGoogleTest(&argc, argv);